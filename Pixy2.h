@@ -18,17 +18,22 @@
 #define _PIXY2_H
 
 #include "TPixy2.h"
+#include "Pixy2Trace.h"
 #include "SPI.h"
 
+#ifndef PIXY_SPI_CLOCKRATE
 #define PIXY_SPI_CLOCKRATE       2000000
+#endif
 
 class Link2SPI
 {
 public:
+  // arg: SPI clock in Hz or PIXY_DEFAULT_ARGVAL to use default
   int8_t open(uint32_t arg)
   {
+    m_clock = (arg == PIXY_DEFAULT_ARGVAL) ? PIXY_SPI_CLOCKRATE : arg;
     SPI.begin();
-    SPI.beginTransaction(SPISettings(PIXY_SPI_CLOCKRATE, MSBFIRST, SPI_MODE3));
+    SPI.beginTransaction(SPISettings(m_clock, MSBFIRST, SPI_MODE3));
 	return 0;
   }
 	
@@ -40,6 +45,7 @@ public:
   int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs=NULL)
   {
     uint8_t i;
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_LINK_RECV, len);
     if (cs)
       *cs = 0;
     for (i=0; i<len; i++)
@@ -48,16 +54,24 @@ public:
       if (cs)
         *cs += buf[i];
     }
+    PIXY2_TRACE_END(PIXY2_TRACE_LINK_RECV, len);
     return len;
   }
     
   int16_t send(uint8_t *buf, uint8_t len)
   {
     uint8_t i;
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_LINK_SEND, len);
     for (i=0; i<len; i++)
       SPI.transfer(buf[i]);
+    PIXY2_TRACE_END(PIXY2_TRACE_LINK_SEND, len);
     return len;
   }
+
+  uint32_t clock() const { return m_clock; }
+
+private:
+  uint32_t m_clock;
 };
 
 
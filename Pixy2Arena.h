@@ -0,0 +1,242 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Per-frame arena for temporary data.
+// Filters, clustering and track matching built on the blocks of one frame need scratch
+// memory that is dead by the next frame. Taking it from the heap with new or a
+// std::vector mixes short-lived blocks with long-lived ones, and after days of uptime
+// the ESP32 heap has the free bytes but not in one piece. An arena hands out memory by
+// moving a pointer through a fixed buffer and takes it all back with reset() at the
+// start of the next frame, so the heap sees nothing and an allocation is a few
+// instructions.
+//
+// Pixy2ArenaAllocator lets STL containers use it. A request that doesn't fit goes to
+// the heap instead and is counted; highWater() and print() show how big the arena
+// should be. Containers on an arena must be gone before reset(). A vector that grows
+// takes its new buffer before freeing the old one, which then stays used until reset(),
+// so reserve() what a frame needs up front.
+//
+//   Pixy2FrameArena<4096> arena;
+//   loop()
+//   {
+//     pixy.ccc.getBlocks();
+//     arena.reset();
+//     std::vector<Block, Pixy2ArenaAllocator<Block> > kept(&arena);
+//     kept.reserve(pixy.ccc.numBlocks);
+//     float *dist = arena.alloc<float>(pixy.ccc.numBlocks*pixy.ccc.numBlocks);
+//     ...
+//   }
+//
+// Define PIXY2_ARENA_DEBUG to fill the arena with 0xa5 on reset(), so data used after
+// its frame shows up.
+
+#ifndef _PIXY2ARENA_H
+#define _PIXY2ARENA_H
+
+#include "TPixy2.h"
+
+#include <stdlib.h>
+#include <new>
+
+#ifndef PIXY2_ARENA_ALIGN
+#define PIXY2_ARENA_ALIGN     8
+#endif
+
+class Pixy2Arena
+{
+public:
+  Pixy2Arena(void *buf, uint32_t size)
+  {
+    m_buf = (uint8_t *)buf;
+    m_size = size;
+    m_used = m_last = 0;
+    resetStats();
+  }
+
+  // Take everything back, at the start of a frame.
+  void reset()
+  {
+#ifdef PIXY2_ARENA_DEBUG
+    memset(m_buf, 0xa5, m_used);
+#endif
+    m_used = m_last = 0;
+  }
+
+  // NULL if it doesn't fit.
+  void *alloc(uint32_t size, uint32_t align = PIXY2_ARENA_ALIGN)
+  {
+    uintptr_t at = ((uintptr_t)m_buf + m_used + align - 1) & ~(uintptr_t)(align - 1);
+    uint32_t start = at - (uintptr_t)m_buf;
+
+    m_allocs++;
+    if (start > m_size || size > m_size - start)
+    {
+      m_failures++;
+      return NULL;
+    }
+    m_last = start;
+    m_used = start + size;
+    if (m_used > m_peak)
+      m_peak = m_used;
+    return (void *)at;
+  }
+
+  // Uninitialised room for count Ts.
+  template <class T> T *alloc(uint32_t count)
+  {
+    return (T *)alloc(count*sizeof(T), alignof(T));
+  }
+
+  // Give back the latest allocation, e.g. scratch freed before anything else was
+  // taken; anything else waits for reset().
+  void release(const void *p)
+  {
+    if (p == m_buf + m_last)
+      m_used = m_last;
+  }
+
+  // For scratch within a frame: rewind(mark()) takes back what came after.
+  uint32_t mark() const { return m_used; }
+  void rewind(uint32_t mark)
+  {
+    if (mark <= m_used)
+      m_used = m_last = mark;
+  }
+
+  bool owns(const void *p) const
+  {
+    return (const uint8_t *)p >= m_buf && (const uint8_t *)p < m_buf + m_size;
+  }
+
+  // The arena, or the heap if it is full: for Pixy2ArenaAllocator.
+  void *allocOrHeap(uint32_t size, uint32_t align)
+  {
+    void *p = alloc(size, align);
+
+    if (p == NULL && (p = malloc(size)) != NULL)
+      m_spills++;
+    return p;
+  }
+
+  void freeOrHeap(void *p)
+  {
+    if (owns(p))
+      release(p);
+    else
+      free(p);
+  }
+
+  void resetStats()
+  {
+    m_peak = m_used;
+    m_allocs = m_failures = m_spills = 0;
+  }
+
+  uint32_t used() const { return m_used; }
+  uint32_t capacity() const { return m_size; }
+  // most in use at once since resetStats()
+  uint32_t highWater() const { return m_peak; }
+  uint32_t allocs() const { return m_allocs; }
+  // requests that didn't fit, and those of them that went to the heap
+  uint32_t failures() const { return m_failures; }
+  uint32_t spills() const { return m_spills; }
+
+  void print()
+  {
+    char buf[160];
+
+    snprintf(buf, sizeof(buf), "arena %lu of %lu bytes at most, %lu allocs, %lu failed, %lu to heap",
+      (unsigned long)m_peak, (unsigned long)m_size, (unsigned long)m_allocs, (unsigned long)m_failures,
+      (unsigned long)m_spills);
+    Serial.println(buf);
+  }
+
+private:
+  uint8_t *m_buf;
+  uint32_t m_size;
+  uint32_t m_used;
+  uint32_t m_last;
+  uint32_t m_peak;
+  uint32_t m_allocs;
+  uint32_t m_failures;
+  uint32_t m_spills;
+};
+
+// An arena with its buffer, e.g. a global.
+template <uint32_t SIZE> class Pixy2FrameArena : public Pixy2Arena
+{
+public:
+  Pixy2FrameArena() : Pixy2Arena(m_storage, SIZE)
+  {
+  }
+
+private:
+  alignas(PIXY2_ARENA_ALIGN) uint8_t m_storage[SIZE];
+};
+
+// STL allocator on an arena. Copies share the arena.
+template <class T> class Pixy2ArenaAllocator
+{
+public:
+  typedef T value_type;
+
+  Pixy2ArenaAllocator(Pixy2Arena *arena)
+  {
+    m_arena = arena;
+  }
+
+  template <class U> Pixy2ArenaAllocator(const Pixy2ArenaAllocator<U> &other)
+  {
+    m_arena = other.arena();
+  }
+
+  // Containers can't take NULL: with the heap out too this throws, or aborts where
+  // exceptions are off.
+  T *allocate(size_t n)
+  {
+    T *p = (T *)m_arena->allocOrHeap(n*sizeof(T), alignof(T));
+
+    if (p == NULL)
+    {
+#ifdef __cpp_exceptions
+      throw std::bad_alloc();
+#else
+      abort();
+#endif
+    }
+    return p;
+  }
+
+  void deallocate(T *p, size_t)
+  {
+    m_arena->freeOrHeap(p);
+  }
+
+  Pixy2Arena *arena() const { return m_arena; }
+
+private:
+  Pixy2Arena *m_arena;
+};
+
+template <class T, class U> bool operator==(const Pixy2ArenaAllocator<T> &a, const Pixy2ArenaAllocator<U> &b)
+{
+  return a.arena() == b.arena();
+}
+
+template <class T, class U> bool operator!=(const Pixy2ArenaAllocator<T> &a, const Pixy2ArenaAllocator<U> &b)
+{
+  return a.arena() != b.arena();
+}
+
+#endif // _PIXY2ARENA_H
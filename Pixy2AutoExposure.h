@@ -0,0 +1,319 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Closed-loop brightness and lamp control.
+// Feed it every CCC frame with update(); it keeps the summed block area of the watched
+// signatures over a settle period and compares it with the best it has seen recently.
+// While detection holds up it leaves the camera alone. When it drops, it steps
+// setCameraBrightness() and keeps going in the direction that makes things better,
+// turning the lamp on once brightness runs out at the top and off again when brightness
+// has come back down. With none of the watched signatures in view there is nothing to
+// judge a change by, so it holds brightness and the lamp until blocks come back. If you
+// have RGB samples from a video visit (Pixy2RGBSampler stats), observeRGB() steers
+// brightness straight to a target luma instead. The controller never samples RGB
+// itself: getRGB() would switch the camera out of CCC.
+//
+// Commands are paid for from a budget of link round trips per second, so the
+// controller can't take more than that from the frame loop; a change that finds the
+// budget empty waits until it refills.
+//
+//   Pixy2AutoExposure<Link2SPI> ae(&pixy);
+//   ae.begin(80);
+//   loop() { if (pixy.ccc.getBlocks() >= 0) ae.update(); }
+
+#ifndef _PIXY2AUTOEXPOSURE_H
+#define _PIXY2AUTOEXPOSURE_H
+
+#include "TPixy2.h"
+#include "Pixy2RGBSampler.h"
+
+// round trips per second the controller may spend
+#ifndef PIXY2_AE_BUDGET
+#define PIXY2_AE_BUDGET             4
+#endif
+// how long the camera needs after a change before the result means anything
+#ifndef PIXY2_AE_SETTLE_MS
+#define PIXY2_AE_SETTLE_MS          400
+#endif
+#ifndef PIXY2_AE_STEP
+#define PIXY2_AE_STEP               12
+#endif
+#ifndef PIXY2_AE_MIN_BRIGHTNESS
+#define PIXY2_AE_MIN_BRIGHTNESS     8
+#endif
+#ifndef PIXY2_AE_MAX_BRIGHTNESS
+#define PIXY2_AE_MAX_BRIGHTNESS     240
+#endif
+// lamp goes off again once brightness is back below this
+#ifndef PIXY2_AE_LAMP_OFF_BRIGHTNESS
+#define PIXY2_AE_LAMP_OFF_BRIGHTNESS 100
+#endif
+#ifndef PIXY2_AE_TARGET_LUMA
+#define PIXY2_AE_TARGET_LUMA        110
+#endif
+#define PIXY2_AE_LUMA_DEADBAND      12
+
+template <class LinkType> class Pixy2AutoExposure
+{
+public:
+  Pixy2AutoExposure(TPixy2<LinkType> *pixy, uint8_t sigmap = CCC_SIG_ALL, uint8_t budget = PIXY2_AE_BUDGET)
+  {
+    m_pixy = pixy;
+    m_sigmap = sigmap;
+    m_budget = budget;
+    m_brightness = 80;
+    m_lamp = false;
+    m_commands = m_deferred = 0;
+    restart();
+  }
+
+  // Set a known starting point. Returns what setCameraBrightness() returned.
+  int8_t begin(uint8_t brightness, bool lamp = false)
+  {
+    int8_t res;
+
+    m_brightness = brightness;
+    m_lamp = lamp;
+    restart();
+    m_commands += 2;
+    res = m_pixy->setCameraBrightness(brightness);
+    if (res >= 0)
+      res = m_pixy->setLamp(lamp, lamp);
+    return res;
+  }
+
+  // Call after each successful ccc.getBlocks(). Costs a round trip only when it changes
+  // brightness or the lamp.
+  void update()
+  {
+    uint32_t now = millis(), area = 0;
+    uint8_t i;
+    const Block *b;
+
+    for (i = 0; i < m_pixy->ccc.numBlocks; i++)
+    {
+      b = &m_pixy->ccc.blocks[i];
+      if (b->m_signature >= 1 && b->m_signature <= 7 && (m_sigmap & (1 << (b->m_signature - 1))))
+        area += (uint32_t)b->m_width*b->m_height;
+    }
+    // blocks back after a hold: the empty frames before them would drag the first score
+    // down and look like a wrong step
+    if (m_holding && area)
+    {
+      m_holding = false;
+      m_winSum = 0;
+      m_winFrames = 0;
+      m_settled = now;
+    }
+    m_winSum += area;
+    m_winFrames++;
+
+    // refill the budget, in thousandths of a round trip
+    m_tokens += (now - m_last)*m_budget;
+    if (m_tokens > (uint32_t)m_budget*1000)
+      m_tokens = (uint32_t)m_budget*1000;
+    m_last = now;
+
+    if (now - m_settled >= PIXY2_AE_SETTLE_MS)
+      evaluate(now);
+  }
+
+  // Mean colour of a recent RGB sample; overrides the search for one settle period.
+  void observeRGB(const Pixy2RGBStats &stats)
+  {
+    if (stats.m_count == 0)
+      return;
+    m_luma = (stats.mean(0)*77 + stats.mean(1)*150 + stats.mean(2)*29) >> 8;
+    m_lumaFresh = true;
+  }
+
+  uint8_t brightness() const { return m_brightness; }
+  bool lamp() const { return m_lamp; }
+  // commands sent, and changes put off because the budget was spent
+  uint32_t commands() const { return m_commands; }
+  uint32_t deferred() const { return m_deferred; }
+  // summed block area per frame: last settle period, and the reference it is held to
+  uint32_t score() const { return m_lastScore; }
+  uint32_t reference() const { return m_ref; }
+
+  void print()
+  {
+    char buf[120];
+
+    snprintf(buf, sizeof(buf), "brightness %d lamp %d score %lu ref %lu (%lu commands, %lu deferred)", m_brightness,
+      m_lamp, (unsigned long)m_lastScore, (unsigned long)m_ref, (unsigned long)m_commands, (unsigned long)m_deferred);
+    Serial.println(buf);
+  }
+
+private:
+  void restart()
+  {
+    m_winSum = 0;
+    m_winFrames = 0;
+    m_ref = m_lastScore = 0;
+    m_dir = 1;
+    m_searching = false;
+    m_holding = false;
+    m_lumaFresh = false;
+    m_tokens = (uint32_t)m_budget*1000;
+    m_last = m_settled = millis();
+  }
+
+  void evaluate(uint32_t now)
+  {
+    uint32_t score = m_winFrames ? m_winSum/m_winFrames : 0, ref = m_ref;
+    int16_t delta = 0, err;
+    int8_t dir = m_dir;
+    bool searching = m_searching;
+
+    if (m_lumaFresh)
+    {
+      err = PIXY2_AE_TARGET_LUMA - m_luma;
+      if (err > PIXY2_AE_LUMA_DEADBAND || err < -PIXY2_AE_LUMA_DEADBAND)
+        delta = err/2;
+      if (delta > 2*PIXY2_AE_STEP)
+        delta = 2*PIXY2_AE_STEP;
+      else if (delta < -2*PIXY2_AE_STEP)
+        delta = -2*PIXY2_AE_STEP;
+      m_dir = delta < 0 ? -1 : 1;
+    }
+    else if (score == 0)
+    {
+      // nothing watched in view: hold everything, and keep the reference and the last
+      // score for when blocks come back
+      m_holding = true;
+      m_winSum = 0;
+      m_winFrames = 0;
+      m_settled = now;
+      return;
+    }
+    else if (score >= m_ref - m_ref/8)
+    {
+      // holding up: nothing to do, but let the reference follow the scene down slowly
+      // so objects leaving the view aren't chased forever
+      m_searching = false;
+      m_ref = score > m_ref ? score : m_ref - m_ref/32;
+    }
+    else
+    {
+      // worse than after the previous step: that step went the wrong way
+      if (m_searching && score < m_lastScore)
+        m_dir = -m_dir;
+      m_searching = true;
+      m_ref -= m_ref/16;
+      delta = m_dir*PIXY2_AE_STEP;
+    }
+
+    if (delta && !adjust(delta))
+    {
+      // try again as soon as the budget allows, with the same window; the step waiting
+      // for a token must not flip the direction or decay the reference every frame
+      m_dir = dir;
+      m_ref = ref;
+      m_searching = searching;
+      return;
+    }
+    m_lastScore = score;
+    m_lumaFresh = false;
+    m_winSum = 0;
+    m_winFrames = 0;
+    m_settled = now;
+  }
+
+  // Apply a brightness step, spilling into the lamp at the ends of the range.
+  bool adjust(int16_t delta)
+  {
+    int16_t b = (int16_t)m_brightness + delta;
+
+    if (b > PIXY2_AE_MAX_BRIGHTNESS)
+    {
+      if (m_brightness == PIXY2_AE_MAX_BRIGHTNESS)
+      {
+        if (m_lamp)
+        {
+          m_dir = -1; // nothing brighter left; search the other way
+          return true;
+        }
+        return setLamp(true);
+      }
+      b = PIXY2_AE_MAX_BRIGHTNESS;
+    }
+    else if (b < PIXY2_AE_MIN_BRIGHTNESS)
+    {
+      if (m_brightness == PIXY2_AE_MIN_BRIGHTNESS)
+      {
+        m_dir = 1;
+        return true;
+      }
+      b = PIXY2_AE_MIN_BRIGHTNESS;
+    }
+    if (m_lamp && delta < 0 && b < PIXY2_AE_LAMP_OFF_BRIGHTNESS)
+      return setLamp(false);
+
+    if (!spend())
+      return false;
+    if (m_pixy->setCameraBrightness(b) >= 0)
+      m_brightness = b;
+    return true;
+  }
+
+  bool setLamp(bool on)
+  {
+    if (!spend())
+      return false;
+    if (m_pixy->setLamp(on, on) >= 0)
+    {
+      m_lamp = on;
+      m_ref = 0; // different light, different scene
+    }
+    return true;
+  }
+
+  bool spend()
+  {
+    if (m_tokens < 1000)
+    {
+      m_deferred++;
+      return false;
+    }
+    m_tokens -= 1000;
+    m_commands++;
+    return true;
+  }
+
+  TPixy2<LinkType> *m_pixy;
+  uint8_t m_sigmap;
+  uint8_t m_budget;
+
+  uint8_t m_brightness;
+  bool m_lamp;
+
+  uint32_t m_winSum;       // summed area over the current settle period
+  uint16_t m_winFrames;
+  uint32_t m_lastScore;
+  uint32_t m_ref;
+  int8_t m_dir;
+  bool m_searching;
+  bool m_holding;          // nothing watched in the last settle period
+  uint8_t m_luma;
+  bool m_lumaFresh;
+
+  uint32_t m_tokens;       // thousandths of a round trip
+  uint32_t m_last;
+  uint32_t m_settled;      // when the last change was made
+  uint32_t m_commands;
+  uint32_t m_deferred;
+};
+
+#endif // _PIXY2AUTOEXPOSURE_H
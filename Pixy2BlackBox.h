@@ -0,0 +1,635 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Black-box recorder: the last few minutes of CCC frames in a flash partition.
+// record() codes each frame against the previous one with Pixy2FrameCodec into a RAM
+// page and never touches flash; full pages are queued, and a background task writes them
+// out, so erase and program times stay off the vision loop. If the queue is full the
+// frame is dropped and counted rather than waited for.
+//
+// The partition is a circular log of 512-byte pages, written in order and erased a
+// sector ahead, so every sector is erased once per lap and wear is spread evenly. begin()
+// erases the first sector; after that the writer erases the next one as soon as it has
+// caught up with the queue, so a page waits for its own program time and not for an
+// erase. Each page carries a sequence number, the time of its first frame and a CRC, and
+// decodes on its own: the first frame in a page is a keyframe. begin() picks up after the
+// newest page from before a reset, in a fresh sector, and counts a boot: page times are
+// millis() since the boot, so the reader tells runs apart by it. A page still in RAM after
+// PIXY2_BLACKBOX_FLUSH_MS is queued anyway, so a crash loses about that much: by the
+// writer task, which wakes that often, also when frames have stopped coming (a camera
+// that went away is what the recording is for). Without the task, call flushIdle() from
+// loop() whether or not there was a frame.
+//
+// Stationary blocks cost 2 bytes and moving ones 3-5, so at 60 fps with a handful of
+// blocks a 1 MB partition holds roughly ten minutes, and each sector is erased every
+// ten minutes or so, years of continuous recording at 100k erase cycles.
+//
+// On the ESP32, add a data partition to the partition table, e.g.
+//   blackbox, data, 0x40, , 1M
+// and read it back with `parttool.py read_partition --partition-name blackbox` and
+// host/pixy_blackbox.
+//
+//   Pixy2FlashPartition flash;
+//   Pixy2BlackBox<Pixy2FlashPartition> box(&flash);
+//   flash.begin();
+//   box.begin();
+//   loop() { if (pixy.ccc.getBlocks() >= 0) box.record(pixy.ccc.blocks, pixy.ccc.numBlocks); }
+//   without the task: box.begin(false), and in loop() box.flushIdle(); box.service();
+//
+// Classic ESP32s pause code running from flash on both cores while a sector is erased
+// (chips with flash auto-suspend don't). Erasing ahead moves the erase off the page
+// write, not off the chip: once every eight pages (a few seconds at 60 fps) the vision
+// loop stops for the erase time, typically 45 ms and up to 400 ms on a worn part. The
+// UART driver buffers through it, but the frame being processed is late by that much;
+// host/pixy_bench's blackbox section measures it with the chip's times.
+
+#ifndef _PIXY2BLACKBOX_H
+#define _PIXY2BLACKBOX_H
+
+#include "TPixy2.h"
+#include "Pixy2FrameCodec.h"
+#include "Pixy2NodeProtocol.h"
+#include "Pixy2Trace.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#ifndef PIXY2_BLACKBOX_PARTITION
+#define PIXY2_BLACKBOX_PARTITION       "blackbox"
+#endif
+// pages waiting for the task; 512 bytes each
+#ifndef PIXY2_BLACKBOX_QUEUE
+#define PIXY2_BLACKBOX_QUEUE           8
+#endif
+// blocks kept per frame, the first ones (Pixy2 sends the largest first)
+#ifndef PIXY2_BLACKBOX_MAX_BLOCKS
+#define PIXY2_BLACKBOX_MAX_BLOCKS      22
+#endif
+#ifndef PIXY2_BLACKBOX_FLUSH_MS
+#define PIXY2_BLACKBOX_FLUSH_MS        1000
+#endif
+#ifndef PIXY2_BLACKBOX_TASK_STACK
+#define PIXY2_BLACKBOX_TASK_STACK      3072
+#endif
+#ifndef PIXY2_BLACKBOX_TASK_PRIORITY
+#define PIXY2_BLACKBOX_TASK_PRIORITY   1
+#endif
+
+#define PIXY2_BLACKBOX_PAGE            512
+#define PIXY2_BLACKBOX_SECTOR          4096
+#define PIXY2_BLACKBOX_HEADER          20
+#define PIXY2_BLACKBOX_PAYLOAD         (PIXY2_BLACKBOX_PAGE - PIXY2_BLACKBOX_HEADER)
+#define PIXY2_BLACKBOX_MAGIC           0x4250
+#define PIXY2_BLACKBOX_LAYOUT          3
+#define PIXY2_BLACKBOX_PAGES_PER_SECTOR (PIXY2_BLACKBOX_SECTOR/PIXY2_BLACKBOX_PAGE)
+#define PIXY2_BLACKBOX_NONE            0xffffffff
+
+// a keyframe of MAX_BLOCKS blocks and its time has to fit in an empty page
+#if PIXY2_BLACKBOX_MAX_BLOCKS > PIXY2_CODEC_MAX_BLOCKS || \
+  5 + 1 + PIXY2_BLACKBOX_MAX_BLOCKS*PIXY2_CODEC_MAX_BLOCK > PIXY2_BLACKBOX_PAYLOAD
+#error "PIXY2_BLACKBOX_MAX_BLOCKS too large for a page"
+#endif
+
+// Page header, little endian:
+//   0  magic       0x4250
+//   2  crc         CRC-16/CCITT from byte 4 to the end of the payload
+//   4  length      payload bytes used
+//   6  frames
+//   7  layout      PIXY2_BLACKBOX_LAYOUT
+//   8  sequence    pages written since the partition was new
+//   12 time        ms timestamp of the first frame
+//   16 boot        begin() calls that found the partition in use; times restart with it
+// then frames: varint ms since the previous frame and a Pixy2FrameCodec frame, the first
+// one a keyframe.
+
+struct Pixy2BlackBoxFrame
+{
+  uint32_t boot;         // the page header's boot count; time is within it
+  uint32_t time;         // ms
+  uint8_t numBlocks;
+  Block blocks[PIXY2_BLACKBOX_MAX_BLOCKS];
+};
+
+#ifdef ARDUINO_ARCH_ESP32
+// The black box partition through esp_partition.
+class Pixy2FlashPartition
+{
+public:
+  Pixy2FlashPartition()
+  {
+    m_part = NULL;
+  }
+
+  bool begin(const char *label = PIXY2_BLACKBOX_PARTITION)
+  {
+    m_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    return m_part != NULL;
+  }
+
+  uint32_t size() const { return m_part ? m_part->size : 0; }
+  bool read(uint32_t addr, void *buf, uint32_t len) { return esp_partition_read(m_part, addr, buf, len) == ESP_OK; }
+  bool write(uint32_t addr, const void *buf, uint32_t len) { return esp_partition_write(m_part, addr, buf, len) == ESP_OK; }
+  bool erase(uint32_t addr, uint32_t len) { return esp_partition_erase_range(m_part, addr, len) == ESP_OK; }
+
+private:
+  const esp_partition_t *m_part;
+};
+#endif
+
+static inline void pixy2BlackBoxPut16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void pixy2BlackBoxPut32(uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+static inline uint16_t pixy2BlackBoxGet16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t pixy2BlackBoxGet32(const uint8_t *p) { return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+// A header that looks like one of ours; the CRC is checked when the page is read.
+static inline bool pixy2BlackBoxHeader(const uint8_t *page)
+{
+  return pixy2BlackBoxGet16(page) == PIXY2_BLACKBOX_MAGIC && page[7] == PIXY2_BLACKBOX_LAYOUT &&
+    pixy2BlackBoxGet16(page + 4) <= PIXY2_BLACKBOX_PAYLOAD;
+}
+
+static inline uint16_t pixy2BlackBoxCrc(const uint8_t *page)
+{
+  return pixy2NodeCrc(page + 4, PIXY2_BLACKBOX_HEADER - 4 + pixy2BlackBoxGet16(page + 4));
+}
+
+// Flash is anything with size(), read(addr, buf, len), write(addr, buf, len) and
+// erase(addr, len) on sector boundaries: Pixy2FlashPartition, or host/Pixy2FlashFile.h.
+template <class Flash> class Pixy2BlackBox
+{
+public:
+  Pixy2BlackBox(Flash *flash)
+  {
+    m_flash = flash;
+    m_pages = 0;
+    m_head = m_tail = 0;
+    m_used = 0;
+    m_frames = 0;
+    m_seq = 0;
+    m_boot = 0;
+    m_writePage = 0;
+    m_erased = PIXY2_BLACKBOX_NONE;
+    m_recorded = m_dropped = m_truncated = 0;
+    m_written = m_erases = m_erasesInline = m_errors = 0;
+    m_pageWaitMaxUs = 0;
+#ifdef ARDUINO_ARCH_ESP32
+    m_task = NULL;
+    m_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+  }
+
+  // Find where the log left off, erase the sector it goes on in and, on the ESP32, start
+  // the writer task. Without the task, call service() now and then. False if the flash is
+  // under two sectors.
+  bool begin(bool task = true)
+  {
+    uint8_t header[PIXY2_BLACKBOX_HEADER];
+    uint32_t p, seq, last = 0;
+    bool found = false;
+
+    m_pages = (m_flash->size()/PIXY2_BLACKBOX_SECTOR)*(PIXY2_BLACKBOX_SECTOR/PIXY2_BLACKBOX_PAGE);
+    if (m_pages < 2*PIXY2_BLACKBOX_SECTOR/PIXY2_BLACKBOX_PAGE)
+      return false;
+    for (p = 0; p < m_pages; p++)
+    {
+      if (!m_flash->read(p*PIXY2_BLACKBOX_PAGE, header, sizeof(header)) || !pixy2BlackBoxHeader(header))
+        continue;
+      seq = pixy2BlackBoxGet32(header + 8);
+      if (!found || (int32_t)(seq - m_seq) > 0)
+      {
+        m_seq = seq;
+        m_boot = pixy2BlackBoxGet32(header + 16);
+        last = p;
+        found = true;
+      }
+    }
+    // a page cut short by the reset may follow the newest one: start on a new sector
+    if (found)
+    {
+      m_seq++;
+      m_boot++;
+      m_writePage = ((last*PIXY2_BLACKBOX_PAGE/PIXY2_BLACKBOX_SECTOR + 1)*PIXY2_BLACKBOX_SECTOR/PIXY2_BLACKBOX_PAGE) % m_pages;
+    }
+    else
+      m_writePage = 0;
+    m_erased = PIXY2_BLACKBOX_NONE;
+    eraseAhead();
+#ifdef ARDUINO_ARCH_ESP32
+    if (task && m_task == NULL)
+      xTaskCreatePinnedToCore(taskMain, "pixy2bb", PIXY2_BLACKBOX_TASK_STACK, this, PIXY2_BLACKBOX_TASK_PRIORITY,
+        &m_task, 0);
+#else
+    (void)task;
+#endif
+    return true;
+  }
+
+  // Add a frame. Returns false if it was dropped because the queue is full.
+  bool record(const Block *blocks, uint8_t n, uint32_t ms = millis())
+  {
+    bool sealed = false, res;
+
+    if (n > PIXY2_BLACKBOX_MAX_BLOCKS)
+    {
+      n = PIXY2_BLACKBOX_MAX_BLOCKS;
+      m_truncated++;
+    }
+    lock();
+    res = add(blocks, n, ms, &sealed);
+    unlock();
+    if (sealed)
+      wake();
+    return res;
+  }
+
+  // Queue the page being filled, e.g. before a planned power-off.
+  void flush()
+  {
+    bool sealed;
+
+    lock();
+    sealed = seal();
+    unlock();
+    if (sealed)
+      wake();
+  }
+
+  // Queue the page being filled if it was started PIXY2_BLACKBOX_FLUSH_MS ago or more.
+  // The writer task does this; without it, call it from loop(). True if it queued one.
+  bool flushIdle(uint32_t ms = millis())
+  {
+    bool sealed = false;
+
+    lock();
+    if (m_used && ms - m_pageTime >= PIXY2_BLACKBOX_FLUSH_MS)
+      sealed = seal();
+    unlock();
+    if (sealed)
+      wake();
+    return sealed;
+  }
+
+  // Write queued pages to flash, then erase the next sector if it isn't yet; returns how
+  // many pages. The writer task calls this.
+  uint8_t service()
+  {
+    const uint8_t *page;
+    uint32_t addr, wait;
+    uint8_t n = 0;
+
+    while (m_tail != __atomic_load_n(&m_head, __ATOMIC_ACQUIRE))
+    {
+      page = m_queue[m_tail%PIXY2_BLACKBOX_QUEUE];
+      addr = m_writePage*PIXY2_BLACKBOX_PAGE;
+      PIXY2_TRACE_BEGIN(PIXY2_TRACE_TELEMETRY, m_writePage);
+      // a whole sector went by without the queue running dry
+      if (addr%PIXY2_BLACKBOX_SECTOR == 0 && m_erased != addr/PIXY2_BLACKBOX_SECTOR)
+      {
+        erase(addr/PIXY2_BLACKBOX_SECTOR);
+        m_erasesInline++;
+      }
+      if (!m_flash->write(addr, page, PIXY2_BLACKBOX_PAGE))
+        m_errors++;
+      PIXY2_TRACE_END(PIXY2_TRACE_TELEMETRY, m_writePage);
+      m_writePage = (m_writePage + 1)%m_pages;
+      m_written++;
+      wait = micros() - m_queuedUs[m_tail%PIXY2_BLACKBOX_QUEUE];
+      if (wait > m_pageWaitMaxUs)
+        m_pageWaitMaxUs = wait;
+      __atomic_store_n(&m_tail, m_tail + 1, __ATOMIC_RELEASE);
+      n++;
+    }
+    eraseAhead();
+    return n;
+  }
+
+  uint32_t recorded() const { return m_recorded; }
+  // frames lost to a full queue, and frames cut to MAX_BLOCKS
+  uint32_t dropped() const { return m_dropped; }
+  uint32_t truncated() const { return m_truncated; }
+  uint32_t pagesWritten() const { return m_written; }
+  uint32_t erases() const { return m_erases; }
+  // erases a queued page had to wait for, and the longest a page waited to be written
+  uint32_t erasesInline() const { return m_erasesInline; }
+  uint32_t pageWaitMaxUs() const { return m_pageWaitMaxUs; }
+  uint32_t errors() const { return m_errors; }
+  uint8_t queued() const { return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE); }
+#ifdef ARDUINO_ARCH_ESP32
+  // the writer task, NULL without one; for its stack high-water mark
+  TaskHandle_t task() const { return m_task; }
+#endif
+
+private:
+  // record() under the lock; sealed is set if a page was queued
+  bool add(const Block *blocks, uint8_t n, uint32_t ms, bool *sealed)
+  {
+    uint8_t *page;
+    uint16_t len;
+
+    if (m_used && ms - m_pageTime >= PIXY2_BLACKBOX_FLUSH_MS)
+      *sealed |= seal();
+    if (!m_used && !open(ms))
+      return false;
+    page = m_queue[m_head%PIXY2_BLACKBOX_QUEUE] + PIXY2_BLACKBOX_HEADER;
+    len = encode(page + m_used, PIXY2_BLACKBOX_PAYLOAD - m_used, blocks, n, ms - m_last);
+    if (len == 0)
+    {
+      *sealed |= seal();
+      if (!open(ms))
+        return false;
+      page = m_queue[m_head%PIXY2_BLACKBOX_QUEUE] + PIXY2_BLACKBOX_HEADER;
+      len = encode(page, PIXY2_BLACKBOX_PAYLOAD, blocks, n, 0);
+    }
+    m_used += len;
+    m_frames++;
+    m_last = ms;
+    m_recorded++;
+    return true;
+  }
+
+  // Close the page being filled and queue it; false if there is none.
+  bool seal()
+  {
+    uint8_t *page;
+
+    if (m_used == 0)
+      return false;
+    page = m_queue[m_head%PIXY2_BLACKBOX_QUEUE];
+    memset(page + PIXY2_BLACKBOX_HEADER + m_used, 0xff, PIXY2_BLACKBOX_PAYLOAD - m_used);
+    pixy2BlackBoxPut16(page, PIXY2_BLACKBOX_MAGIC);
+    pixy2BlackBoxPut16(page + 4, m_used);
+    page[6] = m_frames;
+    page[7] = PIXY2_BLACKBOX_LAYOUT;
+    pixy2BlackBoxPut32(page + 8, m_seq++);
+    pixy2BlackBoxPut32(page + 12, m_pageTime);
+    pixy2BlackBoxPut32(page + 16, m_boot);
+    pixy2BlackBoxPut16(page + 2, pixy2BlackBoxCrc(page));
+    m_used = 0;
+    m_queuedUs[m_head%PIXY2_BLACKBOX_QUEUE] = micros();
+    __atomic_store_n(&m_head, m_head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // record() and the timed flush, both touching the page being filled, run on different
+  // tasks; the lock is held for one frame's coding or one page's sealing
+  void lock()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    portENTER_CRITICAL(&m_lock);
+#endif
+  }
+
+  void unlock()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    portEXIT_CRITICAL(&m_lock);
+#endif
+  }
+
+  void wake()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    if (m_task)
+      xTaskNotifyGive(m_task);
+#endif
+  }
+
+  // the time, then the frame; 0 if they don't fit
+  uint16_t encode(uint8_t *buf, uint16_t len, const Block *blocks, uint8_t n, uint32_t dtMs)
+  {
+    uint8_t dt[5];
+    uint16_t k = Pixy2FrameCodec::putVarint(dt, dtMs) - dt, used;
+
+    if (len <= k || (used = m_codec.encode(buf + k, len - k, blocks, n)) == 0)
+      return 0;
+    memcpy(buf, dt, k);
+    return k + used;
+  }
+
+  // the sector the next page goes in, if it starts one, else the one after
+  void eraseAhead()
+  {
+    uint32_t sector = (m_writePage + PIXY2_BLACKBOX_PAGES_PER_SECTOR - 1)/PIXY2_BLACKBOX_PAGES_PER_SECTOR;
+
+    sector %= m_pages/PIXY2_BLACKBOX_PAGES_PER_SECTOR;
+    if (m_erased != sector)
+      erase(sector);
+  }
+
+  void erase(uint32_t sector)
+  {
+    if (!m_flash->erase(sector*PIXY2_BLACKBOX_SECTOR, PIXY2_BLACKBOX_SECTOR))
+      m_errors++;
+    m_erases++;
+    m_erased = sector;
+  }
+
+  // start a page in the next queue slot, if there is one free
+  bool open(uint32_t ms)
+  {
+    if ((uint8_t)(m_head - __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)) >= PIXY2_BLACKBOX_QUEUE)
+    {
+      m_dropped++;
+      return false;
+    }
+    m_codec.reset();
+    m_pageTime = m_last = ms;
+    m_frames = 0;
+    return true;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  static void taskMain(void *arg)
+  {
+    Pixy2BlackBox *box = (Pixy2BlackBox *)arg;
+
+    // woken by each queued page, and at least twice per PIXY2_BLACKBOX_FLUSH_MS to queue
+    // a page that stopped filling
+    while (true)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PIXY2_BLACKBOX_FLUSH_MS/2));
+      box->flushIdle();
+      box->service();
+    }
+  }
+
+  TaskHandle_t m_task;
+  portMUX_TYPE m_lock;
+#endif
+
+  Flash *m_flash;
+  uint32_t m_pages;
+  Pixy2FrameCodec m_codec;
+
+  // filled by record(), emptied by service()
+  uint8_t m_queue[PIXY2_BLACKBOX_QUEUE][PIXY2_BLACKBOX_PAGE];
+  uint32_t m_queuedUs[PIXY2_BLACKBOX_QUEUE];
+  uint8_t m_head;
+  uint8_t m_tail;
+
+  // the page being filled, m_queue[m_head]
+  uint16_t m_used;
+  uint8_t m_frames;
+  uint32_t m_pageTime;
+  uint32_t m_last;
+  uint32_t m_seq;
+  uint32_t m_boot;
+
+  uint32_t m_writePage;
+  // the sector erased ahead of the pages, NONE until begin()
+  uint32_t m_erased;
+
+  uint32_t m_recorded;
+  uint32_t m_dropped;
+  uint32_t m_truncated;
+  uint32_t m_written;
+  uint32_t m_erases;
+  uint32_t m_erasesInline;
+  uint32_t m_errors;
+  uint32_t m_pageWaitMaxUs;
+};
+
+// Reads a black box back, oldest frame first. Pages that fail their CRC are skipped.
+template <class Flash> class Pixy2BlackBoxReader
+{
+public:
+  Pixy2BlackBoxReader(Flash *flash)
+  {
+    m_flash = flash;
+    m_pages = 0;
+    m_left = 0;
+  }
+
+  // Find the oldest page. False if there is none.
+  bool begin()
+  {
+    uint8_t header[PIXY2_BLACKBOX_HEADER];
+    uint32_t p, seq, first = 0;
+    bool found = false;
+
+    m_pages = (m_flash->size()/PIXY2_BLACKBOX_SECTOR)*(PIXY2_BLACKBOX_SECTOR/PIXY2_BLACKBOX_PAGE);
+    m_valid = m_bad = 0;
+    for (p = 0; p < m_pages; p++)
+    {
+      if (!m_flash->read(p*PIXY2_BLACKBOX_PAGE, header, sizeof(header)) || !pixy2BlackBoxHeader(header))
+        continue;
+      seq = pixy2BlackBoxGet32(header + 8);
+      if (!found || (int32_t)(seq - m_first) < 0)
+      {
+        m_first = seq;
+        first = p;
+        found = true;
+      }
+    }
+    m_next = first;
+    m_left = found ? m_pages : 0;
+    m_pos = m_len = 0;
+    m_started = false;
+    return found;
+  }
+
+  bool next(Pixy2BlackBoxFrame *frame)
+  {
+    const uint8_t *p;
+    uint16_t len, pos;
+    uint32_t dt;
+
+    while (true)
+    {
+      if (m_pos < m_len)
+      {
+        p = m_page + PIXY2_BLACKBOX_HEADER + m_pos;
+        pos = 0;
+        len = 0;
+        // the count is checked first, frame->blocks only holds MAX_BLOCKS
+        if (Pixy2FrameCodec::getVarint(p, m_len - m_pos, &pos, &dt) && pos < m_len - m_pos &&
+          (p[pos] & ~PIXY2_CODEC_KEY) <= PIXY2_BLACKBOX_MAX_BLOCKS)
+          len = m_codec.decode(p + pos, m_len - m_pos - pos, frame->blocks, &frame->numBlocks);
+        if (len)
+        {
+          m_pos += pos + len;
+          m_time += dt;
+          frame->boot = m_boot;
+          frame->time = m_time;
+          return true;
+        }
+        m_bad++; // CRC was fine but the frames aren't: skip the rest
+        m_len = 0;
+      }
+      if (!load())
+        return false;
+    }
+  }
+
+  // pages read with a good CRC, and pages that looked like ours but weren't
+  uint32_t pages() const { return m_valid; }
+  uint32_t badPages() const { return m_bad; }
+
+private:
+  bool load()
+  {
+    uint32_t addr, seq;
+
+    while (m_left)
+    {
+      m_left--;
+      addr = m_next*PIXY2_BLACKBOX_PAGE;
+      m_next = (m_next + 1)%m_pages;
+      if (!m_flash->read(addr, m_page, PIXY2_BLACKBOX_PAGE))
+      {
+        m_bad++;
+        continue;
+      }
+      if (!pixy2BlackBoxHeader(m_page))
+        continue;
+      seq = pixy2BlackBoxGet32(m_page + 8);
+      if (pixy2BlackBoxCrc(m_page) != pixy2BlackBoxGet16(m_page + 2) || (m_started && (int32_t)(seq - m_seq) <= 0))
+      {
+        m_bad++;
+        continue;
+      }
+      m_seq = seq;
+      m_started = true;
+      m_valid++;
+      m_time = pixy2BlackBoxGet32(m_page + 12);
+      m_boot = pixy2BlackBoxGet32(m_page + 16);
+      m_len = pixy2BlackBoxGet16(m_page + 4);
+      m_pos = 0;
+      m_codec.reset();
+      return true;
+    }
+    return false;
+  }
+
+  Flash *m_flash;
+  Pixy2FrameCodec m_codec;
+  uint8_t m_page[PIXY2_BLACKBOX_PAGE];
+  uint32_t m_pages;
+  uint32_t m_next;
+  uint32_t m_left;
+  uint32_t m_first;
+  uint32_t m_seq;
+  bool m_started;
+  uint16_t m_pos;
+  uint16_t m_len;
+  uint32_t m_time;
+  uint32_t m_boot;
+  uint32_t m_valid;
+  uint32_t m_bad;
+};
+
+#endif // _PIXY2BLACKBOX_H
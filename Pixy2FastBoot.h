@@ -0,0 +1,287 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Warm start from a cached camera description.
+// init() opens the link, waits for the camera to answer a version request and then asks
+// for the resolution; with PIXY_UART_AUTOBAUD it first probes baud rates. After a reset
+// of the ESP32 alone (brownout, watchdog) the camera is still running with the same
+// answers, so begin() keeps them in NVS: on a hit it opens the link at the rate that
+// worked last time, fills in version, frameWidth and frameHeight, and returns without a
+// round trip. A Link2UART opened with PIXY_UART_AUTOBAUD starts at the cached rate
+// without probing and still renegotiates if errors pile up later. The cache is checked lazily: validate() from loop() re-reads version and
+// resolution one request per call once a frame has come through, and a run of failed
+// frames means the cache is wrong (camera reset, different rate) and falls back to a
+// full init().
+//
+//   Pixy2FastBoot<Link2UART> boot(&pixy);
+//   boot.begin(PIXY_UART_AUTOBAUD);
+//   loop() { boot.frame(pixy.ccc.getBlocks()); boot.validate(); ... }
+
+#ifndef _PIXY2FASTBOOT_H
+#define _PIXY2FASTBOOT_H
+
+#include "TPixy2.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Preferences.h>
+#endif
+
+#ifndef PIXY2_BOOT_NAMESPACE
+#define PIXY2_BOOT_NAMESPACE    "pixy2"
+#endif
+// consecutive failed frames before an unvalidated cache is given up on
+#ifndef PIXY2_BOOT_FAIL_LIMIT
+#define PIXY2_BOOT_FAIL_LIMIT   4
+#endif
+
+#define PIXY2_BOOT_MAGIC        0x5032
+#define PIXY2_BOOT_LAYOUT       1
+
+#define PIXY2_BOOT_COLD         0   // no usable cache: full init()
+#define PIXY2_BOOT_WARM         1   // running on the cache, not yet checked
+#define PIXY2_BOOT_VALID        2   // checked against the camera
+
+struct Pixy2BootCache
+{
+  uint16_t magic;
+  uint8_t layout;
+  uint8_t reserved;
+  uint32_t linkRate;    // baud or SPI clock the link ended up on
+  Version version;
+  uint16_t frameWidth;
+  uint16_t frameHeight;
+};
+
+template <class LinkType> class Pixy2FastBoot
+{
+public:
+  Pixy2FastBoot(TPixy2<LinkType> *pixy)
+  {
+    m_pixy = pixy;
+    m_state = PIXY2_BOOT_COLD;
+    m_step = 0;
+    m_failures = 0;
+    m_bootUs = m_readyUs = m_firstFrameUs = 0;
+    m_firstFrame = false;
+    m_mismatches = 0;
+  }
+
+  // In place of pixy.init(arg). Returns what init() would.
+  int8_t begin(uint32_t arg = PIXY_DEFAULT_ARGVAL)
+  {
+    m_bootUs = micros();
+    m_arg = arg;
+    if (load() && openCached(m_pixy->m_link, 0) >= 0)
+    {
+      m_pixy->version = &m_cache.version;
+      m_pixy->frameWidth = m_cache.frameWidth;
+      m_pixy->frameHeight = m_cache.frameHeight;
+      m_state = PIXY2_BOOT_WARM;
+      m_step = 0;
+      m_readyUs = micros() - m_bootUs;
+      return PIXY_RESULT_OK;
+    }
+    return cold();
+  }
+
+  // Pass every frame request's result. Records time to first frame and notices when the
+  // cached settings don't work.
+  void frame(int8_t res)
+  {
+    if (res >= 0 || res == PIXY_RESULT_BUSY)
+    {
+      if (res >= 0 && !m_firstFrame)
+      {
+        m_firstFrame = true;
+        m_firstFrameUs = micros() - m_bootUs;
+      }
+      m_failures = 0;
+      return;
+    }
+    if (m_state == PIXY2_BOOT_WARM && ++m_failures >= PIXY2_BOOT_FAIL_LIMIT)
+      cold();
+  }
+
+  // Call from loop() between frames; at most one round trip, none once validated.
+  void validate()
+  {
+    int8_t res;
+
+    if (m_state != PIXY2_BOOT_WARM || !m_firstFrame)
+      return;
+
+    if (m_step == 0)
+    {
+      res = m_pixy->getVersion();
+      if (res < 0)
+        return; // busy; next time
+      if (memcmp(m_pixy->version, &m_cache.version, sizeof(Version)))
+      {
+        m_cache.version = *m_pixy->version;
+        m_mismatches++;
+      }
+      m_pixy->version = &m_cache.version; // m_buf gets reused by the next request
+      m_step = 1;
+      return;
+    }
+
+    if (m_pixy->getResolution() < 0)
+      return;
+    if (m_pixy->frameWidth != m_cache.frameWidth || m_pixy->frameHeight != m_cache.frameHeight)
+    {
+      m_cache.frameWidth = m_pixy->frameWidth;
+      m_cache.frameHeight = m_pixy->frameHeight;
+      m_mismatches++;
+    }
+    // an auto-baud link may have moved since
+    if (linkRate(m_pixy->m_link, 0) != m_cache.linkRate)
+    {
+      m_cache.linkRate = linkRate(m_pixy->m_link, 0);
+      m_mismatches++;
+    }
+    if (m_mismatches)
+      store();
+    m_state = PIXY2_BOOT_VALID;
+  }
+
+  // Forget the cache, e.g. after a firmware update.
+  void clear()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    Preferences prefs;
+
+    if (prefs.begin(PIXY2_BOOT_NAMESPACE, false))
+    {
+      prefs.remove("boot");
+      prefs.end();
+    }
+#else
+    s_ram.magic = 0;
+#endif
+  }
+
+  uint8_t state() const { return m_state; }
+  bool warm() const { return m_state != PIXY2_BOOT_COLD; }
+  // from begin(): until it returned, and until the first good frame
+  uint32_t readyUs() const { return m_readyUs; }
+  uint32_t firstFrameUs() const { return m_firstFrameUs; }
+  // fields the camera disagreed with the cache on, and the link rate if it moved
+  uint8_t mismatches() const { return m_mismatches; }
+
+  void print()
+  {
+    char buf[96];
+
+    snprintf(buf, sizeof(buf), "%s boot: ready after %lu us, first frame after %lu us",
+      m_state == PIXY2_BOOT_COLD ? "cold" : "warm", (unsigned long)m_readyUs, (unsigned long)m_firstFrameUs);
+    Serial.println(buf);
+  }
+
+private:
+  int8_t cold()
+  {
+    int8_t res;
+
+    m_pixy->m_link.close();
+    res = m_pixy->init(m_arg);
+    m_state = PIXY2_BOOT_COLD;
+    m_failures = 0;
+    m_readyUs = micros() - m_bootUs;
+    if (res < 0)
+      return res;
+    // init()'s getResolution() reused the buffer version points into
+    if (m_pixy->getVersion() < 0)
+      return res;
+    m_cache.version = *m_pixy->version;
+    m_pixy->version = &m_cache.version;
+    m_cache.frameWidth = m_pixy->frameWidth;
+    m_cache.frameHeight = m_pixy->frameHeight;
+    m_cache.linkRate = linkRate(m_pixy->m_link, 0);
+    store();
+    return res;
+  }
+
+  bool load()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    Preferences prefs;
+    size_t len = 0;
+
+    if (prefs.begin(PIXY2_BOOT_NAMESPACE, true))
+    {
+      len = prefs.getBytes("boot", &m_cache, sizeof(m_cache));
+      prefs.end();
+    }
+    if (len != sizeof(m_cache))
+      return false;
+#else
+    m_cache = s_ram;
+#endif
+    return m_cache.magic == PIXY2_BOOT_MAGIC && m_cache.layout == PIXY2_BOOT_LAYOUT;
+  }
+
+  void store()
+  {
+    m_cache.magic = PIXY2_BOOT_MAGIC;
+    m_cache.layout = PIXY2_BOOT_LAYOUT;
+    m_cache.reserved = 0;
+#ifdef ARDUINO_ARCH_ESP32
+    Preferences prefs;
+
+    if (prefs.begin(PIXY2_BOOT_NAMESPACE, false))
+    {
+      prefs.putBytes("boot", &m_cache, sizeof(m_cache));
+      prefs.end();
+    }
+#else
+    s_ram = m_cache;
+#endif
+  }
+
+  // The rate the link settled on: baud() on UART links, clock() on SPI ones, otherwise
+  // whatever begin() was given.
+  template <class L> static auto linkRate(L &link, int) -> decltype(link.baud()) { return link.baud(); }
+  template <class L> static auto linkRate(L &link, long) -> decltype(link.clock()) { return link.clock(); }
+  template <class L> uint32_t linkRate(L &, ...) { return m_arg; }
+
+  // Open at the cached rate, in the mode begin() was asked for where the link can start
+  // at a given rate (Link2UART's open(arg, startBaud)); otherwise at the rate alone.
+  template <class L> auto openCached(L &link, int) -> decltype(link.open(0u, 0u))
+  {
+    return link.open(m_arg, m_cache.linkRate);
+  }
+  template <class L> int8_t openCached(L &link, ...) { return link.open(m_cache.linkRate); }
+
+  TPixy2<LinkType> *m_pixy;
+  Pixy2BootCache m_cache;
+  uint32_t m_arg;
+  uint8_t m_state;
+  uint8_t m_step;
+  uint8_t m_failures;
+  uint8_t m_mismatches;
+  bool m_firstFrame;
+  uint32_t m_bootUs;
+  uint32_t m_readyUs;
+  uint32_t m_firstFrameUs;
+
+#ifndef ARDUINO_ARCH_ESP32
+  static Pixy2BootCache s_ram;   // no NVS: lasts as long as the process
+#endif
+};
+
+#ifndef ARDUINO_ARCH_ESP32
+template <class LinkType> Pixy2BootCache Pixy2FastBoot<LinkType>::s_ram;
+#endif
+
+#endif // _PIXY2FASTBOOT_H
@@ -0,0 +1,216 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Fault-injecting link, for seeing how the frame rate holds up on a noisy cable before
+// the robot meets one.
+// TLink2Fault wraps any link class (Link2UART, Link2SPI, Link2UARTLinux, the host's
+// Link2Emu) and corrupts the byte stream between it and TPixy2: bit flips, dropped and
+// duplicated bytes, and latency spikes before a read. Rates are per million bytes (spikes
+// per million recv() calls) and drawn from a seeded generator, so a run can be repeated
+// exactly. A dropped byte is replaced by reading one more from the link, and a duplicated
+// one pushes the last byte of the read into the next, as a UART that lost or doubled a
+// character would. Everything else the link has (emu(), timeouts(), ...) is still there.
+//
+//   TPixy2<TLink2Fault<Link2UART> > pixy;
+//   Pixy2Faults faults = { 100, 20, 20, 1000, 5000, PIXY2_FAULT_BOTH };
+//   pixy.m_link.setFaults(faults, 1);
+//   pixy.init();
+//   ...
+//   pixy.m_link.print();
+//
+// host/pixy_bench's fault section runs it against the emulator at a range of rates.
+
+#ifndef _PIXY2FAULTLINK_H
+#define _PIXY2FAULTLINK_H
+
+#include "TPixy2.h"
+
+#define PIXY2_FAULT_RECV            0x01   // camera to us
+#define PIXY2_FAULT_SEND            0x02   // us to camera
+#define PIXY2_FAULT_BOTH            0x03
+
+// holds a read's worth plus the bytes duplicates pushed out of it
+#define PIXY2_FAULT_PENDING         512
+
+struct Pixy2Faults
+{
+  uint32_t flipPpm;      // one bit of the byte flipped
+  uint32_t dropPpm;
+  uint32_t dupPpm;
+  uint32_t spikePpm;     // per recv() call
+  uint32_t spikeUs;
+  uint8_t directions;    // PIXY2_FAULT_*; spikes are on recv() only
+};
+
+template <class LinkType> class TLink2Fault : public LinkType
+{
+public:
+  TLink2Fault()
+  {
+    Pixy2Faults none = { 0, 0, 0, 0, 0, 0 };
+
+    setFaults(none, 1);
+  }
+
+  // Also restarts the generator from seed and clears the counts.
+  void setFaults(const Pixy2Faults &faults, uint32_t seed)
+  {
+    m_faults = faults;
+    m_rng = seed;
+    m_pendHead = m_pendTail = 0;
+    resetStats();
+  }
+
+  const Pixy2Faults &faults() const { return m_faults; }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t in[256], n;
+    int16_t res, i;
+
+    if (cs)
+      *cs = 0;
+    if (chance(m_faults.spikePpm))
+    {
+      m_spikes++;
+      m_spikeUs += m_faults.spikeUs;
+      delayMicroseconds(m_faults.spikeUs);
+    }
+    while (pending() < len)
+    {
+      res = LinkType::recv(in, len - pending());
+      if (res < 0)
+      {
+        // the read is lost, so is what it had pending
+        m_pendHead = m_pendTail = 0;
+        m_recvErrors++;
+        return res;
+      }
+      m_bytesIn += res;
+      for (i = 0; i < res; i++)
+        for (n = corrupt(&in[i], PIXY2_FAULT_RECV); n; n--)
+          m_pending[m_pendHead++ & (PIXY2_FAULT_PENDING - 1)] = in[i];
+    }
+    for (n = 0; n < len; n++)
+    {
+      buf[n] = m_pending[m_pendTail++ & (PIXY2_FAULT_PENDING - 1)];
+      if (cs)
+        *cs += buf[n];
+    }
+    return len;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    uint8_t out[2*255], c, copies;
+    uint16_t i, n = 0;
+    int16_t res;
+
+    for (i = 0; i < len; i++)
+      for (c = buf[i], copies = corrupt(&c, PIXY2_FAULT_SEND); copies; copies--)
+        out[n++] = c;
+    // the link takes at most 255 at a time
+    for (i = 0; i < n; i += res)
+    {
+      res = LinkType::send(out + i, n - i > 255 ? 255 : n - i);
+      if (res <= 0)
+        return res;
+      m_bytesOut += res;
+    }
+    return len;
+  }
+
+  void resetStats()
+  {
+    m_flips = m_drops = m_dups = m_spikes = 0;
+    m_spikeUs = m_recvErrors = 0;
+    m_bytesIn = m_bytesOut = 0;
+  }
+
+  uint32_t flips() const { return m_flips; }
+  uint32_t drops() const { return m_drops; }
+  uint32_t dups() const { return m_dups; }
+  uint32_t spikes() const { return m_spikes; }
+  // time the spikes added
+  uint32_t spikeUs() const { return m_spikeUs; }
+  // recv() calls the link failed
+  uint32_t recvErrors() const { return m_recvErrors; }
+  // bytes on the wire, as the link moved them
+  uint32_t bytesIn() const { return m_bytesIn; }
+  uint32_t bytesOut() const { return m_bytesOut; }
+
+  void print()
+  {
+    char buf[160];
+
+    snprintf(buf, sizeof(buf), "faults: %lu flips, %lu drops, %lu dups, %lu spikes (%lu us), %lu recv errors",
+      (unsigned long)m_flips, (unsigned long)m_drops, (unsigned long)m_dups, (unsigned long)m_spikes,
+      (unsigned long)m_spikeUs, (unsigned long)m_recvErrors);
+    Serial.println(buf);
+  }
+
+private:
+  uint16_t pending() const { return m_pendHead - m_pendTail; }
+
+  // *c as it arrives at the other end, and how many times it does
+  uint8_t corrupt(uint8_t *c, uint8_t direction)
+  {
+    if (!(m_faults.directions & direction))
+      return 1;
+    if (chance(m_faults.dropPpm))
+    {
+      m_drops++;
+      return 0;
+    }
+    if (chance(m_faults.flipPpm))
+    {
+      m_flips++;
+      *c ^= 1 << (next() & 7);
+    }
+    if (chance(m_faults.dupPpm))
+    {
+      m_dups++;
+      return 2;
+    }
+    return 1;
+  }
+
+  bool chance(uint32_t ppm)
+  {
+    return ppm && next()%1000000 < ppm;
+  }
+
+  uint32_t next()
+  {
+    m_rng = m_rng*1103515245 + 12345;
+    return m_rng >> 8;
+  }
+
+  Pixy2Faults m_faults;
+  uint32_t m_rng;
+  uint8_t m_pending[PIXY2_FAULT_PENDING];
+  uint16_t m_pendHead;
+  uint16_t m_pendTail;
+
+  uint32_t m_flips;
+  uint32_t m_drops;
+  uint32_t m_dups;
+  uint32_t m_spikes;
+  uint32_t m_spikeUs;
+  uint32_t m_recvErrors;
+  uint32_t m_bytesIn;
+  uint32_t m_bytesOut;
+};
+
+#endif // _PIXY2FAULTLINK_H
@@ -0,0 +1,212 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Heap-free text formatting for debug output.
+// A whole report is built in a fixed buffer (on the stack, typically) and handed to the
+// UART in one write, instead of a Serial.print() per field, each of which converts its
+// number on its own and goes through Stream and the UART driver's lock. Integers are
+// converted two digits at a time from a table, with the digit count from the bit length,
+// so there is one division per two digits and no reversal pass. Nothing is allocated;
+// a field that doesn't fit is left out whole and overflow() says so.
+//
+//   Pixy2Format<256> out;
+//   for (i = 0; i < pixy.ccc.numBlocks; i++)
+//     out.str("sig ").udec(pixy.ccc.blocks[i].m_signature).str(" x ").udec(pixy.ccc.blocks[i].m_x).endl();
+//   out.write(Serial);
+
+#ifndef _PIXY2FORMAT_H
+#define _PIXY2FORMAT_H
+
+#include "TPixy2.h"
+
+static const char PIXY2_FORMAT_DIGITS[201] =
+  "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+  "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+static const uint32_t PIXY2_FORMAT_POW10[10] =
+  { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+template <uint16_t SIZE> class Pixy2Format
+{
+public:
+  Pixy2Format()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    m_len = 0;
+    m_overflow = false;
+    m_buf[0] = '\0';
+  }
+
+  Pixy2Format &str(const char *s)
+  {
+    return put(s, strlen(s));
+  }
+
+  Pixy2Format &chr(char c)
+  {
+    return put(&c, 1);
+  }
+
+  Pixy2Format &udec(uint32_t v)
+  {
+    uint8_t n = digits(v);
+    char *p;
+    uint32_t r;
+
+    if (!room(n))
+      return *this;
+    p = m_buf + m_len + n;
+    while (v >= 100)
+    {
+      r = (v%100)*2;
+      v /= 100;
+      *--p = PIXY2_FORMAT_DIGITS[r + 1];
+      *--p = PIXY2_FORMAT_DIGITS[r];
+    }
+    if (v >= 10)
+    {
+      *--p = PIXY2_FORMAT_DIGITS[v*2 + 1];
+      *--p = PIXY2_FORMAT_DIGITS[v*2];
+    }
+    else
+      *--p = '0' + v;
+    m_len += n;
+    m_buf[m_len] = '\0';
+    return *this;
+  }
+
+  Pixy2Format &dec(int32_t v)
+  {
+    if (v >= 0)
+      return udec(v);
+    // the sign and the digits fit together or not at all
+    if (!room(digits(0U - (uint32_t)v) + 1))
+      return *this;
+    m_buf[m_len++] = '-';
+    return udec(0U - (uint32_t)v);
+  }
+
+  // At least width digits, zero padded.
+  Pixy2Format &hex(uint32_t v, uint8_t width = 1)
+  {
+    uint8_t n = 1;
+    char *p;
+
+    while (n < 8 && v >> (4*n))
+      n++;
+    if (n < width)
+      n = width > 8 ? 8 : width;
+    if (!room(n))
+      return *this;
+    p = m_buf + m_len + n;
+    while (p > m_buf + m_len)
+    {
+      *--p = "0123456789abcdef"[v & 0xf];
+      v >>= 4;
+    }
+    m_len += n;
+    m_buf[m_len] = '\0';
+    return *this;
+  }
+
+  // Octal digits, as Pixy names color codes: signature 10 is CC 12.
+  Pixy2Format &oct(uint32_t v)
+  {
+    uint8_t n = 1;
+    char *p;
+
+    while (n < 11 && v >> (3*n))
+      n++;
+    if (!room(n))
+      return *this;
+    p = m_buf + m_len + n;
+    while (p > m_buf + m_len)
+    {
+      *--p = '0' + (v & 7);
+      v >>= 3;
+    }
+    m_len += n;
+    m_buf[m_len] = '\0';
+    return *this;
+  }
+
+  // line end as Serial.println() writes it
+  Pixy2Format &endl()
+  {
+    return put("\r\n", 2);
+  }
+
+  // Same text as Block::print(), without the line end: color codes get their octal name
+  // and angle.
+  Pixy2Format &block(const Block &b)
+  {
+    if (b.m_signature > CCC_MAX_SIGNATURE)
+      return str("CC block sig: ").oct(b.m_signature & 0x7fff).str(" (").udec(b.m_signature).str(" decimal) x: ").
+        udec(b.m_x).str(" y: ").udec(b.m_y).str(" width: ").udec(b.m_width).str(" height: ").udec(b.m_height).
+        str(" angle: ").dec(b.m_angle).str(" index: ").udec(b.m_index).str(" age: ").udec(b.m_age);
+    return str("sig: ").udec(b.m_signature).str(" x: ").udec(b.m_x).str(" y: ").udec(b.m_y).str(" width: ").
+      udec(b.m_width).str(" height: ").udec(b.m_height).str(" index: ").udec(b.m_index).str(" age: ").udec(b.m_age);
+  }
+
+  // Hand the text to anything with write(const uint8_t *, size_t), e.g. Serial, in one call.
+  template <class Out> size_t write(Out &out) const
+  {
+    return m_len ? out.write((const uint8_t *)m_buf, m_len) : 0;
+  }
+
+  const char *c_str() const { return m_buf; }
+  uint16_t length() const { return m_len; }
+  // room left, for writing out and clearing before a line that might not fit
+  uint16_t available() const { return SIZE - 1 - m_len; }
+  // a field was left out for lack of room since the last clear()
+  bool overflow() const { return m_overflow; }
+
+private:
+  static uint8_t digits(uint32_t v)
+  {
+    // bit length*log10(2) is the count or one over it; 0 takes a digit like 1
+    uint8_t t;
+
+    v |= 1;
+    t = ((32 - __builtin_clz(v))*1233) >> 12;
+    return t + 1 - (v < PIXY2_FORMAT_POW10[t]);
+  }
+
+  bool room(uint16_t n)
+  {
+    if (m_len + n < SIZE)
+      return true;
+    m_overflow = true;
+    return false;
+  }
+
+  Pixy2Format &put(const char *s, uint16_t n)
+  {
+    if (!room(n))
+      return *this;
+    memcpy(m_buf + m_len, s, n);
+    m_len += n;
+    m_buf[m_len] = '\0';
+    return *this;
+  }
+
+  char m_buf[SIZE];
+  uint16_t m_len;
+  bool m_overflow;
+};
+
+#endif // _PIXY2FORMAT_H
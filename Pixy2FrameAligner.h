@@ -0,0 +1,156 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Pairs up frames from several cameras by capture time.
+// Push each camera's frames, stamped with capture times on one clock (Pixy2FrameClock
+// on a shared node, or Pixy2ClockSync-mapped across nodes), then call align() until
+// it returns false. Each true is one set: a frame from every stream, all within the
+// tolerance of each other, each the closest its stream has to the latest of them. A
+// frame that can't be part of a set is dropped. Cameras aren't genlocked, so the
+// tolerance should be half a frame period or less; wider, and a frame can pair with
+// its neighbour's match.
+//
+//   Pixy2FrameAligner<Frame, 2> aligner(4000);
+//   aligner.push(0, captureUs, left);
+//   while (aligner.align())
+//     fuse(aligner.frame(0), aligner.frame(1));
+
+#ifndef _PIXY2FRAMEALIGNER_H
+#define _PIXY2FRAMEALIGNER_H
+
+#include "TPixy2.h"
+
+template <class Frame, uint8_t STREAMS, uint8_t DEPTH = 4> class Pixy2FrameAligner
+{
+public:
+  Pixy2FrameAligner(uint32_t toleranceUs)
+  {
+    m_tolerance = toleranceUs;
+    memset(m_head, 0, sizeof(m_head));
+    memset(m_count, 0, sizeof(m_count));
+    m_sets = m_dropped = 0;
+    m_spread = 0;
+  }
+
+  // Queue a frame; a full queue loses its oldest.
+  void push(uint8_t stream, uint32_t captureUs, const Frame &frame)
+  {
+    uint8_t i;
+
+    if (stream >= STREAMS)
+      return;
+    if (m_count[stream] == DEPTH)
+      pop(stream, true);
+    i = (m_head[stream] + m_count[stream]++) % DEPTH;
+    m_time[stream][i] = captureUs;
+    m_frames[stream][i] = frame;
+  }
+
+  // Form the next set if the queues allow it. frame() and time() then hold it.
+  bool align()
+  {
+    uint8_t s, nx, early;
+    uint32_t ref;
+    int32_t late, d, dn, lo, hi;
+
+    while (true)
+    {
+      for (s = 0; s < STREAMS; s++)
+        if (m_count[s] == 0)
+          return false;
+
+      // the latest head; everything is measured from stream 0's head to handle wrap
+      ref = head(0);
+      for (s = 1, late = 0; s < STREAMS; s++)
+        if ((int32_t)(head(s) - ref) > late)
+          late = head(s) - ref;
+
+      for (s = 0; s < STREAMS; s++)
+      {
+        // skip to the frame closest to the latest head
+        while (m_count[s] > 1)
+        {
+          nx = (m_head[s] + 1) % DEPTH;
+          d = (int32_t)(head(s) - ref) - late;
+          dn = (int32_t)(m_time[s][nx] - ref) - late;
+          if ((dn < 0 ? -dn : dn) > (d < 0 ? -d : d))
+            break;
+          pop(s, true);
+        }
+      }
+      // the move can take a head past the latest one, so measure the spread again; the
+      // earliest head is too early for the rest and can't be in any set
+      for (s = 0, lo = hi = 0, early = 0; s < STREAMS; s++)
+      {
+        d = head(s) - ref;
+        if (s == 0 || d < lo)
+        {
+          lo = d;
+          early = s;
+        }
+        if (s == 0 || d > hi)
+          hi = d;
+      }
+      if (hi - lo > (int32_t)m_tolerance)
+      {
+        pop(early, true);
+        continue;
+      }
+
+      for (s = 0; s < STREAMS; s++)
+      {
+        m_set[s] = m_frames[s][m_head[s]];
+        m_setTime[s] = head(s);
+        pop(s, false);
+      }
+      m_spread = hi - lo;
+      m_sets++;
+      return true;
+    }
+  }
+
+  const Frame &frame(uint8_t stream) const { return m_set[stream]; }
+  uint32_t time(uint8_t stream) const { return m_setTime[stream]; }
+  // capture time spread of the last set
+  uint32_t spreadUs() const { return m_spread; }
+
+  uint32_t sets() const { return m_sets; }
+  uint32_t dropped() const { return m_dropped; }
+  uint8_t queued(uint8_t stream) const { return m_count[stream]; }
+
+private:
+  uint32_t head(uint8_t s) const { return m_time[s][m_head[s]]; }
+
+  void pop(uint8_t s, bool drop)
+  {
+    m_head[s] = (m_head[s] + 1) % DEPTH;
+    m_count[s]--;
+    if (drop)
+      m_dropped++;
+  }
+
+  uint32_t m_tolerance;
+  uint32_t m_time[STREAMS][DEPTH];
+  Frame m_frames[STREAMS][DEPTH];
+  uint8_t m_head[STREAMS];
+  uint8_t m_count[STREAMS];
+
+  Frame m_set[STREAMS];
+  uint32_t m_setTime[STREAMS];
+  uint32_t m_spread;
+  uint32_t m_sets;
+  uint32_t m_dropped;
+};
+
+#endif // _PIXY2FRAMEALIGNER_H
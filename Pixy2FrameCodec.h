@@ -0,0 +1,329 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Compact coding of CCC frames for telemetry and logging.
+// Each block is coded against the block with the same tracking index in the previous
+// frame: a mask of the fields that changed and the changes as zigzag varints, with age
+// expected to count up by one. Small moves in both x and y share one byte. A block that
+// is stationary costs 2 bytes and one drifting a pixel or two 3, against 14 for a Block.
+// Blocks without a match are coded whole.
+//
+// A keyframe codes every block whole and needs no previous frame. The encoder sends one
+// first, every keyInterval frames if set, and after reset(). The decoder has to see
+// the same frames in the same order: after an error or reset() it refuses frames until
+// the next keyframe, so over a lossy link call reset() on a gap and set a key interval.
+// The previous frame can also be set on both sides with setReference(), for frames that
+// went across another way.
+//
+// With setAnchored() every frame is coded against the last keyframe (or setReference())
+// instead of the frame before it. Frames grow a little as the scene moves away from the
+// keyframe, but each decodes on its own, so a lost frame costs only itself.
+//
+//   Pixy2FrameCodec enc(30), dec;
+//   len = enc.encode(buf, sizeof(buf), pixy.ccc.blocks, pixy.ccc.numBlocks);
+//   ...
+//   if (dec.decode(buf, len, blocks, &numBlocks) == 0) { /* wait for a keyframe */ }
+//
+// Frame: count | 0x80 if a keyframe, then per block its index, a mask and the fields.
+// Mask bits 0-6 are signature, x, y, width, height, angle and age, and say which differ
+// from the prediction; bit 7 means the x and y changes are 4-bit values packed in the
+// byte after the mask. A mask of 0xff means no previous block: all fields follow as
+// plain varints, angle zigzagged.
+
+#ifndef _PIXY2FRAMECODEC_H
+#define _PIXY2FRAMECODEC_H
+
+#include "TPixy2.h"
+
+#ifndef PIXY2_CODEC_MAX_BLOCKS
+#define PIXY2_CODEC_MAX_BLOCKS     32
+#endif
+
+// index, mask and 7 fields: five 16-bit (3 bytes each as a varint), angle and age
+#define PIXY2_CODEC_MAX_BLOCK      22
+#define PIXY2_CODEC_MAX_FRAME      (1 + PIXY2_CODEC_MAX_BLOCKS*PIXY2_CODEC_MAX_BLOCK)
+#define PIXY2_CODEC_KEY            0x80
+#define PIXY2_CODEC_NEW            0xff
+#define PIXY2_CODEC_XY             0x80
+
+#if PIXY2_CODEC_MAX_BLOCKS > 127
+#error "PIXY2_CODEC_MAX_BLOCKS must fit in 7 bits"
+#endif
+
+class Pixy2FrameCodec
+{
+public:
+  Pixy2FrameCodec(uint16_t keyInterval = 0)
+  {
+    memset(m_slot, 0, sizeof(m_slot));
+    m_refCount = 0;
+    m_keyInterval = keyInterval;
+    m_anchored = false;
+    reset();
+  }
+
+  // Forget the previous frame: the encoder's next frame is a keyframe, and the decoder
+  // waits for one.
+  void reset()
+  {
+    keep(NULL, 0);
+    m_synced = false;
+    m_sinceKey = 0;
+  }
+
+  // A keyframe at least every frames frames; 0 for only the first.
+  void setKeyInterval(uint16_t frames)
+  {
+    m_keyInterval = frames;
+  }
+
+  // Code against the last keyframe rather than the previous frame; set on both sides.
+  void setAnchored(bool on)
+  {
+    m_anchored = on;
+  }
+
+  // Use blocks as the previous frame, as if they had been coded and decoded.
+  void setReference(const Block *blocks, uint8_t n)
+  {
+    keep(blocks, n > PIXY2_CODEC_MAX_BLOCKS ? PIXY2_CODEC_MAX_BLOCKS : n);
+    m_synced = true;
+    m_sinceKey = 1;
+  }
+
+  // the next encode() will be a keyframe
+  bool keyDue() const
+  {
+    return !m_synced || (m_keyInterval && m_sinceKey >= m_keyInterval);
+  }
+
+  // the decoder has a previous frame to work from
+  bool synced() const { return m_synced; }
+
+  // Returns the bytes used, or 0 if the frame doesn't fit in len (nothing changes then,
+  // so it can be tried again with more room). A buffer of PIXY2_CODEC_MAX_FRAME always
+  // fits.
+  uint16_t encode(uint8_t *buf, uint16_t len, const Block *blocks, uint8_t n)
+  {
+    // coded in place when the worst case fits, so the common case copies nothing
+    uint8_t *out = len >= 1 + n*PIXY2_CODEC_MAX_BLOCK ? buf : m_scratch;
+    uint8_t *p = out, *mask;
+    bool key = keyDue();
+    const Block *ref;
+    int32_t d[7];
+    uint8_t i, k, m;
+    uint16_t used;
+
+    if (n > PIXY2_CODEC_MAX_BLOCKS)
+      return 0;
+    *p++ = n | (key ? PIXY2_CODEC_KEY : 0);
+    for (i = 0; i < n; i++)
+    {
+      const Block &b = blocks[i];
+      *p++ = b.m_index;
+      ref = key ? NULL : find(b.m_index);
+      if (ref == NULL)
+      {
+        *p++ = PIXY2_CODEC_NEW;
+        p = putVarint(p, b.m_signature);
+        p = putVarint(p, b.m_x);
+        p = putVarint(p, b.m_y);
+        p = putVarint(p, b.m_width);
+        p = putVarint(p, b.m_height);
+        p = putVarint(p, zigzag(b.m_angle));
+        p = putVarint(p, b.m_age);
+        continue;
+      }
+      d[0] = (int32_t)b.m_signature - ref->m_signature;
+      d[1] = (int32_t)b.m_x - ref->m_x;
+      d[2] = (int32_t)b.m_y - ref->m_y;
+      d[3] = (int32_t)b.m_width - ref->m_width;
+      d[4] = (int32_t)b.m_height - ref->m_height;
+      d[5] = (int32_t)b.m_angle - ref->m_angle;
+      d[6] = (int32_t)b.m_age - nextAge(ref->m_age);
+      for (k = 0, m = 0; k < 7; k++)
+        if (d[k])
+          m |= 1 << k;
+      mask = p++;
+      // both moved a little; not with every field changed, which would read as NEW
+      if ((m & 0x06) == 0x06 && m != 0x7f && d[1] >= -8 && d[1] < 8 && d[2] >= -8 && d[2] < 8)
+      {
+        *p++ = (d[1] & 0x0f) | (d[2] & 0x0f) << 4;
+        *mask = m | PIXY2_CODEC_XY;
+        m &= ~0x06;
+      }
+      else
+        *mask = m;
+      for (k = 0; m; k++, m >>= 1)
+        if (m & 1)
+          p = putVarint(p, zigzag(d[k]));
+    }
+    used = p - out;
+    if (used > len)
+      return 0;
+    if (out != buf)
+      memcpy(buf, out, used);
+    if (key || !m_anchored)
+      keep(blocks, n);
+    m_synced = true;
+    m_sinceKey = key ? 1 : m_sinceKey + 1;
+    return used;
+  }
+
+  // Returns the bytes read, or 0 if the data is malformed or needs a previous frame this
+  // decoder doesn't have.
+  uint16_t decode(const uint8_t *buf, uint16_t len, Block *blocks, uint8_t *n)
+  {
+    uint16_t pos = 1;
+    bool key;
+    const Block *ref;
+    int32_t f[7];
+    uint32_t v;
+    uint8_t i, k, mask;
+
+    if (len < 1)
+      return fail();
+    key = buf[0] & PIXY2_CODEC_KEY;
+    *n = buf[0] & ~PIXY2_CODEC_KEY;
+    if (*n > PIXY2_CODEC_MAX_BLOCKS || (!key && !m_synced))
+      return fail();
+    for (i = 0; i < *n; i++)
+    {
+      if (len - pos < 2)
+        return fail();
+      blocks[i].m_index = buf[pos++];
+      mask = buf[pos++];
+      if (mask == PIXY2_CODEC_NEW)
+      {
+        for (k = 0; k < 7; k++)
+        {
+          if (!getVarint(buf, len, &pos, &v))
+            return fail();
+          f[k] = k == 5 ? unzigzag(v) : (int32_t)v;
+        }
+      }
+      else
+      {
+        if (key || (ref = find(blocks[i].m_index)) == NULL)
+          return fail();
+        f[0] = ref->m_signature;
+        f[1] = ref->m_x;
+        f[2] = ref->m_y;
+        f[3] = ref->m_width;
+        f[4] = ref->m_height;
+        f[5] = ref->m_angle;
+        f[6] = nextAge(ref->m_age);
+        if (mask & PIXY2_CODEC_XY)
+        {
+          if (pos >= len)
+            return fail();
+          f[1] += (int8_t)(buf[pos] << 4) >> 4;
+          f[2] += (int8_t)buf[pos++] >> 4;
+          mask &= ~(PIXY2_CODEC_XY | 0x06);
+        }
+        for (k = 0; mask; k++, mask >>= 1)
+        {
+          if (!(mask & 1))
+            continue;
+          if (!getVarint(buf, len, &pos, &v))
+            return fail();
+          f[k] += unzigzag(v);
+        }
+      }
+      blocks[i].m_signature = f[0];
+      blocks[i].m_x = f[1];
+      blocks[i].m_y = f[2];
+      blocks[i].m_width = f[3];
+      blocks[i].m_height = f[4];
+      blocks[i].m_angle = f[5];
+      blocks[i].m_age = f[6];
+    }
+    if (key || !m_anchored)
+      keep(blocks, *n);
+    m_synced = true;
+    return pos;
+  }
+
+  // Varints for containers around the frames. putVarint() needs 5 bytes of room.
+  static uint8_t *putVarint(uint8_t *p, uint32_t v)
+  {
+    while (v >= 0x80)
+    {
+      *p++ = v | 0x80;
+      v >>= 7;
+    }
+    *p++ = v;
+    return p;
+  }
+
+  static bool getVarint(const uint8_t *buf, uint16_t len, uint16_t *pos, uint32_t *v)
+  {
+    uint8_t shift;
+
+    for (*v = 0, shift = 0; shift < 35; shift += 7)
+    {
+      if (*pos >= len)
+        return false;
+      *v |= (uint32_t)(buf[*pos] & 0x7f) << shift;
+      if (!(buf[(*pos)++] & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+private:
+  static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+  static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+  // a tracked block is one frame older (age saturates at 255)
+  static int32_t nextAge(uint8_t age) { return age < 255 ? age + 1 : 255; }
+
+  // a bad frame breaks the chain, but not an anchored decoder's keyframe
+  uint16_t fail()
+  {
+    if (!m_anchored)
+      m_synced = false;
+    return 0;
+  }
+
+  const Block *find(uint8_t index) const
+  {
+    return m_slot[index] ? &m_ref[m_slot[index] - 1] : NULL;
+  }
+
+  // Becomes the previous frame. m_slot maps a tracking index to its block (+1), so a
+  // lookup is one load; with repeated indices the first one counts.
+  void keep(const Block *blocks, uint8_t n)
+  {
+    uint8_t i;
+
+    for (i = 0; i < m_refCount; i++)
+      m_slot[m_ref[i].m_index] = 0;
+    if (n)
+      memcpy(m_ref, blocks, n*sizeof(Block));
+    m_refCount = n;
+    for (i = n; i > 0; i--)
+      m_slot[m_ref[i - 1].m_index] = i;
+  }
+
+  Block m_ref[PIXY2_CODEC_MAX_BLOCKS];
+  uint8_t m_refCount;
+  uint8_t m_slot[256];
+  bool m_synced;
+  bool m_anchored;
+  uint16_t m_keyInterval;
+  uint16_t m_sinceKey;
+  uint8_t m_scratch[PIXY2_CODEC_MAX_FRAME];
+};
+
+#endif // _PIXY2FRAMECODEC_H
@@ -0,0 +1,294 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Shared CCC frames for several readers.
+// When the steering, arm and telemetry tasks each call getBlocks(), the camera is asked
+// once per reader for what is mostly the same frame. Pixy2FrameService owns the link
+// instead: getFrame(maxAgeMs) hands back the frame it already has if that is recent
+// enough, and only otherwise asks the camera, once, for everyone waiting. Link traffic
+// then follows the frame rate and the tightest maxAgeMs, not the number of readers.
+//
+// A frame's age counts from when the camera last confirmed it: a new frame, or a busy
+// answer saying there is nothing newer yet. getFrame() never returns anything older
+// than maxAgeMs; if the camera can't be asked the reference is empty.
+//
+// Frames are immutable and reference counted in a pool of PIXY2_FRAME_BUFFERS. A
+// Pixy2FrameRef keeps its frame as it was for as long as the reader holds it, while newer
+// frames go to other buffers, so readers never copy blocks or hold a lock while they
+// work. Keep a buffer for each reader that can hold a frame at once plus one for the
+// next fetch; with none free, getFrame() can only serve the current frame.
+//
+//   Pixy2FrameService<Link2UART> frames(&pixy);
+//
+//   steer task:    Pixy2FrameRef f = frames.getFrame(10);
+//                  if (f) for (i = 0; i < f->numBlocks; i++) ... f->blocks[i] ...
+//   telemetry:     Pixy2FrameRef f = frames.getFrame(100);
+//
+// Other requests (line, video, settings) use frames.pixy() between lock() and unlock().
+
+#ifndef _PIXY2FRAMESERVICE_H
+#define _PIXY2FRAMESERVICE_H
+
+#include "TPixy2.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#elif !defined(ARDUINO)
+#include <mutex>
+#endif
+
+#ifndef PIXY2_FRAME_BUFFERS
+#define PIXY2_FRAME_BUFFERS         4
+#endif
+
+// all a CCC response holds
+#define PIXY2_FRAME_BLOCKS          (PIXY_BUFFERSIZE/sizeof(Block))
+#define PIXY2_FRAME_NONE            0xff
+
+struct Pixy2Frame
+{
+  uint32_t seq;          // frames the service has fetched, this one included
+  uint32_t ms;           // millis() when it came from the camera
+  uint8_t numBlocks;
+  Block blocks[PIXY2_FRAME_BLOCKS];
+};
+
+// The buffers and their counts, without the link.
+class Pixy2FramePool
+{
+public:
+  Pixy2FramePool()
+  {
+    memset(m_refs, 0, sizeof(m_refs));
+  }
+
+  const Pixy2Frame &frame(uint8_t i) const { return m_frames[i]; }
+
+  void retain(uint8_t i) { __atomic_add_fetch(&m_refs[i], 1, __ATOMIC_ACQ_REL); }
+  void release(uint8_t i) { __atomic_sub_fetch(&m_refs[i], 1, __ATOMIC_ACQ_REL); }
+
+  // readers holding buffer i, plus one if it is the current frame
+  uint8_t refs(uint8_t i) const { return __atomic_load_n(&m_refs[i], __ATOMIC_ACQUIRE); }
+
+protected:
+  Pixy2Frame m_frames[PIXY2_FRAME_BUFFERS];
+  uint8_t m_refs[PIXY2_FRAME_BUFFERS];
+};
+
+// A reader's hold on a frame; copies share it and the last one lets the buffer go.
+class Pixy2FrameRef
+{
+public:
+  Pixy2FrameRef()
+  {
+    m_pool = NULL;
+    m_index = PIXY2_FRAME_NONE;
+  }
+
+  Pixy2FrameRef(Pixy2FramePool *pool, uint8_t index)
+  {
+    m_pool = pool;
+    m_index = index;
+    m_pool->retain(m_index);
+  }
+
+  Pixy2FrameRef(const Pixy2FrameRef &other)
+  {
+    m_pool = other.m_pool;
+    m_index = other.m_index;
+    if (m_pool)
+      m_pool->retain(m_index);
+  }
+
+  Pixy2FrameRef &operator=(const Pixy2FrameRef &other)
+  {
+    if (other.m_pool)
+      other.m_pool->retain(other.m_index);
+    reset();
+    m_pool = other.m_pool;
+    m_index = other.m_index;
+    return *this;
+  }
+
+  ~Pixy2FrameRef()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    if (m_pool)
+      m_pool->release(m_index);
+    m_pool = NULL;
+    m_index = PIXY2_FRAME_NONE;
+  }
+
+  explicit operator bool() const { return m_pool != NULL; }
+  const Pixy2Frame *operator->() const { return &m_pool->frame(m_index); }
+  const Pixy2Frame &operator*() const { return m_pool->frame(m_index); }
+
+  // ms since the blocks came from the camera
+  uint32_t age() const { return millis() - m_pool->frame(m_index).ms; }
+
+private:
+  Pixy2FramePool *m_pool;
+  uint8_t m_index;
+};
+
+template <class LinkType> class Pixy2FrameService : public Pixy2FramePool
+{
+public:
+  Pixy2FrameService(TPixy2<LinkType> *pixy)
+  {
+    m_pixy = pixy;
+    m_current = PIXY2_FRAME_NONE;
+    m_seq = 0;
+    m_confirmedMs = 0;
+#ifdef ARDUINO_ARCH_ESP32
+    m_mutex = xSemaphoreCreateMutex();
+#endif
+    resetStats();
+  }
+
+  // The current frame if the camera confirmed it at most maxAgeMs ago, else a new one.
+  // Readers asking while a fetch is under way wait for it and share its frame.
+  Pixy2FrameRef getFrame(uint32_t maxAgeMs)
+  {
+    Pixy2FrameRef ref;
+
+    lock();
+    m_requests++;
+    if (m_current == PIXY2_FRAME_NONE || millis() - m_confirmedMs > maxAgeMs)
+      fetch();
+    else
+      m_hits++;
+    if (m_current != PIXY2_FRAME_NONE && millis() - m_confirmedMs <= maxAgeMs)
+      ref = Pixy2FrameRef(this, m_current);
+    unlock();
+    return ref;
+  }
+
+  // For other requests, between lock() and unlock().
+  TPixy2<LinkType> *pixy() { return m_pixy; }
+
+  void lock()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+#elif !defined(ARDUINO)
+    m_mutex.lock();
+#endif
+  }
+
+  void unlock()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    xSemaphoreGive(m_mutex);
+#elif !defined(ARDUINO)
+    m_mutex.unlock();
+#endif
+  }
+
+  void resetStats()
+  {
+    m_requests = m_hits = m_fetches = m_newFrames = m_busy = m_failures = m_starved = 0;
+  }
+
+  // getFrame() calls, and those the current frame served
+  uint32_t requests() const { return m_requests; }
+  uint32_t hits() const { return m_hits; }
+  // getBlocks() calls, the new frames and busy answers they got, and failures
+  uint32_t fetches() const { return m_fetches; }
+  uint32_t newFrames() const { return m_newFrames; }
+  uint32_t busy() const { return m_busy; }
+  uint32_t failures() const { return m_failures; }
+  // fetches skipped as readers held every other buffer
+  uint32_t starved() const { return m_starved; }
+
+  void print()
+  {
+    char buf[192];
+
+    snprintf(buf, sizeof(buf),
+      "frames: %lu requests, %lu from cache, %lu fetches, %lu new, %lu busy, %lu failed, %lu starved",
+      (unsigned long)m_requests, (unsigned long)m_hits, (unsigned long)m_fetches, (unsigned long)m_newFrames,
+      (unsigned long)m_busy, (unsigned long)m_failures, (unsigned long)m_starved);
+    Serial.println(buf);
+  }
+
+private:
+  // Called locked. The new frame goes into a buffer no reader holds, then becomes
+  // current in one step; readers of the old one keep it until they let go.
+  void fetch()
+  {
+    uint8_t i, slot = PIXY2_FRAME_NONE;
+    int8_t res;
+
+    for (i = 0; i < PIXY2_FRAME_BUFFERS && slot == PIXY2_FRAME_NONE; i++)
+      if (refs(i) == 0)
+        slot = i;
+    if (slot == PIXY2_FRAME_NONE)
+    {
+      m_starved++;
+      return;
+    }
+    m_fetches++;
+    res = m_pixy->ccc.getBlocks(false);
+    if (res == PIXY_RESULT_BUSY)
+    {
+      m_busy++;
+      if (m_current != PIXY2_FRAME_NONE)
+        m_confirmedMs = millis();
+      return;
+    }
+    if (res < 0)
+    {
+      m_failures++;
+      return;
+    }
+
+    Pixy2Frame &f = m_frames[slot];
+    f.seq = ++m_seq;
+    f.ms = m_confirmedMs = millis();
+    f.numBlocks = res < (int8_t)PIXY2_FRAME_BLOCKS ? res : PIXY2_FRAME_BLOCKS;
+    memcpy(f.blocks, m_pixy->ccc.blocks, f.numBlocks*sizeof(Block));
+    // the service's own reference
+    retain(slot);
+    if (m_current != PIXY2_FRAME_NONE)
+      release(m_current);
+    m_current = slot;
+    m_newFrames++;
+  }
+
+  TPixy2<LinkType> *m_pixy;
+  uint8_t m_current;
+  uint32_t m_seq;
+  uint32_t m_confirmedMs;
+#ifdef ARDUINO_ARCH_ESP32
+  SemaphoreHandle_t m_mutex;
+#elif !defined(ARDUINO)
+  std::mutex m_mutex;
+#endif
+
+  uint32_t m_requests;
+  uint32_t m_hits;
+  uint32_t m_fetches;
+  uint32_t m_newFrames;
+  uint32_t m_busy;
+  uint32_t m_failures;
+  uint32_t m_starved;
+};
+
+#endif // _PIXY2FRAMESERVICE_H
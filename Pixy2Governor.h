@@ -0,0 +1,268 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// CPU frequency governor driven by per-frame work.
+// Bracket the application's handling of each frame with workBegin()/workEnd(). The
+// governor converts the measured time to cycles and picks the lowest of 80, 160 and
+// 240 MHz that would still finish the worst recent frame within the budget (a share of
+// the frame period, measured from workBegin() to workBegin() unless set). Going up is
+// immediate on a miss or when the current level gets tight; going down waits for a run
+// of frames that would have fit comfortably at the lower level.
+//
+// With CONFIG_PM_ENABLE the level is the DFS maximum and the governor holds an
+// ESP_PM_CPU_FREQ_MAX lock only between workBegin() and workEnd(), so the clock also
+// drops to the minimum between frames. Without it, setCpuFrequencyMhz() is used. Off
+// the ESP32 nothing is switched, but the levels and counters still run, for modelling.
+//
+// The governor is the clock's only owner: anything else that wants it lowered between
+// frames (Pixy2PowerMode's PIXY2_POWER_SLOW) asks through idleBegin()/idleEnd(), so the
+// two never undo each other's setting.
+
+#ifndef _PIXY2GOVERNOR_H
+#define _PIXY2GOVERNOR_H
+
+#include "TPixy2.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "sdkconfig.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+#endif
+
+#define PIXY2_GOV_LEVELS        3
+
+// share of the frame period the application's work may use
+#ifndef PIXY2_GOV_BUDGET_PCT
+#define PIXY2_GOV_BUDGET_PCT    80
+#endif
+// go up when the worst frame uses more than this much of the budget
+#ifndef PIXY2_GOV_UP_PCT
+#define PIXY2_GOV_UP_PCT        90
+#endif
+// go down when the worst frame would use less than this at the lower level...
+#ifndef PIXY2_GOV_DOWN_PCT
+#define PIXY2_GOV_DOWN_PCT      70
+#endif
+// ...for this many frames in a row
+#ifndef PIXY2_GOV_DOWN_FRAMES
+#define PIXY2_GOV_DOWN_FRAMES   30
+#endif
+
+static const uint16_t PIXY2_GOV_MHZ[PIXY2_GOV_LEVELS] = { 80, 160, 240 };
+
+class Pixy2Governor
+{
+public:
+  // budgetUs: time the work may take per frame; 0 derives it from the frame period
+  Pixy2Governor(uint32_t budgetUs = 0)
+  {
+    m_budget = budgetUs;
+    m_level = m_prev = PIXY2_GOV_LEVELS - 1;
+    m_idle = false;
+    m_period = 0;
+    m_lastBegin = 0;
+    m_peak = 0;
+    m_calm = 0;
+#if defined(ARDUINO_ARCH_ESP32) && CONFIG_PM_ENABLE
+    m_lock = NULL;
+    m_pmLevel = PIXY2_GOV_LEVELS;
+#endif
+    resetStats();
+  }
+
+  // Call once from setup(). Returns false if the power management setup failed.
+  bool begin()
+  {
+#if defined(ARDUINO_ARCH_ESP32) && CONFIG_PM_ENABLE
+    if (m_lock == NULL && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "pixy2gov", &m_lock) != ESP_OK)
+      return false;
+#endif
+    return apply();
+  }
+
+  void setBudget(uint32_t budgetUs) { m_budget = budgetUs; }
+
+  // The lowest level from now until idleEnd(), for a gap with no work in it; the level
+  // the work needs is kept and comes back at idleEnd(). Time idle counts at the lowest.
+  bool idleBegin()
+  {
+    m_idle = true;
+    return apply();
+  }
+
+  bool idleEnd()
+  {
+    m_idle = false;
+    return apply();
+  }
+
+  void workBegin()
+  {
+    uint32_t now = micros();
+
+    if (m_lastBegin)
+    {
+      // a frame period; ignore stalls
+      if (m_period == 0)
+        m_period = now - m_lastBegin;
+      else if (now - m_lastBegin < 4*m_period)
+        m_period = (m_period*7 + (now - m_lastBegin))/8;
+    }
+    m_lastBegin = now;
+#if defined(ARDUINO_ARCH_ESP32) && CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(m_lock);
+#endif
+    m_workStart = micros();
+  }
+
+  void workEnd()
+  {
+    uint32_t now = micros(), us = now - m_workStart, budget = budgetUs();
+    uint64_t cycles;
+    uint8_t lower;
+
+#if defined(ARDUINO_ARCH_ESP32) && CONFIG_PM_ENABLE
+    esp_pm_lock_release(m_lock);
+#endif
+    m_frames++;
+    if (budget == 0)
+      return; // no period yet
+    if (us > budget)
+      m_misses++;
+
+    cycles = (uint64_t)us*PIXY2_GOV_MHZ[m_level];
+    // the peak decays (half-life ~45 frames) so a slow frame long ago doesn't pin the
+    // level, but periodic spikes keep it up
+    m_peak = cycles > m_peak ? cycles : m_peak - m_peak/64;
+
+    if (m_level < PIXY2_GOV_LEVELS - 1 && m_peak > (uint64_t)budget*PIXY2_GOV_MHZ[m_level]*PIXY2_GOV_UP_PCT/100)
+    {
+      // as many levels as it takes at once
+      while (m_level < PIXY2_GOV_LEVELS - 1 && m_peak > (uint64_t)budget*PIXY2_GOV_MHZ[m_level]*PIXY2_GOV_UP_PCT/100)
+        m_level++;
+      m_calm = 0;
+      m_switches++;
+      apply();
+      return;
+    }
+    if (m_level > 0)
+    {
+      lower = m_level - 1;
+      if (m_peak < (uint64_t)budget*PIXY2_GOV_MHZ[lower]*PIXY2_GOV_DOWN_PCT/100)
+      {
+        if (++m_calm >= PIXY2_GOV_DOWN_FRAMES)
+        {
+          m_level = lower;
+          m_calm = 0;
+          m_switches++;
+          apply();
+        }
+      }
+      else
+        m_calm = 0;
+    }
+  }
+
+  uint16_t mhz() const { return PIXY2_GOV_MHZ[m_level]; }
+  uint8_t level() const { return m_level; }
+  uint32_t budgetUs() const { return m_budget ? m_budget : m_period*PIXY2_GOV_BUDGET_PCT/100; }
+
+  // frames whose work overran the budget, and level changes
+  uint32_t misses() const { return m_misses; }
+  uint32_t switches() const { return m_switches; }
+  uint32_t frames() const { return m_frames; }
+  // time spent at a level since resetStats(), current stretch and idle included
+  uint64_t timeUs(uint8_t level) const
+  {
+    if (level >= PIXY2_GOV_LEVELS)
+      return 0;
+    return m_time[level] + (level == m_prev ? (uint32_t)(micros() - m_since) : 0);
+  }
+
+  void resetStats()
+  {
+    memset(m_time, 0, sizeof(m_time));
+    m_misses = m_switches = m_frames = 0;
+    m_since = micros();
+  }
+
+  void print()
+  {
+    char buf[160];
+    uint64_t total = timeUs(0) + timeUs(1) + timeUs(2);
+
+    if (total == 0)
+      total = 1;
+    snprintf(buf, sizeof(buf), "%d MHz, budget %lu us: 80 MHz %d%% 160 MHz %d%% 240 MHz %d%%, %lu misses in %lu frames",
+      mhz(), (unsigned long)budgetUs(), (int)(timeUs(0)*100/total), (int)(timeUs(1)*100/total),
+      (int)(timeUs(2)*100/total), (unsigned long)m_misses, (unsigned long)m_frames);
+    Serial.println(buf);
+  }
+
+private:
+  bool apply()
+  {
+    uint32_t now = micros();
+    uint8_t level = m_idle ? 0 : m_level;
+    bool ok = true;
+
+    m_time[m_prev] += now - m_since;
+    m_since = now;
+    m_prev = level;
+
+#ifdef ARDUINO_ARCH_ESP32
+#if CONFIG_PM_ENABLE
+    // idle needs nothing: the lock is only held for work, so DFS is at the minimum
+    if (m_pmLevel != m_level)
+    {
+      esp_pm_config_t cfg;
+
+      cfg.max_freq_mhz = PIXY2_GOV_MHZ[m_level];
+      cfg.min_freq_mhz = PIXY2_GOV_MHZ[0];
+      cfg.light_sleep_enable = false;
+      ok = esp_pm_configure(&cfg) == ESP_OK;
+      if (ok)
+        m_pmLevel = m_level;
+    }
+#else
+    ok = setCpuFrequencyMhz(PIXY2_GOV_MHZ[level]);
+#endif
+#endif
+    return ok;
+  }
+
+  uint32_t m_budget;
+  uint32_t m_period;       // smoothed workBegin() to workBegin()
+  uint32_t m_lastBegin;
+  uint32_t m_workStart;
+  uint64_t m_peak;         // decaying worst-case cycles per frame
+  uint8_t m_level;
+  uint8_t m_prev;          // level the time since m_since belongs to
+  bool m_idle;             // between idleBegin() and idleEnd()
+  uint16_t m_calm;
+
+  uint64_t m_time[PIXY2_GOV_LEVELS];
+  uint32_t m_since;
+  uint32_t m_misses;
+  uint32_t m_switches;
+  uint32_t m_frames;
+
+#if defined(ARDUINO_ARCH_ESP32) && CONFIG_PM_ENABLE
+  esp_pm_lock_handle_t m_lock;
+  uint8_t m_pmLevel;       // level the DFS maximum is set to
+#endif
+};
+
+#endif // _PIXY2GOVERNOR_H
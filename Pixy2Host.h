@@ -0,0 +1,85 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Arduino stand-ins for Linux hosts.
+// TPixy2 and its program classes use millis(), delayMicroseconds() and Serial.print();
+// include this before TPixy2.h (the Linux link headers do) and the same code runs on a
+// single-board computer. Nothing here is compiled on Arduino targets.
+
+#ifndef _PIXY2HOST_H
+#define _PIXY2HOST_H
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 32-bit wrap-around like the Arduino counters, so millis()-t0 arithmetic behaves the same.
+inline uint32_t micros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000);
+}
+
+inline uint32_t millis()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+inline void delayMicroseconds(uint32_t us)
+{
+  // short delays are spun; the scheduler can't sleep for less than ~50us reliably
+  if (us < 100)
+  {
+    uint32_t t0 = micros();
+    while (micros() - t0 < us);
+    return;
+  }
+  struct timespec ts = { (time_t)(us/1000000), (long)(us%1000000)*1000 };
+  nanosleep(&ts, NULL);
+}
+
+inline void delay(uint32_t ms)
+{
+  delayMicroseconds(ms*1000);
+}
+
+// Serial.print() onto stdout, for Version::print() and Block::print().
+class Pixy2HostSerial
+{
+public:
+  void begin(uint32_t) { }
+  void print(const char *s) { fputs(s, stdout); }
+  void print(char c) { fputc(c, stdout); }
+  void print(long v) { printf("%ld", v); }
+  void print(unsigned long v) { printf("%lu", v); }
+  void print(int v) { print((long)v); }
+  void print(unsigned v) { print((unsigned long)v); }
+  void print(double v, int digits = 2) { printf("%.*f", digits, v); }
+  template <typename T> void println(T v) { print(v); println(); }
+  void println() { fputs("\n", stdout); }
+  size_t write(const uint8_t *buf, size_t len) { return fwrite(buf, 1, len, stdout); }
+};
+
+inline Pixy2HostSerial Serial;
+
+#endif // ARDUINO
+
+#endif // _PIXY2HOST_H
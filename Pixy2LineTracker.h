@@ -0,0 +1,345 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Line tracking feature graph.
+// Keeps the vectors and intersections from line.getMainFeatures()/getAllFeatures() across
+// frames. Vectors are matched by the tracking index Pixy2 gives them, so a frame only
+// touches what moved: derived geometry is recomputed for changed vectors, vanished ones
+// are dropped, and the steering target is re-chosen only when the vector being followed
+// goes away. Intersections have no index; they are matched by position and branch
+// count, and link to their vectors through the branch indices.
+// With only a few vectors nearly all of them move every frame, so comparing each with
+// its last copy costs more than it saves: below LINE_TRACKER_REBUILD_BELOW the vectors
+// are laid out again from scratch, keeping their birth frames and the followed vector.
+
+#ifndef _PIXY2LINETRACKER_H
+#define _PIXY2LINETRACKER_H
+
+#include "TPixy2.h"
+
+// slots are tracked in bitmaps, 32 bits for vectors and 16 for intersections
+#ifndef LINE_TRACKER_MAX_VECTORS
+#define LINE_TRACKER_MAX_VECTORS         32
+#endif
+#ifndef LINE_TRACKER_MAX_INTERSECTIONS
+#define LINE_TRACKER_MAX_INTERSECTIONS   8
+#endif
+static_assert(LINE_TRACKER_MAX_VECTORS <= 32, "LINE_TRACKER_MAX_VECTORS is over the 32-bit slot bitmap");
+static_assert(LINE_TRACKER_MAX_INTERSECTIONS <= 16, "LINE_TRACKER_MAX_INTERSECTIONS is over the 16-bit slot bitmap");
+// vector count under which apply() rebuilds the vector slots instead of matching them
+#ifndef LINE_TRACKER_REBUILD_BELOW
+#define LINE_TRACKER_REBUILD_BELOW       8
+#endif
+// how far (line grid units) an intersection may move between frames and still match
+#define LINE_TRACKER_INTERSECTION_SLACK  3
+
+#define LINE_TRACKER_NONE                0xff
+
+struct LineTrackVector
+{
+  Vector m_vec;
+  int8_t m_dx;          // head minus tail
+  int8_t m_dy;
+  uint16_t m_len2;      // squared length
+  uint32_t m_seen;      // frame it was last reported in
+  uint32_t m_born;      // frame it first appeared in
+};
+
+struct LineTrackIntersection
+{
+  Intersection m_int;
+  uint32_t m_seen;
+};
+
+template <class LinkType> class Pixy2LineTracker
+{
+public:
+  Pixy2LineTracker(TPixy2<LinkType> *pixy)
+  {
+    m_pixy = pixy;
+    reset();
+  }
+
+  void reset()
+  {
+    memset(m_slotOf, LINE_TRACKER_NONE, sizeof(m_slotOf));
+    m_vecLive = 0;
+    m_intLive = 0;
+    m_frame = 0;
+    m_target = LINE_TRACKER_NONE;
+    m_steer = 0;
+    m_added = m_changed = m_removed = 0;
+  }
+
+  // Fetch main (or all) features and apply them. Returns what getFeatures returned.
+  int8_t update(bool all = false, bool wait = true)
+  {
+    Pixy2Line<LinkType> &line = m_pixy->line;
+    int8_t res;
+
+    res = all ? line.getAllFeatures(LINE_VECTOR | LINE_INTERSECTION, wait) :
+      line.getMainFeatures(LINE_VECTOR | LINE_INTERSECTION, wait);
+    if (res < 0)
+      return res;
+    apply(line.vectors, line.numVectors, line.intersections, line.numIntersections);
+    return res;
+  }
+
+  // Apply one frame of features. Works without a camera, e.g. on recorded frames.
+  void apply(const Vector *vectors, uint8_t numVectors, const Intersection *intersections, uint8_t numIntersections)
+  {
+    uint8_t i;
+
+    m_frame++;
+    m_added = m_changed = m_removed = 0;
+
+    if (numVectors < LINE_TRACKER_REBUILD_BELOW)
+      rebuildVectors(vectors, numVectors);
+    else
+    {
+      for (i = 0; i < numVectors; i++)
+        applyVector(vectors[i]);
+    }
+    for (i = 0; i < numIntersections; i++)
+      applyIntersection(intersections[i]);
+
+    expire();
+
+    if (m_target == LINE_TRACKER_NONE)
+      chooseTarget();
+    if (m_target != LINE_TRACKER_NONE)
+      m_steer = (int16_t)m_vecs[m_target].m_vec.m_x1 - (int16_t)(m_pixy->frameWidth/2);
+    else
+      m_steer = 0;
+  }
+
+  // Horizontal offset of the followed vector's head from the frame centre; 0 with none.
+  int16_t steer() const { return m_steer; }
+  // Vector being followed, or NULL.
+  const LineTrackVector *target() const { return m_target == LINE_TRACKER_NONE ? NULL : &m_vecs[m_target]; }
+  // Follow a particular vector (by Pixy index) instead of the automatic choice.
+  bool setTarget(uint8_t index)
+  {
+    if (m_slotOf[index] == LINE_TRACKER_NONE)
+      return false;
+    m_target = m_slotOf[index];
+    return true;
+  }
+
+  // Vector by Pixy index, or NULL if it isn't in the graph.
+  const LineTrackVector *vector(uint8_t index) const
+  {
+    return m_slotOf[index] == LINE_TRACKER_NONE ? NULL : &m_vecs[m_slotOf[index]];
+  }
+
+  // Vector on branch b of an intersection, or NULL if that vector is gone.
+  const LineTrackVector *branch(const LineTrackIntersection &in, uint8_t b) const
+  {
+    return b < in.m_int.m_n ? vector(in.m_int.m_intLines[b].m_index) : NULL;
+  }
+
+  // Iterate live entries: slot numbers 0..MAX-1, skip the ones that return NULL.
+  const LineTrackVector *vectorSlot(uint8_t slot) const { return m_vecLive & ((uint32_t)1 << slot) ? &m_vecs[slot] : NULL; }
+  const LineTrackIntersection *intersectionSlot(uint8_t slot) const { return m_intLive & (1U << slot) ? &m_ints[slot] : NULL; }
+
+  uint32_t frame() const { return m_frame; }
+  // what the last frame did to the graph
+  uint8_t added() const { return m_added; }
+  uint8_t changed() const { return m_changed; }
+  uint8_t removed() const { return m_removed; }
+
+private:
+  void applyVector(const Vector &v)
+  {
+    uint8_t slot = m_slotOf[v.m_index];
+    LineTrackVector *tv;
+
+    if (slot == LINE_TRACKER_NONE)
+    {
+      slot = freeSlot(m_vecLive, LINE_TRACKER_MAX_VECTORS);
+      if (slot == LINE_TRACKER_NONE)
+        return;
+      m_vecLive |= (uint32_t)1 << slot;
+      m_slotOf[v.m_index] = slot;
+      tv = &m_vecs[slot];
+      tv->m_born = m_frame;
+      tv->m_vec.m_index = v.m_index;
+      m_added++;
+    }
+    else
+    {
+      tv = &m_vecs[slot];
+      // geometry and flags unchanged: nothing to recompute
+      if (!memcmp(&tv->m_vec, &v, sizeof(Vector)))
+      {
+        tv->m_seen = m_frame;
+        return;
+      }
+      m_changed++;
+    }
+    tv->m_vec = v;
+    tv->m_dx = (int8_t)(v.m_x1 - v.m_x0);
+    tv->m_dy = (int8_t)(v.m_y1 - v.m_y0);
+    tv->m_len2 = tv->m_dx*tv->m_dx + tv->m_dy*tv->m_dy;
+    tv->m_seen = m_frame;
+  }
+
+  // Lay the frame's vectors out in slots 0..n-1. Vectors still there keep their birth
+  // frame and count as changed without a compare; the followed one stays followed.
+  void rebuildVectors(const Vector *vectors, uint8_t n)
+  {
+    uint32_t born[LINE_TRACKER_REBUILD_BELOW], live;
+    uint8_t i, slot, follow;
+    LineTrackVector *tv;
+
+    follow = m_target == LINE_TRACKER_NONE ? LINE_TRACKER_NONE : m_vecs[m_target].m_vec.m_index;
+    for (i = 0; i < n; i++)
+    {
+      slot = m_slotOf[vectors[i].m_index];
+      if (slot == LINE_TRACKER_NONE)
+      {
+        born[i] = m_frame;
+        m_added++;
+      }
+      else
+      {
+        born[i] = m_vecs[slot].m_born;
+        m_changed++;
+      }
+    }
+    m_removed += __builtin_popcount(m_vecLive) - m_changed;
+    for (live = m_vecLive; live; live &= live - 1)
+      m_slotOf[m_vecs[__builtin_ctz(live)].m_vec.m_index] = LINE_TRACKER_NONE;
+
+    for (i = 0; i < n; i++)
+    {
+      const Vector &v = vectors[i];
+      tv = &m_vecs[i];
+      tv->m_vec = v;
+      tv->m_dx = (int8_t)(v.m_x1 - v.m_x0);
+      tv->m_dy = (int8_t)(v.m_y1 - v.m_y0);
+      tv->m_len2 = tv->m_dx*tv->m_dx + tv->m_dy*tv->m_dy;
+      tv->m_seen = m_frame;
+      tv->m_born = born[i];
+      m_slotOf[v.m_index] = i;
+    }
+    m_vecLive = ((uint32_t)1 << n) - 1;
+    m_target = follow == LINE_TRACKER_NONE ? LINE_TRACKER_NONE : m_slotOf[follow];
+  }
+
+  void applyIntersection(const Intersection &in)
+  {
+    uint8_t slot, best = LINE_TRACKER_NONE;
+    int8_t dx, dy;
+
+    for (slot = 0; slot < LINE_TRACKER_MAX_INTERSECTIONS; slot++)
+    {
+      if (!(m_intLive & (1U << slot)) || m_ints[slot].m_seen == m_frame || m_ints[slot].m_int.m_n != in.m_n)
+        continue;
+      dx = m_ints[slot].m_int.m_x - in.m_x;
+      dy = m_ints[slot].m_int.m_y - in.m_y;
+      if (dx >= -LINE_TRACKER_INTERSECTION_SLACK && dx <= LINE_TRACKER_INTERSECTION_SLACK &&
+        dy >= -LINE_TRACKER_INTERSECTION_SLACK && dy <= LINE_TRACKER_INTERSECTION_SLACK)
+      {
+        best = slot;
+        break;
+      }
+    }
+    if (best == LINE_TRACKER_NONE)
+    {
+      best = freeSlot(m_intLive, LINE_TRACKER_MAX_INTERSECTIONS);
+      if (best == LINE_TRACKER_NONE)
+        return;
+      m_intLive |= 1U << best;
+      m_added++;
+    }
+    else if (memcmp(&m_ints[best].m_int, &in, sizeof(Intersection)))
+      m_changed++;
+    m_ints[best].m_int = in;
+    m_ints[best].m_seen = m_frame;
+  }
+
+  // Drop whatever wasn't reported this frame; only live slots are visited.
+  void expire()
+  {
+    uint32_t live;
+    uint8_t slot;
+
+    for (live = m_vecLive; live; live &= live - 1)
+    {
+      slot = __builtin_ctz(live);
+      if (m_vecs[slot].m_seen == m_frame)
+        continue;
+      m_slotOf[m_vecs[slot].m_vec.m_index] = LINE_TRACKER_NONE;
+      m_vecLive &= ~((uint32_t)1 << slot);
+      if (m_target == slot)
+        m_target = LINE_TRACKER_NONE;
+      m_removed++;
+    }
+    for (live = m_intLive; live; live &= live - 1)
+    {
+      slot = __builtin_ctz(live);
+      if (m_ints[slot].m_seen == m_frame)
+        continue;
+      m_intLive &= ~(1U << slot);
+      m_removed++;
+    }
+  }
+
+  // Follow the vector whose tail is nearest the bottom of the frame, then the longest.
+  void chooseTarget()
+  {
+    uint32_t live;
+    uint8_t slot;
+    int32_t score, best = -1;
+
+    for (live = m_vecLive; live; live &= live - 1)
+    {
+      slot = __builtin_ctz(live);
+      if (m_vecs[slot].m_vec.m_flags & LINE_FLAG_INVALID)
+        continue;
+      score = ((int32_t)m_vecs[slot].m_vec.m_y0 << 16) + m_vecs[slot].m_len2;
+      if (score > best)
+      {
+        best = score;
+        m_target = slot;
+      }
+    }
+  }
+
+  static uint8_t freeSlot(uint32_t live, uint8_t max)
+  {
+    if (live == 0xffffffff)
+      return LINE_TRACKER_NONE;
+    uint8_t slot = __builtin_ctz(~live);
+    return slot < max ? slot : LINE_TRACKER_NONE;
+  }
+
+  TPixy2<LinkType> *m_pixy;
+
+  LineTrackVector m_vecs[LINE_TRACKER_MAX_VECTORS];
+  LineTrackIntersection m_ints[LINE_TRACKER_MAX_INTERSECTIONS];
+  uint32_t m_vecLive;          // bitmap of used m_vecs slots
+  uint16_t m_intLive;          // bitmap of used m_ints slots
+  uint8_t m_slotOf[256];       // Pixy vector index -> slot
+
+  uint32_t m_frame;
+  uint8_t m_target;
+  int16_t m_steer;
+  uint8_t m_added;
+  uint8_t m_changed;
+  uint8_t m_removed;
+};
+
+#endif // _PIXY2LINETRACKER_H
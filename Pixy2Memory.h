@@ -0,0 +1,277 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Memory budget report.
+// Register each component with what it holds: the object itself (its buffers are
+// members, so sizeof covers them), heap it allocates, and FreeRTOS task stacks, whose
+// least free space so far is read when the report is made. print() lists them all with
+// the heap's free, minimum free and largest block, and marks anything over its budget;
+// overBudget() says the same to code.
+//
+// Budgets are bytes per component, PIXY2_BUDGET_* below; define them before including
+// this to change them. For a stack the budget is the free space it must keep.
+// PIXY2_MEMORY_BUDGET(type, limit) checks a type at compile time; host/pixy_bench checks
+// every component in the tree that way, so one that outgrows its budget breaks the host
+// build.
+//
+//   Pixy2MemoryReport mem;
+//   mem.addPixy("pixy", pixy);
+//   mem.add("blackbox", box, PIXY2_BUDGET_BLACKBOX);
+//   mem.addHeap("uart rx", PIXY2_UART_RX_BUFSIZE);
+//   mem.addTask("loop", xTaskGetCurrentTaskHandle(), 8192, 1024);
+//   mem.addTask("blackbox", box.task(), PIXY2_BLACKBOX_TASK_STACK, 512);
+//   mem.addBuzzer();
+//   mem.setHeapFloor(20000);
+//   ...
+//   mem.print();
+
+#ifndef _PIXY2MEMORY_H
+#define _PIXY2MEMORY_H
+
+#include "TPixy2.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ZumoBuzzer.cpp's state, when it is linked in
+extern uint32_t zumoBuzzerMemory() __attribute__((weak));
+#endif
+
+#ifndef PIXY2_MEMORY_ITEMS
+#define PIXY2_MEMORY_ITEMS          24
+#endif
+
+// TPixy2 with its link, and the link buffer it allocates
+#ifndef PIXY2_BUDGET_PIXY
+#define PIXY2_BUDGET_PIXY           1024
+#endif
+// ZumoBuzzer.cpp checks its state against this at compile time and repeats the default
+#ifndef PIXY2_BUDGET_BUZZER
+#define PIXY2_BUDGET_BUZZER         128
+#endif
+#ifndef PIXY2_BUDGET_LINE_TRACKER
+#define PIXY2_BUDGET_LINE_TRACKER   1280
+#endif
+#ifndef PIXY2_BUDGET_SCHEDULER
+#define PIXY2_BUDGET_SCHEDULER      512
+#endif
+#ifndef PIXY2_BUDGET_STEREO
+#define PIXY2_BUDGET_STEREO         4096
+#endif
+#ifndef PIXY2_BUDGET_BLACKBOX
+#define PIXY2_BUDGET_BLACKBOX       6144
+#endif
+#ifndef PIXY2_BUDGET_CODEC
+#define PIXY2_BUDGET_CODEC          1536
+#endif
+#ifndef PIXY2_BUDGET_NODE_TX
+#define PIXY2_BUDGET_NODE_TX        2048
+#endif
+#ifndef PIXY2_BUDGET_NODE_PARSER
+#define PIXY2_BUDGET_NODE_PARSER    1024
+#endif
+#ifndef PIXY2_BUDGET_CLOCK_SYNC
+#define PIXY2_BUDGET_CLOCK_SYNC     512
+#endif
+#ifndef PIXY2_BUDGET_FRAME_SERVICE
+#define PIXY2_BUDGET_FRAME_SERVICE  1536
+#endif
+// governor, power mode, fast boot, auto exposure, RGB sampler, frame clock
+#ifndef PIXY2_BUDGET_SMALL
+#define PIXY2_BUDGET_SMALL          128
+#endif
+
+#define PIXY2_MEMORY_BUDGET(type, limit) \
+  static_assert(sizeof(type) <= (limit), #type " is over its memory budget")
+
+#define PIXY2_MEMORY_STATIC         0
+#define PIXY2_MEMORY_HEAP           1
+#define PIXY2_MEMORY_STACK          2
+
+struct Pixy2MemoryItem
+{
+  const char *name;
+  uint8_t kind;
+  uint32_t bytes;        // stack: its size
+  uint32_t budget;       // 0 for none; stack: free bytes it must keep
+#ifdef ARDUINO_ARCH_ESP32
+  TaskHandle_t task;
+#endif
+};
+
+class Pixy2MemoryReport
+{
+public:
+  Pixy2MemoryReport()
+  {
+    m_count = 0;
+    m_heapFloor = 0;
+  }
+
+  // An object: sizeof covers its member buffers.
+  template <class T> bool add(const char *name, const T &, uint32_t budget = 0)
+  {
+    return add(name, PIXY2_MEMORY_STATIC, sizeof(T), budget);
+  }
+
+  bool addStatic(const char *name, uint32_t bytes, uint32_t budget = 0)
+  {
+    return add(name, PIXY2_MEMORY_STATIC, bytes, budget);
+  }
+
+  // Heap a component takes for good, e.g. a driver's buffer.
+  bool addHeap(const char *name, uint32_t bytes, uint32_t budget = 0)
+  {
+    return add(name, PIXY2_MEMORY_HEAP, bytes, budget);
+  }
+
+  // TPixy2 and its link buffer; the CCC blocks live in that buffer.
+  template <class LinkType> bool addPixy(const char *name, const TPixy2<LinkType> &pixy)
+  {
+    return add(name, pixy, PIXY2_BUDGET_PIXY - PIXY_BUFFERSIZE) &&
+      addHeap(name, PIXY_BUFFERSIZE, PIXY_BUFFERSIZE);
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // A task's stack; its least free space is read in each report.
+  bool addTask(const char *name, TaskHandle_t task, uint32_t stackBytes, uint32_t minFree)
+  {
+    if (task == NULL || !add(name, PIXY2_MEMORY_STACK, stackBytes, minFree))
+      return false;
+    m_items[m_count - 1].task = task;
+    return true;
+  }
+
+  bool addBuzzer()
+  {
+    return zumoBuzzerMemory && addStatic("buzzer", zumoBuzzerMemory(), PIXY2_BUDGET_BUZZER);
+  }
+#endif
+
+  // Over budget if the heap's free space has ever dropped below bytes.
+  void setHeapFloor(uint32_t bytes)
+  {
+    m_heapFloor = bytes;
+  }
+
+  uint8_t count() const { return m_count; }
+  const Pixy2MemoryItem &item(uint8_t i) const { return m_items[i]; }
+
+  // Bytes a stack has never used; 0 off the ESP32 or for other kinds.
+  uint32_t stackFree(uint8_t i) const
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    // in bytes on ESP-IDF
+    if (m_items[i].kind == PIXY2_MEMORY_STACK)
+      return uxTaskGetStackHighWaterMark(m_items[i].task);
+#else
+    (void)i;
+#endif
+    return 0;
+  }
+
+  bool over(uint8_t i) const
+  {
+    const Pixy2MemoryItem &it = m_items[i];
+
+    if (it.budget == 0)
+      return false;
+    return it.kind == PIXY2_MEMORY_STACK ? stackFree(i) < it.budget : it.bytes > it.budget;
+  }
+
+  // Components over budget, and the heap if it went under its floor.
+  uint8_t overBudget() const
+  {
+    uint8_t i, n = 0;
+
+    for (i = 0; i < m_count; i++)
+      if (over(i))
+        n++;
+#ifdef ARDUINO_ARCH_ESP32
+    if (m_heapFloor && esp_get_minimum_free_heap_size() < m_heapFloor)
+      n++;
+#endif
+    return n;
+  }
+
+  // static and heap bytes of everything registered
+  uint32_t total(uint8_t kind) const
+  {
+    uint32_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < m_count; i++)
+      if (m_items[i].kind == kind)
+        sum += m_items[i].bytes;
+    return sum;
+  }
+
+  void print()
+  {
+    static const char *kinds[] = { "static", "heap", "stack" };
+    char buf[160];
+    uint8_t i;
+
+    for (i = 0; i < m_count; i++)
+    {
+      const Pixy2MemoryItem &it = m_items[i];
+      if (it.kind == PIXY2_MEMORY_STACK)
+        snprintf(buf, sizeof(buf), "%-12s stack  %6lu bytes, %lu never used (keep %lu)%s", it.name, (unsigned long)it.bytes,
+          (unsigned long)stackFree(i), (unsigned long)it.budget, over(i) ? " OVER" : "");
+      else if (it.budget)
+        snprintf(buf, sizeof(buf), "%-12s %-6s %6lu bytes (budget %lu)%s", it.name, kinds[it.kind], (unsigned long)it.bytes,
+          (unsigned long)it.budget, over(i) ? " OVER" : "");
+      else
+        snprintf(buf, sizeof(buf), "%-12s %-6s %6lu bytes", it.name, kinds[it.kind], (unsigned long)it.bytes);
+      Serial.println(buf);
+    }
+    snprintf(buf, sizeof(buf), "total        static %6lu bytes, heap %lu bytes", (unsigned long)total(PIXY2_MEMORY_STATIC),
+      (unsigned long)total(PIXY2_MEMORY_HEAP));
+    Serial.println(buf);
+#ifdef ARDUINO_ARCH_ESP32
+    snprintf(buf, sizeof(buf), "heap         %lu free, %lu at least (floor %lu), largest block %lu%s",
+      (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size(),
+      (unsigned long)m_heapFloor, (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+      m_heapFloor && esp_get_minimum_free_heap_size() < m_heapFloor ? " OVER" : "");
+    Serial.println(buf);
+#endif
+  }
+
+private:
+  bool add(const char *name, uint8_t kind, uint32_t bytes, uint32_t budget)
+  {
+    Pixy2MemoryItem *it;
+
+    if (m_count >= PIXY2_MEMORY_ITEMS)
+      return false;
+    it = &m_items[m_count++];
+    it->name = name;
+    it->kind = kind;
+    it->bytes = bytes;
+    it->budget = budget;
+#ifdef ARDUINO_ARCH_ESP32
+    it->task = NULL;
+#endif
+    return true;
+  }
+
+  Pixy2MemoryItem m_items[PIXY2_MEMORY_ITEMS];
+  uint8_t m_count;
+  uint32_t m_heapFloor;
+};
+
+#endif // _PIXY2MEMORY_H
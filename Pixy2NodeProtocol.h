@@ -0,0 +1,430 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Node-to-host detection protocol.
+// A node (ESP32 + Pixy2) sends one packet per frame over UART/RS-485; the host
+// collector merges packets from many nodes. Everything is little-endian:
+//
+//   0  sync        0xc1b0 (b0 c1 on the wire)
+//   2  type        PIXY2_NODE_TYPE_*
+//   3  node        node ID
+//   4  seq         16-bit, +1 per packet; gaps are drops
+//   6  timestamp   32-bit node clock, us (micros() or a Pixy2FrameClock estimate)
+//   10 numBlocks
+//   11 reserved
+//   12 blocks      numBlocks x 8 bytes, see below
+//   .. crc         CRC-16/CCITT over everything from sync to the last block
+//
+// With Pixy2NodeTx::setDelta() a node sends DELTA packets instead where they come out
+// smaller: bytes 10-11 are a payload length, and the payload the low byte of the seq of
+// the node's last BLOCKS packet followed by an anchored Pixy2FrameCodec frame against
+// that packet. Every BLOCKS packet is a keyframe (its blocks as unpacked are the
+// reference), sent every keyInterval frames and whenever delta coding doesn't pay. A
+// receiver decodes with an anchored Pixy2FrameCodec per node and takes the blocks of
+// each BLOCKS packet with setReference(). A lost DELTA packet costs only itself; DELTA
+// packets whose BLOCKS packet was lost don't match its seq and are dropped until the
+// next one. DELTA blocks carry the angle and the full age.
+//
+// Clock sync uses the same framing. The host sends SYNC_REQ (node ID, or 0xff for any)
+// stamped with its own clock and no blocks; the node answers SYNC_RESP stamped with its
+// clock as it sends, and one 8-byte slot holding the request's timestamp and the node
+// time it arrived. The four times go into a Pixy2ClockSync on the host. Sync packets
+// don't use up sequence numbers.
+//
+// A packed block is a 16-bit signature followed by 48 bits: x (9), y (8), width (9),
+// height (8), tracking index (8), age (6, saturating). The colour code angle is not
+// sent. That is 8 bytes against 14 for a Block, and 20 bytes for a typical two-block
+// frame against ~100 of Serial.print text.
+
+#ifndef _PIXY2NODEPROTOCOL_H
+#define _PIXY2NODEPROTOCOL_H
+
+#include "TPixy2.h"
+#include "Pixy2FrameCodec.h"
+
+#define PIXY2_NODE_SYNC             0xc1b0
+#define PIXY2_NODE_TYPE_BLOCKS      0x01
+#define PIXY2_NODE_TYPE_SYNC_REQ    0x02
+#define PIXY2_NODE_TYPE_SYNC_RESP   0x03
+#define PIXY2_NODE_TYPE_DELTA       0x04
+#define PIXY2_NODE_ANY              0xff
+#define PIXY2_NODE_HEADER_SIZE      12
+#define PIXY2_NODE_BLOCK_SIZE       8
+#define PIXY2_NODE_CRC_SIZE         2
+
+#ifndef PIXY2_NODE_MAX_BLOCKS
+#define PIXY2_NODE_MAX_BLOCKS       32
+#endif
+#define PIXY2_NODE_MAX_PACKET       (PIXY2_NODE_HEADER_SIZE + PIXY2_NODE_MAX_BLOCKS*PIXY2_NODE_BLOCK_SIZE + PIXY2_NODE_CRC_SIZE)
+// with setDelta(), a BLOCKS packet at least this often
+#ifndef PIXY2_NODE_KEY_INTERVAL
+#define PIXY2_NODE_KEY_INTERVAL     30
+#endif
+
+#if PIXY2_NODE_MAX_BLOCKS > PIXY2_CODEC_MAX_BLOCKS
+#error "PIXY2_NODE_MAX_BLOCKS is more than Pixy2FrameCodec handles"
+#endif
+
+struct Pixy2NodeFrame
+{
+  uint8_t type;
+  uint8_t node;
+  uint16_t seq;
+  uint32_t timestamp;
+  uint8_t numBlocks;
+  Block blocks[PIXY2_NODE_MAX_BLOCKS];
+  uint32_t sync[2];     // SYNC_RESP: request timestamp, node time it arrived
+  const uint8_t *delta; // DELTA: the coded frame, only valid in the parser's callback
+  uint16_t deltaLen;    // at most PIXY2_NODE_MAX_BLOCKS*PIXY2_NODE_BLOCK_SIZE
+};
+
+static inline uint16_t pixy2NodeCrc(const uint8_t *buf, uint16_t len)
+{
+  uint16_t crc = 0xffff;
+  uint8_t i;
+
+  while (len--)
+  {
+    crc ^= (uint16_t)*buf++ << 8;
+    for (i = 0; i < 8; i++)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Serialize a frame; buf must hold PIXY2_NODE_MAX_PACKET. Returns the packet length.
+static inline uint16_t pixy2NodePack(uint8_t *buf, const Pixy2NodeFrame &frame)
+{
+  uint8_t i, j, n = frame.numBlocks > PIXY2_NODE_MAX_BLOCKS ? PIXY2_NODE_MAX_BLOCKS : frame.numBlocks;
+  uint16_t len, crc;
+  uint64_t bits;
+  const Block *b;
+  uint8_t *p;
+
+  buf[0] = PIXY2_NODE_SYNC & 0xff;
+  buf[1] = PIXY2_NODE_SYNC >> 8;
+  buf[2] = frame.type;
+  buf[3] = frame.node;
+  buf[4] = frame.seq & 0xff;
+  buf[5] = frame.seq >> 8;
+  for (i = 0; i < 4; i++)
+    buf[6 + i] = frame.timestamp >> (8*i);
+  if (frame.type != PIXY2_NODE_TYPE_BLOCKS)
+    n = 0;
+  buf[10] = n;
+  buf[11] = 0;
+  len = PIXY2_NODE_HEADER_SIZE + n*PIXY2_NODE_BLOCK_SIZE;
+
+  for (i = 0, p = buf + PIXY2_NODE_HEADER_SIZE; i < n; i++, p += PIXY2_NODE_BLOCK_SIZE)
+  {
+    b = &frame.blocks[i];
+    bits = (uint64_t)(b->m_x & 0x1ff) | (uint64_t)(b->m_y & 0xff) << 9 | (uint64_t)(b->m_width & 0x1ff) << 17 |
+      (uint64_t)(b->m_height & 0xff) << 26 | (uint64_t)b->m_index << 34 | (uint64_t)(b->m_age > 63 ? 63 : b->m_age) << 42;
+    p[0] = b->m_signature & 0xff;
+    p[1] = b->m_signature >> 8;
+    for (j = 0; j < 6; j++)
+      p[2 + j] = bits >> (8*j);
+  }
+
+  if (frame.type == PIXY2_NODE_TYPE_SYNC_RESP)
+  {
+    // one slot: the request's timestamp and the node time it arrived
+    for (i = 0; i < 4; i++)
+    {
+      buf[PIXY2_NODE_HEADER_SIZE + i] = frame.sync[0] >> (8*i);
+      buf[PIXY2_NODE_HEADER_SIZE + 4 + i] = frame.sync[1] >> (8*i);
+    }
+    buf[10] = 1;
+    len = PIXY2_NODE_HEADER_SIZE + PIXY2_NODE_BLOCK_SIZE;
+  }
+  else if (frame.type == PIXY2_NODE_TYPE_DELTA)
+  {
+    // may already be in place
+    memmove(buf + PIXY2_NODE_HEADER_SIZE, frame.delta, frame.deltaLen);
+    buf[10] = frame.deltaLen & 0xff;
+    buf[11] = frame.deltaLen >> 8;
+    len = PIXY2_NODE_HEADER_SIZE + frame.deltaLen;
+  }
+
+  crc = pixy2NodeCrc(buf, len);
+  buf[len] = crc & 0xff;
+  buf[len + 1] = crc >> 8;
+  return len + PIXY2_NODE_CRC_SIZE;
+}
+
+// A block as it comes out of a BLOCKS packet.
+static inline void pixy2NodeClip(Block *b)
+{
+  b->m_x &= 0x1ff;
+  b->m_y &= 0xff;
+  b->m_width &= 0x1ff;
+  b->m_height &= 0xff;
+  b->m_angle = 0;
+  if (b->m_age > 63)
+    b->m_age = 63;
+}
+
+// Node side: numbers packets and stamps them.
+class Pixy2NodeTx
+{
+public:
+  Pixy2NodeTx(uint8_t node)
+  {
+    m_node = node;
+    m_seq = 0;
+    m_keySeq = 0;
+    m_delta = false;
+  }
+
+  // Send DELTA packets where they are smaller, coded against the last BLOCKS packet,
+  // which goes out at least every keyInterval frames so a receiver that lost one picks
+  // up again.
+  void setDelta(bool on, uint16_t keyInterval = PIXY2_NODE_KEY_INTERVAL)
+  {
+    m_delta = on;
+    m_codec.setKeyInterval(keyInterval);
+    m_codec.setAnchored(true);
+    m_codec.reset();
+  }
+
+  // Packet for one frame of blocks, stamped with the node clock at capture.
+  uint16_t pack(uint8_t *buf, const Block *blocks, uint8_t numBlocks, uint32_t timestamp)
+  {
+    Pixy2NodeFrame *frame = &m_frame;
+    uint16_t len;
+    uint8_t i;
+
+    frame->type = PIXY2_NODE_TYPE_BLOCKS;
+    frame->node = m_node;
+    frame->seq = m_seq++;
+    frame->timestamp = timestamp;
+    frame->numBlocks = numBlocks > PIXY2_NODE_MAX_BLOCKS ? PIXY2_NODE_MAX_BLOCKS : numBlocks;
+    memcpy(frame->blocks, blocks, frame->numBlocks*sizeof(Block));
+    if (!m_delta)
+      return pixy2NodePack(buf, *frame);
+
+    // only if it comes out under the packed blocks, with the keyframe's seq in front
+    if (!m_codec.keyDue() && frame->numBlocks && (len = m_codec.encode(buf + PIXY2_NODE_HEADER_SIZE + 1,
+      frame->numBlocks*PIXY2_NODE_BLOCK_SIZE - 2, frame->blocks, frame->numBlocks)) != 0)
+    {
+      buf[PIXY2_NODE_HEADER_SIZE] = m_keySeq;
+      frame->type = PIXY2_NODE_TYPE_DELTA;
+      frame->delta = buf + PIXY2_NODE_HEADER_SIZE;
+      frame->deltaLen = len + 1;
+      return pixy2NodePack(buf, *frame);
+    }
+    len = pixy2NodePack(buf, *frame);
+    for (i = 0; i < frame->numBlocks; i++)
+      pixy2NodeClip(&frame->blocks[i]);
+    m_codec.setReference(frame->blocks, frame->numBlocks);
+    m_keySeq = frame->seq;
+    return len;
+  }
+
+  // Write a packet to anything with write(buf, len): Serial2, an RS-485 driver...
+  // Stamped with the time of sending unless a capture time is given.
+  template <class Out> uint16_t send(Out &out, const Block *blocks, uint8_t numBlocks)
+  {
+    return send(out, blocks, numBlocks, micros());
+  }
+
+  template <class Out> uint16_t send(Out &out, const Block *blocks, uint8_t numBlocks, uint32_t timestamp)
+  {
+    uint8_t buf[PIXY2_NODE_MAX_PACKET];
+    uint16_t len = pack(buf, blocks, numBlocks, timestamp);
+
+    out.write(buf, len);
+    return len;
+  }
+
+  // SYNC_RESP to a request that arrived at rxUs; 0 if it wasn't addressed to this node.
+  uint16_t packSync(uint8_t *buf, const Pixy2NodeFrame &req, uint32_t rxUs, uint32_t txUs)
+  {
+    Pixy2NodeFrame *frame = &m_frame;
+
+    if (req.type != PIXY2_NODE_TYPE_SYNC_REQ || (req.node != m_node && req.node != PIXY2_NODE_ANY))
+      return 0;
+    frame->type = PIXY2_NODE_TYPE_SYNC_RESP;
+    frame->node = m_node;
+    frame->seq = m_seq;
+    frame->timestamp = txUs;
+    frame->numBlocks = 0;
+    frame->sync[0] = req.timestamp;
+    frame->sync[1] = rxUs;
+    return pixy2NodePack(buf, *frame);
+  }
+
+  // Answer a request from the host's parser callback. Take rxUs as the bytes come in,
+  // not in the callback, if the loop can lag.
+  template <class Out> uint16_t answer(Out &out, const Pixy2NodeFrame &req, uint32_t rxUs)
+  {
+    uint8_t buf[PIXY2_NODE_MAX_PACKET];
+    uint16_t len = packSync(buf, req, rxUs, micros());
+
+    if (len)
+      out.write(buf, len);
+    return len;
+  }
+
+  uint8_t node() const { return m_node; }
+  uint16_t seq() const { return m_seq; }
+
+private:
+  uint8_t m_node;
+  uint16_t m_seq;
+  uint8_t m_keySeq;     // low byte of the last BLOCKS packet's seq
+  Pixy2NodeFrame m_frame;
+  bool m_delta;
+  Pixy2FrameCodec m_codec;
+};
+
+typedef void (*Pixy2NodeFn)(const Pixy2NodeFrame &frame, void *arg);
+
+// Receive side: finds packets in a byte stream, checks them and unpacks the blocks.
+class Pixy2NodeParser
+{
+public:
+  Pixy2NodeParser()
+  {
+    m_len = 0;
+    m_frames = m_crcErrors = m_skipped = 0;
+  }
+
+  // Feed received bytes; fn is called for every good packet. Returns packets found.
+  uint16_t feed(const uint8_t *buf, uint16_t len, Pixy2NodeFn fn, void *arg)
+  {
+    uint16_t found = 0;
+    int8_t res;
+
+    while (len--)
+    {
+      m_buf[m_len++] = *buf++;
+      while ((res = step(fn, arg)) != 0)
+        if (res > 1)
+          found++;
+    }
+    return found;
+  }
+
+  uint32_t frames() const { return m_frames; }
+  uint32_t crcErrors() const { return m_crcErrors; }
+  // bytes thrown away looking for sync
+  uint32_t skipped() const { return m_skipped; }
+
+private:
+  // Look at the start of the buffer once. Returns 0 if more bytes are needed, 1 if bytes
+  // were skipped, 2 if a packet was taken.
+  int8_t step(Pixy2NodeFn fn, void *arg)
+  {
+    uint16_t need;
+
+    if (m_len == 0)
+      return 0;
+    if (m_buf[0] != (PIXY2_NODE_SYNC & 0xff) || (m_len >= 2 && m_buf[1] != PIXY2_NODE_SYNC >> 8))
+      return skip();
+    if (m_len < PIXY2_NODE_HEADER_SIZE)
+      return 0;
+    if (m_buf[2] == PIXY2_NODE_TYPE_DELTA)
+      need = m_buf[10] | (m_buf[11] << 8);
+    else
+      need = m_buf[10]*PIXY2_NODE_BLOCK_SIZE;
+    if (need > PIXY2_NODE_MAX_BLOCKS*PIXY2_NODE_BLOCK_SIZE)
+      return skip();
+    need += PIXY2_NODE_HEADER_SIZE + PIXY2_NODE_CRC_SIZE;
+    if (m_len < need)
+      return 0;
+    if (pixy2NodeCrc(m_buf, need - PIXY2_NODE_CRC_SIZE) != (uint16_t)(m_buf[need - 2] | (m_buf[need - 1] << 8)))
+    {
+      m_crcErrors++;
+      return skip();
+    }
+    unpack();
+    m_frames++;
+    fn(m_frame, arg);
+    consume(need);
+    return 2;
+  }
+
+  // Drop bytes up to the next possible sync.
+  int8_t skip()
+  {
+    uint16_t i;
+
+    for (i = 1; i < m_len && m_buf[i] != (PIXY2_NODE_SYNC & 0xff); i++);
+    m_skipped += i;
+    consume(i);
+    return 1;
+  }
+
+  void consume(uint16_t n)
+  {
+    memmove(m_buf, m_buf + n, m_len - n);
+    m_len -= n;
+  }
+
+  void unpack()
+  {
+    uint8_t i, j;
+    uint64_t bits;
+    const uint8_t *p;
+    Block *b;
+
+    m_frame.type = m_buf[2];
+    m_frame.node = m_buf[3];
+    m_frame.seq = m_buf[4] | (m_buf[5] << 8);
+    m_frame.timestamp = (uint32_t)m_buf[6] | (uint32_t)m_buf[7] << 8 | (uint32_t)m_buf[8] << 16 | (uint32_t)m_buf[9] << 24;
+    m_frame.numBlocks = m_buf[10];
+    m_frame.delta = NULL;
+    m_frame.deltaLen = 0;
+    if (m_frame.type == PIXY2_NODE_TYPE_DELTA)
+    {
+      m_frame.delta = m_buf + PIXY2_NODE_HEADER_SIZE;
+      m_frame.deltaLen = m_buf[10] | (m_buf[11] << 8);
+      m_frame.numBlocks = 0;
+      return;
+    }
+    if (m_frame.type != PIXY2_NODE_TYPE_BLOCKS)
+    {
+      p = m_buf + PIXY2_NODE_HEADER_SIZE;
+      for (i = 0; i < 2; i++)
+        m_frame.sync[i] = m_frame.numBlocks ? (uint32_t)p[4*i] | (uint32_t)p[4*i + 1] << 8 |
+          (uint32_t)p[4*i + 2] << 16 | (uint32_t)p[4*i + 3] << 24 : 0;
+      m_frame.numBlocks = 0;
+      return;
+    }
+    for (i = 0, p = m_buf + PIXY2_NODE_HEADER_SIZE; i < m_frame.numBlocks; i++, p += PIXY2_NODE_BLOCK_SIZE)
+    {
+      b = &m_frame.blocks[i];
+      for (j = 0, bits = 0; j < 6; j++)
+        bits |= (uint64_t)p[2 + j] << (8*j);
+      b->m_signature = p[0] | (p[1] << 8);
+      b->m_x = bits & 0x1ff;
+      b->m_y = (bits >> 9) & 0xff;
+      b->m_width = (bits >> 17) & 0x1ff;
+      b->m_height = (bits >> 26) & 0xff;
+      b->m_index = (bits >> 34) & 0xff;
+      b->m_age = (bits >> 42) & 0x3f;
+      b->m_angle = 0;
+    }
+  }
+
+  uint8_t m_buf[PIXY2_NODE_MAX_PACKET];
+  uint16_t m_len;
+  Pixy2NodeFrame m_frame;
+  uint32_t m_frames;
+  uint32_t m_crcErrors;
+  uint32_t m_skipped;
+};
+
+#endif // _PIXY2NODEPROTOCOL_H
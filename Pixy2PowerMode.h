@@ -0,0 +1,266 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Frame-gap power saving.
+// The camera delivers a frame every 1/fps seconds; asking sooner only gets
+// PIXY_RESULT_BUSY back. Pass each frame request's result to frame() so the frame
+// period and phase can be learned, and call idle() once the application is done with a
+// frame: it sleeps until shortly before the next frame is due instead of letting loop()
+// poll. How it sleeps is the mode:
+//
+//   PIXY2_POWER_SPIN    don't; loop() polls as before (baseline)
+//   PIXY2_POWER_IDLE    block in the RTOS so the idle task parks the CPU (WFI)
+//   PIXY2_POWER_SLOW    the same at the lowest clock, through a Pixy2Governor
+//   PIXY2_POWER_SLEEP   ESP32 light sleep, woken by timer and optionally UART2 RX
+//
+// The CPU clock belongs to Pixy2Governor, so PIXY2_POWER_SLOW asks one for the lowest
+// level over the gap (idleBegin()/idleEnd()) rather than setting the clock itself, and
+// the governor's choice for the work is back when idle() returns. Without a governor,
+// SLOW idles at the current clock. A governor that is never given work stays at 240 MHz
+// and only drops for the gaps.
+//
+// Time in each state is counted, and with per-state currents (datasheet figures by
+// default, radio off) gives an estimated average draw. Off the ESP32 the modes only
+// wait, so the same counters model a run on a host.
+//
+//   Pixy2PowerMode power(PIXY2_POWER_SLEEP);
+//   loop() { int8_t res = pixy.ccc.getBlocks(); power.frame(res); if (res >= 0) { ...; power.idle(); } }
+//
+//   Pixy2Governor gov;
+//   Pixy2PowerMode power(PIXY2_POWER_SLOW, &gov);
+//   setup() { gov.begin(); }
+
+#ifndef _PIXY2POWERMODE_H
+#define _PIXY2POWERMODE_H
+
+#include "TPixy2.h"
+#include "Pixy2Governor.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp_sleep.h"
+#include "driver/uart.h"
+#endif
+
+#define PIXY2_POWER_SPIN        0
+#define PIXY2_POWER_IDLE        1
+#define PIXY2_POWER_SLOW        2
+#define PIXY2_POWER_SLEEP       3
+#define PIXY2_POWER_ACTIVE      PIXY2_POWER_SPIN  // state index for time spent working/polling
+#define PIXY2_POWER_STATES      4
+
+// wake this long before the frame is due; covers light sleep wakeup and jitter
+#ifndef PIXY2_POWER_GUARD_US
+#define PIXY2_POWER_GUARD_US    1500
+#endif
+// light sleep is only worth it for gaps at least this long; shorter ones idle
+#ifndef PIXY2_POWER_MIN_SLEEP_US
+#define PIXY2_POWER_MIN_SLEEP_US 3000
+#endif
+
+// Supply current per state in uA: working at 240 MHz, idle at 240 MHz, idle at 80 MHz,
+// light sleep.
+#ifndef PIXY2_POWER_UA_ACTIVE
+#define PIXY2_POWER_UA_ACTIVE   50000
+#endif
+#ifndef PIXY2_POWER_UA_IDLE
+#define PIXY2_POWER_UA_IDLE     27000
+#endif
+#ifndef PIXY2_POWER_UA_SLOW
+#define PIXY2_POWER_UA_SLOW     20000
+#endif
+#ifndef PIXY2_POWER_UA_SLEEP
+#define PIXY2_POWER_UA_SLEEP    800
+#endif
+
+class Pixy2PowerMode
+{
+public:
+  Pixy2PowerMode(uint8_t mode = PIXY2_POWER_SLEEP, Pixy2Governor *gov = NULL)
+  {
+    m_mode = mode;
+    m_gov = gov;
+    m_uartWake = false;
+    m_period = 0;
+    m_lastFrame = 0;
+    m_waking = false;
+    m_uA[PIXY2_POWER_ACTIVE] = PIXY2_POWER_UA_ACTIVE;
+    m_uA[PIXY2_POWER_IDLE] = PIXY2_POWER_UA_IDLE;
+    m_uA[PIXY2_POWER_SLOW] = PIXY2_POWER_UA_SLOW;
+    m_uA[PIXY2_POWER_SLEEP] = PIXY2_POWER_UA_SLEEP;
+    resetStats();
+  }
+
+  void setMode(uint8_t mode) { m_mode = mode; }
+  uint8_t mode() const { return m_mode; }
+  // The clock's owner, for PIXY2_POWER_SLOW.
+  void setGovernor(Pixy2Governor *gov) { m_gov = gov; }
+  // Also wake from light sleep on UART2 RX activity (the bytes that wake it are lost).
+  void setUartWakeup(bool enable) { m_uartWake = enable; }
+  // Measured currents for the estimate, in uA.
+  void setCurrent(uint8_t state, uint32_t uA) { if (state < PIXY2_POWER_STATES) m_uA[state] = uA; }
+
+  // Pass every frame request's result.
+  void frame(int8_t res)
+  {
+    uint32_t now = micros(), dt, n;
+
+    if (res == PIXY_RESULT_BUSY)
+    {
+      if (m_waking)
+        m_early++;
+      return;
+    }
+    if (res < 0)
+      return;
+
+    m_waking = false;
+    m_frames++;
+    if (m_lastFrame)
+    {
+      dt = now - m_lastFrame;
+      if (m_period == 0)
+        m_period = dt;
+      else
+      {
+        // a slow application skips frames; count whole periods
+        n = (dt + m_period/2)/m_period;
+        if (n >= 1 && n <= 8)
+          m_period = (m_period*7 + dt/n)/8;
+      }
+    }
+    m_lastFrame = now;
+  }
+
+  // Call when done with a frame. Returns shortly before the next one is due.
+  void idle()
+  {
+    uint32_t now = micros(), next, wait;
+    uint8_t state = m_mode;
+
+    account(PIXY2_POWER_ACTIVE, now);
+    if (m_mode == PIXY2_POWER_SPIN || m_period == 0)
+      return;
+
+    // a late application waits for the frame after next
+    next = m_lastFrame + m_period;
+    while ((int32_t)(next - now) < PIXY2_POWER_GUARD_US)
+      next += m_period;
+    wait = next - now - PIXY2_POWER_GUARD_US;
+    if (state == PIXY2_POWER_SLEEP && wait < PIXY2_POWER_MIN_SLEEP_US)
+      state = PIXY2_POWER_IDLE;
+    if (state == PIXY2_POWER_SLOW && m_gov == NULL)
+      state = PIXY2_POWER_IDLE;
+
+    switch (state)
+    {
+    // whole ticks, rounded up: a tick's jitter is within the guard
+    case PIXY2_POWER_IDLE:
+      delay((wait + 999)/1000);
+      break;
+
+    case PIXY2_POWER_SLOW:
+      m_gov->idleBegin();
+      delay((wait + 999)/1000);
+      m_gov->idleEnd();
+      break;
+
+    case PIXY2_POWER_SLEEP:
+#ifdef ARDUINO_ARCH_ESP32
+      esp_sleep_enable_timer_wakeup(wait);
+      if (m_uartWake)
+      {
+        uart_set_wakeup_threshold(UART_NUM_2, 3);
+        esp_sleep_enable_uart_wakeup(UART_NUM_2);
+      }
+      esp_light_sleep_start();
+      if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UART)
+        m_uartWakeups++;
+#else
+      delayMicroseconds(wait);
+#endif
+      m_sleeps++;
+      break;
+    }
+    account(state, micros());
+    m_waking = true;
+  }
+
+  uint32_t periodUs() const { return m_period; }
+  uint32_t frames() const { return m_frames; }
+  // light sleeps, those ended by UART, and BUSY answers right after waking (too early)
+  uint32_t sleeps() const { return m_sleeps; }
+  uint32_t uartWakeups() const { return m_uartWakeups; }
+  uint32_t early() const { return m_early; }
+  uint64_t timeUs(uint8_t state) const { return state < PIXY2_POWER_STATES ? m_time[state] : 0; }
+
+  // Average supply current since resetStats() from the per-state times, in mA.
+  float estimatedMa() const
+  {
+    uint64_t total = 0;
+    float charge = 0;
+    uint8_t i;
+
+    for (i = 0; i < PIXY2_POWER_STATES; i++)
+    {
+      total += m_time[i];
+      charge += (float)m_time[i]*m_uA[i];
+    }
+    return total ? charge/total/1000 : 0;
+  }
+
+  void resetStats()
+  {
+    memset(m_time, 0, sizeof(m_time));
+    m_frames = m_sleeps = m_uartWakeups = m_early = 0;
+    m_mark = micros();
+  }
+
+  void print()
+  {
+    char buf[128];
+    uint64_t total = m_time[0] + m_time[1] + m_time[2] + m_time[3];
+
+    if (total == 0)
+      total = 1;
+    snprintf(buf, sizeof(buf), "period %lu us, active %d%% idle %d%% slow %d%% sleep %d%%, ~%d mA, %lu early",
+      (unsigned long)m_period, (int)(m_time[0]*100/total), (int)(m_time[1]*100/total), (int)(m_time[2]*100/total),
+      (int)(m_time[3]*100/total), (int)(estimatedMa() + 0.5f), (unsigned long)m_early);
+    Serial.println(buf);
+  }
+
+private:
+  void account(uint8_t state, uint32_t now)
+  {
+    m_time[state] += now - m_mark;
+    m_mark = now;
+  }
+
+  uint8_t m_mode;
+  bool m_uartWake;
+  Pixy2Governor *m_gov;
+
+  uint32_t m_period;       // smoothed frame period
+  uint32_t m_lastFrame;    // when the latest frame came in
+  bool m_waking;           // slept since the last frame
+
+  uint32_t m_mark;
+  uint64_t m_time[PIXY2_POWER_STATES];
+  uint32_t m_uA[PIXY2_POWER_STATES];
+  uint32_t m_frames;
+  uint32_t m_sleeps;
+  uint32_t m_uartWakeups;
+  uint32_t m_early;
+};
+
+#endif // _PIXY2POWERMODE_H
@@ -0,0 +1,235 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Batched video.getRGB() sampling.
+// video.getRGB() is one full round trip per pixel. The sampler writes up to `window`
+// getRGB requests back to back before reading the first answer, so the link and the
+// camera overlap instead of taking turns. Results go to a caller-provided buffer and can
+// also be folded into a running mean/histogram.
+//
+// Pipelining needs a link that buffers in both directions (UART). On SPI, clocking out
+// the next request would discard the answer to the previous one, so use a window of 1.
+// If a response is missing or the camera reports an error, outstanding answers are
+// drained until the link has been quiet for a response time, and the remaining points
+// are fetched one by one with video.getRGB().
+
+#ifndef _PIXY2RGBSAMPLER_H
+#define _PIXY2RGBSAMPLER_H
+
+#include "TPixy2.h"
+
+#ifndef PIXY2_RGB_HIST_BINS
+#define PIXY2_RGB_HIST_BINS    16
+#endif
+
+// bytes drain() allows per answer: a result is 10 with checksums, an error 7
+#define PIXY2_RGB_ANSWER_MAX   16
+
+struct Pixy2Point
+{
+  uint16_t m_x;
+  uint16_t m_y;
+};
+
+// Running per-channel mean and histogram; channels are r, g, b. Counts are 32-bit and
+// sums 64-bit, so a long run (a sample every frame for years) doesn't wrap.
+struct Pixy2RGBStats
+{
+  void reset() { memset(this, 0, sizeof(*this)); }
+
+  void add(uint8_t r, uint8_t g, uint8_t b)
+  {
+    m_sum[0] += r;
+    m_sum[1] += g;
+    m_sum[2] += b;
+    m_hist[0][r*PIXY2_RGB_HIST_BINS >> 8]++;
+    m_hist[1][g*PIXY2_RGB_HIST_BINS >> 8]++;
+    m_hist[2][b*PIXY2_RGB_HIST_BINS >> 8]++;
+    m_count++;
+  }
+
+  uint8_t mean(uint8_t channel) const { return m_count ? m_sum[channel]/m_count : 0; }
+
+  uint64_t m_sum[3];
+  uint32_t m_hist[3][PIXY2_RGB_HIST_BINS];
+  uint32_t m_count;
+};
+
+template <class LinkType> class Pixy2RGBSampler
+{
+public:
+  Pixy2RGBSampler(TPixy2<LinkType> *pixy, uint8_t window = 1)
+  {
+    m_pixy = pixy;
+    m_window = window ? window : 1;
+    m_exchanges = m_fallbacks = 0;
+  }
+
+  void setWindow(uint8_t window) { m_window = window ? window : 1; }
+
+  // Sample n points. rgb (3 bytes per point, r g b) and stats are each optional.
+  // Returns the number of points sampled or a PIXY_RESULT_* error.
+  int16_t sample(const Pixy2Point *points, uint16_t n, uint8_t *rgb, Pixy2RGBStats *stats = NULL, bool saturate = true)
+  {
+    uint16_t sent = 0, done = 0;
+    uint8_t px[3];
+    int8_t res;
+
+    while (done < n)
+    {
+      while (sent < n && sent - done < m_window)
+      {
+        request(points[sent], saturate);
+        sent++;
+      }
+      res = response(px);
+      if (res < 0)
+      {
+        drain(sent - done - 1);
+        return slowPath(points, n, done, rgb, stats, saturate);
+      }
+      store(done++, px, rgb, stats);
+    }
+    return n;
+  }
+
+  // Sample a cols x rows grid with its top-left point at (x0, y0), step pixels apart,
+  // row by row into rgb.
+  int16_t sampleGrid(uint16_t x0, uint16_t y0, uint8_t cols, uint8_t rows, uint8_t step,
+    uint8_t *rgb, Pixy2RGBStats *stats = NULL, bool saturate = true)
+  {
+    Pixy2Point pts[32];
+    uint16_t i, k, n = (uint16_t)cols*rows;
+    int16_t res;
+
+    // in chunks so the point list stays on the stack
+    for (i = 0; i < n; i += k)
+    {
+      for (k = 0; k < 32 && i + k < n; k++)
+      {
+        pts[k].m_x = x0 + ((i + k) % cols)*step;
+        pts[k].m_y = y0 + ((i + k) / cols)*step;
+      }
+      res = sample(pts, k, rgb ? rgb + i*3 : NULL, stats, saturate);
+      if (res < 0)
+        return res;
+    }
+    return n;
+  }
+
+  // link exchanges so far, and how many points needed the one-at-a-time path
+  uint32_t exchanges() const { return m_exchanges; }
+  uint32_t fallbacks() const { return m_fallbacks; }
+
+private:
+  void request(const Pixy2Point &p, bool saturate)
+  {
+    uint8_t buf[PIXY_SEND_HEADER_SIZE + 5];
+
+    buf[0] = PIXY_NO_CHECKSUM_SYNC & 0xff;
+    buf[1] = PIXY_NO_CHECKSUM_SYNC >> 8;
+    buf[2] = VIDEO_REQUEST_GET_RGB;
+    buf[3] = 5;
+    buf[4] = p.m_x & 0xff;
+    buf[5] = p.m_x >> 8;
+    buf[6] = p.m_y & 0xff;
+    buf[7] = p.m_y >> 8;
+    buf[8] = saturate;
+    m_pixy->m_link.send(buf, sizeof(buf));
+    m_exchanges++;
+  }
+
+  // One response packet; fills r g b on a result, else returns the camera's error.
+  int8_t response(uint8_t *px)
+  {
+    uint8_t c, cprev, i, hdr[4], payload[8];
+    uint16_t csCalc;
+    bool cs;
+
+    for (i = 0, cprev = 0; ; i++, cprev = c)
+    {
+      if (i >= 16 || m_pixy->m_link.recv(&c, 1) < 0)
+        return PIXY_RESULT_ERROR;
+      if ((uint16_t)(cprev | (c << 8)) == PIXY_CHECKSUM_SYNC)
+      {
+        cs = true;
+        break;
+      }
+      if ((uint16_t)(cprev | (c << 8)) == PIXY_NO_CHECKSUM_SYNC)
+      {
+        cs = false;
+        break;
+      }
+    }
+    if (m_pixy->m_link.recv(hdr, cs ? 4 : 2) < 0 || hdr[1] > sizeof(payload))
+      return PIXY_RESULT_ERROR;
+    if (m_pixy->m_link.recv(payload, hdr[1], &csCalc) < 0)
+      return PIXY_RESULT_ERROR;
+    if (cs && csCalc != (uint16_t)(hdr[2] | (hdr[3] << 8)))
+      return PIXY_RESULT_CHECKSUM_ERROR;
+    if (hdr[0] == PIXY_TYPE_RESPONSE_ERROR && hdr[1] >= 1)
+      return (int8_t)payload[0];
+    if (hdr[0] != PIXY_TYPE_RESPONSE_RESULT || hdr[1] != 4)
+      return PIXY_RESULT_ERROR;
+    px[0] = payload[2];
+    px[1] = payload[1];
+    px[2] = payload[0];
+    return PIXY_RESULT_OK;
+  }
+
+  // Read and drop answers still in flight so the next exchange starts clean: whole ones
+  // first, then whatever is left byte by byte, including a late answer to the request
+  // that failed, until a read times out. Bounded by what the answers could hold.
+  void drain(uint16_t outstanding)
+  {
+    uint8_t px[3], c;
+    uint16_t bytes = 0, limit = (outstanding + 1)*PIXY2_RGB_ANSWER_MAX;
+
+    while (outstanding--)
+      response(px);
+    while (bytes++ < limit && m_pixy->m_link.recv(&c, 1) >= 0);
+  }
+
+  int16_t slowPath(const Pixy2Point *points, uint16_t n, uint16_t from, uint8_t *rgb, Pixy2RGBStats *stats, bool saturate)
+  {
+    uint8_t px[3];
+    int8_t res;
+
+    for (; from < n; from++)
+    {
+      res = m_pixy->video.getRGB(points[from].m_x, points[from].m_y, &px[0], &px[1], &px[2], saturate);
+      m_exchanges++;
+      m_fallbacks++;
+      if (res < 0)
+        return res;
+      store(from, px, rgb, stats);
+    }
+    return n;
+  }
+
+  static void store(uint16_t i, const uint8_t *px, uint8_t *rgb, Pixy2RGBStats *stats)
+  {
+    if (rgb)
+      memcpy(rgb + i*3, px, 3);
+    if (stats)
+      stats->add(px[0], px[1], px[2]);
+  }
+
+  TPixy2<LinkType> *m_pixy;
+  uint8_t m_window;
+  uint32_t m_exchanges;
+  uint32_t m_fallbacks;
+};
+
+#endif // _PIXY2RGBSAMPLER_H
@@ -0,0 +1,347 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Retrying link, so one bad byte costs a resend instead of a failed call or a re-init().
+// TLink2Retry wraps any link class. When TPixy2 sends a request it knows, the next recv()
+// reads the whole response itself and checks it: a timeout before a header, a short
+// frame (header but not all of the payload), a checksum error, or a bad type (a packet
+// of some other type or length arrived and no fitting one after it). On a failure the
+// request is sent again as its policy says; TPixy2 then reads the good response out of
+// the wrapper as if it had just come off the wire, or gets the usual error once the
+// retries are used up.
+//
+// Queries (version, resolution, frame rate, blocks, line features, RGB) are retried at
+// once. Settings are retried once after a short wait, as setting a value twice does no
+// harm; reversing the line vector is never retried, as a second one undoes the first.
+// setPolicy() changes any of them.
+//
+// A response that arrives after its attempt was given up on would be taken for the
+// answer to the next request, and every answer after would be one behind. Before a
+// resend, and before the request after an exchange that needed one, whatever the link
+// has buffered is read and dropped: the next packet answers the resend, and the first
+// attempt's answer turning up after the resend's doesn't answer the next request. Every
+// packet is also matched against the request's response type and length, and ones that
+// don't fit are dropped. After a resend they are counted as stale, left over from the
+// attempt before; on the first attempt they make a bad type. Error responses (busy,
+// program changing) always fit and go to TPixy2.
+//
+//   TPixy2<TLink2Retry<Link2UART> > pixy;
+//   ...
+//   pixy.m_link.print();   // failures by kind, retries and the time they took
+
+#ifndef _PIXY2RETRY_H
+#define _PIXY2RETRY_H
+
+#include "TPixy2.h"
+
+// bytes skipped looking for a response's sync, and reads that may come back empty
+#ifndef PIXY2_RETRY_HUNT_BYTES
+#define PIXY2_RETRY_HUNT_BYTES      300
+#endif
+#ifndef PIXY2_RETRY_HUNT_MISSES
+#define PIXY2_RETRY_HUNT_MISSES     5
+#endif
+// stale packets dropped per attempt
+#ifndef PIXY2_RETRY_STALE
+#define PIXY2_RETRY_STALE           3
+#endif
+#define PIXY2_RETRY_POLICIES        20
+
+#define PIXY2_RETRY_OK              0
+#define PIXY2_RETRY_TIMEOUT         1
+#define PIXY2_RETRY_SHORT           2
+#define PIXY2_RETRY_CHECKSUM        3
+#define PIXY2_RETRY_BAD_TYPE        4
+#define PIXY2_RETRY_KINDS           5
+
+struct Pixy2RetryPolicy
+{
+  uint8_t request;
+  uint8_t response;      // expected type
+  uint8_t minLength;
+  uint8_t lengthStep;    // the length is a multiple of this; 0 for any
+  uint8_t retries;
+  uint16_t delayUs;      // before each resend
+};
+
+template <class LinkType> class TLink2Retry : public LinkType
+{
+public:
+  TLink2Retry()
+  {
+    static const Pixy2RetryPolicy defaults[] =
+    {
+      { PIXY_TYPE_REQUEST_VERSION, PIXY_TYPE_RESPONSE_VERSION, 16, 0, 2, 0 },
+      { PIXY_TYPE_REQUEST_RESOLUTION, PIXY_TYPE_RESPONSE_RESOLUTION, 4, 0, 2, 0 },
+      { PIXY_TYPE_REQUEST_FPS, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 2, 0 },
+      { CCC_REQUEST_BLOCKS, CCC_RESPONSE_BLOCKS, 0, sizeof(Block), 2, 0 },
+      { LINE_REQUEST_GET_FEATURES, LINE_RESPONSE_GET_FEATURES, 0, 0, 2, 0 },
+      { VIDEO_REQUEST_GET_RGB, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 2, 0 },
+      { PIXY_TYPE_REQUEST_CHANGE_PROG, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 1000 },
+      { PIXY_TYPE_REQUEST_BRIGHTNESS, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { PIXY_TYPE_REQUEST_SERVO, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { PIXY_TYPE_REQUEST_LED, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { PIXY_TYPE_REQUEST_LAMP, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { LINE_REQUEST_SET_MODE, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { LINE_REQUEST_SET_VECTOR, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { LINE_REQUEST_SET_NEXT_TURN_ANGLE, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { LINE_REQUEST_SET_DEFAULT_TURN_ANGLE, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 1, 500 },
+      { LINE_REQUEST_REVERSE_VECTOR, PIXY_TYPE_RESPONSE_RESULT, 4, 0, 0, 0 },
+    };
+
+    m_numPolicies = sizeof(defaults)/sizeof(defaults[0]);
+    memcpy(m_policies, defaults, sizeof(defaults));
+    m_policy = NULL;
+    m_state = STATE_IDLE;
+    m_reqLen = m_respLen = m_respPos = 0;
+    m_resent = false;
+    resetStats();
+  }
+
+  // Override or add a request's policy; false if the table is full.
+  bool setPolicy(const Pixy2RetryPolicy &policy)
+  {
+    Pixy2RetryPolicy *p = find(policy.request);
+
+    if (p == NULL)
+    {
+      if (m_numPolicies >= PIXY2_RETRY_POLICIES)
+        return false;
+      p = &m_policies[m_numPolicies++];
+    }
+    *p = policy;
+    return true;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    // what is left of a response given up on, or the first answer to a request that was
+    // sent again, would be read as this one's
+    if (m_state == STATE_FAILED || m_resent)
+      drain();
+    m_resent = false;
+    // anything TPixy2 didn't read of the last response goes
+    m_state = STATE_IDLE;
+    m_policy = len >= PIXY_SEND_HEADER_SIZE ? find(buf[2]) : NULL;
+    if (m_policy)
+    {
+      memcpy(m_req, buf, len);
+      m_reqLen = len;
+      m_state = STATE_PENDING;
+      m_exchanges++;
+    }
+    return LinkType::send(buf, len);
+  }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (m_state == STATE_IDLE)
+      return LinkType::recv(buf, len, cs);
+    if (cs)
+      *cs = 0;
+    if (m_state == STATE_PENDING)
+      m_state = exchange() == PIXY2_RETRY_OK ? STATE_READY : STATE_FAILED;
+    if (m_state == STATE_FAILED || m_respLen - m_respPos < len)
+      return PIXY_RESULT_ERROR;
+    for (i = 0; i < len; i++)
+    {
+      buf[i] = m_resp[m_respPos++];
+      if (cs)
+        *cs += buf[i];
+    }
+    if (m_respPos == m_respLen)
+      m_state = STATE_IDLE;
+    return len;
+  }
+
+  void resetStats()
+  {
+    memset(m_failures, 0, sizeof(m_failures));
+    m_exchanges = m_retries = m_recovered = m_givenUp = m_stale = m_drained = 0;
+    m_retryUs = 0;
+  }
+
+  // requests the policies cover, and failed attempts of each PIXY2_RETRY_* kind
+  uint32_t exchanges() const { return m_exchanges; }
+  uint32_t failures(uint8_t kind) const { return m_failures[kind]; }
+  uint32_t retries() const { return m_retries; }
+  // exchanges that needed retries and got an answer, and those that didn't
+  uint32_t recovered() const { return m_recovered; }
+  uint32_t givenUp() const { return m_givenUp; }
+  uint32_t stale() const { return m_stale; }
+  uint32_t drained() const { return m_drained; }
+  // time from the first failure of an exchange to its end, summed
+  uint32_t retryUs() const { return m_retryUs; }
+
+  void print()
+  {
+    char buf[192];
+
+    snprintf(buf, sizeof(buf), "retry: %lu exchanges, %lu timeouts, %lu short, %lu checksum, %lu bad type",
+      (unsigned long)m_exchanges, (unsigned long)m_failures[PIXY2_RETRY_TIMEOUT],
+      (unsigned long)m_failures[PIXY2_RETRY_SHORT], (unsigned long)m_failures[PIXY2_RETRY_CHECKSUM],
+      (unsigned long)m_failures[PIXY2_RETRY_BAD_TYPE]);
+    Serial.println(buf);
+    snprintf(buf, sizeof(buf),
+      "retry: %lu retries, %lu recovered, %lu given up, %lu us retrying, %lu stale, %lu bytes drained",
+      (unsigned long)m_retries, (unsigned long)m_recovered, (unsigned long)m_givenUp, (unsigned long)m_retryUs,
+      (unsigned long)m_stale, (unsigned long)m_drained);
+    Serial.println(buf);
+  }
+
+private:
+  enum { STATE_IDLE, STATE_PENDING, STATE_READY, STATE_FAILED };
+
+  Pixy2RetryPolicy *find(uint8_t request)
+  {
+    uint8_t i;
+
+    for (i = 0; i < m_numPolicies; i++)
+      if (m_policies[i].request == request)
+        return &m_policies[i];
+    return NULL;
+  }
+
+  // Read the response to m_req into m_resp, sending again as the policy allows.
+  uint8_t exchange()
+  {
+    uint32_t failedUs = 0;
+    uint8_t attempt, res;
+
+    for (attempt = 0; true; attempt++)
+    {
+      if (attempt)
+      {
+        if (m_policy->delayUs)
+          delayMicroseconds(m_policy->delayUs);
+        drain();
+        m_retries++;
+        m_resent = true;
+        LinkType::send(m_req, m_reqLen);
+      }
+      res = readResponse(attempt > 0);
+      if (res == PIXY2_RETRY_OK)
+      {
+        if (attempt)
+        {
+          m_recovered++;
+          m_retryUs += micros() - failedUs;
+        }
+        return res;
+      }
+      m_failures[res]++;
+      if (attempt == 0)
+        failedUs = micros();
+      if (attempt >= m_policy->retries)
+      {
+        if (m_policy->retries)
+          m_retryUs += micros() - failedUs;
+        m_givenUp++;
+        return res;
+      }
+    }
+  }
+
+  uint8_t readResponse(bool resent)
+  {
+    uint8_t dropped, res, type, length;
+    bool mismatched = false;
+
+    for (dropped = 0; dropped <= PIXY2_RETRY_STALE; dropped++)
+    {
+      // whatever ended the wait, what came was the wrong packet
+      if ((res = readPacket()) != PIXY2_RETRY_OK)
+        return mismatched ? PIXY2_RETRY_BAD_TYPE : res;
+      type = m_resp[2];
+      length = m_resp[3];
+      if (type == PIXY_TYPE_RESPONSE_ERROR && length >= 1)
+        return PIXY2_RETRY_OK;
+      if (type == m_policy->response && length >= m_policy->minLength &&
+        (m_policy->lengthStep == 0 || length%m_policy->lengthStep == 0))
+        return PIXY2_RETRY_OK;
+      if (resent)
+        m_stale++;
+      else
+        mismatched = true;
+    }
+    return PIXY2_RETRY_BAD_TYPE;
+  }
+
+  // Drop what is left of a failed response, until the link has nothing.
+  void drain()
+  {
+    uint16_t i;
+    uint8_t c;
+
+    for (i = 0; i < 2*PIXY2_RETRY_HUNT_BYTES && LinkType::recv(&c, 1) >= 0; i++)
+      m_drained++;
+  }
+
+  // One packet as it came, sync included.
+  uint8_t readPacket()
+  {
+    uint16_t sync, csCalc, skipped = 0;
+    uint8_t c = 0, misses = 0, header;
+
+    m_respLen = m_respPos = 0;
+    for (sync = 0; sync != PIXY_CHECKSUM_SYNC && sync != PIXY_NO_CHECKSUM_SYNC; )
+    {
+      if (LinkType::recv(&c, 1) < 0)
+      {
+        if (++misses > PIXY2_RETRY_HUNT_MISSES)
+          return PIXY2_RETRY_TIMEOUT;
+        delayMicroseconds(25);
+        continue;
+      }
+      if (++skipped > PIXY2_RETRY_HUNT_BYTES)
+        return PIXY2_RETRY_TIMEOUT;
+      sync = sync >> 8 | c << 8;
+    }
+    m_resp[0] = sync & 0xff;
+    m_resp[1] = sync >> 8;
+    header = sync == PIXY_CHECKSUM_SYNC ? 4 : 2;
+    if (LinkType::recv(m_resp + 2, header) < 0)
+      return PIXY2_RETRY_SHORT;
+    m_respLen = 2 + header + m_resp[3];
+    if (LinkType::recv(m_resp + 2 + header, m_resp[3], &csCalc) < 0)
+      return PIXY2_RETRY_SHORT;
+    if (header == 4 && csCalc != (m_resp[4] | m_resp[5] << 8))
+      return PIXY2_RETRY_CHECKSUM;
+    return PIXY2_RETRY_OK;
+  }
+
+  Pixy2RetryPolicy m_policies[PIXY2_RETRY_POLICIES];
+  uint8_t m_numPolicies;
+  Pixy2RetryPolicy *m_policy;
+  uint8_t m_state;
+  bool m_resent;         // the last exchange sent its request again
+  uint8_t m_req[PIXY_SEND_HEADER_SIZE + 255];
+  uint8_t m_reqLen;
+  uint8_t m_resp[6 + 255];
+  uint16_t m_respLen;
+  uint16_t m_respPos;
+
+  uint32_t m_failures[PIXY2_RETRY_KINDS];
+  uint32_t m_exchanges;
+  uint32_t m_retries;
+  uint32_t m_recovered;
+  uint32_t m_givenUp;
+  uint32_t m_stale;
+  uint32_t m_drained;
+  uint32_t m_retryUs;
+};
+
+#endif // _PIXY2RETRY_H
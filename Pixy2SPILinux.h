@@ -0,0 +1,232 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Linux spidev link class.
+// Same interface as Link2SPI. send() only stages the request; the first recv() after it
+// clocks the request out and the response in with one two-transfer SPI_IOC_MESSAGE
+// ioctl. How much to clock in is learned per request type from the previous response,
+// so a typical exchange costs a single syscall. Device access goes through the SpiDev
+// template parameter (SpidevPosix on real hardware) so a fake can stand in for it.
+
+#ifndef _PIXY2SPILINUX_H
+#define _PIXY2SPILINUX_H
+
+#include "Pixy2Host.h"
+#include "TPixy2.h"
+
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef PIXY_SPI_CLOCKRATE
+#define PIXY_SPI_CLOCKRATE       2000000
+#endif
+
+#ifndef PIXY2_SPI_DEVICE
+#define PIXY2_SPI_DEVICE "/dev/spidev0.0"
+#endif
+
+// Gap between clocking out a request and clocking in the response, for the camera to
+// start answering.
+#ifndef PIXY2_SPI_TURNAROUND_US
+#define PIXY2_SPI_TURNAROUND_US  20
+#endif
+
+// Response bytes clocked in with a request before anything has been learned: sync plus
+// checksummed header.
+#define PIXY2_SPI_MIN_PREFETCH   6
+#define PIXY2_SPI_RXBUF          (PIXY_BUFFERSIZE + 16)
+
+// spidev character device.
+class SpidevPosix
+{
+public:
+  SpidevPosix() { m_fd = -1; }
+
+  int open(const char *device, uint8_t mode, uint32_t hz)
+  {
+    uint8_t bits = 8;
+
+    m_fd = ::open(device, O_RDWR | O_CLOEXEC);
+    if (m_fd < 0)
+      return -1;
+    if (ioctl(m_fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(m_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0)
+    {
+      close();
+      return -1;
+    }
+    return 0;
+  }
+
+  void close()
+  {
+    if (m_fd >= 0)
+      ::close(m_fd);
+    m_fd = -1;
+  }
+
+  // n is 1 or 2
+  int transfer(struct spi_ioc_transfer *xfer, unsigned n)
+  {
+    return ioctl(m_fd, n == 2 ? SPI_IOC_MESSAGE(2) : SPI_IOC_MESSAGE(1), xfer);
+  }
+
+private:
+  int m_fd;
+};
+
+template <class SpiDev> class TLink2SPILinux
+{
+public:
+  TLink2SPILinux()
+  {
+    m_device = PIXY2_SPI_DEVICE;
+    m_batch = true;
+    m_txLen = m_rxHead = m_rxLen = 0;
+    m_consumed = 0;
+    m_ioctls = m_clocked = 0;
+    for (uint8_t i = 0; i < 128; i++)
+      m_prefetch[i] = PIXY2_SPI_MIN_PREFETCH;
+  }
+
+  // Call before init()/open() to use another device.
+  void setDevice(const char *device) { m_device = device; }
+  // false does one ioctl per send() and recv() call, for comparison
+  void setBatching(bool batch) { m_batch = batch; }
+
+  // arg: SPI clock in Hz or PIXY_DEFAULT_ARGVAL to use default
+  int8_t open(uint32_t arg)
+  {
+    m_hz = (arg == PIXY_DEFAULT_ARGVAL) ? PIXY_SPI_CLOCKRATE : arg;
+    m_txLen = m_rxHead = m_rxLen = 0;
+    return m_dev.open(m_device, SPI_MODE_3, m_hz) < 0 ? PIXY_RESULT_ERROR : 0;
+  }
+
+  void close()
+  {
+    m_dev.close();
+  }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (cs) *cs = 0;
+
+    for (i = 0; i < len; i++)
+    {
+      if (m_rxHead == m_rxLen && exchange(len - i) < 0)
+        return -1;
+      buf[i] = m_rx[m_rxHead++];
+      if (cs) *cs += buf[i];
+    }
+    m_consumed += len;
+    return len;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    // what the last exchange of this type turned out to need
+    if (m_consumed)
+      m_prefetch[m_txType & 0x7f] = m_consumed < PIXY2_SPI_MIN_PREFETCH ? PIXY2_SPI_MIN_PREFETCH :
+        (m_consumed > PIXY2_SPI_RXBUF ? PIXY2_SPI_RXBUF : m_consumed);
+    // a request nobody read the answer to still has to go out
+    if (m_txLen && exchange(0) < 0)
+      return -1;
+
+    memcpy(m_tx, buf, len);
+    m_txLen = len;
+    m_txType = len > 2 ? buf[2] : 0;
+    m_rxHead = m_rxLen = 0; // bytes clocked past the last response are idle filler
+    m_consumed = 0;
+    if (!m_batch && exchange(0) < 0)
+      return -1;
+    return len;
+  }
+
+  uint32_t clock() const { return m_hz; }
+  // SPI_IOC_MESSAGE calls and bytes clocked in either direction
+  uint32_t ioctls() const { return m_ioctls; }
+  uint32_t clocked() const { return m_clocked; }
+  SpiDev &dev() { return m_dev; }
+
+private:
+  // Clock out the staged request (if any) and clock in at least need bytes; with a staged
+  // request, the learned response length for its type if that's more.
+  int exchange(uint16_t need)
+  {
+    struct spi_ioc_transfer xfer[2];
+    unsigned n = 0;
+    uint16_t rxLen = need;
+
+    memset(xfer, 0, sizeof(xfer));
+    if (m_txLen)
+    {
+      xfer[n].tx_buf = (uintptr_t)m_tx;
+      xfer[n].len = m_txLen;
+      xfer[n].delay_usecs = PIXY2_SPI_TURNAROUND_US;
+      n++;
+      if (m_batch && rxLen < m_prefetch[m_txType & 0x7f])
+        rxLen = m_prefetch[m_txType & 0x7f];
+      if (!m_batch)
+        rxLen = 0;
+    }
+    if (rxLen)
+    {
+      xfer[n].rx_buf = (uintptr_t)m_rx;
+      xfer[n].len = rxLen;
+      n++;
+    }
+    if (n == 0)
+      return 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+      xfer[i].speed_hz = m_hz;
+      xfer[i].bits_per_word = 8;
+    }
+
+    m_ioctls++;
+    if (m_dev.transfer(xfer, n) < 0)
+      return -1;
+    m_clocked += m_txLen + rxLen;
+    m_txLen = 0;
+    m_rxHead = 0;
+    m_rxLen = rxLen;
+    return rxLen;
+  }
+
+  SpiDev m_dev;
+  const char *m_device;
+  uint32_t m_hz;
+  bool m_batch;
+
+  uint8_t m_tx[PIXY_BUFFERSIZE];
+  uint8_t m_txLen;
+  uint8_t m_txType;
+  uint8_t m_rx[PIXY2_SPI_RXBUF];
+  uint16_t m_rxHead;
+  uint16_t m_rxLen;
+  uint16_t m_consumed;          // response bytes read since the last send()
+  uint16_t m_prefetch[128];     // per request type
+
+  uint32_t m_ioctls;
+  uint32_t m_clocked;
+};
+
+typedef TLink2SPILinux<SpidevPosix> Link2SPILinux;
+typedef TPixy2<Link2SPILinux> Pixy2SPILinux;
+
+#endif // _PIXY2SPILINUX_H
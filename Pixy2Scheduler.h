@@ -0,0 +1,261 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Multi-program request scheduler.
+// The camera runs one program at a time and changeProg() takes a good fraction of a
+// second, so interleaving CCC, line and video requests one by one spends most of the
+// time switching. Tasks declare the rate they need; each earns credit at that rate, and
+// the scheduler stays in one program while its tasks have credit, moving to another
+// program only once that program has built up a whole cycle's worth of work. Every
+// program with tasks is then visited once per cycle instead of once per request; a
+// longer cycle means fewer switches but burstier service. Rates that don't fit in what
+// the switches leave over show up as achieved < requested.
+//
+//   Pixy2Scheduler<Link2UART> sched(&pixy);
+//   sched.addTask(PIXY2_PROG_CCC, 60, steer, NULL);
+//   sched.addTask(PIXY2_PROG_LINE, 20, follow, NULL);
+//   loop() { sched.run(); }
+
+#ifndef _PIXY2SCHEDULER_H
+#define _PIXY2SCHEDULER_H
+
+#include "TPixy2.h"
+#include "Pixy2Trace.h"
+
+#define PIXY2_PROG_CCC                 0
+#define PIXY2_PROG_LINE                1
+#define PIXY2_PROG_VIDEO               2
+#define PIXY2_PROGS                    3
+
+#ifndef PIXY2_SCHED_MAX_TASKS
+#define PIXY2_SCHED_MAX_TASKS          8
+#endif
+
+// Runs one request (getBlocks(), getMainFeatures(), getRGB()...). Return >= 0 when it
+// produced a result; failures don't use up the task's credit.
+typedef int8_t (*Pixy2TaskFn)(void *arg);
+
+struct Pixy2TaskStats
+{
+  uint16_t rateHz;       // requested
+  uint32_t runs;         // successful calls
+  uint32_t failures;
+};
+
+template <class LinkType> class Pixy2Scheduler
+{
+public:
+  Pixy2Scheduler(TPixy2<LinkType> *pixy, uint16_t cycleMs = 1000)
+  {
+    m_pixy = pixy;
+    m_cycleMs = cycleMs;
+    m_numTasks = 0;
+    m_prog = PIXY2_PROGS; // unknown until the first switch
+    m_visitRuns = 0;
+    m_switches = 0;
+    m_switchMs = 0;
+    m_start = m_last = 0;
+  }
+
+  // Returns the task id, or -1 if the table is full.
+  int8_t addTask(uint8_t prog, uint16_t rateHz, Pixy2TaskFn fn, void *arg)
+  {
+    Task *t;
+
+    if (m_numTasks >= PIXY2_SCHED_MAX_TASKS || prog >= PIXY2_PROGS)
+      return -1;
+    t = &m_tasks[m_numTasks];
+    t->prog = prog;
+    t->fn = fn;
+    t->arg = arg;
+    t->credit = 0;
+    memset(&t->stats, 0, sizeof(t->stats));
+    t->stats.rateHz = rateHz;
+    return m_numTasks++;
+  }
+
+  // Call from loop(). Does at most one program switch or one task call.
+  void run()
+  {
+    uint32_t now = millis();
+    uint8_t i, best;
+    int8_t res;
+    Task *t;
+
+    if (m_start == 0)
+      m_start = m_last = now;
+    accrue(now - m_last);
+    m_last = now;
+
+    // first call: start with whichever program is owed the most
+    if (m_prog == PIXY2_PROGS)
+    {
+      for (i = 0, best = 0; i < PIXY2_PROGS; i++)
+        if (credit(i) > credit(best))
+          best = i;
+      if (credit(best) >= 1000)
+        switchTo(best);
+      return;
+    }
+
+    // another program has a full cycle's work waiting and this visit has done its share;
+    // look round-robin from the current program so none is starved
+    if ((int32_t)m_visitRuns >= batch(m_prog)/1000 || credit(m_prog) < 1000)
+    {
+      for (i = 1; i < PIXY2_PROGS; i++)
+      {
+        best = (m_prog + i) % PIXY2_PROGS;
+        if (batch(best) && credit(best) >= batch(best))
+        {
+          switchTo(best);
+          return;
+        }
+      }
+    }
+
+    // the task of the current program with the most credit
+    best = PIXY2_SCHED_MAX_TASKS;
+    for (i = 0; i < m_numTasks; i++)
+    {
+      t = &m_tasks[i];
+      if (t->prog == m_prog && t->credit >= 1000 && (best == PIXY2_SCHED_MAX_TASKS || t->credit > m_tasks[best].credit))
+        best = i;
+    }
+    if (best == PIXY2_SCHED_MAX_TASKS)
+      return;
+
+    t = &m_tasks[best];
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_DISPATCH, best);
+    res = t->fn(t->arg);
+    PIXY2_TRACE_END(PIXY2_TRACE_DISPATCH, best);
+    if (res >= 0)
+    {
+      t->credit -= 1000;
+      t->stats.runs++;
+      m_visitRuns++;
+    }
+    else
+      t->stats.failures++;
+  }
+
+  const Pixy2TaskStats &stats(uint8_t id) const { return m_tasks[id].stats; }
+
+  // Achieved rate of a task since the first run(), in Hz.
+  float achievedHz(uint8_t id) const
+  {
+    uint32_t elapsed = m_last - m_start;
+    return elapsed ? m_tasks[id].stats.runs*1000.0f/elapsed : 0;
+  }
+
+  uint32_t switches() const { return m_switches; }
+  // smoothed changeProg() time
+  uint16_t switchMs() const { return m_switchMs; }
+
+  void print()
+  {
+    char buf[128];
+    uint8_t i;
+
+    for (i = 0; i < m_numTasks; i++)
+    {
+      snprintf(buf, sizeof(buf), "task %d prog %d: requested %d Hz achieved %d.%d Hz (%lu runs, %lu failures)", i,
+        m_tasks[i].prog, m_tasks[i].stats.rateHz, (int)achievedHz(i), (int)(achievedHz(i)*10)%10,
+        (unsigned long)m_tasks[i].stats.runs, (unsigned long)m_tasks[i].stats.failures);
+      Serial.println(buf);
+    }
+    snprintf(buf, sizeof(buf), "switches: %lu, %d ms each", (unsigned long)m_switches, m_switchMs);
+    Serial.println(buf);
+  }
+
+private:
+  struct Task
+  {
+    uint8_t prog;
+    Pixy2TaskFn fn;
+    void *arg;
+    int32_t credit;        // runs owed, in thousandths
+    Pixy2TaskStats stats;
+  };
+
+  // Credit accrues at the task's rate, capped at one cycle's worth so a program that
+  // can't keep up doesn't build an endless backlog.
+  void accrue(uint32_t dtMs)
+  {
+    uint8_t i;
+    int32_t cap;
+
+    for (i = 0; i < m_numTasks; i++)
+    {
+      cap = (int32_t)m_tasks[i].stats.rateHz*m_cycleMs + 1000;
+      m_tasks[i].credit += m_tasks[i].stats.rateHz*dtMs;
+      if (m_tasks[i].credit > cap)
+        m_tasks[i].credit = cap;
+    }
+  }
+
+  int32_t credit(uint8_t prog)
+  {
+    int32_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < m_numTasks; i++)
+      if (m_tasks[i].prog == prog)
+        sum += m_tasks[i].credit;
+    return sum;
+  }
+
+  // A cycle's worth of runs for a program, in thousandths.
+  int32_t batch(uint8_t prog)
+  {
+    int32_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < m_numTasks; i++)
+      if (m_tasks[i].prog == prog)
+        sum += (int32_t)m_tasks[i].stats.rateHz*m_cycleMs;
+    return sum;
+  }
+
+  void switchTo(uint8_t prog)
+  {
+    static const char *names[PIXY2_PROGS] = { "color_connected_components", "line", "video" };
+    uint32_t t0 = millis(), dt;
+    int8_t res;
+
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_PROG_SWITCH, prog);
+    res = m_pixy->changeProg(names[prog]);
+    PIXY2_TRACE_END(PIXY2_TRACE_PROG_SWITCH, prog);
+    if (res < 0)
+      return;
+    dt = millis() - t0;
+    m_switchMs = m_switches ? (m_switchMs*3 + dt)/4 : dt;
+    m_switches++;
+    m_prog = prog;
+    m_visitRuns = 0;
+  }
+
+  TPixy2<LinkType> *m_pixy;
+  uint16_t m_cycleMs;
+  Task m_tasks[PIXY2_SCHED_MAX_TASKS];
+  uint8_t m_numTasks;
+
+  uint8_t m_prog;
+  uint32_t m_visitRuns;
+  uint32_t m_switches;
+  uint16_t m_switchMs;
+  uint32_t m_start;
+  uint32_t m_last;
+};
+
+#endif // _PIXY2SCHEDULER_H
@@ -0,0 +1,391 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Stereo fusion of CCC blocks.
+// Two calibrated Pixy2s looking the same way: blocks of the same signature are matched
+// across the views and triangulated into 3-D positions (mm, left camera frame: x right,
+// y down, z forward). begin() turns the calibration into a rectification lookup table
+// per camera, a coarse grid of fixed-point rectified coordinates, so after it a frame
+// costs no floating point: each block centre is interpolated from four grid nodes,
+// rectified rows make the epipolar constraint a row comparison, and depth is the
+// baseline over the disparity.
+//
+// The work per frame is bounded: at most PIXY2_STEREO_MAX_BLOCKS blocks per view are
+// looked at (the first ones, which Pixy2 sends largest first), so at most MAX_BLOCKS
+// squared candidate checks, and at most PIXY2_STEREO_MAX_PAIRS candidates are ranked.
+// Candidates must share a signature, lie on the same rectified row within the slack,
+// have a disparity in range and similar sizes; the best ones, by row error and size
+// difference, are taken greedily, each block at most once.
+//
+//   Pixy2StereoCalib calib = { ... };   // from any stereo calibration
+//   Pixy2Stereo stereo;
+//   stereo.begin(calib);
+//   if (left.ccc.getBlocks() >= 0 && right.ccc.getBlocks() >= 0)
+//   {
+//     stereo.fuse(left.ccc.blocks, left.ccc.numBlocks, right.ccc.blocks, right.ccc.numBlocks);
+//     for (i = 0; i < stereo.numPoints; i++)
+//       stereo.points[i].print();
+//   }
+//
+// The two frames should be captured close together; on one board, fetch both right
+// after each other, or pair frames by capture time with Pixy2FrameAligner.
+
+#ifndef _PIXY2STEREO_H
+#define _PIXY2STEREO_H
+
+#include "TPixy2.h"
+
+#include <math.h>
+
+// CCC frame size
+#ifndef PIXY2_STEREO_WIDTH
+#define PIXY2_STEREO_WIDTH             316
+#endif
+#ifndef PIXY2_STEREO_HEIGHT
+#define PIXY2_STEREO_HEIGHT            208
+#endif
+// rectification grid spacing, log2 pixels: 4 is a 21x15 grid, 2.5 KB for both cameras
+#ifndef PIXY2_STEREO_LUT_SHIFT
+#define PIXY2_STEREO_LUT_SHIFT         4
+#endif
+#ifndef PIXY2_STEREO_MAX_BLOCKS
+#define PIXY2_STEREO_MAX_BLOCKS        32
+#endif
+#if PIXY2_STEREO_MAX_BLOCKS > 32
+#error "PIXY2_STEREO_MAX_BLOCKS is at most 32"
+#endif
+#ifndef PIXY2_STEREO_MAX_PAIRS
+#define PIXY2_STEREO_MAX_PAIRS         64
+#endif
+// how far off the rectified row a match may be, 1/16 pixels, plus 1/8 of the block height
+#ifndef PIXY2_STEREO_ROW_SLACK
+#define PIXY2_STEREO_ROW_SLACK         32
+#endif
+// disparity range, 1/16 pixels; the minimum sets the farthest point, the maximum the nearest
+#ifndef PIXY2_STEREO_MIN_DISPARITY
+#define PIXY2_STEREO_MIN_DISPARITY     16
+#endif
+#ifndef PIXY2_STEREO_MAX_DISPARITY
+#define PIXY2_STEREO_MAX_DISPARITY     (200*16)
+#endif
+
+#define PIXY2_STEREO_LUT_COLS          ((PIXY2_STEREO_WIDTH >> PIXY2_STEREO_LUT_SHIFT) + 2)
+#define PIXY2_STEREO_LUT_ROWS          ((PIXY2_STEREO_HEIGHT >> PIXY2_STEREO_LUT_SHIFT) + 2)
+
+// Pinhole intrinsics in CCC pixels with two radial distortion terms.
+struct Pixy2StereoCamera
+{
+  float m_fx;
+  float m_fy;
+  float m_cx;
+  float m_cy;
+  float m_k1;
+  float m_k2;
+};
+
+struct Pixy2StereoCalib
+{
+  Pixy2StereoCamera m_left;
+  Pixy2StereoCamera m_right;
+  // right camera pose: a point p in left camera coordinates is R*p + T in right ones
+  float m_R[9];          // row major
+  float m_T[3];          // mm
+};
+
+struct Pixy2StereoPoint
+{
+  void print()
+  {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "sig: %d x: %d y: %d z: %d disparity: %d left: %d right: %d", m_signature, m_x, m_y, m_z,
+      m_disparity, m_left, m_right);
+    Serial.println(buf);
+  }
+  uint16_t m_signature;
+  int16_t m_x;           // mm
+  int16_t m_y;
+  int16_t m_z;
+  uint16_t m_disparity;  // 1/16 pixels
+  uint8_t m_left;        // block indices in the arrays given to fuse()
+  uint8_t m_right;
+};
+
+class Pixy2Stereo
+{
+public:
+  Pixy2Stereo()
+  {
+    m_valid = false;
+    numPoints = 0;
+    m_checks = 0;
+  }
+
+  // Build the lookup tables. False if the calibration can't be rectified (no baseline).
+  bool begin(const Pixy2StereoCalib &calib)
+  {
+    const float *R = calib.m_R;
+    float e1[3], e2[3], e3[3], rl[9], rr[9], len;
+    uint8_t i, j;
+
+    // Rectifying rotation: x along the baseline, z as close to the left optical axis
+    // as that allows. The right camera's centre in left coordinates is -R'T.
+    for (i = 0; i < 3; i++)
+      e1[i] = -(R[i]*calib.m_T[0] + R[3 + i]*calib.m_T[1] + R[6 + i]*calib.m_T[2]);
+    len = sqrtf(e1[0]*e1[0] + e1[1]*e1[1] + e1[2]*e1[2]);
+    if (len < 1e-3f)
+      return false;
+    for (i = 0; i < 3; i++)
+      e1[i] /= len;
+    // e2 = z x e1, e3 = e1 x e2
+    e2[0] = -e1[1];
+    e2[1] = e1[0];
+    e2[2] = 0;
+    len = sqrtf(e2[0]*e2[0] + e2[1]*e2[1]);
+    if (len < 1e-3f)
+      return false; // baseline along the optical axis
+    e2[0] /= len;
+    e2[1] /= len;
+    e3[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    e3[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    e3[2] = e1[0]*e2[1] - e1[1]*e2[0];
+    for (i = 0; i < 3; i++)
+    {
+      rl[i] = e1[i];
+      rl[3 + i] = e2[i];
+      rl[6 + i] = e3[i];
+    }
+    // the right camera's rays are turned into left orientation first: rr = rl*R'
+    for (i = 0; i < 3; i++)
+      for (j = 0; j < 3; j++)
+        rr[i*3 + j] = rl[i*3]*R[j*3] + rl[i*3 + 1]*R[j*3 + 1] + rl[i*3 + 2]*R[j*3 + 2];
+
+    m_f = (calib.m_left.m_fx + calib.m_left.m_fy + calib.m_right.m_fx + calib.m_right.m_fy)/4;
+    m_cx = (calib.m_left.m_cx + calib.m_right.m_cx)/2;
+    m_cy = (calib.m_left.m_cy + calib.m_right.m_cy)/2;
+    m_fq = (int32_t)(m_f*16 + 0.5f);
+    m_cxq = (int32_t)(m_cx*16 + 0.5f);
+    m_cyq = (int32_t)(m_cy*16 + 0.5f);
+    // depth (mm) = f*B/d, with d in 1/16 pixels
+    m_fb = (int32_t)(m_f*sqrtf(calib.m_T[0]*calib.m_T[0] + calib.m_T[1]*calib.m_T[1] + calib.m_T[2]*calib.m_T[2])*16 + 0.5f);
+    // rectified back to left camera coordinates, Q14
+    for (i = 0; i < 3; i++)
+      for (j = 0; j < 3; j++)
+        m_back[i*3 + j] = (int16_t)(rl[j*3 + i]*16384 + (rl[j*3 + i] < 0 ? -0.5f : 0.5f));
+
+    fill(m_lut[0], calib.m_left, rl);
+    fill(m_lut[1], calib.m_right, rr);
+    m_valid = true;
+    return true;
+  }
+
+  // Match and triangulate one pair of frames. Returns the number of points.
+  uint8_t fuse(const Block *left, uint8_t numLeft, const Block *right, uint8_t numRight)
+  {
+    Candidate *c;
+    uint8_t i, j, k, nc;
+    uint32_t usedL, usedR;
+    int32_t dv, d, slack, dw, dh, cost;
+
+    numPoints = 0;
+    m_checks = 0;
+    if (!m_valid)
+      return 0;
+    if (numLeft > PIXY2_STEREO_MAX_BLOCKS)
+      numLeft = PIXY2_STEREO_MAX_BLOCKS;
+    if (numRight > PIXY2_STEREO_MAX_BLOCKS)
+      numRight = PIXY2_STEREO_MAX_BLOCKS;
+    for (i = 0; i < numLeft; i++)
+      rectify(m_lut[0], left[i].m_x, left[i].m_y, &m_rect[0][i][0], &m_rect[0][i][1]);
+    for (i = 0; i < numRight; i++)
+      rectify(m_lut[1], right[i].m_x, right[i].m_y, &m_rect[1][i][0], &m_rect[1][i][1]);
+
+    // gate every pair, keeping the best MAX_PAIRS in cost order
+    for (i = 0, nc = 0; i < numLeft; i++)
+      for (j = 0; j < numRight; j++)
+      {
+        m_checks++;
+        if (left[i].m_signature != right[j].m_signature)
+          continue;
+        d = m_rect[0][i][0] - m_rect[1][j][0];
+        if (d < PIXY2_STEREO_MIN_DISPARITY || d > PIXY2_STEREO_MAX_DISPARITY)
+          continue;
+        dv = m_rect[0][i][1] - m_rect[1][j][1];
+        if (dv < 0)
+          dv = -dv;
+        slack = PIXY2_STEREO_ROW_SLACK + 2*(left[i].m_height < right[j].m_height ? left[i].m_height : right[j].m_height);
+        if (dv > slack)
+          continue;
+        dw = (int32_t)left[i].m_width - right[j].m_width;
+        dh = (int32_t)left[i].m_height - right[j].m_height;
+        if (dw < 0)
+          dw = -dw;
+        if (dh < 0)
+          dh = -dh;
+        // sizes within half of each other
+        if (2*dw > left[i].m_width + right[j].m_width || 2*dh > left[i].m_height + right[j].m_height)
+          continue;
+        // row error in 1/16 pixels, size difference at half a pixel per pixel
+        cost = dv + 8*(dw + dh);
+        if (nc == PIXY2_STEREO_MAX_PAIRS)
+        {
+          if (cost >= m_cand[nc - 1].m_cost)
+            continue;
+          nc--;
+        }
+        for (k = nc++; k > 0 && m_cand[k - 1].m_cost > cost; k--)
+          m_cand[k] = m_cand[k - 1];
+        m_cand[k].m_cost = cost;
+        m_cand[k].m_left = i;
+        m_cand[k].m_right = j;
+      }
+
+    for (k = 0, usedL = usedR = 0; k < nc; k++)
+    {
+      c = &m_cand[k];
+      if (usedL & ((uint32_t)1 << c->m_left) || usedR & ((uint32_t)1 << c->m_right))
+        continue;
+      usedL |= (uint32_t)1 << c->m_left;
+      usedR |= (uint32_t)1 << c->m_right;
+      triangulate(&points[numPoints++], left[c->m_left].m_signature, c->m_left, c->m_right);
+    }
+    return numPoints;
+  }
+
+  // Rectified position of a pixel in 1/16 pixels; camera 0 is left, 1 right.
+  void rectified(uint8_t camera, uint16_t x, uint16_t y, int16_t *u, int16_t *v) const
+  {
+    rectify(m_lut[camera ? 1 : 0], x, y, u, v);
+  }
+
+  bool valid() const { return m_valid; }
+  // pairs looked at by the last fuse(), at most MAX_BLOCKS squared
+  uint16_t checks() const { return m_checks; }
+
+  Pixy2StereoPoint points[PIXY2_STEREO_MAX_BLOCKS];
+  uint8_t numPoints;
+
+private:
+  struct Candidate
+  {
+    int32_t m_cost;
+    uint8_t m_left;
+    uint8_t m_right;
+  };
+
+  // Rectified coordinates of every grid node, so runtime undistortion is a bilinear
+  // blend of four entries. The iteration inverts the radial model; a few rounds do for
+  // the distortion a Pixy2 lens has.
+  void fill(int16_t lut[][2], const Pixy2StereoCamera &cam, const float *rot)
+  {
+    float xd, yd, x, y, r2, s, rx, ry, rz;
+    uint16_t col, row;
+    uint8_t it;
+    int16_t *e;
+
+    for (row = 0; row < PIXY2_STEREO_LUT_ROWS; row++)
+      for (col = 0; col < PIXY2_STEREO_LUT_COLS; col++)
+      {
+        xd = ((col << PIXY2_STEREO_LUT_SHIFT) - cam.m_cx)/cam.m_fx;
+        yd = ((row << PIXY2_STEREO_LUT_SHIFT) - cam.m_cy)/cam.m_fy;
+        x = xd;
+        y = yd;
+        for (it = 0; it < 8; it++)
+        {
+          r2 = x*x + y*y;
+          s = 1 + cam.m_k1*r2 + cam.m_k2*r2*r2;
+          x = xd/s;
+          y = yd/s;
+        }
+        rx = rot[0]*x + rot[1]*y + rot[2];
+        ry = rot[3]*x + rot[4]*y + rot[5];
+        rz = rot[6]*x + rot[7]*y + rot[8];
+        e = lut[row*PIXY2_STEREO_LUT_COLS + col];
+        e[0] = clamp16((m_f*rx/rz + m_cx)*16);
+        e[1] = clamp16((m_f*ry/rz + m_cy)*16);
+      }
+  }
+
+  static int16_t clamp16(float v)
+  {
+    if (v > 32767)
+      return 32767;
+    if (v < -32768)
+      return -32768;
+    return (int16_t)(v < 0 ? v - 0.5f : v + 0.5f);
+  }
+
+  static void rectify(const int16_t lut[][2], uint16_t x, uint16_t y, int16_t *u, int16_t *v)
+  {
+    const int16_t *a, *b;
+    int32_t fx, fy, top, bot;
+    uint16_t col = x >> PIXY2_STEREO_LUT_SHIFT, row = y >> PIXY2_STEREO_LUT_SHIFT;
+    uint8_t i;
+    int16_t *out[2] = { u, v };
+
+    if (col > PIXY2_STEREO_LUT_COLS - 2)
+      col = PIXY2_STEREO_LUT_COLS - 2;
+    if (row > PIXY2_STEREO_LUT_ROWS - 2)
+      row = PIXY2_STEREO_LUT_ROWS - 2;
+    fx = x - (col << PIXY2_STEREO_LUT_SHIFT);
+    fy = y - (row << PIXY2_STEREO_LUT_SHIFT);
+    a = lut[row*PIXY2_STEREO_LUT_COLS + col];
+    b = lut[(row + 1)*PIXY2_STEREO_LUT_COLS + col];
+    for (i = 0; i < 2; i++)
+    {
+      top = (a[i] << PIXY2_STEREO_LUT_SHIFT) + (a[2 + i] - a[i])*fx;
+      bot = (b[i] << PIXY2_STEREO_LUT_SHIFT) + (b[2 + i] - b[i])*fx;
+      *out[i] = ((top << PIXY2_STEREO_LUT_SHIFT) + (bot - top)*fy + (1 << (2*PIXY2_STEREO_LUT_SHIFT - 1))) >>
+        (2*PIXY2_STEREO_LUT_SHIFT);
+    }
+  }
+
+  void triangulate(Pixy2StereoPoint *p, uint16_t signature, uint8_t l, uint8_t r)
+  {
+    int32_t d = m_rect[0][l][0] - m_rect[1][r][0], z, x, y;
+    int64_t out[3];
+    uint8_t i;
+
+    // rectified left camera coordinates, mm
+    z = m_fb/d;
+    x = (m_rect[0][l][0] - m_cxq)*z/m_fq;
+    y = (m_rect[0][l][1] - m_cyq)*z/m_fq;
+    for (i = 0; i < 3; i++)
+    {
+      out[i] = ((int64_t)m_back[i*3]*x + (int64_t)m_back[i*3 + 1]*y + (int64_t)m_back[i*3 + 2]*z + 8192) >> 14;
+      if (out[i] > 32767)
+        out[i] = 32767;
+      else if (out[i] < -32768)
+        out[i] = -32768;
+    }
+    p->m_signature = signature;
+    p->m_x = (int16_t)out[0];
+    p->m_y = (int16_t)out[1];
+    p->m_z = (int16_t)out[2];
+    p->m_disparity = d;
+    p->m_left = l;
+    p->m_right = r;
+  }
+
+  bool m_valid;
+  float m_f, m_cx, m_cy;
+  int32_t m_fq, m_cxq, m_cyq; // 1/16 pixels
+  int32_t m_fb;               // f*B, pixels/16 * mm
+  int16_t m_back[9];          // Q14
+  int16_t m_lut[2][PIXY2_STEREO_LUT_ROWS*PIXY2_STEREO_LUT_COLS][2];
+  int16_t m_rect[2][PIXY2_STEREO_MAX_BLOCKS][2];
+  Candidate m_cand[PIXY2_STEREO_MAX_PAIRS];
+  uint16_t m_checks;
+};
+
+#endif // _PIXY2STEREO_H
@@ -0,0 +1,376 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Frame capture times and clock sync between nodes.
+//
+// Pixy2FrameClock estimates when the camera made each frame available from link
+// timing alone. Frames come on a fixed grid (phase + n*period). A request that
+// returned a new frame bounds that frame's availability from above: it was ready
+// before the answer was complete. A request answered PIXY_RESULT_BUSY bounds the next
+// frame from below: it wasn't ready when the request went out. The grid phase is
+// pushed just far enough to satisfy each bound, so with polling that sees BUSY now
+// and then it converges to within the request's own duration, whenever the
+// application gets round to asking. Upper bounds alone can't tell a period from its
+// fractions, so the period starts at the nominal 60 fps and is only trimmed. Use
+// getBlocks(false) so BUSY answers are seen; with wait=true only the upper bounds are
+// available and the estimate is looser. Capture time is availability
+// minus the camera's pipeline delay, which is the same for every camera and only
+// matters when comparing against other sensors.
+//
+// Pixy2ClockSync maps another node's clock onto this one from NTP-style exchanges:
+// t1 request sent (local), t2 received and t3 answered (remote), t4 answer received
+// (local). A line fitted through the recent exchanges, favouring those with the least
+// round-trip delay, gives the offset and the rate difference. Over links with a lot of
+// jitter even the best exchange can be milliseconds out, so the line is also held to
+// one-way bounds: a request can't arrive before it was sent, which caps the offset, and
+// neither can any packet from the remote, which floors it. Pass every such packet to
+// bound(); frame traffic keeps the floor fresh, and the best bound of each couple of
+// seconds traces the offset closely enough to take the rate from as well.
+
+#ifndef _PIXY2TIMESYNC_H
+#define _PIXY2TIMESYNC_H
+
+#include "TPixy2.h"
+
+// camera exposure-to-available delay subtracted from estimates
+#ifndef PIXY2_CAPTURE_PIPELINE_US
+#define PIXY2_CAPTURE_PIPELINE_US  0
+#endif
+// nominal frame period; trimmed to the camera's actual rate, within 1%
+#ifndef PIXY2_FRAME_PERIOD_US
+#define PIXY2_FRAME_PERIOD_US      16667
+#endif
+#ifndef PIXY2_SYNC_SAMPLES
+#define PIXY2_SYNC_SAMPLES         16
+#endif
+// largest rate difference believed, ppm; crystals are tens
+#ifndef PIXY2_SYNC_MAX_PPM
+#define PIXY2_SYNC_MAX_PPM         200
+#endif
+// how fast a one-way bound loosens, beyond the estimated rate, ppm: a lot while the
+// rate comes from the exchanges, a little once there is a run of bound() windows
+#ifndef PIXY2_SYNC_LEAK
+#define PIXY2_SYNC_LEAK            100
+#endif
+#ifndef PIXY2_SYNC_PEAK_LEAK
+#define PIXY2_SYNC_PEAK_LEAK       20
+#endif
+#ifndef PIXY2_SYNC_WINDOW_US
+#define PIXY2_SYNC_WINDOW_US       2000000
+#endif
+
+class Pixy2FrameClock
+{
+public:
+  Pixy2FrameClock(uint32_t periodUs = PIXY2_FRAME_PERIOD_US)
+  {
+    m_nominal = periodUs;
+    reset();
+  }
+
+  void reset()
+  {
+    m_period = m_nominal << 8;
+    m_last = 0;
+    m_frames = 0;
+    m_busy = false;
+  }
+
+  // Pass every frame request: its result, when it was sent and when its answer was
+  // complete. Returns the estimated capture time of a new frame, or 0.
+  uint32_t frame(int8_t res, uint32_t sentUs, uint32_t doneUs)
+  {
+    uint32_t period = m_period >> 8;
+    int32_t n, d;
+
+    if (res == PIXY_RESULT_BUSY)
+    {
+      // the frame after the last one wasn't available when this went out
+      d = sentUs - (m_last + period);
+      if (m_frames >= 2 && d > 0 && d < (int32_t)period)
+        correct(d, 1);
+      m_busy = true;
+      return 0;
+    }
+    if (res < 0)
+      return 0;
+
+    if (m_frames++ == 0)
+    {
+      m_last = doneUs;
+      return doneUs - PIXY2_CAPTURE_PIPELINE_US;
+    }
+
+    // the latest grid slot at or before doneUs, since the frame was ready by then
+    n = (int32_t)(doneUs - m_last)/(int32_t)period;
+    if (n < 1)
+      n = 1;
+    m_last += n*period + (((m_period & 0xff)*n) >> 8);
+    // ready no later than the answer: pull the grid earlier if it says otherwise
+    d = doneUs - m_last;
+    if (d < 0)
+      correct(d, n);
+    else if (!m_busy)
+      correct(d/16, n); // nothing holds the grid back: creep towards the bound
+    m_busy = false;
+    return m_last - PIXY2_CAPTURE_PIPELINE_US;
+  }
+
+  uint32_t periodUs() const { return m_period >> 8; }
+  uint32_t frames() const { return m_frames; }
+
+private:
+  // Move the grid by d; the period takes a share of it spread over the n periods it
+  // built up over, so corrections that keep going one way trim the period.
+  void correct(int32_t d, int32_t n)
+  {
+    m_last += d;
+    m_period += d*256/(16*n);
+    if (m_period > (m_nominal << 8) + (m_nominal << 8)/100)
+      m_period = (m_nominal << 8) + (m_nominal << 8)/100;
+    else if (m_period < (m_nominal << 8) - (m_nominal << 8)/100)
+      m_period = (m_nominal << 8) - (m_nominal << 8)/100;
+  }
+
+  uint32_t m_nominal;
+  uint32_t m_period;    // 1/256 us
+  uint32_t m_last;      // availability of the latest frame
+  uint32_t m_frames;
+  bool m_busy;          // a BUSY answer bounded the current frame
+};
+
+class Pixy2ClockSync
+{
+public:
+  Pixy2ClockSync()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    m_count = m_next = 0;
+    m_offset = 0;
+    m_ref = 0;
+    m_rate = 0;
+    m_delay = 0;
+    m_floor.set = m_ceil.set = false;
+    m_peakCount = m_peakNext = 0;
+    m_window.set = false;
+    m_leak = PIXY2_SYNC_LEAK*1e-6f;
+  }
+
+  // One exchange. Returns false if it was discarded (negative delay: clocks stepped).
+  bool sample(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4)
+  {
+    int32_t delay = (int32_t)(t4 - t1) - (int32_t)(t3 - t2);
+    uint8_t i;
+
+    if (delay < 0)
+      return false;
+    m_samples[m_next].local = t1 + (uint32_t)(t4 - t1)/2;
+    // ((t2 - t1) + (t3 - t4))/2, kept modular: the clocks can be any distance apart
+    m_samples[m_next].offset = t2 - t1 - delay/2;
+    m_samples[m_next].delay = delay;
+    m_next = (m_next + 1) % PIXY2_SYNC_SAMPLES;
+    if (m_count < PIXY2_SYNC_SAMPLES)
+      m_count++;
+
+    for (i = 0, m_delay = delay; i < m_count; i++)
+      if (m_samples[i].delay < m_delay)
+        m_delay = m_samples[i].delay;
+    fit(t4);
+    // the request can't have arrived before it was sent
+    m_ceil.tighten(t2 - t1, t1, m_rate, 1, m_leak);
+    return true;
+  }
+
+  // A packet stamped remote (or later) arrived at local.
+  void bound(uint32_t remote, uint32_t local)
+  {
+    int32_t b = remote - local;
+
+    m_floor.tighten(b, local, m_rate, -1, m_leak);
+    if (m_window.set && (int32_t)(local - m_windowStart) >= PIXY2_SYNC_WINDOW_US)
+    {
+      m_peaks[m_peakNext].local = m_window.time;
+      m_peaks[m_peakNext].offset = m_window.value;
+      m_peakNext = (m_peakNext + 1) % PIXY2_SYNC_SAMPLES;
+      if (m_peakCount < PIXY2_SYNC_SAMPLES)
+        m_peakCount++;
+      m_window.set = false;
+      fitPeaks();
+    }
+    if (!m_window.set)
+      m_windowStart = local;
+    if (!m_window.set || b - m_window.value > 0)
+    {
+      m_window.value = b;
+      m_window.time = local;
+      m_window.set = true;
+    }
+  }
+
+  bool valid() const { return m_count > 0; }
+  // remote minus local at local time t, us
+  int32_t offset(uint32_t t) const
+  {
+    int32_t line = m_offset + (int32_t)(m_rate*(int32_t)(t - m_ref)), lo, hi, b;
+
+    // The line is good to half the best round trip. Within that, the offset is no more
+    // than any request's one-way time says and no less than any packet's.
+    lo = line - m_delay/2;
+    hi = line + m_delay/2;
+    if (m_ceil.set && hi - (b = m_ceil.at(t, m_rate, 1, m_leak)) > 0)
+      hi = b;
+    if (m_floor.set && (b = m_floor.at(t, m_rate, -1, m_leak)) - lo > 0)
+      lo = b;
+    return hi - lo >= 0 ? lo + (hi - lo)/2 : lo;
+  }
+  uint32_t toLocal(uint32_t remote) const { return remote - offset(remote - m_offset); }
+  uint32_t toRemote(uint32_t local) const { return local + offset(local); }
+  // best round trip in the window, and the rate difference in parts per million
+  int32_t delay() const { return m_delay; }
+  float ppm() const { return m_rate*1e6f; }
+
+private:
+  struct Sample
+  {
+    uint32_t local;
+    int32_t offset;
+    int32_t delay;
+  };
+
+  // A one-way bound on the offset, carried forward at the estimated rate and loosened
+  // by the leak so an error in the rate can't carry it past the truth.
+  struct Bound
+  {
+    bool set;
+    int32_t value;
+    uint32_t time;
+
+    int32_t at(uint32_t t, float rate, int8_t dir, float leak) const
+    {
+      return value + (int32_t)((rate + dir*leak)*(int32_t)(t - time));
+    }
+
+    void tighten(int32_t v, uint32_t t, float rate, int8_t dir, float leak)
+    {
+      if (!set || (v - at(t, rate, dir, leak))*dir < 0)
+      {
+        value = v;
+        time = t;
+        set = true;
+      }
+    }
+  };
+
+  // Least squares line through the window's offsets. An exchange's error is up to half
+  // its delay, almost all of it queuing the fastest exchanges escaped, so each is
+  // weighted down by the square of how much slower than the fastest it was.
+  void fit(uint32_t now)
+  {
+    float w, sw = 0, mx = 0, my = 0, sxx = 0, sxy = 0, x, y;
+    int32_t base = m_samples[(m_next + PIXY2_SYNC_SAMPLES - 1) % PIXY2_SYNC_SAMPLES].offset;
+    uint8_t i;
+
+    for (i = 0; i < m_count; i++)
+    {
+      w = weight(i);
+      sw += w;
+      mx += w*(int32_t)(m_samples[i].local - now);
+      my += w*(m_samples[i].offset - base);
+    }
+    mx /= sw;
+    my /= sw;
+    for (i = 0; i < m_count; i++)
+    {
+      w = weight(i);
+      x = (int32_t)(m_samples[i].local - now) - mx;
+      y = m_samples[i].offset - base - my;
+      sxx += w*x*x;
+      sxy += w*x*y;
+    }
+    m_ref = now + (int32_t)mx;
+    m_offset = base + (int32_t)my;
+    // a few seconds' spread at least, or the slope is all noise
+    if (m_peakCount < 4 && sxx > 4e12f*sw)
+      m_rate = clamp(sxy/sxx);
+  }
+
+  // Rate from the window peaks of the one-way bounds: plain least squares, as each is
+  // the best of a hundred or so packets.
+  void fitPeaks()
+  {
+    float mx = 0, my = 0, sxx = 0, sxy = 0, x, y;
+    uint32_t now = m_peaks[(m_peakNext + PIXY2_SYNC_SAMPLES - 1) % PIXY2_SYNC_SAMPLES].local;
+    int32_t base = m_peaks[(m_peakNext + PIXY2_SYNC_SAMPLES - 1) % PIXY2_SYNC_SAMPLES].offset;
+    uint8_t i;
+
+    if (m_peakCount < 4)
+      return;
+    for (i = 0; i < m_peakCount; i++)
+    {
+      mx += (int32_t)(m_peaks[i].local - now);
+      my += m_peaks[i].offset - base;
+    }
+    mx /= m_peakCount;
+    my /= m_peakCount;
+    for (i = 0; i < m_peakCount; i++)
+    {
+      x = (int32_t)(m_peaks[i].local - now) - mx;
+      y = m_peaks[i].offset - base - my;
+      sxx += x*x;
+      sxy += x*y;
+    }
+    m_rate = clamp(sxy/sxx);
+    m_leak = PIXY2_SYNC_PEAK_LEAK*1e-6f;
+    if (m_count)
+      fit(m_ref);
+  }
+
+  static float clamp(float rate)
+  {
+    if (rate > PIXY2_SYNC_MAX_PPM*1e-6f)
+      return PIXY2_SYNC_MAX_PPM*1e-6f;
+    if (rate < -PIXY2_SYNC_MAX_PPM*1e-6f)
+      return -PIXY2_SYNC_MAX_PPM*1e-6f;
+    return rate;
+  }
+
+  float weight(uint8_t i) const
+  {
+    float d = m_samples[i].delay - m_delay + 200;
+    return 1/(d*d);
+  }
+
+  Sample m_samples[PIXY2_SYNC_SAMPLES];
+  uint8_t m_count;
+  uint8_t m_next;
+  int32_t m_delay;
+  uint32_t m_ref;       // local time the line is centred on
+  int32_t m_offset;     // offset there
+  float m_rate;         // offset change per us
+  Bound m_floor;        // from bound()
+  Bound m_ceil;         // from requests
+  float m_leak;
+
+  Sample m_peaks[PIXY2_SYNC_SAMPLES];   // best bound() of each window
+  uint8_t m_peakCount;
+  uint8_t m_peakNext;
+  Bound m_window;       // best bound() of the current window so far
+  uint32_t m_windowStart;
+};
+
+#endif // _PIXY2TIMESYNC_H
@@ -0,0 +1,292 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Event tracer, for seeing how link waits, request handlers, buzzer interrupts and
+// telemetry writes interleave on the two cores.
+// Link2UART, Link2SPI, Pixy2Scheduler, Pixy2BlackBox and ZumoBuzzer.cpp mark their work
+// with PIXY2_TRACE_BEGIN/END/INSTANT. Unless PIXY2_TRACE is defined for every file (a
+// build flag, e.g. build_flags = -DPIXY2_TRACE) those expand to nothing and this file
+// adds no code or data. With it, each event is 12 bytes in a ring per core: CPU cycle
+// count, task (0 in an interrupt), id and a 16-bit argument. A slot is claimed with one
+// atomic add, so tasks and interrupts on a core never wait for each other, and the two
+// cores never touch the same ring. When a ring is full the oldest events are overwritten.
+//
+//   Pixy2Tracer::start();
+//   ...
+//   Pixy2Tracer::stop();
+//   Pixy2Tracer::dump(Serial);     // binary; host/pixy_trace turns it into Chrome JSON
+//
+// Application events take ids from PIXY2_TRACE_USER up:
+//   PIXY2_TRACE_BEGIN(PIXY2_TRACE_USER + 1, 0); steer(); PIXY2_TRACE_END(PIXY2_TRACE_USER + 1, 0);
+//
+// The cycle counter is 32 bits and each core has its own, so every ring also gets clock
+// events: the cycle count with the microsecond clock both cores share, at start(), then
+// at least every PIXY2_TRACE_CLOCK_CYCLES and every eighth of a ring. The exporter places
+// events between them at the clock rate dump() saw; with Pixy2Governor or Pixy2PowerMode
+// changing the rate, times are only as exact as the clock events are frequent. Events
+// older than a full ring's first clock event are dropped.
+//
+// Dump, little-endian: "PXTR", version, cores, event size, 0, CPU MHz (32 bits), then per
+// core the number of events, the number overwritten (32 bits each) and the events
+// oldest first.
+
+#ifndef _PIXY2TRACE_H
+#define _PIXY2TRACE_H
+
+#include <stdint.h>
+
+#define PIXY2_TRACE_TYPE_BEGIN      0
+#define PIXY2_TRACE_TYPE_END        1
+#define PIXY2_TRACE_TYPE_INSTANT    2
+
+// event ids; a clock event's task field holds the microsecond clock
+#define PIXY2_TRACE_CLOCK           0
+#define PIXY2_TRACE_LINK_SEND       1      // arg: bytes
+#define PIXY2_TRACE_LINK_RECV       2      // arg: bytes; includes waiting for them
+#define PIXY2_TRACE_DISPATCH        3      // arg: scheduler task id
+#define PIXY2_TRACE_PROG_SWITCH     4      // arg: program; the changeProg() call
+#define PIXY2_TRACE_BUZZER_ISR      5
+#define PIXY2_TRACE_BUZZER_NOTE     6      // parsing and starting the next note
+#define PIXY2_TRACE_TELEMETRY       7      // arg: black box page written
+#define PIXY2_TRACE_USER            32
+
+inline const char *pixy2TraceName(uint8_t id)
+{
+  static const char *names[] = { "clock", "link_send", "link_recv", "dispatch", "prog_switch", "buzzer_isr",
+    "buzzer_note", "telemetry" };
+
+  return id < sizeof(names)/sizeof(names[0]) ? names[id] : NULL;
+}
+
+#ifdef PIXY2_TRACE
+
+// device sources built against host/hal use the host's clock and threads
+#if defined(_PIXY2HOST_H) || (!defined(ARDUINO) && !defined(ARDUINO_ARCH_ESP32))
+#define PIXY2_TRACE_HOST
+#include "Pixy2Host.h"
+#include <sched.h>
+#include <unistd.h>
+#elif defined(ARDUINO_ARCH_ESP32)
+#include "esp_cpu.h"
+#include "esp_ipc.h"
+#include "esp_timer.h"
+#include "esp32-hal-cpu.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#error "PIXY2_TRACE needs an ESP32 or a Linux host"
+#endif
+
+#ifndef PIXY2_TRACE_EVENTS
+#define PIXY2_TRACE_EVENTS          1024   // per core
+#endif
+
+#ifndef PIXY2_TRACE_CORES
+#ifdef PIXY2_TRACE_HOST
+#define PIXY2_TRACE_CORES           4
+#else
+#define PIXY2_TRACE_CORES           portNUM_PROCESSORS
+#endif
+#endif
+
+#ifndef PIXY2_TRACE_CLOCK_CYCLES
+#define PIXY2_TRACE_CLOCK_CYCLES    (1UL << 30)
+#endif
+
+#if PIXY2_TRACE_EVENTS & (PIXY2_TRACE_EVENTS - 1)
+#error "PIXY2_TRACE_EVENTS must be a power of two"
+#endif
+
+#define PIXY2_TRACE_BEGIN(id, arg)    Pixy2Tracer::record(PIXY2_TRACE_TYPE_BEGIN, id, arg)
+#define PIXY2_TRACE_END(id, arg)      Pixy2Tracer::record(PIXY2_TRACE_TYPE_END, id, arg)
+#define PIXY2_TRACE_INSTANT(id, arg)  Pixy2Tracer::record(PIXY2_TRACE_TYPE_INSTANT, id, arg)
+
+struct Pixy2TraceEvent
+{
+  uint32_t cycles;
+  uint32_t task;
+  uint8_t type;
+  uint8_t id;
+  uint16_t arg;
+};
+
+static_assert(sizeof(Pixy2TraceEvent) == 12, "Pixy2TraceEvent is written as 12 bytes");
+
+struct Pixy2TraceRing
+{
+  uint32_t head;         // events ever claimed
+  uint32_t clock;        // cycles and head at the last clock event
+  uint32_t clockHead;
+  Pixy2TraceEvent events[PIXY2_TRACE_EVENTS];
+};
+
+class Pixy2Tracer
+{
+public:
+  // Clear the rings and start recording.
+  static void start()
+  {
+    uint8_t core;
+
+    stop();
+    memset(s_rings, 0, sizeof(s_rings));
+    for (core = 0; core < PIXY2_TRACE_CORES; core++)
+    {
+#if !defined(PIXY2_TRACE_HOST) && portNUM_PROCESSORS > 1
+      // each core stamps its own counter
+      if (core != xPortGetCoreID())
+      {
+        esp_ipc_call_blocking(core, clockHere, NULL);
+        continue;
+      }
+#endif
+      clock(&s_rings[core], cycles());
+    }
+    __atomic_store_n(&s_on, true, __ATOMIC_RELEASE);
+  }
+
+  // Stop recording; an event being written on the other core finishes within a few
+  // instructions.
+  static void stop()
+  {
+    __atomic_store_n(&s_on, false, __ATOMIC_RELEASE);
+  }
+
+  static bool on() { return __atomic_load_n(&s_on, __ATOMIC_RELAXED); }
+
+  // Inlined into interrupt handlers, which may run from IRAM.
+  static inline __attribute__((always_inline)) void record(uint8_t type, uint8_t id, uint16_t arg)
+  {
+    Pixy2TraceRing *ring;
+    uint32_t now;
+
+    if (!on())
+      return;
+    ring = &s_rings[core()];
+    now = cycles();
+    if (now - ring->clock > PIXY2_TRACE_CLOCK_CYCLES || ring->head - ring->clockHead >= PIXY2_TRACE_EVENTS/8)
+      clock(ring, now);
+    put(ring, now, task(), type, id, arg);
+  }
+
+  // events recorded on core, and how many of them were overwritten
+  static uint32_t recorded(uint8_t core) { return s_rings[core].head; }
+  static uint32_t lost(uint8_t core)
+  {
+    return s_rings[core].head > PIXY2_TRACE_EVENTS ? s_rings[core].head - PIXY2_TRACE_EVENTS : 0;
+  }
+
+  // Write the rings to anything with write(const uint8_t *, size_t), e.g. Serial. Call
+  // stop() first.
+  template <class Out> static void dump(Out &out)
+  {
+    uint8_t hdr[12] = { 'P', 'X', 'T', 'R', 1, PIXY2_TRACE_CORES, sizeof(Pixy2TraceEvent), 0 };
+    uint32_t n, first, i;
+    uint8_t core;
+
+    put32(hdr + 8, mhz());
+    out.write(hdr, sizeof(hdr));
+    for (core = 0; core < PIXY2_TRACE_CORES; core++)
+    {
+      const Pixy2TraceRing &ring = s_rings[core];
+      n = ring.head - lost(core);
+      first = lost(core);
+      put32(hdr, n);
+      put32(hdr + 4, lost(core));
+      out.write(hdr, 8);
+      // in two pieces where the ring wraps
+      i = first & (PIXY2_TRACE_EVENTS - 1);
+      if (i + n > PIXY2_TRACE_EVENTS)
+      {
+        out.write((const uint8_t *)&ring.events[i], (PIXY2_TRACE_EVENTS - i)*sizeof(Pixy2TraceEvent));
+        n -= PIXY2_TRACE_EVENTS - i;
+        i = 0;
+      }
+      out.write((const uint8_t *)&ring.events[i], n*sizeof(Pixy2TraceEvent));
+    }
+  }
+
+private:
+#ifndef PIXY2_TRACE_HOST
+  static inline __attribute__((always_inline)) uint32_t cycles() { return esp_cpu_get_cycle_count(); }
+  static inline __attribute__((always_inline)) uint32_t micros32() { return (uint32_t)esp_timer_get_time(); }
+  static inline __attribute__((always_inline)) uint8_t core() { return xPortGetCoreID(); }
+  static inline __attribute__((always_inline)) uint32_t task()
+  {
+    return xPortInIsrContext() ? 0 : (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+  }
+  static uint32_t mhz() { return getCpuFrequencyMhz(); }
+
+  static void clockHere(void *)
+  {
+    clock(&s_rings[core()], cycles());
+  }
+#else
+  // a 100 MHz counter from the monotonic clock
+  static uint32_t cycles()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec*100000000 + ts.tv_nsec/10);
+  }
+  static uint32_t micros32() { return micros(); }
+  static uint8_t core() { return sched_getcpu()%PIXY2_TRACE_CORES; }
+  static uint32_t task()
+  {
+    static thread_local uint32_t tid = gettid();
+    return tid;
+  }
+  static uint32_t mhz() { return 100; }
+#endif
+
+  static inline __attribute__((always_inline)) void put(Pixy2TraceRing *ring, uint32_t stamp, uint32_t who,
+    uint8_t type, uint8_t id, uint16_t arg)
+  {
+    Pixy2TraceEvent *e = &ring->events[__atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & (PIXY2_TRACE_EVENTS - 1)];
+
+    e->cycles = stamp;
+    e->task = who;
+    e->type = type;
+    e->id = id;
+    e->arg = arg;
+  }
+
+  static inline __attribute__((always_inline)) void clock(Pixy2TraceRing *ring, uint32_t now)
+  {
+    ring->clock = now;
+    ring->clockHead = ring->head;
+    put(ring, now, micros32(), PIXY2_TRACE_TYPE_INSTANT, PIXY2_TRACE_CLOCK, 0);
+  }
+
+  static void put32(uint8_t *p, uint32_t v)
+  {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+  }
+
+  static inline bool s_on = false;
+  static inline Pixy2TraceRing s_rings[PIXY2_TRACE_CORES];
+};
+
+#else
+
+#define PIXY2_TRACE_BEGIN(id, arg)    do { } while (0)
+#define PIXY2_TRACE_END(id, arg)      do { } while (0)
+#define PIXY2_TRACE_INSTANT(id, arg)  do { } while (0)
+
+#endif // PIXY2_TRACE
+
+#endif // _PIXY2TRACE_H
@@ -1,108 +1,602 @@
-//
-// begin license header
-//
-// This file is part of Pixy CMUcam5 or "Pixy" for short
-//
-// All Pixy source code is provided under the terms of the
-// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
-// Those wishing to use Pixy source code, software and/or
-// technologies under different licensing terms should contact us at
-// cmucam@cs.cmu.edu. Such licensing terms are available for
-// all portions of the Pixy codebase presented here.
-//
-// end license header
-//
-// UART link class.
-// On ESP32 we use HardwareSerial2 with selectable RX/TX pins.
-// On AVR/others we use Serial1 as in the original library.
-
-#ifndef _PIXY2UART_H
-#define _PIXY2UART_H
-
-#include "TPixy2.h"
-#include <Arduino.h>
-
-// ---------- Defaults you can override in your sketch BEFORE including Pixy2UART.h ----------
-#ifndef PIXY_UART_BAUDRATE
-#define PIXY_UART_BAUDRATE 115200
-#endif
-
-#ifdef ARDUINO_ARCH_ESP32
-  // Default pins for ESP32 DevKit V1 (UART2)
-  #ifndef PIXY2_UART_RX_PIN
-  #define PIXY2_UART_RX_PIN 16
-  #endif
-  #ifndef PIXY2_UART_TX_PIN
-  #define PIXY2_UART_TX_PIN 17
-  #endif
-#endif
-// -----------------------------------------------------------------------------------------
-
-class Link2UART
-{
-public:
-  // arg: baud rate or PIXY_DEFAULT_ARGVAL to use default
-  int8_t open(uint32_t arg)
-  {
-    uint32_t baud = (arg == PIXY_DEFAULT_ARGVAL) ? PIXY_UART_BAUDRATE : arg;
-
-#ifdef ARDUINO_ARCH_ESP32
-    // Use UART2 on ESP32 with configured pins.
-    // NOTE: Ensure PixyMon is set to Interface=UART, Baud=baud, and USB is unplugged.
-    Serial2.begin(baud, SERIAL_8N1, PIXY2_UART_RX_PIN, PIXY2_UART_TX_PIN);
-#else
-    // Non-ESP32 (e.g., AVR Mega) uses Serial1 like the original code.
-    Serial1.begin(baud);
-#endif
-    return 0;
-  }
-
-  void close() { }
-
-  // Receive exactly len bytes with ~2ms timeout per byte.
-  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
-  {
-    if (cs) *cs = 0;
-
-    for (uint8_t i = 0; i < len; i++)
-    {
-      int16_t c = -1;
-      uint16_t spins = 0;
-
-      // ~2ms timeout at 10 us per check (200 iterations)
-      while (true)
-      {
-#ifdef ARDUINO_ARCH_ESP32
-        c = Serial2.read();
-#else
-        c = Serial1.read();
-#endif
-        if (c >= 0) break;
-        if (spins++ >= 200) return -1;
-        delayMicroseconds(10);
-      }
-
-      buf[i] = static_cast<uint8_t>(c);
-      if (cs) *cs += buf[i];
-    }
-    return len;
-  }
-
-  int16_t send(uint8_t *buf, uint8_t len)
-  {
-#ifdef ARDUINO_ARCH_ESP32
-    Serial2.write(buf, len);
-#else
-    Serial1.write(buf, len);
-#endif
-    return len;
-  }
-
-private:
-  uint8_t m_addr; // unused, kept for API parity
-};
-
-// Type alias the same way the library does
-typedef TPixy2<Link2UART> Pixy2UART;
-
-#endif // _PIXY2UART_H
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// UART link class.
+// On ESP32 we use HardwareSerial2 with selectable RX/TX pins.
+// On AVR/others we use Serial1 as in the original library.
+
+#ifndef _PIXY2UART_H
+#define _PIXY2UART_H
+
+#include "TPixy2.h"
+#include <Arduino.h>
+#include "Pixy2Trace.h"
+#ifdef ARDUINO_ARCH_ESP32
+#include "driver/uart.h"
+#endif
+
+// ---------- Defaults you can override in your sketch BEFORE including Pixy2UART.h ----------
+#ifndef PIXY_UART_BAUDRATE
+#define PIXY_UART_BAUDRATE 115200
+#endif
+
+// Pass to open()/init() instead of a baud rate to probe for the fastest rate the camera
+// answers reliably at (see Link2UART::negotiate()).
+#define PIXY_UART_AUTOBAUD             0x80000001
+
+// Version pings that must all pass (sync, type and checksum) before a rate is accepted.
+#ifndef PIXY_UART_PROBE_PINGS
+#define PIXY_UART_PROBE_PINGS          4
+#endif
+
+// Receive errors in a row that make an auto-baud link probe again before the next send,
+// once they have also gone on this long without a good read. A wrong rate fails every
+// read for good; a burst of noise on the right one lets reads through now and then, and
+// shouldn't cost a scan of every rate. A probe that lands back on the same rate doubles
+// the time, up to 8x, until one finds the camera somewhere else.
+#ifndef PIXY_UART_ERROR_LIMIT
+#define PIXY_UART_ERROR_LIMIT          8
+#endif
+#ifndef PIXY_UART_ERROR_MS
+#define PIXY_UART_ERROR_MS             250
+#endif
+
+// Software TX ring behind sendAsync(); must hold at least one full request.
+#ifndef PIXY_UART_TX_RING
+#define PIXY_UART_TX_RING              256
+#endif
+
+#ifdef ARDUINO_ARCH_ESP32
+  // Default pins for ESP32 DevKit V1 (UART2)
+  #ifndef PIXY2_UART_RX_PIN
+  #define PIXY2_UART_RX_PIN 16
+  #endif
+  #ifndef PIXY2_UART_TX_PIN
+  #define PIXY2_UART_TX_PIN 17
+  #endif
+  // RX ring size; must hold a whole response so setRxWakeup() can wake once per burst.
+  #ifndef PIXY2_UART_RX_BUFSIZE
+  #define PIXY2_UART_RX_BUFSIZE 512
+  #endif
+  // Idle time on RX, in symbols, that ends a burst and fires the wakeup.
+  #ifndef PIXY2_UART_RX_IDLE_SYMBOLS
+  #define PIXY2_UART_RX_IDLE_SYMBOLS 2
+  #endif
+#endif
+// -----------------------------------------------------------------------------------------
+
+// Candidate rates for PIXY_UART_AUTOBAUD, slowest (safe) first.
+static const uint32_t PIXY_UART_RATES[] = { 115200, 230400, 460800, 921600, 1000000, 1500000, 2000000 };
+#define PIXY_UART_NUM_RATES (sizeof(PIXY_UART_RATES)/sizeof(PIXY_UART_RATES[0]))
+
+// Receive-side timing, accumulated across recv() calls. waitUs is time spent waiting for
+// bytes that hadn't arrived yet; blockedUs is the part of it where the task was blocked
+// (CPU free for other tasks). In the spin loop blockedUs stays 0, so
+// blockedUs*100/waitUs is the idle percentage and wakeups/exchanges the wakeups per frame.
+struct Link2UARTRxStats
+{
+  uint32_t exchanges;   // send() calls
+  uint32_t wakeups;     // RX events delivered while waiting; counted in the UART event task
+  uint32_t spins;       // spin-loop polls that found no byte
+  uint32_t waitUs;
+  uint32_t blockedUs;
+};
+
+// Called once the last byte queued by sendAsync() has left the shift register.
+// doneUs is the micros() time it left, which is where response latency starts.
+typedef void (*Link2UARTTxDone)(uint32_t doneUs, void *arg);
+
+class Link2UART
+{
+public:
+  Link2UART()
+  {
+    m_baud = PIXY_UART_BAUDRATE;
+    m_autoBaud = false;
+    m_renegotiate = false;
+    m_errors = m_syncBytes = 0;
+    m_goodMs = 0;
+    m_errorMs = PIXY_UART_ERROR_MS;
+    m_timeouts = m_syncErrors = 0;
+    m_renegotiations = 0;
+#ifdef ARDUINO_ARCH_ESP32
+    m_rxSem = NULL;
+    m_rxWakeup = false;
+#endif
+    m_txHead = m_txTail = m_txCount = 0;
+    m_txPending = false;
+    m_txDone = NULL;
+    m_txStartUs = m_txWireUs = m_txDoneUs = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+  }
+
+  // arg: baud rate, PIXY_DEFAULT_ARGVAL to use default, or PIXY_UART_AUTOBAUD to probe
+  int8_t open(uint32_t arg)
+  {
+    return open(arg, 0);
+  }
+
+  // As open(arg), but with PIXY_UART_AUTOBAUD and a startBaud the camera answered at
+  // before, start there without probing. Errors still make the link probe again.
+  int8_t open(uint32_t arg, uint32_t startBaud)
+  {
+    m_autoBaud = (arg == PIXY_UART_AUTOBAUD);
+    if (m_autoBaud)
+      m_baud = startBaud ? startBaud : PIXY_UART_BAUDRATE;
+    else
+      m_baud = arg == PIXY_DEFAULT_ARGVAL ? PIXY_UART_BAUDRATE : arg;
+    m_errors = m_syncBytes = 0;
+    m_goodMs = millis();
+    m_errorMs = PIXY_UART_ERROR_MS;
+    m_timeouts = m_syncErrors = 0;
+    m_renegotiations = 0;
+    m_renegotiate = false;
+    // the wire model compares with the clock, which may be anywhere in its 32 bits
+    m_txStartUs = m_txDoneUs = micros();
+    m_txWireUs = 0;
+
+#ifdef ARDUINO_ARCH_ESP32
+    // Use UART2 on ESP32 with configured pins.
+    // NOTE: Ensure PixyMon is set to Interface=UART, Baud=baud, and USB is unplugged.
+    Serial2.setRxBufferSize(PIXY2_UART_RX_BUFSIZE);
+    Serial2.begin(m_baud, SERIAL_8N1, PIXY2_UART_RX_PIN, PIXY2_UART_TX_PIN);
+    setBurstTimeout();
+#else
+    // Non-ESP32 (e.g., AVR Mega) uses Serial1 like the original code.
+    Serial1.begin(m_baud);
+#endif
+    if (m_autoBaud && !startBaud)
+      negotiate(false);
+    return 0;
+  }
+
+  void close()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    setRxWakeup(false);
+#endif
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // Sleep in recv() until the UART reports the end of a burst (RX idle timeout) instead of
+  // polling every 10 us. The callback runs in the UART driver's event task and gives a
+  // semaphore, so a waiting task wakes once per response and the CPU is free meanwhile.
+  bool setRxWakeup(bool enable)
+  {
+    if (enable)
+    {
+      if (m_rxSem==NULL && (m_rxSem = xSemaphoreCreateBinary())==NULL)
+        return false;
+      Serial2.setRxTimeout(PIXY2_UART_RX_IDLE_SYMBOLS);
+      Serial2.onReceive([this]() {
+        // the driver's event task, while loop() may be reading or resetting the stats
+        __atomic_add_fetch(&m_stats.wakeups, 1, __ATOMIC_RELAXED);
+        xSemaphoreGive(m_rxSem);
+      }, true);
+      m_rxWakeup = true;
+    }
+    else if (m_rxWakeup)
+    {
+      Serial2.onReceive(NULL);
+      m_rxWakeup = false;
+    }
+    return true;
+  }
+#endif
+
+  const Link2UARTRxStats &rxStats() const { return m_stats; }
+  void resetRxStats()
+  {
+    uint32_t wakeups = __atomic_load_n(&m_stats.wakeups, __ATOMIC_RELAXED);
+
+    m_stats.exchanges = m_stats.spins = m_stats.waitUs = m_stats.blockedUs = 0;
+    // take off only what was read, so a wakeup the event task counts meanwhile stays
+    __atomic_sub_fetch(&m_stats.wakeups, wakeups, __ATOMIC_RELAXED);
+  }
+
+  // Probe the candidate rates and lock in the fastest one that passes PIXY_UART_PROBE_PINGS
+  // checksummed version requests. Pixy2 has no command to change its UART rate (it is set
+  // in PixyMon), so this finds the rate the camera is configured for and rejects rates the
+  // wiring can't carry. The camera's rate doesn't follow ours, so an error spike can't be
+  // fixed by stepping down: with degrade set, the current rate is retried first and then
+  // slower ones, fastest first, before the full scan. That re-locks quickly after a burst
+  // of noise, and finds the camera again if someone set it slower in PixyMon.
+  // Returns the locked rate. When nothing answers it falls back to PIXY_UART_BAUDRATE, or
+  // with degrade stays where it was: noise that drowns every probe doesn't move the camera.
+  uint32_t negotiate(bool degrade)
+  {
+    uint32_t was = m_baud, best = 0;
+    int8_t i;
+
+    if (degrade)
+    {
+      for (i = PIXY_UART_NUM_RATES - 1; i >= 0 && !best; i--)
+        if (PIXY_UART_RATES[i] <= was && probe(PIXY_UART_RATES[i]))
+          best = PIXY_UART_RATES[i];
+    }
+    if (!best)
+    {
+      for (i = 0; i < (int8_t)PIXY_UART_NUM_RATES; i++)
+        if (probe(PIXY_UART_RATES[i]))
+          best = PIXY_UART_RATES[i];
+    }
+    if (!best)
+      best = degrade ? was : PIXY_UART_BAUDRATE;
+    if (degrade && best == was)
+      m_errorMs = m_errorMs < 8*PIXY_UART_ERROR_MS ? m_errorMs*2 : m_errorMs;
+    else
+      m_errorMs = PIXY_UART_ERROR_MS;
+
+    setBaud(best);
+    m_errors = m_syncBytes = 0;
+    m_goodMs = millis();
+    m_renegotiate = false;
+    return best;
+  }
+
+  uint32_t baud() const { return m_baud; }
+  uint32_t timeouts() const { return m_timeouts; }
+  uint32_t syncErrors() const { return m_syncErrors; }
+  uint16_t renegotiations() const { return m_renegotiations; }
+
+  // Receive exactly len bytes with ~2ms timeout per byte.
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    int16_t res;
+
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_LINK_RECV, len);
+    if (m_txPending)
+      poll();
+    res = recvBytes(buf, len, cs);
+    PIXY2_TRACE_END(PIXY2_TRACE_LINK_RECV, len);
+
+    if (res < 0)
+    {
+      m_timeouts++;
+      countError();
+    }
+    else if (len == 1)
+    {
+      // TPixy2::getSync() hunts for the sync word one byte at a time. A long run of single
+      // byte reads means we're receiving garbage, which is what a wrong rate looks like.
+      if (++m_syncBytes > 32)
+      {
+        m_syncBytes = 0;
+        m_syncErrors++;
+        countError();
+      }
+    }
+    else
+    {
+      m_errors = m_syncBytes = 0;
+      m_goodMs = millis();
+    }
+    return res;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    int16_t res;
+
+    PIXY2_TRACE_BEGIN(PIXY2_TRACE_LINK_SEND, len);
+    if (m_renegotiate)
+    {
+      m_renegotiations++;
+      negotiate(true);
+    }
+    // keep ordering with anything still queued by sendAsync(), and let a done callback
+    // still to come fire before this exchange takes the TX state over
+    while (m_txPending && m_txDone && poll());
+    while (m_txCount)
+      pumpTx();
+    beginExchange(NULL, NULL);
+    res = sendBytes(buf, len);
+    PIXY2_TRACE_END(PIXY2_TRACE_LINK_SEND, len);
+    return res;
+  }
+
+  // Queue len bytes in the TX ring and return without waiting for the UART. Bytes move to
+  // the UART as it has room (from poll(), send() and recv()). done, if given, is called
+  // from poll() once the last queued byte is on the wire. Returns len, or -1 if the ring
+  // can't take the whole request or an earlier request's done callback is still to come.
+  int16_t sendAsync(const uint8_t *buf, uint8_t len, Link2UARTTxDone done = NULL, void *arg = NULL)
+  {
+    uint8_t i;
+
+    if (len > PIXY_UART_TX_RING - m_txCount || (m_txPending && m_txDone && poll()))
+      return -1;
+    for (i = 0; i < len; i++)
+    {
+      m_txRing[m_txHead] = buf[i];
+      m_txHead = (m_txHead + 1) % PIXY_UART_TX_RING;
+    }
+    m_txCount += len;
+    beginExchange(done, arg);
+    poll();
+    return len;
+  }
+
+  // Feed queued bytes to the UART without blocking and check for TX completion.
+  // Returns true while bytes are still queued or on the wire.
+  bool poll()
+  {
+    pumpTx();
+    if (!m_txPending)
+      return false;
+    if (m_txCount || !txIdle())
+      return true;
+    m_txPending = false;
+    if (m_txDone)
+      m_txDone(m_txDoneUs, m_txDoneArg);
+    return false;
+  }
+
+  // When the last byte of the most recent send()/sendAsync() left the shift register
+  // (valid once poll() has returned false).
+  uint32_t txDoneMicros() const { return m_txDoneUs; }
+
+private:
+  void beginExchange(Link2UARTTxDone done, void *arg)
+  {
+    m_stats.exchanges++;
+    m_txDone = done;
+    m_txDoneArg = arg;
+    m_txPending = true;
+#ifdef ARDUINO_ARCH_ESP32
+    // drop a wakeup left over from a response the previous exchange already polled out
+    if (m_rxWakeup)
+      xSemaphoreTake(m_rxSem, 0);
+#endif
+  }
+
+  void pumpTx()
+  {
+    uint16_t n;
+    int room;
+
+    while (m_txCount)
+    {
+#ifdef ARDUINO_ARCH_ESP32
+      room = Serial2.availableForWrite();
+#else
+      room = Serial1.availableForWrite();
+#endif
+      if (room <= 0)
+        break;
+      n = PIXY_UART_TX_RING - m_txTail; // contiguous run
+      if (n > m_txCount) n = m_txCount;
+      if (n > room) n = room;
+      if (n > 0xff) n = 0xff;
+      sendBytes(&m_txRing[m_txTail], n);
+      m_txTail = (m_txTail + n) % PIXY_UART_TX_RING;
+      m_txCount -= n;
+    }
+  }
+
+  // Model of the wire: bytes handed to an idle transmitter start now, later ones queue
+  // behind them at 10 bit times each (8N1).
+  void txAccount(uint16_t n)
+  {
+    uint32_t now = micros();
+
+    if ((int32_t)(now - (m_txStartUs + m_txWireUs)) >= 0)
+    {
+      m_txStartUs = now;
+      m_txWireUs = 0;
+    }
+    m_txWireUs += (uint32_t)((uint64_t)n*10000000/m_baud);
+  }
+
+  // On ESP32 the driver tells us when the shift register is empty; we report the modelled
+  // finish time unless it's still ahead (the model is conservative). Elsewhere we only
+  // have the model.
+  bool txIdle()
+  {
+    uint32_t now = micros(), est = m_txStartUs + m_txWireUs;
+
+#ifdef ARDUINO_ARCH_ESP32
+    if (uart_wait_tx_done(UART_NUM_2, 0)!=ESP_OK)
+      return false;
+    m_txDoneUs = (int32_t)(now - est) >= 0 ? est : now;
+#else
+    if ((int32_t)(now - est) < 0)
+      return false;
+    m_txDoneUs = est;
+#endif
+    return true;
+  }
+
+  void countError()
+  {
+    if (m_errors < 0xff)
+      m_errors++;
+    if (m_autoBaud && m_errors >= PIXY_UART_ERROR_LIMIT && millis() - m_goodMs >= m_errorMs)
+      m_renegotiate = true;
+  }
+
+  void setBaud(uint32_t baud)
+  {
+    m_baud = baud;
+#ifdef ARDUINO_ARCH_ESP32
+    Serial2.updateBaudRate(baud);
+    setBurstTimeout();
+#else
+    Serial1.end();
+    Serial1.begin(baud);
+#endif
+  }
+
+  void drain()
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    while (Serial2.read() >= 0);
+#else
+    while (Serial1.read() >= 0);
+#endif
+  }
+
+  // One rate passes when every ping gets a version response with a valid checksum.
+  bool probe(uint32_t baud)
+  {
+    static const uint8_t req[PIXY_SEND_HEADER_SIZE] =
+      { PIXY_NO_CHECKSUM_SYNC & 0xff, PIXY_NO_CHECKSUM_SYNC >> 8, PIXY_TYPE_REQUEST_VERSION, 0 };
+    uint8_t hdr[4], payload[32], c, cprev, i, n;
+    uint16_t csCalc;
+
+    setBaud(baud);
+    delay(2); // let the line settle after the rate change
+    drain();
+
+    for (n = 0; n < PIXY_UART_PROBE_PINGS; n++)
+    {
+      sendBytes(const_cast<uint8_t *>(req), sizeof(req));
+      for (i = 0, cprev = 0; ; i++, cprev = c)
+      {
+        if (i >= 16 || recvBytes(&c, 1) < 0)
+          return false;
+        if ((uint16_t)(cprev | (c << 8)) == PIXY_CHECKSUM_SYNC)
+          break;
+      }
+      if (recvBytes(hdr, 4) < 0 || hdr[0] != PIXY_TYPE_RESPONSE_VERSION || hdr[1] > sizeof(payload))
+        return false;
+      if (recvBytes(payload, hdr[1], &csCalc) < 0 || csCalc != (uint16_t)(hdr[2] | (hdr[3] << 8)))
+        return false;
+    }
+    return true;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // A wakeup only comes at the end of a burst, so allow for a whole buffer on the wire
+  // plus the ~2ms response gap the spin loop tolerates.
+  void setBurstTimeout()
+  {
+    m_burstUs = 2000 + (uint32_t)PIXY_BUFFERSIZE*10*1000/(m_baud/1000);
+    m_burstTicks = pdMS_TO_TICKS(m_burstUs/1000 + 1);
+  }
+
+  int16_t waitByte()
+  {
+    int16_t c;
+    uint32_t t0 = micros(), t1;
+    bool woken;
+
+    while ((c = Serial2.read()) < 0)
+    {
+      if (micros() - t0 >= m_burstUs)
+        break;
+      // only the take itself blocks; a wakeup already given returns at once
+      t1 = micros();
+      woken = xSemaphoreTake(m_rxSem, m_burstTicks)==pdTRUE;
+      m_stats.blockedUs += micros() - t1;
+      if (!woken)
+        break;
+    }
+    m_stats.waitUs += micros() - t0;
+    return c;
+  }
+#endif
+
+  int16_t recvBytes(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    if (cs) *cs = 0;
+
+    for (uint8_t i = 0; i < len; i++)
+    {
+      int16_t c = -1;
+      uint16_t spins = 0;
+      uint32_t t0 = 0;
+
+#ifdef ARDUINO_ARCH_ESP32
+      if (m_rxWakeup)
+      {
+        if ((c = Serial2.read()) < 0 && (c = waitByte()) < 0)
+          return -1;
+      }
+      else
+#endif
+      // ~2ms timeout at 10 us per check (200 iterations)
+      while (true)
+      {
+#ifdef ARDUINO_ARCH_ESP32
+        c = Serial2.read();
+#else
+        c = Serial1.read();
+#endif
+        if (c >= 0) break;
+        if (spins==0) t0 = micros();
+        m_stats.spins++;
+        if (spins++ >= 200)
+        {
+          m_stats.waitUs += micros() - t0;
+          return -1;
+        }
+        delayMicroseconds(10);
+      }
+      if (spins)
+        m_stats.waitUs += micros() - t0;
+
+      buf[i] = static_cast<uint8_t>(c);
+      if (cs) *cs += buf[i];
+    }
+    return len;
+  }
+
+  int16_t sendBytes(uint8_t *buf, uint8_t len)
+  {
+    txAccount(len);
+#ifdef ARDUINO_ARCH_ESP32
+    Serial2.write(buf, len);
+#else
+    Serial1.write(buf, len);
+#endif
+    return len;
+  }
+
+  uint8_t m_addr; // unused, kept for API parity
+
+  uint32_t m_baud;
+  bool m_autoBaud;
+  bool m_renegotiate;
+  uint8_t m_errors;         // receive errors since the last good multi-byte read
+  uint32_t m_goodMs;        // millis() of that read, or of the last negotiate()
+  uint32_t m_errorMs;       // how long errors must go on before probing, see PIXY_UART_ERROR_MS
+  uint8_t m_syncBytes;      // single-byte reads since the last good multi-byte read
+  uint32_t m_timeouts;
+  uint32_t m_syncErrors;
+  uint16_t m_renegotiations;
+
+  Link2UARTRxStats m_stats;
+
+  uint8_t m_txRing[PIXY_UART_TX_RING];
+  uint16_t m_txHead;
+  uint16_t m_txTail;
+  uint16_t m_txCount;
+  bool m_txPending;
+  Link2UARTTxDone m_txDone;
+  void *m_txDoneArg;
+  uint32_t m_txStartUs;
+  uint32_t m_txWireUs;
+  uint32_t m_txDoneUs;
+#ifdef ARDUINO_ARCH_ESP32
+  SemaphoreHandle_t m_rxSem;
+  bool m_rxWakeup;
+  uint32_t m_burstUs;
+  TickType_t m_burstTicks;
+#endif
+};
+
+// Type alias the same way the library does
+typedef TPixy2<Link2UART> Pixy2UART;
+
+#endif // _PIXY2UART_H
@@ -0,0 +1,222 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Linux UART link class.
+// Same interface as Link2UART, on a /dev/tty* device: raw termios with any baud rate
+// (termios2/BOTHER), non-blocking reads driven by epoll and batched into a ring so
+// TPixy2's byte-at-a-time sync hunt doesn't cost a syscall per byte.
+
+#ifndef _PIXY2UARTLINUX_H
+#define _PIXY2UARTLINUX_H
+
+#include "Pixy2Host.h"
+#include "TPixy2.h"
+
+#include <asm/termbits.h>   // termios2; can't be mixed with <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifndef PIXY_UART_BAUDRATE
+#define PIXY_UART_BAUDRATE 115200
+#endif
+
+#ifndef PIXY2_UART_DEVICE
+#define PIXY2_UART_DEVICE "/dev/ttyUSB0"
+#endif
+
+// Longest gap between bytes before recv() gives up. USB serial adapters batch RX
+// (FTDI's latency timer defaults to 16ms), so this is looser than the ESP32's ~2ms.
+#ifndef PIXY2_UART_LINUX_TIMEOUT_MS
+#define PIXY2_UART_LINUX_TIMEOUT_MS 20
+#endif
+
+// RX ring; power of two.
+#ifndef PIXY2_UART_LINUX_RING
+#define PIXY2_UART_LINUX_RING 4096
+#endif
+
+class Link2UARTLinux
+{
+public:
+  Link2UARTLinux()
+  {
+    m_device = PIXY2_UART_DEVICE;
+    m_fd = m_epfd = -1;
+    m_head = m_tail = 0;
+    m_reads = m_writes = m_waits = 0;
+  }
+
+  // Call before init()/open() to use another device, e.g. "/dev/ttyAMA0" or a pty.
+  void setDevice(const char *device) { m_device = device; }
+
+  // arg: baud rate or PIXY_DEFAULT_ARGVAL to use default
+  int8_t open(uint32_t arg)
+  {
+    struct termios2 tio;
+    struct epoll_event ev;
+
+    close();
+    m_baud = (arg == PIXY_DEFAULT_ARGVAL) ? PIXY_UART_BAUDRATE : arg;
+
+    m_fd = ::open(m_device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0)
+      return PIXY_RESULT_ERROR;
+
+    // raw 8N1, no flow control, no line discipline processing
+    if (ioctl(m_fd, TCGETS2, &tio) < 0)
+      goto fail;
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= CS8 | CLOCAL | CREAD | BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = tio.c_ospeed = m_baud;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(m_fd, TCSETS2, &tio) < 0)
+      goto fail;
+    ioctl(m_fd, TCFLSH, TCIOFLUSH);
+
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0)
+      goto fail;
+    ev.events = EPOLLIN;
+    ev.data.fd = m_fd;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_fd, &ev) < 0)
+      goto fail;
+
+    m_head = m_tail = 0;
+    return 0;
+
+fail:
+    close();
+    return PIXY_RESULT_ERROR;
+  }
+
+  void close()
+  {
+    if (m_epfd >= 0)
+      ::close(m_epfd);
+    if (m_fd >= 0)
+      ::close(m_fd);
+    m_fd = m_epfd = -1;
+  }
+
+  // Receive exactly len bytes; fails if no byte arrives for PIXY2_UART_LINUX_TIMEOUT_MS.
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (cs) *cs = 0;
+
+    for (i = 0; i < len; i++)
+    {
+      if (m_head == m_tail && fill() <= 0)
+        return -1;
+      buf[i] = m_ring[m_tail++ & (PIXY2_UART_LINUX_RING - 1)];
+      if (cs) *cs += buf[i];
+    }
+    return len;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    struct pollfd pfd = { m_fd, POLLOUT, 0 };
+    ssize_t n;
+    uint8_t sent = 0;
+
+    while (sent < len)
+    {
+      n = write(m_fd, buf + sent, len - sent);
+      m_writes++;
+      if (n > 0)
+        sent += n;
+      else if (n < 0 && errno == EAGAIN)
+      {
+        if (poll(&pfd, 1, PIXY2_UART_LINUX_TIMEOUT_MS) <= 0)
+          return -1;
+      }
+      else if (n < 0 && errno != EINTR)
+        return -1;
+    }
+    return len;
+  }
+
+  uint32_t baud() const { return m_baud; }
+  int fd() const { return m_fd; }
+
+  // syscall counters: read() calls, write() calls and epoll_wait() calls
+  uint32_t reads() const { return m_reads; }
+  uint32_t writes() const { return m_writes; }
+  uint32_t waits() const { return m_waits; }
+
+private:
+  // Read whatever the driver has into the ring, waiting on epoll when it has nothing.
+  // Returns bytes added, 0 on timeout, -1 on error.
+  int fill()
+  {
+    struct epoll_event ev;
+    uint32_t start, room;
+    ssize_t n;
+    int r;
+
+    while (true)
+    {
+      // contiguous free space; the ring is empty whenever we're called
+      start = m_head & (PIXY2_UART_LINUX_RING - 1);
+      room = PIXY2_UART_LINUX_RING - start;
+      n = read(m_fd, m_ring + start, room);
+      m_reads++;
+      if (n > 0)
+      {
+        m_head += n;
+        return n;
+      }
+      // with VMIN=VTIME=0 an empty tty reads 0 rather than failing with EAGAIN;
+      // hangups are reported through epoll instead
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        return -1;
+
+      m_waits++;
+      r = epoll_wait(m_epfd, &ev, 1, PIXY2_UART_LINUX_TIMEOUT_MS);
+      if (r == 0)
+        return 0;
+      if (r < 0 && errno != EINTR)
+        return -1;
+      if (r > 0 && (ev.events & (EPOLLHUP | EPOLLERR)))
+        return -1;
+    }
+  }
+
+  const char *m_device;
+  int m_fd;
+  int m_epfd;
+  uint32_t m_baud;
+
+  uint8_t m_ring[PIXY2_UART_LINUX_RING];
+  uint32_t m_head;   // free-running; index with & (PIXY2_UART_LINUX_RING - 1)
+  uint32_t m_tail;
+
+  uint32_t m_reads;
+  uint32_t m_writes;
+  uint32_t m_waits;
+};
+
+typedef TPixy2<Link2UARTLinux> Pixy2UARTLinux;
+
+#endif // _PIXY2UARTLINUX_H
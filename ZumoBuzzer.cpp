@@ -9,12 +9,18 @@
 #include <esp32-hal-ledc.h>     // LEDC (PWM) helpers (3.x, pin-based)
 #include <esp32-hal-timer.h>    // HW timer helpers (3.x)
 #include "ZumoBuzzer.h"
+#include "Pixy2Trace.h"
 
 // ===================== CONFIGURABLES =====================
 #ifndef ZUMO_BUZZER_PIN
 #define ZUMO_BUZZER_PIN 13      // change to your buzzer GPIO
 #endif
 
+// Pixy2Memory.h's budget for the state below, without pulling TPixy2 in here
+#ifndef PIXY2_BUDGET_BUZZER
+#define PIXY2_BUDGET_BUZZER 128
+#endif
+
 // LEDC: 12-bit duty resolution (0..4095). Works fine up to 10 kHz tones.
 static const uint8_t  LEDC_RES_BITS = 12;
 static const uint32_t LEDC_DUTY_MAX = (1U << LEDC_RES_BITS) - 1;
@@ -47,6 +53,7 @@ static portMUX_TYPE s_timerMux = portMUX_INITIALIZER_UNLOCKED;
 static volatile bool s_noteElapsed = false;
 
 static void IRAM_ATTR onTimerDone() {
+  PIXY2_TRACE_INSTANT(PIXY2_TRACE_BUZZER_ISR, 0);
   // Stop PWM immediately (silence)
   ledcWrite(ZUMO_BUZZER_PIN, 0);
   portENTER_CRITICAL_ISR(&s_timerMux);
@@ -266,9 +273,11 @@ static void nextNote() {
   unsigned int  dot_add;
   char c;
 
+  PIXY2_TRACE_BEGIN(PIXY2_TRACE_BUZZER_NOTE, 0);
   if (staccato && staccato_rest_duration) {
     ZumoBuzzer::playNote(SILENT_NOTE, staccato_rest_duration, 0);
     staccato_rest_duration = 0;
+    PIXY2_TRACE_END(PIXY2_TRACE_BUZZER_NOTE, 0);
     return;
   }
 
@@ -314,7 +323,9 @@ parse_character:
       tmp_octave = octave; tmp_duration = duration;
       goto parse_character;
     default:
-      buzzerSequence = 0; return;
+      buzzerSequence = 0;
+      PIXY2_TRACE_END(PIXY2_TRACE_BUZZER_NOTE, 0);
+      return;
   }
 
   note += tmp_octave * 12;
@@ -343,6 +354,7 @@ parse_character:
   }
 
   ZumoBuzzer::playNote(rest ? SILENT_NOTE : note, tmp_duration, volume);
+  PIXY2_TRACE_END(PIXY2_TRACE_BUZZER_NOTE, 0);
 }
 
 // Advance sequence in main context (not inside ISR)
@@ -366,4 +378,18 @@ void ZumoBuzzer::playMode(unsigned char mode) {
   if (mode == PLAY_AUTOMATIC) playCheck();
 }
 
+// Bytes of state above, for Pixy2MemoryReport::addBuzzer().
+static constexpr uint32_t kBuzzerMemory =
+  sizeof(buzzerInitialized) + sizeof(buzzerFinished) + sizeof(buzzerSequence) +
+    sizeof(buzzerTimeout_ms) + sizeof(play_mode_setting) + sizeof(use_program_space) +
+    sizeof(octave) + sizeof(whole_note_duration) + sizeof(note_type) + sizeof(duration) +
+    sizeof(volume) + sizeof(staccato) + sizeof(staccato_rest_duration) +
+    sizeof(s_timer) + sizeof(s_timerMux) + sizeof(s_noteElapsed) +
+    sizeof(s_ledcAttached) + sizeof(s_currFreq);
+static_assert(kBuzzerMemory <= PIXY2_BUDGET_BUZZER, "ZumoBuzzer state is over its memory budget");
+
+uint32_t zumoBuzzerMemory() {
+  return kBuzzerMemory;
+}
+
 #endif // ARDUINO_ARCH_ESP32
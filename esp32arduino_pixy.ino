@@ -1,5 +1,6 @@
 #include <Pixy2.h>
 #include <SPI.h>
+#include "Pixy2Format.h"
 
 // Use VSPI pins on ESP32
 static const int PIXY_SCK  = 18;
@@ -27,20 +28,26 @@ void loop() {
   pixy.ccc.getBlocks();
 
   if (pixy.ccc.numBlocks) {
+    // the frame's report is built on the stack and goes to the UART in one write,
+    // or a few when there are more blocks than it holds
+    Pixy2Format<512> out;
+
     for (int i = 0; i < pixy.ccc.numBlocks; i++) {
       auto &b = pixy.ccc.blocks[i];
 
       // Replace '6' with whatever signature ID you taught for blue
       if (b.m_signature == 6) {
-        Serial.print("BLUE @ (");
-        Serial.print(b.m_x); Serial.print(", ");
-        Serial.print(b.m_y); Serial.print(")  w=");
-        Serial.print(b.m_width); Serial.print(" h=");
-        Serial.println(b.m_height);
+        // a line is at most 40 characters; send what's there before one might not fit
+        if (out.available() < 40) {
+          out.write(Serial);
+          out.clear();
+        }
+        out.str("BLUE @ (").udec(b.m_x).str(", ").udec(b.m_y).str(")  w=").udec(b.m_width).str(" h=").udec(b.m_height).endl();
 
         // TODO: do something—toggle a pin, send UART, etc.
         // digitalWrite(LED_BUILTIN, HIGH);
       }
     }
+    out.write(Serial);
   }
 }
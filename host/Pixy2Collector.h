@@ -0,0 +1,503 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Multi-node detection collector.
+// Reads Pixy2NodeProtocol packets from any number of serial devices (or other fds) on
+// one thread with epoll, and merges them into a single feed ordered by capture time.
+// Node clocks are mapped onto the host clock with a per-node offset: the smallest
+// arrival-minus-timestamp seen, which tracks the node's clock up to the shortest
+// transport delay and leaks upwards slowly to follow drift. Frames are held for
+// holdUs so slower links can catch up, then released in order to in-process consumers
+// and to clients of a Unix seqpacket socket (one packet per frame, re-stamped with host
+// time). A frame that turns up after later frames were released counts as late and is
+// dropped; sequence gaps count as drops; a node whose sequence and clock both go
+// backwards has restarted.
+//
+// With syncEvery() the collector also sends SYNC_REQ on every source and maps each
+// node that answers through a Pixy2ClockSync instead, which takes the transport delay
+// out (half the round trip, asymmetry aside) and follows drift without the leak. The
+// offset estimate then only fills in for nodes that haven't answered yet.
+//
+// DELTA packets are decoded per node against the node's last BLOCKS packet and released
+// as BLOCKS frames. A gap doesn't stop that; only DELTA packets whose BLOCKS packet was
+// lost can't be decoded, and count as undecoded until the next one.
+
+#ifndef _PIXY2COLLECTOR_H
+#define _PIXY2COLLECTOR_H
+
+#include "../Pixy2UARTLinux.h"
+#include "../Pixy2NodeProtocol.h"
+#include "../Pixy2TimeSync.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+#include <vector>
+
+#ifndef PIXY2_COLLECTOR_HOLD_US
+#define PIXY2_COLLECTOR_HOLD_US    20000
+#endif
+#define PIXY2_COLLECTOR_NODES      256
+
+struct Pixy2CollectorNode
+{
+  bool seen;
+  uint16_t nextSeq;
+  uint32_t frames;
+  uint32_t drops;        // sequence gaps
+  uint32_t late;         // arrived after the feed had moved past them
+  uint32_t restarts;
+  uint32_t lastTs;
+  uint64_t tsHigh;       // node clock wraps, in units of 2^32 us
+  int64_t offset;        // host us minus node us
+  Pixy2ClockSync sync;   // from SYNC_RESP, when the node answers
+  uint32_t syncs;
+  Pixy2FrameCodec codec; // last BLOCKS packet, for DELTA packets
+  uint8_t keySeq;        // its seq, low byte
+  uint32_t undecoded;    // DELTA packets without the BLOCKS packet they build on
+};
+
+// Released frame; hostUs is the capture time on the host clock.
+typedef void (*Pixy2CollectorFn)(const Pixy2NodeFrame &frame, uint64_t hostUs, void *arg);
+
+class Pixy2Collector
+{
+public:
+  Pixy2Collector(uint32_t holdUs = PIXY2_COLLECTOR_HOLD_US)
+  {
+    m_holdUs = holdUs;
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_listen.fd = -1;
+    m_listen.kind = LISTEN;
+    m_released = 0;
+    m_sources = m_clients = 0;
+    m_merged = m_late = m_undecoded = m_clientDrops = m_goneCrcErrors = 0;
+    m_syncUs = 0;
+    m_lastSync = 0;
+    for (int i = 0; i < PIXY2_COLLECTOR_NODES; i++)
+    {
+      m_nodes[i] = Pixy2CollectorNode();
+      m_nodes[i].codec.setAnchored(true);
+    }
+  }
+
+  ~Pixy2Collector()
+  {
+    size_t i;
+
+    for (i = 0; i < m_endpoints.size(); i++)
+      drop(m_endpoints[i], false);
+    if (m_listen.fd >= 0)
+      close(m_listen.fd);
+    close(m_epfd);
+  }
+
+  // Open a serial device (raw, 8N1) and read node packets from it. Returns the fd or -1.
+  int addDevice(const char *device, uint32_t baud)
+  {
+    Endpoint *ep = new Endpoint;
+
+    ep->kind = SOURCE;
+    ep->link.setDevice(device);
+    if (ep->link.open(baud) < 0)
+    {
+      delete ep;
+      return -1;
+    }
+    ep->fd = ep->link.fd();
+    return watch(ep);
+  }
+
+  // Read node packets from an fd that is already open (pipe, socket). Takes ownership.
+  int addFd(int fd)
+  {
+    Endpoint *ep = new Endpoint;
+
+    ep->kind = SOURCE;
+    ep->fd = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return watch(ep);
+  }
+
+  // Serve the merged feed on a Unix seqpacket socket. Returns 0 or -1.
+  int listen(const char *path)
+  {
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    m_listen.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen.fd < 0 || bind(m_listen.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(m_listen.fd, 16) < 0)
+      return -1;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &m_listen;
+    return epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_listen.fd, &ev);
+  }
+
+  // Send a clock sync request on every source this often; 0 stops.
+  void syncEvery(uint32_t ms) { m_syncUs = (uint64_t)ms*1000; }
+
+  void addConsumer(Pixy2CollectorFn fn, void *arg)
+  {
+    Consumer c = { fn, arg };
+    m_consumers.push_back(c);
+  }
+
+  // One epoll round: read whatever is ready, then release frames that are due. Waits at
+  // most timeoutMs, less if a held frame comes due sooner. Returns frames released.
+  int poll(int timeoutMs)
+  {
+    struct epoll_event evs[64];
+    uint64_t now = nowUs(), due;
+    int n, i;
+
+    if (!m_held.empty())
+    {
+      due = m_held.begin()->first + m_holdUs;
+      if (due <= now)
+        timeoutMs = 0;
+      else if ((due - now)/1000 + 1 < (uint64_t)timeoutMs)
+        timeoutMs = (due - now)/1000 + 1;
+    }
+    if (m_syncUs)
+    {
+      if (now - m_lastSync >= m_syncUs)
+      {
+        syncRequest((uint32_t)now);
+        m_lastSync = now;
+      }
+      if ((m_lastSync + m_syncUs - now)/1000 + 1 < (uint64_t)timeoutMs)
+        timeoutMs = (m_lastSync + m_syncUs - now)/1000 + 1;
+    }
+    n = epoll_wait(m_epfd, evs, 64, timeoutMs);
+    for (i = 0; i < n; i++)
+    {
+      Endpoint *ep = (Endpoint *)evs[i].data.ptr;
+
+      if (ep->kind == LISTEN)
+        accept();
+      else if (ep->kind == SOURCE)
+        read(ep, evs[i].events);
+      else if (evs[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        drop(ep, true);
+    }
+    return release(nowUs(), false);
+  }
+
+  // Release everything still held, e.g. before exiting.
+  int flush() { return release(0, true); }
+
+  const Pixy2CollectorNode &node(uint8_t id) const { return m_nodes[id]; }
+  uint32_t sources() const { return m_sources; }
+  uint32_t clients() const { return m_clients; }
+  uint32_t merged() const { return m_merged; }
+  uint32_t late() const { return m_late; }
+  // DELTA packets received but not released, all nodes
+  uint32_t undecoded() const { return m_undecoded; }
+  // frames a slow socket client didn't get
+  uint32_t clientDrops() const { return m_clientDrops; }
+  uint32_t crcErrors() const
+  {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < m_endpoints.size(); i++)
+      if (m_endpoints[i]->kind == SOURCE)
+        sum += m_endpoints[i]->parser.crcErrors();
+    return sum + m_goneCrcErrors;
+  }
+
+  static uint64_t nowUs()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+  }
+
+private:
+  enum Kind { SOURCE, LISTEN, CLIENT };
+
+  struct Endpoint
+  {
+    Kind kind;
+    int fd;
+    Link2UARTLinux link;      // owns fd for devices
+    Pixy2NodeParser parser;
+    Pixy2Collector *self;
+    uint64_t arrival;
+  };
+
+  struct Consumer
+  {
+    Pixy2CollectorFn fn;
+    void *arg;
+  };
+
+  int watch(Endpoint *ep)
+  {
+    struct epoll_event ev;
+
+    ep->self = this;
+    // clients only listen; nothing they write is read, so only their hangup is watched
+    // (level-triggered EPOLLIN on unread input would wake every epoll_wait at once)
+    ev.events = ep->kind == CLIENT ? EPOLLRDHUP : EPOLLIN;
+    ev.data.ptr = ep;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, ep->fd, &ev) < 0)
+    {
+      if (ep->link.fd() < 0)
+        close(ep->fd);
+      delete ep;
+      return -1;
+    }
+    m_endpoints.push_back(ep);
+    if (ep->kind == SOURCE)
+      m_sources++;
+    else
+      m_clients++;
+    return ep->fd;
+  }
+
+  void drop(Endpoint *ep, bool erase)
+  {
+    size_t i;
+
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, ep->fd, NULL);
+    if (ep->kind == SOURCE)
+    {
+      m_sources--;
+      m_goneCrcErrors += ep->parser.crcErrors();
+    }
+    else
+      m_clients--;
+    if (ep->link.fd() >= 0)
+      ep->link.close();
+    else
+      close(ep->fd);
+    if (erase)
+      for (i = 0; i < m_endpoints.size(); i++)
+        if (m_endpoints[i] == ep)
+        {
+          m_endpoints.erase(m_endpoints.begin() + i);
+          break;
+        }
+    delete ep;
+  }
+
+  void accept()
+  {
+    Endpoint *ep;
+    int fd;
+
+    while ((fd = accept4(m_listen.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+      ep = new Endpoint;
+      ep->kind = CLIENT;
+      ep->fd = fd;
+      watch(ep);
+    }
+  }
+
+  void read(Endpoint *ep, uint32_t events)
+  {
+    uint8_t buf[4096];
+    ssize_t n;
+
+    ep->arrival = nowUs();
+    n = ::read(ep->fd, buf, sizeof(buf));
+    if (n > 0)
+      ep->parser.feed(buf, n, received, ep);
+    else if ((n == 0 && !isatty(ep->fd)) || (n < 0 && errno != EAGAIN && errno != EINTR) ||
+      (n <= 0 && (events & (EPOLLHUP | EPOLLERR))))
+      drop(ep, true);
+  }
+
+  static void received(const Pixy2NodeFrame &frame, void *arg)
+  {
+    Endpoint *ep = (Endpoint *)arg;
+    ep->self->receive(frame, ep->arrival);
+  }
+
+  void syncRequest(uint32_t now)
+  {
+    Pixy2NodeFrame req;
+    uint8_t buf[PIXY2_NODE_MAX_PACKET];
+    uint16_t len;
+    size_t i;
+
+    req.type = PIXY2_NODE_TYPE_SYNC_REQ;
+    req.node = PIXY2_NODE_ANY;
+    req.seq = 0;
+    req.timestamp = now;
+    req.numBlocks = 0;
+    len = pixy2NodePack(buf, req);
+    for (i = 0; i < m_endpoints.size(); i++)
+      if (m_endpoints[i]->kind == SOURCE && ::write(m_endpoints[i]->fd, buf, len) < 0)
+        continue; // a full or read-only link just doesn't get synced
+  }
+
+  void receive(const Pixy2NodeFrame &frame, uint64_t arrival)
+  {
+    Pixy2CollectorNode *nd = &m_nodes[frame.node];
+    uint16_t gap;
+    uint64_t ts;
+    int64_t sample;
+
+    if (frame.type == PIXY2_NODE_TYPE_SYNC_RESP)
+    {
+      if (nd->sync.sample(frame.sync[0], frame.sync[1], frame.timestamp, (uint32_t)arrival))
+        nd->syncs++;
+      return;
+    }
+    if (frame.type != PIXY2_NODE_TYPE_BLOCKS && frame.type != PIXY2_NODE_TYPE_DELTA)
+      return;
+    if (nd->seen)
+    {
+      gap = frame.seq - nd->nextSeq;
+      if (gap >= 0x8000)
+      {
+        // going backwards: a duplicate, unless the clock went back as well
+        if ((int32_t)(frame.timestamp - nd->lastTs) >= 0)
+          return;
+        nd->restarts++;
+        nd->seen = false;
+        nd->sync.reset();
+        nd->codec.reset();
+      }
+      else if (gap)
+        nd->drops += gap;
+    }
+    if (!nd->seen)
+    {
+      nd->seen = true;
+      nd->tsHigh = 0;
+      nd->offset = (int64_t)arrival - frame.timestamp;
+    }
+    else if (frame.timestamp < nd->lastTs)
+      nd->tsHigh += (uint64_t)1 << 32;
+    nd->lastTs = frame.timestamp;
+    nd->nextSeq = frame.seq + 1;
+    nd->frames++;
+
+    if (frame.type == PIXY2_NODE_TYPE_BLOCKS)
+    {
+      nd->codec.setReference(frame.blocks, frame.numBlocks);
+      nd->keySeq = frame.seq;
+    }
+    else
+    {
+      m_decoded = frame;
+      m_decoded.type = PIXY2_NODE_TYPE_BLOCKS;
+      m_decoded.delta = NULL;
+      m_decoded.deltaLen = 0;
+      // built on a BLOCKS packet this side never got
+      if (frame.deltaLen < 2 || frame.delta[0] != nd->keySeq || !nd->codec.synced() ||
+        (frame.delta[1] & ~PIXY2_CODEC_KEY) > PIXY2_NODE_MAX_BLOCKS ||
+        nd->codec.decode(frame.delta + 1, frame.deltaLen - 1, m_decoded.blocks, &m_decoded.numBlocks) == 0)
+      {
+        nd->undecoded++;
+        m_undecoded++;
+        return;
+      }
+    }
+
+    ts = nd->tsHigh + frame.timestamp;
+    sample = (int64_t)arrival - (int64_t)ts;
+    if (sample < nd->offset)
+      nd->offset = sample;
+    else
+      nd->offset += (sample - nd->offset) >> 10;
+
+    nd->sync.bound(frame.timestamp, (uint32_t)arrival);
+    if (nd->sync.valid())
+    {
+      // host time of the capture, taken as the most recent past instant with these low bits
+      sample = ts;
+      ts = arrival - (uint32_t)((uint32_t)arrival - nd->sync.toLocal(frame.timestamp));
+      nd->offset = (int64_t)ts - sample;
+    }
+    else
+      ts += nd->offset;
+    if (ts < m_released)
+    {
+      nd->late++;
+      m_late++;
+      return;
+    }
+    m_held.insert(std::make_pair(ts, frame.type == PIXY2_NODE_TYPE_DELTA ? m_decoded : frame));
+  }
+
+  int release(uint64_t now, bool all)
+  {
+    std::multimap<uint64_t, Pixy2NodeFrame>::iterator it;
+    Pixy2NodeFrame frame;
+    uint8_t buf[PIXY2_NODE_MAX_PACKET];
+    uint16_t len;
+    size_t i;
+    int count = 0;
+
+    while (!m_held.empty() && (all || m_held.begin()->first + m_holdUs <= now))
+    {
+      it = m_held.begin();
+      m_released = it->first;
+      for (i = 0; i < m_consumers.size(); i++)
+        m_consumers[i].fn(it->second, it->first, m_consumers[i].arg);
+      if (m_clients)
+      {
+        frame = it->second;
+        frame.timestamp = (uint32_t)it->first;
+        len = pixy2NodePack(buf, frame);
+        for (i = 0; i < m_endpoints.size(); i++)
+        {
+          if (m_endpoints[i]->kind != CLIENT)
+            continue;
+          if (send(m_endpoints[i]->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+          {
+            if (errno == EAGAIN)
+              m_clientDrops++;
+            else
+              drop(m_endpoints[i--], true);
+          }
+        }
+      }
+      m_held.erase(it);
+      m_merged++;
+      count++;
+    }
+    return count;
+  }
+
+  int m_epfd;
+  uint32_t m_holdUs;
+  Endpoint m_listen;
+  std::vector<Endpoint *> m_endpoints;
+  std::vector<Consumer> m_consumers;
+  std::multimap<uint64_t, Pixy2NodeFrame> m_held;   // by capture time on the host clock
+  uint64_t m_released;                              // capture time of the last frame out
+  uint64_t m_syncUs;
+  uint64_t m_lastSync;
+
+  Pixy2CollectorNode m_nodes[PIXY2_COLLECTOR_NODES];
+  Pixy2NodeFrame m_decoded;
+  uint32_t m_sources;
+  uint32_t m_clients;
+  uint32_t m_merged;
+  uint32_t m_late;
+  uint32_t m_undecoded;
+  uint32_t m_clientDrops;
+  uint32_t m_goneCrcErrors;   // from sources already closed
+};
+
+#endif // _PIXY2COLLECTOR_H
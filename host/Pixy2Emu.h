@@ -0,0 +1,516 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Pixy2 camera emulator for host tools.
+// Pixy2Emu parses request packets a byte at a time and queues the bytes the camera would
+// answer with, computed from a synthetic scene: blocks moving on Lissajous paths, a
+// swaying line with a side branch for the line program, a colour gradient for
+// video.getRGB; optionally blocks shrink and vanish as brightness and the lamp move
+// away from what the scene's light needs. Frames advance with time at the configured
+// frame rate (or once per request with setFrameRate(0)), and asking for a frame that was
+// already served returns PIXY_RESULT_BUSY like the real camera. Requests for another
+// program switch to it and answer PIXY_RESULT_PROG_CHANGING until the switch is done.
+// Requests that aren't for a frame (version, resolution, changeProg, settings) answer at
+// once unless setReplyTime() says how long the camera's main loop takes to get to them.
+// With setRequestTimeout() a request that stops arriving halfway is dropped, so the
+// parser resyncs after a lost byte the way the camera's serial interface does.
+// Link2Emu wraps it as an in-process link for TPixy2; SpidevEmu puts it behind a fake
+// spidev for TLink2SPILinux.
+
+#ifndef _PIXY2EMU_H
+#define _PIXY2EMU_H
+
+#include "../Pixy2Host.h"
+#include "TPixy2.h"
+
+#include <linux/spi/spidev.h>
+#include <deque>
+#include <math.h>
+
+#define PIXY2EMU_PROG_CCC      0
+#define PIXY2EMU_PROG_LINE     1
+#define PIXY2EMU_PROG_VIDEO    2
+
+// brightness the lamp is worth in setExposure()'s model
+#define PIXY2EMU_LAMP_BOOST    60
+
+class Pixy2Emu
+{
+public:
+  Pixy2Emu()
+  {
+    m_state = 0;
+    m_numBlocks = 4;
+    m_fps = 60;
+    m_switchUs = 100000;
+    m_replyUs = 0;
+    m_timeoutUs = 0;
+    m_lastByteUs = 0;
+    m_prog = PIXY2EMU_PROG_CCC;
+    m_progReadyUs = micros();
+    m_t0 = micros();
+    m_frame = 0;
+    m_served[0] = m_served[1] = m_served[2] = 0xffffffff;
+    m_brightness = 80;
+    m_lampUpper = m_lampLower = 0;
+    m_bestExposure = m_exposureRange = 0;
+    m_requests = m_progSwitches = 0;
+  }
+
+  // blocks per CCC frame (each response holds at most 18)
+  void setBlocks(uint8_t n) { m_numBlocks = n; }
+  // frames per second; 0 makes every request see a new frame
+  void setFrameRate(uint16_t fps) { m_fps = fps; }
+  // how long a program switch keeps answering PIXY_RESULT_PROG_CHANGING
+  void setSwitchTime(uint32_t us) { m_switchUs = us; }
+  // how long a request other than for a frame waits before its answer starts
+  void setReplyTime(uint32_t us) { m_replyUs = us; }
+  // how long a request may pause before its partial bytes are dropped; 0 waits forever
+  void setRequestTimeout(uint32_t us) { m_timeoutUs = us; }
+  // Blocks are seen best at brightness best (plus PIXY2EMU_LAMP_BOOST with the lamp on),
+  // shrink linearly away from it and are lost range off; range 0 turns this off.
+  void setExposure(uint16_t best, uint16_t range) { m_bestExposure = best; m_exposureRange = range; }
+
+  uint32_t frame() const { return m_frame; }
+  uint8_t prog() const { return m_prog; }
+  uint8_t brightness() const { return m_brightness; }
+  bool lamp() const { return m_lampUpper != 0; }
+  uint32_t requests() const { return m_requests; }
+  uint32_t progSwitches() const { return m_progSwitches; }
+
+  // How much of each block setExposure() leaves, 0 to 1.
+  double exposure() const
+  {
+    int16_t off;
+
+    if (m_exposureRange == 0)
+      return 1;
+    off = m_brightness + (m_lampUpper ? PIXY2EMU_LAMP_BOOST : 0) - m_bestExposure;
+    if (off < 0)
+      off = -off;
+    return off >= m_exposureRange ? 0 : 1 - (double)off/m_exposureRange;
+  }
+
+  void feed(const uint8_t *buf, size_t len)
+  {
+    size_t i;
+    for (i = 0; i < len; i++)
+      feed(buf[i]);
+  }
+
+  void feed(uint8_t c)
+  {
+    if (m_timeoutUs)
+    {
+      if (m_state && micros() - m_lastByteUs > m_timeoutUs)
+        m_state = 0;
+      m_lastByteUs = micros();
+    }
+    switch (m_state)
+    {
+    case 0: // sync, little endian
+      m_state = c == (PIXY_NO_CHECKSUM_SYNC & 0xff) || c == (PIXY_CHECKSUM_SYNC & 0xff) ? 1 : 0;
+      m_cs = c == (PIXY_CHECKSUM_SYNC & 0xff);
+      break;
+    case 1:
+      m_state = c == (PIXY_NO_CHECKSUM_SYNC >> 8) ? 2 : 0;
+      break;
+    case 2:
+      m_type = c;
+      m_state = 3;
+      break;
+    case 3:
+      m_length = c;
+      m_index = 0;
+      m_state = m_cs ? 4 : 6;
+      if (!m_cs && m_length == 0)
+        request();
+      break;
+    case 4: // checksum bytes we don't verify
+    case 5:
+      m_state++;
+      if (m_state == 6 && m_length == 0)
+        request();
+      break;
+    case 6:
+      m_payload[m_index++] = c;
+      if (m_index == m_length)
+        request();
+      break;
+    }
+  }
+
+  size_t pending() const { return m_out.size(); }
+
+  size_t take(uint8_t *buf, size_t len)
+  {
+    size_t i;
+    for (i = 0; i < len && !m_out.empty(); i++)
+    {
+      buf[i] = m_out.front();
+      m_out.pop_front();
+    }
+    return i;
+  }
+
+private:
+  void request()
+  {
+    uint8_t *p = m_payload;
+    uint8_t resp[256];
+
+    m_state = 0;
+    m_requests++;
+    tick();
+    if (m_replyUs && m_type != CCC_REQUEST_BLOCKS && m_type != LINE_REQUEST_GET_FEATURES &&
+      m_type != VIDEO_REQUEST_GET_RGB)
+      delayMicroseconds(m_replyUs);
+
+    switch (m_type)
+    {
+    case PIXY_TYPE_REQUEST_VERSION:
+      memset(resp, 0, 16);
+      put16(resp, 0x2200);
+      resp[2] = 3; resp[3] = 0; put16(resp + 4, 18);
+      strcpy((char *)resp + 6, "general");
+      respond(PIXY_TYPE_RESPONSE_VERSION, resp, 16);
+      break;
+
+    case PIXY_TYPE_REQUEST_RESOLUTION:
+      // the line program reports its feature grid
+      put16(resp, m_prog == PIXY2EMU_PROG_LINE ? 79 : 316);
+      put16(resp + 2, m_prog == PIXY2EMU_PROG_LINE ? 52 : 208);
+      respond(PIXY_TYPE_RESPONSE_RESOLUTION, resp, 4);
+      break;
+
+    case PIXY_TYPE_REQUEST_CHANGE_PROG:
+      if (!strncmp((char *)p, "color", 5))
+        switchProg(PIXY2EMU_PROG_CCC);
+      else if (!strncmp((char *)p, "line", 4))
+        switchProg(PIXY2EMU_PROG_LINE);
+      else if (!strncmp((char *)p, "video", 5))
+        switchProg(PIXY2EMU_PROG_VIDEO);
+      else
+      {
+        result(PIXY_RESULT_ERROR);
+        break;
+      }
+      result(ready() ? 1 : 0);
+      break;
+
+    case PIXY_TYPE_REQUEST_BRIGHTNESS:
+      m_brightness = p[0];
+      result(PIXY_RESULT_OK);
+      break;
+
+    case PIXY_TYPE_REQUEST_LAMP:
+      m_lampUpper = p[0];
+      m_lampLower = p[1];
+      result(PIXY_RESULT_OK);
+      break;
+
+    case PIXY_TYPE_REQUEST_LED:
+    case PIXY_TYPE_REQUEST_SERVO:
+      result(PIXY_RESULT_OK);
+      break;
+
+    case PIXY_TYPE_REQUEST_FPS:
+      result(m_fps ? m_fps : 60);
+      break;
+
+    case CCC_REQUEST_BLOCKS:
+      if (!program(PIXY2EMU_PROG_CCC))
+        break;
+      respondBlocks(p[0], p[1]);
+      break;
+
+    case LINE_REQUEST_GET_FEATURES:
+      if (!program(PIXY2EMU_PROG_LINE))
+        break;
+      respondLine(p[0], p[1]);
+      break;
+
+    case VIDEO_REQUEST_GET_RGB:
+      if (!program(PIXY2EMU_PROG_VIDEO))
+        break;
+      respondRGB(get16(p), get16(p + 2));
+      break;
+
+    default:
+      error(PIXY_RESULT_ERROR);
+      break;
+    }
+  }
+
+  // Frame counter from the emulated sensor clock.
+  void tick()
+  {
+    if (m_fps)
+      m_frame = (uint32_t)((uint64_t)(micros() - m_t0)*m_fps/1000000);
+    else
+      m_frame++;
+  }
+
+  bool ready() { return (int32_t)(micros() - m_progReadyUs) >= 0; }
+
+  void switchProg(uint8_t prog)
+  {
+    if (prog == m_prog)
+      return;
+    m_prog = prog;
+    m_progReadyUs = micros() + m_switchUs;
+    m_progSwitches++;
+  }
+
+  // Switch to the program a request needs; answers the request itself if it can't be
+  // served yet (switching, or no new frame since the last one served).
+  bool program(uint8_t prog)
+  {
+    switchProg(prog);
+    if (!ready())
+    {
+      error(PIXY_RESULT_PROG_CHANGING);
+      return false;
+    }
+    if (prog != PIXY2EMU_PROG_VIDEO)
+    {
+      if (m_served[prog] == m_frame)
+      {
+        error(PIXY_RESULT_BUSY);
+        return false;
+      }
+      m_served[prog] = m_frame;
+    }
+    return true;
+  }
+
+  void respondBlocks(uint8_t sigmap, uint8_t maxBlocks)
+  {
+    uint8_t resp[18*14], *b = resp;
+    uint8_t i, n = 0;
+    uint16_t sig;
+    double t = m_frame/60.0, scale = exposure();
+
+    for (i = 0; i < m_numBlocks && n < 18 && n < maxBlocks && scale > 0; i++)
+    {
+      sig = i % 7 + 1;
+      if (!(sigmap & (1 << (sig - 1))))
+        continue;
+      put16(b, sig);
+      put16(b + 2, (uint16_t)(158 + 120*sin(t*(0.7 + 0.13*i) + i)));
+      put16(b + 4, (uint16_t)(104 + 80*sin(t*(0.5 + 0.11*i) + 2*i)));
+      put16(b + 6, (uint16_t)(scale*(20 + (i*7) % 30) + 0.5));
+      put16(b + 8, (uint16_t)(scale*(15 + (i*5) % 25) + 0.5));
+      put16(b + 10, 0);
+      b[12] = i;
+      b[13] = m_frame > 255 ? 255 : m_frame;
+      b += 14;
+      n++;
+    }
+    respond(CCC_RESPONSE_BLOCKS, resp, n*14);
+  }
+
+  // Main line from the bottom edge swaying around the centre of the 79x52 line grid; with
+  // all features, a branch leaves it halfway up every other second.
+  void respondLine(uint8_t type, uint8_t features)
+  {
+    uint8_t resp[2 + 2*sizeof(Vector) + 2 + sizeof(Intersection)], *f = resp;
+    Vector v[2];
+    Intersection in;
+    uint8_t n = 1, x0, x1;
+    double t = m_frame/60.0;
+
+    x0 = (uint8_t)(39 + 10*sin(t*0.8));
+    x1 = (uint8_t)(39 + 18*sin(t*0.8 + 0.6));
+    v[0] = (Vector){ x0, 51, x1, 4, 1, 0 };
+    if (type == LINE_GET_ALL_FEATURES && (m_frame/120) % 2)
+    {
+      v[1] = (Vector){ (uint8_t)((x0 + x1)/2), 28, 74, 20, 2, 0 };
+      n = 2;
+    }
+    if (features & LINE_VECTOR)
+    {
+      f[0] = LINE_VECTOR;
+      f[1] = n*sizeof(Vector);
+      memcpy(f + 2, v, n*sizeof(Vector));
+      f += 2 + n*sizeof(Vector);
+    }
+    if ((features & LINE_INTERSECTION) && n == 2)
+    {
+      memset(&in, 0, sizeof(in));
+      in.m_x = v[1].m_x0;
+      in.m_y = v[1].m_y0;
+      in.m_n = 3;
+      in.m_intLines[0].m_index = 1;
+      in.m_intLines[1].m_index = 1;
+      in.m_intLines[1].m_angle = 180;
+      in.m_intLines[2].m_index = 2;
+      in.m_intLines[2].m_angle = -70;
+      f[0] = LINE_INTERSECTION;
+      f[1] = sizeof(Intersection);
+      memcpy(f + 2, &in, sizeof(in));
+      f += 2 + sizeof(Intersection);
+    }
+    respond(LINE_RESPONSE_GET_FEATURES, resp, f - resp);
+  }
+
+  void respondRGB(uint16_t x, uint16_t y)
+  {
+    uint8_t resp[4];
+
+    if (x >= 316 || y >= 208)
+    {
+      error(PIXY_RESULT_ERROR);
+      return;
+    }
+    resp[0] = (uint8_t)(x*255/315);                    // b
+    resp[1] = (uint8_t)(y*255/207);                    // g
+    resp[2] = (uint8_t)(m_brightness + (x ^ y) % 32);  // r
+    resp[3] = 0;
+    respond(PIXY_TYPE_RESPONSE_RESULT, resp, 4);
+  }
+
+  void result(int32_t res)
+  {
+    uint8_t resp[4];
+    put16(resp, (uint16_t)res);
+    put16(resp + 2, (uint16_t)(res >> 16));
+    respond(PIXY_TYPE_RESPONSE_RESULT, resp, 4);
+  }
+
+  void error(int8_t res)
+  {
+    uint8_t resp[4] = { (uint8_t)res, 0, 0, 0 };
+    respond(PIXY_TYPE_RESPONSE_ERROR, resp, 4);
+  }
+
+  // responses always carry a checksum
+  void respond(uint8_t type, const uint8_t *payload, uint8_t len)
+  {
+    uint16_t cs = 0;
+    uint8_t i;
+
+    for (i = 0; i < len; i++)
+      cs += payload[i];
+    m_out.push_back(PIXY_CHECKSUM_SYNC & 0xff);
+    m_out.push_back(PIXY_CHECKSUM_SYNC >> 8);
+    m_out.push_back(type);
+    m_out.push_back(len);
+    m_out.push_back(cs & 0xff);
+    m_out.push_back(cs >> 8);
+    m_out.insert(m_out.end(), payload, payload + len);
+  }
+
+  static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+  static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+  uint8_t m_state;
+  bool m_cs;
+  uint8_t m_type;
+  uint8_t m_length;
+  uint8_t m_index;
+  uint8_t m_payload[256];
+  std::deque<uint8_t> m_out;
+
+  uint8_t m_numBlocks;
+  uint16_t m_fps;
+  uint32_t m_switchUs;
+  uint32_t m_replyUs;
+  uint32_t m_timeoutUs;
+  uint32_t m_lastByteUs;
+  uint8_t m_prog;
+  uint32_t m_progReadyUs;
+  uint32_t m_t0;
+  uint32_t m_frame;
+  uint32_t m_served[3];
+  uint8_t m_brightness;
+  uint8_t m_lampUpper;
+  uint8_t m_lampLower;
+  uint16_t m_bestExposure;
+  uint16_t m_exposureRange;
+  uint32_t m_requests;
+  uint32_t m_progSwitches;
+};
+
+// In-process link to an emulated camera; bytes move instantly.
+class Link2Emu
+{
+public:
+  int8_t open(uint32_t) { return 0; }
+  void close() { }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (cs) *cs = 0;
+    if (m_emu.pending() < len)
+      return -1;
+    m_emu.take(buf, len);
+    if (cs)
+      for (i = 0; i < len; i++)
+        *cs += buf[i];
+    return len;
+  }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    m_emu.feed(buf, len);
+    return len;
+  }
+
+  Pixy2Emu &emu() { return m_emu; }
+
+private:
+  Pixy2Emu m_emu;
+};
+
+typedef TPixy2<Link2Emu> Pixy2Emulated;
+
+// Fake spidev: clocked-out bytes go to the emulator, clocked-in bytes come from its
+// output, and an idle camera shifts out zeros.
+class SpidevEmu
+{
+public:
+  int open(const char *, uint8_t, uint32_t) { return 0; }
+  void close() { }
+
+  int transfer(struct spi_ioc_transfer *xfer, unsigned n)
+  {
+    unsigned i;
+    size_t got;
+    int total = 0;
+
+    for (i = 0; i < n; i++)
+    {
+      if (xfer[i].tx_buf)
+        m_emu.feed((const uint8_t *)(uintptr_t)xfer[i].tx_buf, xfer[i].len);
+      if (xfer[i].rx_buf)
+      {
+        uint8_t *rx = (uint8_t *)(uintptr_t)xfer[i].rx_buf;
+        got = m_emu.take(rx, xfer[i].len);
+        memset(rx + got, 0, xfer[i].len - got);
+      }
+      total += xfer[i].len;
+    }
+    return total;
+  }
+
+  Pixy2Emu &emu() { return m_emu; }
+
+private:
+  Pixy2Emu m_emu;
+};
+
+#endif // _PIXY2EMU_H
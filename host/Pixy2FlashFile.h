@@ -0,0 +1,154 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// File-backed stand-in for a NOR flash partition, for Pixy2BlackBox on a host, and for
+// reading partition dumps. It behaves like the part: erase works on whole 4 KB sectors
+// and sets bytes to 0xff, programming can only clear bits, and both can be given the
+// chip's typical times. Erases are counted per sector to show wear, and busy() is true
+// while an erase or program is under way, for modelling chips that stall other code then.
+
+#ifndef _PIXY2FLASHFILE_H
+#define _PIXY2FLASHFILE_H
+
+#include "../Pixy2Host.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define PIXY2_FLASHFILE_SECTOR     4096
+
+class Pixy2FlashFile
+{
+public:
+  Pixy2FlashFile()
+  {
+    m_fd = -1;
+    m_size = 0;
+    m_eraseUs = m_programUs = 0;
+    m_programs = 0;
+    m_busy = false;
+  }
+
+  ~Pixy2FlashFile()
+  {
+    close();
+  }
+
+  // Open a partition image. With size, a missing or shorter file is extended with erased
+  // sectors; without, the file's size is used (a dump). Returns -1 with errno on failure.
+  int open(const char *path, uint32_t size = 0, bool readOnly = false)
+  {
+    struct stat st;
+    uint8_t blank[PIXY2_FLASHFILE_SECTOR];
+    uint32_t addr;
+
+    close();
+    if ((m_fd = ::open(path, readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644)) < 0)
+      return -1;
+    if (fstat(m_fd, &st) < 0)
+      return -1;
+    m_size = (uint32_t)st.st_size & ~(PIXY2_FLASHFILE_SECTOR - 1);
+    if (size > m_size && !readOnly)
+    {
+      memset(blank, 0xff, sizeof(blank));
+      for (addr = m_size; addr < size; addr += PIXY2_FLASHFILE_SECTOR)
+        if (pwrite(m_fd, blank, sizeof(blank), addr) != (ssize_t)sizeof(blank))
+          return -1;
+      m_size = size;
+    }
+    else if (size && size < m_size)
+      m_size = size;
+    m_erases.assign(m_size/PIXY2_FLASHFILE_SECTOR, 0);
+    return 0;
+  }
+
+  void close()
+  {
+    if (m_fd >= 0)
+      ::close(m_fd);
+    m_fd = -1;
+  }
+
+  // Sleep like the chip: per 4 KB sector erase and per 256-byte page program.
+  void setTiming(uint32_t eraseUs, uint32_t programUs)
+  {
+    m_eraseUs = eraseUs;
+    m_programUs = programUs;
+  }
+
+  uint32_t size() const { return m_size; }
+
+  bool read(uint32_t addr, void *buf, uint32_t len)
+  {
+    return addr + len <= m_size && pread(m_fd, buf, len, addr) == (ssize_t)len;
+  }
+
+  bool write(uint32_t addr, const void *buf, uint32_t len)
+  {
+    std::vector<uint8_t> cur(len);
+    uint32_t i;
+
+    if (!read(addr, cur.data(), len))
+      return false;
+    for (i = 0; i < len; i++)
+      cur[i] &= ((const uint8_t *)buf)[i];
+    if (m_programUs)
+      busyFor(m_programUs*((len + 255)/256));
+    m_programs++;
+    return pwrite(m_fd, cur.data(), len, addr) == (ssize_t)len;
+  }
+
+  bool erase(uint32_t addr, uint32_t len)
+  {
+    uint8_t blank[PIXY2_FLASHFILE_SECTOR];
+
+    if (addr%PIXY2_FLASHFILE_SECTOR || len%PIXY2_FLASHFILE_SECTOR || addr + len > m_size)
+      return false;
+    memset(blank, 0xff, sizeof(blank));
+    for (; len; addr += PIXY2_FLASHFILE_SECTOR, len -= PIXY2_FLASHFILE_SECTOR)
+    {
+      if (m_eraseUs)
+        busyFor(m_eraseUs);
+      if (pwrite(m_fd, blank, sizeof(blank), addr) != (ssize_t)sizeof(blank))
+        return false;
+      m_erases[addr/PIXY2_FLASHFILE_SECTOR]++;
+    }
+    return true;
+  }
+
+  uint32_t sectors() const { return m_erases.size(); }
+  uint32_t erases(uint32_t sector) const { return m_erases[sector]; }
+  uint32_t programs() const { return m_programs; }
+  bool busy() const { return __atomic_load_n(&m_busy, __ATOMIC_ACQUIRE); }
+
+private:
+  void busyFor(uint32_t us)
+  {
+    __atomic_store_n(&m_busy, true, __ATOMIC_RELEASE);
+    delayMicroseconds(us);
+    __atomic_store_n(&m_busy, false, __ATOMIC_RELEASE);
+  }
+
+  int m_fd;
+  uint32_t m_size;
+  uint32_t m_eraseUs;
+  uint32_t m_programUs;
+  uint32_t m_programs;
+  bool m_busy;
+  std::vector<uint32_t> m_erases;
+};
+
+#endif // _PIXY2FLASHFILE_H
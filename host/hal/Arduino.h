@@ -0,0 +1,289 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Arduino core stand-ins for building device sources on a host (Pixy2UART.h, ZumoBuzzer.cpp),
+// for host/pixy_bench. Put this directory on the include path ahead of any Arduino core.
+// Serial1 keeps its bytes in memory: what the device code writes waits in a TX queue, and
+// a pump callback, run when the code reads with nothing received, lets the host side move
+// it to a peer (e.g. Pixy2Emu) and put the answer in the RX queue. The ESP32 pieces
+// ZumoBuzzer.cpp needs are in the other headers here; portMUX critical sections are
+// no-ops, as there is one thread. ESP32 builds also get Serial2, a UART on a clock: the
+// peer's answer arrives a byte time at a time, and the RX timeout callback comes once a
+// burst has gone quiet, run from a blocked semaphore take as the driver's task would.
+
+#ifndef _HAL_ARDUINO_H
+#define _HAL_ARDUINO_H
+
+#include "../../Pixy2Host.h"
+
+#define IRAM_ATTR
+#define SERIAL_8N1                        0x800001c
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED      0
+#define portENTER_CRITICAL(mux)           ((void)(mux))
+#define portEXIT_CRITICAL(mux)            ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)       ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)        ((void)(mux))
+
+#define HAL_SERIAL_BUFSIZE                1024
+
+typedef void (*HalSerialPump)(void *arg);
+
+class HalSerial
+{
+public:
+  HalSerial()
+  {
+    m_baud = 0;
+    m_rxHead = m_rxTail = 0;
+    m_txLen = 0;
+    m_pump = NULL;
+    m_arg = NULL;
+    m_reads = m_writes = 0;
+  }
+
+  void begin(uint32_t baud) { m_baud = baud; }
+  void end() { }
+
+  int available() const { return m_rxHead - m_rxTail; }
+  int availableForWrite() const { return HAL_SERIAL_BUFSIZE - m_txLen; }
+
+  int read()
+  {
+    m_reads++;
+    if (m_rxHead == m_rxTail && m_pump)
+      m_pump(m_arg);
+    if (m_rxHead == m_rxTail)
+      return -1;
+    return m_rx[m_rxTail++ & (HAL_SERIAL_BUFSIZE - 1)];
+  }
+
+  // Up to len bytes in one call, like Stream::readBytes() without its wait.
+  size_t readBytes(uint8_t *buf, size_t len)
+  {
+    size_t i;
+
+    m_reads++;
+    if ((size_t)available() < len && m_pump)
+      m_pump(m_arg);
+    for (i = 0; i < len && m_rxHead != m_rxTail; i++)
+      buf[i] = m_rx[m_rxTail++ & (HAL_SERIAL_BUFSIZE - 1)];
+    return i;
+  }
+
+  size_t write(const uint8_t *buf, size_t len)
+  {
+    m_writes++;
+    if (len > HAL_SERIAL_BUFSIZE - m_txLen)
+      len = HAL_SERIAL_BUFSIZE - m_txLen;
+    memcpy(m_tx + m_txLen, buf, len);
+    m_txLen += len;
+    return len;
+  }
+
+  // Host side: the pump runs in read() when nothing has been received.
+  void setPump(HalSerialPump pump, void *arg)
+  {
+    m_pump = pump;
+    m_arg = arg;
+  }
+
+  // Host side: what the device code wrote, oldest first.
+  size_t takeTx(uint8_t *buf, size_t len)
+  {
+    if (len > m_txLen)
+      len = m_txLen;
+    memcpy(buf, m_tx, len);
+    memmove(m_tx, m_tx + len, m_txLen - len);
+    m_txLen -= len;
+    return len;
+  }
+
+  // Host side: bytes for the device code to read; returns how many fit.
+  size_t putRx(const uint8_t *buf, size_t len)
+  {
+    size_t i;
+
+    for (i = 0; i < len && m_rxHead - m_rxTail < HAL_SERIAL_BUFSIZE; i++)
+      m_rx[m_rxHead++ & (HAL_SERIAL_BUFSIZE - 1)] = buf[i];
+    return i;
+  }
+
+  uint32_t baud() const { return m_baud; }
+  // read()/readBytes() and write() calls
+  uint32_t reads() const { return m_reads; }
+  uint32_t writes() const { return m_writes; }
+
+private:
+  uint32_t m_baud;
+  uint8_t m_rx[HAL_SERIAL_BUFSIZE];
+  uint32_t m_rxHead;
+  uint32_t m_rxTail;
+  uint8_t m_tx[HAL_SERIAL_BUFSIZE];
+  size_t m_txLen;
+  HalSerialPump m_pump;
+  void *m_arg;
+  uint32_t m_reads;
+  uint32_t m_writes;
+};
+
+inline HalSerial Serial1;
+
+#ifdef ARDUINO_ARCH_ESP32
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <deque>
+#include <functional>
+
+typedef void (*HalUartPeer)(const uint8_t *buf, size_t len, void *arg);
+
+class HalUart
+{
+public:
+  HalUart()
+  {
+    m_baud = 115200;
+    m_rxTimeout = 10;
+    m_txEndUs = m_rxEndUs = micros();
+    m_peer = NULL;
+    m_arg = NULL;
+    m_reads = 0;
+  }
+
+  void setRxBufferSize(size_t) { }
+  void begin(uint32_t baud, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1) { m_baud = baud; }
+  void end() { }
+  void updateBaudRate(uint32_t baud) { m_baud = baud; }
+  // idle time, in symbols (byte times), that ends a burst
+  void setRxTimeout(uint8_t symbols) { m_rxTimeout = symbols; }
+
+  void onReceive(std::function<void()> cb, bool = false)
+  {
+    m_onReceive = cb;
+    m_events.clear();
+    g_halDispatch = cb ? dispatch : NULL;
+  }
+
+  int available() const
+  {
+    uint32_t now = micros();
+    int n = 0;
+
+    while (n < (int)m_rx.size() && (int32_t)(now - m_rx[n].us) >= 0)
+      n++;
+    return n;
+  }
+  int availableForWrite() const { return HAL_SERIAL_BUFSIZE; }
+
+  int read()
+  {
+    uint8_t c;
+
+    m_reads++;
+    if (m_rx.empty() || (int32_t)(micros() - m_rx.front().us) < 0)
+      return -1;
+    c = m_rx.front().c;
+    m_rx.pop_front();
+    return c;
+  }
+
+  // Goes on the wire behind whatever is still leaving; the peer has it at once.
+  size_t write(const uint8_t *buf, size_t len)
+  {
+    uint32_t now = micros();
+
+    if ((int32_t)(now - m_txEndUs) > 0)
+      m_txEndUs = now;
+    m_txEndUs += len*byteUs();
+    if (m_peer)
+      m_peer(buf, len, m_arg);
+    return len;
+  }
+
+  bool txDone() const { return (int32_t)(micros() - m_txEndUs) >= 0; }
+
+  // Host side: who gets what the device code writes.
+  void setPeer(HalUartPeer peer, void *arg)
+  {
+    m_peer = peer;
+    m_arg = arg;
+  }
+
+  // Host side: the peer answers, starting gapUs after our last byte has left (and
+  // behind anything it is still sending), at the line rate.
+  void transmit(const uint8_t *buf, size_t len, uint32_t gapUs)
+  {
+    uint32_t t = m_txEndUs + gapUs;
+    size_t i;
+
+    if ((int32_t)(m_rxEndUs - t) > 0)
+      t = m_rxEndUs;
+    for (i = 0; i < len; i++)
+    {
+      t += byteUs();
+      m_rx.push_back({ buf[i], t });
+    }
+    m_rxEndUs = t;
+    if (len && m_onReceive)
+      m_events.push_back(t + m_rxTimeout*byteUs());
+  }
+
+  uint32_t baud() const { return m_baud; }
+  uint32_t reads() const { return m_reads; }
+
+private:
+  struct Byte
+  {
+    uint8_t c;
+    uint32_t us;
+  };
+
+  uint32_t byteUs() const { return 10000000/m_baud; }
+
+  static uint32_t dispatch();
+
+  uint32_t m_baud;
+  uint8_t m_rxTimeout;
+  uint32_t m_txEndUs;
+  uint32_t m_rxEndUs;
+  std::deque<Byte> m_rx;
+  std::deque<uint32_t> m_events;   // when each burst's RX timeout fires
+  std::function<void()> m_onReceive;
+  HalUartPeer m_peer;
+  void *m_arg;
+  uint32_t m_reads;
+};
+
+inline HalUart Serial2;
+
+// The RX timeouts due by now, as the driver's event task would deliver them.
+inline uint32_t HalUart::dispatch()
+{
+  uint32_t now = micros();
+
+  while (!Serial2.m_events.empty() && (int32_t)(now - Serial2.m_events.front()) >= 0)
+  {
+    Serial2.m_events.pop_front();
+    if (Serial2.m_onReceive)
+      Serial2.m_onReceive();
+  }
+  return Serial2.m_events.empty() ? HAL_NO_EVENT : Serial2.m_events.front() - now;
+}
+
+#endif // ARDUINO_ARCH_ESP32
+
+#endif // _HAL_ARDUINO_H
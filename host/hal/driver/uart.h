@@ -0,0 +1,35 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// ESP-IDF UART driver stand-ins for host builds: what Link2UART asks of UART2 directly.
+
+#ifndef _HAL_DRIVER_UART_H
+#define _HAL_DRIVER_UART_H
+
+#include "../Arduino.h"
+
+typedef int uart_port_t;
+typedef int esp_err_t;
+
+#define UART_NUM_2                        2
+#define ESP_OK                            0
+#define ESP_ERR_TIMEOUT                   0x107
+
+// Serial2 is the only UART; without waiting, done is whether the last byte has left.
+inline esp_err_t uart_wait_tx_done(uart_port_t, TickType_t)
+{
+  return Serial2.txDone() ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+#endif // _HAL_DRIVER_UART_H
@@ -0,0 +1,53 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// LEDC stand-ins for host builds (Arduino-ESP32 3.x pin-based API). Nothing is driven;
+// the latest settings and the number of calls are kept for benchmarks to read.
+
+#ifndef _HAL_ESP32_HAL_LEDC_H
+#define _HAL_ESP32_HAL_LEDC_H
+
+#include <stdint.h>
+
+struct HalLedc
+{
+  uint32_t freq;
+  uint32_t duty;
+  uint32_t calls;
+};
+
+inline HalLedc g_halLedc;
+
+inline bool ledcAttach(uint8_t, uint32_t freq, uint8_t)
+{
+  g_halLedc.freq = freq;
+  g_halLedc.calls++;
+  return true;
+}
+
+inline uint32_t ledcChangeFrequency(uint8_t, uint32_t freq, uint8_t)
+{
+  g_halLedc.freq = freq;
+  g_halLedc.calls++;
+  return freq;
+}
+
+inline bool ledcWrite(uint8_t, uint32_t duty)
+{
+  g_halLedc.duty = duty;
+  g_halLedc.calls++;
+  return true;
+}
+
+#endif // _HAL_ESP32_HAL_LEDC_H
@@ -0,0 +1,81 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Hardware timer stand-ins for host builds (Arduino-ESP32 3.x API). There is one timer
+// and it never fires by itself: halTimerExpire() runs its interrupt handler if an alarm
+// is armed, as the hardware would once the alarm time passes.
+
+#ifndef _HAL_ESP32_HAL_TIMER_H
+#define _HAL_ESP32_HAL_TIMER_H
+
+#include <stdint.h>
+
+struct hw_timer_t
+{
+  void (*isr)();
+  uint64_t alarmUs;
+  bool armed;
+  bool running;
+  uint32_t calls;
+};
+
+inline hw_timer_t g_halTimer;
+
+inline hw_timer_t *timerBegin(uint32_t)
+{
+  g_halTimer.calls++;
+  return &g_halTimer;
+}
+
+inline void timerAttachInterrupt(hw_timer_t *timer, void (*isr)())
+{
+  timer->isr = isr;
+  timer->calls++;
+}
+
+inline void timerStart(hw_timer_t *timer)
+{
+  timer->running = true;
+  timer->calls++;
+}
+
+inline void timerStop(hw_timer_t *timer)
+{
+  timer->running = false;
+  timer->calls++;
+}
+
+inline void timerWrite(hw_timer_t *timer, uint64_t)
+{
+  timer->calls++;
+}
+
+inline void timerAlarm(hw_timer_t *timer, uint64_t us, bool, uint64_t)
+{
+  timer->alarmUs = us;
+  timer->armed = true;
+  timer->calls++;
+}
+
+// Fire the pending alarm; returns its time in us, or 0 if none was armed.
+inline uint64_t halTimerExpire()
+{
+  if (!g_halTimer.armed || !g_halTimer.running || g_halTimer.isr == NULL)
+    return 0;
+  g_halTimer.armed = false;
+  g_halTimer.isr();
+  return g_halTimer.alarmUs;
+}
+
+#endif // _HAL_ESP32_HAL_TIMER_H
@@ -0,0 +1,38 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// FreeRTOS stand-ins for host builds. There is one task, so a call that would block
+// sleeps instead, and meanwhile runs what the rest of the system would have done:
+// g_halDispatch, if set, runs the events due by now (the UART driver's callbacks) and
+// returns the microseconds until the next one.
+
+#ifndef _HAL_FREERTOS_H
+#define _HAL_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                            1
+#define pdFALSE                           0
+#define portTICK_PERIOD_MS                1
+#define portMAX_DELAY                     0xffffffff
+#define pdMS_TO_TICKS(ms)                 ((TickType_t)(ms)/portTICK_PERIOD_MS)
+
+#define HAL_NO_EVENT                      0xffffffff
+
+inline uint32_t (*g_halDispatch)() = NULL;
+
+#endif // _HAL_FREERTOS_H
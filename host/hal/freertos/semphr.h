@@ -0,0 +1,68 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Binary semaphore stand-ins for host builds. A take that has to wait sleeps until the
+// next event g_halDispatch knows of or the timeout, whichever comes first, so the time
+// it blocks is time the CPU is free.
+
+#ifndef _HAL_SEMPHR_H
+#define _HAL_SEMPHR_H
+
+#include "FreeRTOS.h"
+#include "../../../Pixy2Host.h"
+
+struct HalSemaphore
+{
+  bool given;
+};
+
+typedef HalSemaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+  return new HalSemaphore{ false };
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+  sem->given = true;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+  uint32_t t0 = micros(), next, left;
+  struct timespec ts;
+
+  while (true)
+  {
+    next = g_halDispatch ? g_halDispatch() : HAL_NO_EVENT;
+    if (sem->given)
+    {
+      sem->given = false;
+      return pdTRUE;
+    }
+    left = ticks == portMAX_DELAY ? HAL_NO_EVENT : ticks*portTICK_PERIOD_MS*1000;
+    if (micros() - t0 >= left)
+      return pdFALSE;
+    left -= micros() - t0;
+    if (next > left)
+      next = left;
+    ts.tv_sec = next/1000000;
+    ts.tv_nsec = (long)(next%1000000)*1000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+#endif // _HAL_SEMPHR_H
@@ -0,0 +1,3542 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Host benchmarks for the Pixy2 link and program code, run against the camera emulator.
+//
+// Build (from this directory, with the Pixy2 Arduino library's headers on the path; hal/
+// has the Arduino and ESP32 stand-ins device sources are built against):
+//   g++ -O2 -std=gnu++17 -I.. -Ihal -I<Pixy2 library>/src pixy_bench.cpp -o pixy_bench -lpthread
+// For the buzzer section, with the ZumoShield library's ZumoBuzzer.h on the path too:
+//   g++ -O2 -std=gnu++17 -DARDUINO_ARCH_ESP32 -Ihal -I<ZumoShield library> -c ../ZumoBuzzer.cpp
+//   g++ -O2 -std=gnu++17 -I.. -Ihal -I<Pixy2 library>/src -I<ZumoShield library> pixy_bench.cpp
+//     ZumoBuzzer.o -o pixy_bench -lpthread
+// For the rx-wakeup section, with Link2UART built for ESP32 against hal/'s Serial2:
+//   g++ -O2 -std=gnu++17 -DARDUINO_ARCH_ESP32 -I.. -Ihal -I<Pixy2 library>/src -c pixy_bench_esp32.cpp
+//   and add -DPIXY_BENCH_ESP32 and pixy_bench_esp32.o to the pixy_bench line.
+// Run:
+//   ./pixy_bench [section ...]      (no arguments runs every section)
+//   PIXY_BENCH_SEED=n picks another random scene for the simulated sections.
+//   PIXY_BENCH_JSON=file also writes the results as JSON.
+//   PIXY_BENCH_BASELINE=file compares them with an earlier PIXY_BENCH_JSON file and exits
+//   with 1 if a time or rate is worse by more than PIXY_BENCH_THRESHOLD percent (default
+//   10). Counts and sizes are not compared. Take baselines on the same, idle machine.
+//
+// Sections:
+//   uart-pty   Link2UARTLinux over a pseudo-terminal pair with the emulator on the master
+//              side: getBlocks() latency percentiles, frames/s, bytes/s and syscalls/frame.
+//   spidev     TLink2SPILinux on a fake spidev, batched and one-ioctl-per-call: ioctls and
+//              bytes clocked per frame, and the bytes/s the SPI clock would then allow.
+//   line       Pixy2LineTracker on synthetic line scenes: incremental update versus
+//              rebuilding the graph each frame, per frame cost. Under
+//              LINE_TRACKER_REBUILD_BELOW vectors the update rebuilds the vector slots
+//              itself, so there the two differ by reset() alone.
+//   sched      CCC + line + RGB requests on the emulator (60 fps, 100 ms program switches):
+//              achieved versus requested rates with Pixy2Scheduler, and with the
+//              requests simply issued in turn.
+//   rgb        ROI grids of getRGB() samples over the pty: one video.getRGB() per pixel
+//              versus Pixy2RGBSampler pipelining 1, 4 and 8 requests; ROI latency and
+//              exchanges/s.
+//   boot       Time from reset to the first CCC frame over the pty, with init() and with
+//              Pixy2FastBoot restoring the previous boot's cached camera description,
+//              with a camera that answers version and resolution at once and one that
+//              takes 8 ms (half a 60 fps frame) to get to each. Then Link2UART with
+//              PIXY_UART_AUTOBAUD on the Serial1 stand-in, where a cold boot probes the
+//              rates, and a camera set slower under a warm boot: the link must find it.
+//   power      CCC at 60 fps with 3 and 12 ms of work per frame under each
+//              Pixy2PowerMode mode: frames/s kept and the modelled supply current.
+//   governor   CCC at 60 fps with CPU-bound work that scales with the clock and periodic
+//              spikes: time at each Pixy2Governor frequency, budget misses and switches.
+//   collector  Simulated nodes on ptys (60 fps, skewed clocks, lost and corrupted packets)
+//              into one Pixy2Collector thread: merged frames/s, drops found, ordering,
+//              capture-time error, latency, collector CPU and link bytes per frame, with
+//              BLOCKS packets and with DELTA packets (frames delivered and undecoded).
+//   sync       Two nodes with skewed clocks and cameras, in virtual time, over jittery
+//              links: capture-time error on the host clock from 10 s in, how long until
+//              it stays within 2 ms, and how often frames are paired with the right
+//              partner, for arrival times, send times mapped by arrival offset, and
+//              Pixy2FrameClock + Pixy2ClockSync. Then Pixy2FrameAligner fed in bursts,
+//              cameras 8.4 and 2 ms apart: sets formed and none wider than the tolerance.
+//   stereo     Pixy2Stereo on synthetic two-camera scenes: fuse time per frame, match
+//              precision and recall, depth and position error.
+//   format     The sketch's per-block debug report through Print-style calls (one
+//              conversion and one locked UART write per field), snprintf into one write,
+//              and Pixy2Format: time and UART writes per report.
+//   blackbox   Pixy2BlackBox on a file-backed flash: twenty minutes of 60 fps frames into
+//              1 MB (coded size, what is retained, read back and compared, sector wear),
+//              and time spent in the vision loop with the chip's erase and program times,
+//              writer thread versus writing from the loop, and with the loop paused by
+//              each erase as on a classic ESP32. Then a reset: a second boot's frames,
+//              with times from 0 again, read back under the next boot count. Then frames
+//              that stop: the page being filled must reach flash after FLUSH_MS, unflushed.
+//   codec      Pixy2FrameCodec on synthetic frames, on frames from the emulated camera
+//              through the link and, with PIXY_BENCH_TRACE=<black box dump>, on a
+//              recording: coded size against Blocks and the node protocol's packing,
+//              with and without keyframes and coded against the keyframe, encode and
+//              decode time per frame.
+//   arena      Soak of per-frame filter, clustering and track matching code with its
+//              temporaries from the heap and from a Pixy2FrameArena, next to long-lived
+//              track histories on the heap: time per frame and per allocation, heap
+//              size and free-but-scattered bytes over the run, arena high water.
+//   memory     Pixy2MemoryReport of every component's object size against its budget.
+//              The budgets are also checked when this file compiles, so a component
+//              that outgrows its PIXY2_BUDGET_* fails the build.
+//   link       CCC frames replayed from a recording of the emulator: a bulk link (one
+//              copy per recv()) against Link2UART reading a byte at a time from the
+//              Serial1 stand-in; time per frame and per byte, read calls per frame.
+//   checksum   Copying a payload and summing it the way the links do, into the caller's
+//              total byte by byte, against summing in a local: time per byte.
+//   ccc        ccc.getBlocks() parsing replayed frames of 1 to 18 blocks: time per frame
+//              and per block.
+//   query      getVersion(), getResolution() and getFPS() on replayed answers: time per
+//              call.
+//   buzzer     ZumoBuzzer playing a long sequence on the LEDC and timer stand-ins, the
+//              timer expired by hand: parse and schedule time per note, HAL calls per
+//              note, and playNote() alone. Built only when ZumoBuzzer.h is found.
+//   trace      Link2UART frames as in link with Pixy2Tracer stopped and recording, and
+//              record() alone: cost per event (the difference of the two frame times
+//              is inside their noise). Built only with -DPIXY2_TRACE (for
+//              ZumoBuzzer.o too); PIXY_BENCH_TRACE_DUMP=file writes the last run's
+//              dump for pixy_trace.
+//   fault      CCC frames (8 blocks) through TLink2Fault on the emulator at per-byte
+//              error rates from 0 to 1%: frames/s in link time at 115200 baud (with
+//              2 ms per failed read, as Link2UART times out), how many of the error-free
+//              rate are kept, failed frames, time to the next good frame after a
+//              failure, and the wire bytes spent on failed exchanges.
+//   retry      The same with TLink2Retry over the fault link, against the bare fault
+//              link: getBlocks() and getVersion() calls that fail, frames/s in link
+//              time, retries, stale packets dropped and failures by kind per 1000
+//              calls. Then an answer held back until after the resend's: the next
+//              getBlocks() must not take it, leaving its own answer on the link.
+//   frames     Readers at 100, 30 and 10 Hz (wanting frames at most 10, 30 and 100 ms
+//              old) sharing the emulator at 60 fps, three and six of them: each calling
+//              getBlocks() against Pixy2FrameService, in link requests and bytes per
+//              second, time per call and the age of the frames served.
+//   uart-tx    Link2UART's sendAsync() on the Serial1 stand-in at 115200: when poll()
+//              reports the request on the wire against the 10 bit times a byte the
+//              model gives, that the done callback fires once with txDoneMicros(),
+//              and that send() and a second sendAsync() while it is pending neither
+//              lose it nor reorder bytes.
+//   rx-wakeup  Link2UART built for ESP32 on the Serial2 stand-in (bytes at the line rate,
+//              RX timeout callbacks once a burst goes quiet), CCC at 60 fps: the spin
+//              loop against setRxWakeup(), in the share of the time waiting for bytes
+//              spent blocked, wakeups, spins and exchanges per frame, and CPU time per
+//              frame. Built only with -DPIXY_BENCH_ESP32 (see Build).
+//   autobaud   Link2UART with PIXY_UART_AUTOBAUD on the Serial1 stand-in, the emulator
+//              behind TLink2Fault at a fixed rate: the rate open() locks for cameras at
+//              115200 to 2000000, then after a short burst of noise (which must not
+//              probe), a long one and after the camera is set slower: renegotiations,
+//              the rate it ends on and getBlocks() calls until frames come through again.
+//   exposure   Pixy2AutoExposure on the emulator with blocks that shrink away from the
+//              brightness the light needs: settled, after the light dims, in the dark
+//              (the lamp needed), with the watched blocks gone and back. Time to
+//              converge, brightness, lamp and commands; the empty scene must not move
+//              brightness or the lamp. Then the dimming again with a budget of one round
+//              trip a second, which must still converge.
+//
+// The link, checksum, ccc, query and buzzer sections report the best of five runs.
+
+#include "../Pixy2UARTLinux.h"
+#include "../Pixy2SPILinux.h"
+#include "../Pixy2LineTracker.h"
+#include "../Pixy2Scheduler.h"
+#include "../Pixy2RGBSampler.h"
+#include "../Pixy2FastBoot.h"
+#include "../Pixy2PowerMode.h"
+#include "../Pixy2Governor.h"
+#include "../Pixy2TimeSync.h"
+#include "../Pixy2FrameAligner.h"
+#include "../Pixy2Stereo.h"
+#include "../Pixy2Format.h"
+#include "../Pixy2BlackBox.h"
+#include "../Pixy2Arena.h"
+#include "../Pixy2AutoExposure.h"
+#include "../Pixy2Memory.h"
+#include "../Pixy2FaultLink.h"
+#include "../Pixy2Retry.h"
+#include "../Pixy2FrameService.h"
+#include "Pixy2Emu.h"
+#include "Pixy2Collector.h"
+#include "Pixy2FlashFile.h"
+#include "../Pixy2UART.h"
+#include "esp32-hal-ledc.h"
+#include "esp32-hal-timer.h"
+#if __has_include(<ZumoBuzzer.h>)
+#include <ZumoBuzzer.h>
+#define PIXY_BENCH_BUZZER
+#endif
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static bool selected(int argc, char *argv[], const char *name)
+{
+  int i;
+
+  if (argc < 2)
+    return true;
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], name))
+      return true;
+  return false;
+}
+
+struct BenchResult
+{
+  std::string section;
+  std::string metric;
+  double value;
+  std::string unit;
+};
+
+static std::vector<BenchResult> g_results;
+// checks that failed; any fails the run
+static uint32_t g_failures;
+
+static void report(const char *section, const char *metric, double value, const char *unit)
+{
+  printf("%-16s %-26s %12.2f %s\n", section, metric, value, unit);
+  g_results.push_back({section, metric, value, unit});
+}
+
+// A check that didn't hold: said on stderr, and the run exits non-zero.
+static void __attribute__((format(printf, 1, 2))) fail(const char *fmt, ...)
+{
+  va_list args;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  g_failures++;
+}
+
+// Latency percentiles in microseconds; sorts the samples.
+static void reportLatency(const char *section, std::vector<uint32_t> &us)
+{
+  double sum = 0;
+  size_t i;
+
+  if (us.empty())
+    return;
+  std::sort(us.begin(), us.end());
+  for (i = 0; i < us.size(); i++)
+    sum += us[i];
+  report(section, "latency_mean", sum/us.size(), "us");
+  report(section, "latency_p50", us[us.size()/2], "us");
+  report(section, "latency_p99", us[us.size()*99/100], "us");
+}
+
+// Which way is better for a unit: -1 lower (times, and requests to the camera), 1 higher
+// (rates), 0 neither (counts, sizes and model outputs, which aren't checked against the
+// baseline).
+static int betterDirection(const std::string &unit)
+{
+  if (unit == "ns" || unit == "us" || unit == "ms" || unit == "s" || unit == "req/s")
+    return -1;
+  if (unit == "fps" || unit == "/s" || unit == "B/s")
+    return 1;
+  return 0;
+}
+
+// One result per line, so the baseline reader below needs no JSON parser.
+static bool writeJson(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  size_t i;
+
+  if (f == NULL)
+    return false;
+  fprintf(f, "{\"results\": [\n");
+  for (i = 0; i < g_results.size(); i++)
+    fprintf(f, "  {\"section\": \"%s\", \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+      g_results[i].section.c_str(), g_results[i].metric.c_str(), g_results[i].value, g_results[i].unit.c_str(),
+      i + 1 < g_results.size() ? "," : "");
+  fprintf(f, "]}\n");
+  return fclose(f) == 0;
+}
+
+// Compare this run with a file writeJson() made: a time or rate worse than the baseline
+// by more than threshold percent is a regression. Times and rates are positive, so a
+// baseline at or below zero is a derived value gone through its noise and is skipped.
+// Returns the regressions, -1 if the file can't be read.
+static int compareBaseline(const char *path, double threshold)
+{
+  FILE *f = fopen(path, "r");
+  char line[256], section[64], metric[64];
+  double base, change;
+  int dir, compared = 0, regressions = 0;
+  size_t i;
+
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, " {\"section\": \"%63[^\"]\", \"metric\": \"%63[^\"]\", \"value\": %lf", section, metric,
+      &base) != 3)
+      continue;
+    for (i = 0; i < g_results.size(); i++)
+      if (g_results[i].section == section && g_results[i].metric == metric)
+        break;
+    if (i == g_results.size() || (dir = betterDirection(g_results[i].unit)) == 0 || base <= 0)
+      continue;
+    compared++;
+    change = 100*(g_results[i].value - base)/base;
+    if (-dir*change > threshold)
+    {
+      regressions++;
+      fprintf(stderr, "regression: %s %s %.2f -> %.2f %s (%+.1f%%)\n", section, metric, base, g_results[i].value,
+        g_results[i].unit.c_str(), change);
+    }
+  }
+  fclose(f);
+  fprintf(stderr, "baseline %s: %d results compared, %d worse by more than %.1f%%\n", path, compared, regressions,
+    threshold);
+  return regressions;
+}
+
+// ---------------------------------------------------------------------------------------
+// uart-pty
+
+// The emulated camera on the master side of a pty, serviced with epoll like a device.
+struct PtyCamera
+{
+  int master;
+  int stopFd;
+  Pixy2Emu emu;
+
+  void run()
+  {
+    struct epoll_event ev, evs[2];
+    uint8_t buf[512];
+    int epfd = epoll_create1(0), n, i;
+    ssize_t len;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = master;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, master, &ev);
+    ev.data.fd = stopFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &ev);
+
+    while (true)
+    {
+      n = epoll_wait(epfd, evs, 2, -1);
+      for (i = 0; i < n; i++)
+      {
+        if (evs[i].data.fd == stopFd)
+        {
+          close(epfd);
+          return;
+        }
+        len = read(master, buf, sizeof(buf));
+        if (len > 0)
+        {
+          emu.feed(buf, len);
+          len = emu.take(buf, sizeof(buf));
+          while (len > 0)
+          {
+            if (write(master, buf, len) < 0)
+              break;
+            len = emu.take(buf, sizeof(buf));
+          }
+        }
+      }
+    }
+  }
+};
+
+// PtyCamera on its own thread, with the slave side's name to open.
+struct PtyRig
+{
+  PtyCamera cam;
+  int pipefd[2];
+  std::thread th;
+
+  bool start()
+  {
+    cam.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (cam.master < 0 || grantpt(cam.master) < 0 || unlockpt(cam.master) < 0 || pipe(pipefd) < 0)
+    {
+      perror("pty");
+      return false;
+    }
+    cam.stopFd = pipefd[0];
+    th = std::thread(&PtyCamera::run, &cam);
+    return true;
+  }
+
+  const char *device() { return ptsname(cam.master); }
+
+  void stop()
+  {
+    if (write(pipefd[1], "x", 1) < 0)
+      perror("stop");
+    th.join();
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(cam.master);
+  }
+};
+
+static void benchUartPty(uint8_t blocks, uint32_t frames)
+{
+  PtyRig rig;
+  Pixy2UARTLinux pixy;
+  std::vector<uint32_t> lat;
+  uint32_t i, t0, t, bytes = 0, reads, writes, waits;
+  char name[32];
+
+  rig.cam.emu.setBlocks(blocks);
+  rig.cam.emu.setFrameRate(0);
+  if (!rig.start())
+    return;
+
+  pixy.m_link.setDevice(rig.device());
+  if (pixy.init(921600) < 0)
+  {
+    printf("uart-pty: init failed\n");
+  }
+  else
+  {
+    reads = pixy.m_link.reads();
+    writes = pixy.m_link.writes();
+    waits = pixy.m_link.waits();
+    lat.reserve(frames);
+    t0 = micros();
+    for (i = 0; i < frames; i++)
+    {
+      t = micros();
+      if (pixy.ccc.getBlocks() < 0)
+        break;
+      lat.push_back(micros() - t);
+      bytes += 6 + pixy.ccc.numBlocks*sizeof(Block);
+    }
+    t = micros() - t0;
+
+    snprintf(name, sizeof(name), "uart-pty/%u", blocks);
+    reportLatency(name, lat);
+    report(name, "frames_per_s", i*1e6/t, "fps");
+    report(name, "rx_bytes_per_s", bytes*1e6/t, "B/s");
+    report(name, "syscalls_per_frame", (double)(pixy.m_link.reads() - reads + pixy.m_link.writes() - writes +
+      pixy.m_link.waits() - waits)/(i ? i : 1), "calls");
+  }
+
+  pixy.m_link.close();
+  rig.stop();
+}
+
+// ---------------------------------------------------------------------------------------
+// spidev
+
+static void benchSpidev(bool batch, uint8_t blocks, uint32_t frames)
+{
+  TPixy2<TLink2SPILinux<SpidevEmu> > pixy;
+  uint32_t i, t0, t, bytes = 0, ioctls, clocked;
+  double wireUs;
+  char name[32];
+
+  pixy.m_link.dev().emu().setBlocks(blocks);
+  pixy.m_link.dev().emu().setFrameRate(0);
+  pixy.m_link.setBatching(batch);
+  if (pixy.init() < 0)
+  {
+    printf("spidev: init failed\n");
+    return;
+  }
+
+  ioctls = pixy.m_link.ioctls();
+  clocked = pixy.m_link.clocked();
+  t0 = micros();
+  for (i = 0; i < frames; i++)
+  {
+    if (pixy.ccc.getBlocks() < 0)
+      break;
+    bytes += 6 + pixy.ccc.numBlocks*sizeof(Block);
+  }
+  t = micros() - t0;
+  if (i == 0)
+    return;
+  ioctls = pixy.m_link.ioctls() - ioctls;
+  clocked = pixy.m_link.clocked() - clocked;
+  // wire time per frame: bits at the SPI clock plus one turnaround per request
+  wireUs = (double)clocked*8*1e6/pixy.m_link.clock()/i + PIXY2_SPI_TURNAROUND_US;
+
+  snprintf(name, sizeof(name), "spidev/%s/%u", batch ? "batch" : "call", blocks);
+  report(name, "ioctls_per_frame", (double)ioctls/i, "calls");
+  report(name, "clocked_bytes_per_frame", (double)clocked/i, "B");
+  report(name, "host_frames_per_s", i*1e6/t, "fps");
+  report(name, "wire_bytes_per_s", bytes/i/wireUs*1e6, "B/s");
+}
+
+// ---------------------------------------------------------------------------------------
+// line
+
+// A scene of n vectors that mostly hold still; each frame a few endpoints move by one
+// grid unit, and now and then a vector disappears or a new one appears.
+struct LineScene
+{
+  Vector vecs[LINE_TRACKER_MAX_VECTORS];
+  Intersection ints[4];
+  uint8_t n;
+  uint8_t nextIndex;
+  uint32_t rng;
+
+  uint32_t rand() { rng = rng*1103515245 + 12345; return rng >> 16; }
+
+  void init(uint8_t count)
+  {
+    uint8_t i;
+
+    rng = 1;
+    n = count;
+    for (i = 0; i < n; i++)
+      vecs[i] = (Vector){ (uint8_t)(rand() % 79), (uint8_t)(rand() % 52), (uint8_t)(rand() % 79), (uint8_t)(rand() % 52), i, 0 };
+    nextIndex = n;
+    memset(ints, 0, sizeof(ints));
+    for (i = 0; i < 4; i++)
+    {
+      ints[i].m_x = vecs[i].m_x1;
+      ints[i].m_y = vecs[i].m_y1;
+      ints[i].m_n = 2;
+      ints[i].m_intLines[0].m_index = i;
+      ints[i].m_intLines[1].m_index = (i + 1) % n;
+    }
+  }
+
+  void step()
+  {
+    uint8_t i, k;
+
+    for (k = 0; k < 3; k++)
+    {
+      i = rand() % n;
+      vecs[i].m_x1 += rand() % 3 - 1;
+      vecs[i].m_y1 += rand() % 3 - 1;
+    }
+    if (rand() % 30 == 0)
+    {
+      i = rand() % n;
+      vecs[i].m_index = nextIndex++;
+    }
+  }
+};
+
+static void benchLine(uint8_t count, uint32_t frames)
+{
+  Pixy2Emulated pixy;
+  Pixy2LineTracker<Link2Emu> tracker(&pixy);
+  LineScene scene;
+  uint32_t i, t0, tInc, tFull;
+  uint32_t steer = 0;
+  char name[32];
+
+  pixy.frameWidth = 79;
+
+  scene.init(count);
+  t0 = micros();
+  for (i = 0; i < frames; i++)
+  {
+    scene.step();
+    tracker.apply(scene.vecs, scene.n, scene.ints, 4);
+    steer += tracker.steer();
+  }
+  tInc = micros() - t0;
+
+  scene.init(count);
+  t0 = micros();
+  for (i = 0; i < frames; i++)
+  {
+    scene.step();
+    tracker.reset();
+    tracker.apply(scene.vecs, scene.n, scene.ints, 4);
+    steer += tracker.steer();
+  }
+  tFull = micros() - t0;
+
+  snprintf(name, sizeof(name), "line/%u", count);
+  report(name, "incremental_ns_per_frame", tInc*1000.0/frames, "ns");
+  report(name, "rebuild_ns_per_frame", tFull*1000.0/frames, "ns");
+  if (steer == 0xffffffff)
+    printf("\n"); // keep the loops from being optimised away
+}
+
+// ---------------------------------------------------------------------------------------
+// sched
+
+static int8_t schedCcc(void *arg) { return ((Pixy2Emulated *)arg)->ccc.getBlocks(); }
+static int8_t schedLine(void *arg) { return ((Pixy2Emulated *)arg)->line.getMainFeatures(); }
+static int8_t schedRgb(void *arg)
+{
+  uint8_t r, g, b;
+  return ((Pixy2Emulated *)arg)->video.getRGB(158, 104, &r, &g, &b);
+}
+
+static void benchSched(uint16_t cccHz, uint16_t lineHz, uint16_t rgbHz, uint32_t ms)
+{
+  static const char *names[3] = { "ccc", "line", "rgb" };
+  const uint16_t rates[3] = { cccHz, lineHz, rgbHz };
+  Pixy2Emulated pixy;
+  Pixy2Scheduler<Link2Emu> sched(&pixy);
+  uint32_t t0, runs[3] = { 0, 0, 0 }, switches;
+  uint8_t i;
+  char name[32], metric[32];
+
+  snprintf(name, sizeof(name), "sched/%u-%u-%u", cccHz, lineHz, rgbHz);
+  pixy.init();
+  sched.addTask(PIXY2_PROG_CCC, rates[0], schedCcc, &pixy);
+  sched.addTask(PIXY2_PROG_LINE, rates[1], schedLine, &pixy);
+  sched.addTask(PIXY2_PROG_VIDEO, rates[2], schedRgb, &pixy);
+  for (t0 = millis(); millis() - t0 < ms; )
+  {
+    sched.run();
+    delayMicroseconds(200);
+  }
+  for (i = 0; i < 3; i++)
+  {
+    snprintf(metric, sizeof(metric), "%s_requested", names[i]);
+    report(name, metric, rates[i], "Hz");
+    snprintf(metric, sizeof(metric), "%s_achieved", names[i]);
+    report(name, metric, sched.achievedHz(i), "Hz");
+  }
+  report(name, "switches_per_s", sched.switches()*1000.0/ms, "/s");
+
+  // the naive way: each request in turn, letting the camera switch programs on demand
+  switches = pixy.m_link.emu().progSwitches();
+  for (t0 = millis(); millis() - t0 < ms; )
+  {
+    if (schedCcc(&pixy) >= 0)
+      runs[0]++;
+    if (schedLine(&pixy) >= 0)
+      runs[1]++;
+    if (schedRgb(&pixy) >= 0)
+      runs[2]++;
+  }
+  for (i = 0; i < 3; i++)
+  {
+    snprintf(metric, sizeof(metric), "naive_%s_achieved", names[i]);
+    report(name, metric, runs[i]*1000.0/ms, "Hz");
+  }
+  report(name, "naive_switches_per_s", (pixy.m_link.emu().progSwitches() - switches)*1000.0/ms, "/s");
+}
+
+// ---------------------------------------------------------------------------------------
+// rgb
+
+// A cols x rows ROI grid per round over the pty: video.getRGB() per pixel, then
+// Pixy2RGBSampler with growing windows. Every pass must read the same colours.
+static void benchRgb(uint8_t cols, uint8_t rows, uint32_t rounds)
+{
+  static const uint8_t windows[] = { 0, 1, 4, 8 }; // 0: plain getRGB()
+  PtyRig rig;
+  Pixy2UARTLinux pixy;
+  Pixy2RGBSampler<Link2UARTLinux> sampler(&pixy);
+  std::vector<uint8_t> ref(cols*rows*3), rgb(cols*rows*3);
+  uint32_t i, t0, t, n = (uint32_t)cols*rows;
+  uint16_t p;
+  uint8_t w;
+  char name[32];
+
+  if (!rig.start())
+    return;
+  pixy.m_link.setDevice(rig.device());
+  if (pixy.init(921600) < 0 || pixy.changeProg("video") < 0)
+  {
+    printf("rgb: init failed\n");
+    pixy.m_link.close();
+    rig.stop();
+    return;
+  }
+
+  for (w = 0; w < sizeof(windows); w++)
+  {
+    t0 = micros();
+    for (i = 0; i < rounds; i++)
+    {
+      if (windows[w] == 0)
+      {
+        for (p = 0; p < n; p++)
+          if (pixy.video.getRGB(40 + (p % cols)*8, 30 + (p / cols)*8, &rgb[p*3], &rgb[p*3 + 1], &rgb[p*3 + 2]) < 0)
+            break;
+        if (p < n)
+          break;
+      }
+      else
+      {
+        sampler.setWindow(windows[w]);
+        if (sampler.sampleGrid(40, 30, cols, rows, 8, rgb.data()) < 0)
+          break;
+      }
+    }
+    t = micros() - t0;
+
+    if (windows[w] == 0)
+    {
+      snprintf(name, sizeof(name), "rgb/%ux%u/getRGB", cols, rows);
+      ref = rgb;
+    }
+    else
+      snprintf(name, sizeof(name), "rgb/%ux%u/window%u", cols, rows, windows[w]);
+    if (i < rounds || rgb != ref)
+    {
+      printf("%s: failed after %u rounds\n", name, i);
+      continue;
+    }
+    report(name, "roi_latency", (double)t/rounds, "us");
+    report(name, "exchanges_per_s", (double)n*rounds*1e6/t, "/s");
+  }
+  report("rgb", "sampler_fallbacks", sampler.fallbacks(), "pixels");
+
+  pixy.m_link.close();
+  rig.stop();
+}
+
+// ---------------------------------------------------------------------------------------
+// boot
+
+// Reset to first frame over the pty: init() every time, then Pixy2FastBoot with the
+// description cached by the previous boot. The camera runs at 60 fps and takes replyUs
+// to answer each version or resolution request: the time its main loop needs to get to
+// one, up to a frame's processing, which is what a warm boot saves.
+static void benchBoot(uint32_t replyUs, uint32_t boots)
+{
+  PtyRig rig;
+  std::vector<uint32_t> ttff[2];
+  uint32_t i, validated = 0;
+  uint8_t warm;
+  char name[32];
+
+  rig.cam.emu.setFrameRate(60);
+  rig.cam.emu.setReplyTime(replyUs);
+  if (!rig.start())
+    return;
+
+  for (warm = 0; warm < 2; warm++)
+  {
+    for (i = 0; i < boots; i++)
+    {
+      Pixy2UARTLinux pixy;
+      Pixy2FastBoot<Link2UARTLinux> boot(&pixy);
+
+      if (!warm)
+        boot.clear();
+      pixy.m_link.setDevice(rig.device());
+      if (boot.begin(921600) < 0)
+      {
+        printf("boot: begin failed\n");
+        break;
+      }
+      while (!boot.firstFrameUs())
+        boot.frame(pixy.ccc.getBlocks());
+      ttff[warm].push_back(boot.firstFrameUs());
+      // let the lazy check finish, as loop() would
+      while (boot.state() == PIXY2_BOOT_WARM)
+      {
+        boot.validate();
+        boot.frame(pixy.ccc.getBlocks());
+      }
+      if (warm && boot.mismatches() == 0)
+        validated++;
+    }
+  }
+  snprintf(name, sizeof(name), "boot/%ums/cold", replyUs/1000);
+  reportLatency(name, ttff[0]);
+  snprintf(name, sizeof(name), "boot/%ums/warm", replyUs/1000);
+  reportLatency(name, ttff[1]);
+  report(name, "cache_confirmed", validated, "boots");
+
+  rig.stop();
+}
+
+// ---------------------------------------------------------------------------------------
+// power
+
+// CCC at 60 fps with workUs of application work per frame, under each power mode: frames
+// per second kept and the modelled supply current.
+static void benchPower(uint32_t workUs, uint32_t ms)
+{
+  static const char *modes[] = { "spin", "idle", "slow", "sleep" };
+  Pixy2Emulated pixy;
+  uint32_t t0, t;
+  uint8_t m;
+  int8_t res;
+  char name[32];
+
+  pixy.m_link.emu().setFrameRate(60);
+  pixy.init();
+  for (m = PIXY2_POWER_SPIN; m <= PIXY2_POWER_SLEEP; m++)
+  {
+    // the clock's owner, never given work: 240 MHz, and the lowest level in the gaps
+    Pixy2Governor gov;
+    Pixy2PowerMode power(m, &gov);
+
+    gov.begin();
+
+    for (t0 = millis(); millis() - t0 < ms; )
+    {
+      res = pixy.ccc.getBlocks();
+      power.frame(res);
+      if (res >= 0)
+      {
+        // the application's share of the frame
+        for (t = micros(); micros() - t < workUs; );
+        power.idle();
+      }
+    }
+    snprintf(name, sizeof(name), "power/%ums/%s", workUs/1000, modes[m]);
+    report(name, "frames_per_s", power.frames()*1000.0/ms, "fps");
+    report(name, "estimated_current", power.estimatedMa(), "mA");
+    report(name, "active_share", 100.0*power.timeUs(PIXY2_POWER_ACTIVE)/
+      (power.timeUs(0) + power.timeUs(1) + power.timeUs(2) + power.timeUs(3)), "%");
+    if (m == PIXY2_POWER_SLOW)
+      report(name, "governor_time_at_80mhz", 100.0*gov.timeUs(0)/(gov.timeUs(0) + gov.timeUs(1) + gov.timeUs(2)), "%");
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// governor
+
+// CCC at 60 fps with CPU-bound work of baseCycles per frame and a spike of spikeCycles
+// every 50th frame; the work runs for cycles/MHz so it speeds up with the clock. Time at
+// each Pixy2Governor level, budget misses and switches, against staying at 240 MHz.
+static void benchGovernor(uint32_t baseCycles, uint32_t spikeCycles, uint32_t ms)
+{
+  Pixy2Emulated pixy;
+  Pixy2Governor gov;
+  uint32_t t0, t, us, n = 0, fixedMisses = 0;
+  uint64_t total;
+  uint8_t pass, i;
+  char name[32], metric[32];
+
+  snprintf(name, sizeof(name), "governor/%uk-%uk", baseCycles/1000, spikeCycles/1000);
+  pixy.m_link.emu().setFrameRate(60);
+  pixy.init();
+  gov.begin();
+  // pass 0 governs, pass 1 stays at 240 MHz and only counts misses
+  for (pass = 0; pass < 2; pass++)
+  {
+    for (t0 = millis(); millis() - t0 < ms; )
+    {
+      if (pixy.ccc.getBlocks() < 0)
+        continue;
+      us = ((++n % 50) ? baseCycles : spikeCycles)/(pass == 0 ? gov.mhz() : 240);
+      if (pass == 0)
+        gov.workBegin();
+      for (t = micros(); micros() - t < us; );
+      if (pass == 0)
+        gov.workEnd();
+      else if (us > gov.budgetUs())
+        fixedMisses++;
+    }
+    if (pass == 0)
+    {
+      total = gov.timeUs(0) + gov.timeUs(1) + gov.timeUs(2);
+      for (i = 0; i < PIXY2_GOV_LEVELS; i++)
+      {
+        snprintf(metric, sizeof(metric), "time_at_%umhz", PIXY2_GOV_MHZ[i]);
+        report(name, metric, 100.0*gov.timeUs(i)/total, "%");
+      }
+      report(name, "budget_misses", gov.misses(), "frames");
+      report(name, "switches_per_s", gov.switches()*1000.0/ms, "/s");
+      report(name, "frames", gov.frames(), "frames");
+    }
+  }
+  report(name, "fixed240_budget_misses", fixedMisses, "frames");
+}
+
+// ---------------------------------------------------------------------------------------
+// collector
+
+// Nodes on the master sides of ptys, all driven from one thread: 60 fps each with their
+// own clock offset, 1% of packets lost and 0.5% corrupted on the wire.
+struct SimNodes
+{
+  std::vector<int> masters;
+  std::vector<int64_t> offsets;   // node clock minus host clock, us
+  std::vector<uint32_t> dropped;  // lost or corrupted
+  bool delta;                     // Pixy2NodeTx::setDelta()
+  uint64_t bytes;
+  uint32_t sent;
+  volatile bool stop;
+
+  void run()
+  {
+    std::vector<Pixy2NodeTx> tx;
+    std::vector<uint64_t> due;
+    uint8_t buf[PIXY2_NODE_MAX_PACKET];
+    Block blocks[2];
+    uint64_t now;
+    uint16_t len;
+    size_t i;
+
+    for (i = 0; i < masters.size(); i++)
+    {
+      tx.push_back(Pixy2NodeTx(i));
+      tx.back().setDelta(delta);
+      due.push_back(Pixy2Collector::nowUs() + rand()%16667);
+    }
+    memset(blocks, 0, sizeof(blocks));
+    while (!stop)
+    {
+      now = Pixy2Collector::nowUs();
+      for (i = 0; i < masters.size(); i++)
+      {
+        if (now < due[i])
+          continue;
+        blocks[0].m_signature = 1;
+        blocks[0].m_x = tx[i].seq() % 316;
+        blocks[1].m_signature = 2;
+        blocks[1].m_y = tx[i].seq() % 208;
+        blocks[0].m_age = blocks[1].m_age = std::min(tx[i].seq(), (uint16_t)255);
+        // stamped at capture, on the node's clock
+        len = tx[i].pack(buf, blocks, 2, (uint32_t)(due[i] + offsets[i]));
+        due[i] += 16667;
+        bytes += len;
+        sent++;
+        if (rand()%100 == 0)
+        {
+          dropped[i]++;
+          continue;
+        }
+        // a corrupted packet fails its CRC, so it is lost as well
+        if (rand()%200 == 0)
+        {
+          buf[PIXY2_NODE_HEADER_SIZE + rand()%(len - PIXY2_NODE_HEADER_SIZE)] ^= 0x10;
+          dropped[i]++;
+        }
+        if (write(masters[i], buf, len) < 0)
+          perror("node");
+      }
+      usleep(500);
+    }
+  }
+};
+
+struct CollectorCheck
+{
+  SimNodes *sim;
+  uint64_t last;
+  uint64_t lastCapture;
+  uint32_t frames;
+  uint32_t outOfOrder;     // host timestamps going backwards
+  uint32_t misordered;     // true capture times going backwards by more than 2 ms
+  double latency;          // release minus true capture, summed
+  double skew;             // |assigned minus true capture|, summed
+};
+
+static void collectorConsumer(const Pixy2NodeFrame &frame, uint64_t hostUs, void *arg)
+{
+  CollectorCheck *c = (CollectorCheck *)arg;
+  uint64_t now = Pixy2Collector::nowUs();
+  // what the node stamped, back on the host clock (the low 32 bits are enough here)
+  int64_t capture = (int64_t)(uint32_t)(frame.timestamp - c->sim->offsets[frame.node]) - (int64_t)(uint32_t)now + (int64_t)now;
+
+  if (hostUs < c->last)
+    c->outOfOrder++;
+  if (c->frames && capture + 2000 < (int64_t)c->lastCapture)
+    c->misordered++;
+  c->last = hostUs;
+  c->lastCapture = capture;
+  c->latency += now - capture;
+  c->skew += fabs((double)hostUs - capture);
+  c->frames++;
+}
+
+static void benchCollector(uint16_t nodes, uint32_t ms, bool delta)
+{
+  SimNodes sim;
+  Pixy2Collector col;
+  CollectorCheck check;
+  std::vector<int> fds;
+  struct rusage r0, r1;
+  uint32_t injected = 0, detected = 0, undecoded = 0, i;
+  uint64_t t0;
+  double cpu;
+  char name[32];
+  int m;
+
+  for (i = 0; i < nodes; i++)
+  {
+    m = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m < 0 || grantpt(m) < 0 || unlockpt(m) < 0 || col.addDevice(ptsname(m), 921600) < 0)
+    {
+      perror("pty");
+      return;
+    }
+    sim.masters.push_back(m);
+    sim.offsets.push_back((int64_t)(rand()%100000) - 50000);
+    sim.dropped.push_back(0);
+  }
+  memset(&check, 0, sizeof(check));
+  check.sim = &sim;
+  col.addConsumer(collectorConsumer, &check);
+
+  sim.delta = delta;
+  sim.bytes = 0;
+  sim.sent = 0;
+  sim.stop = false;
+  std::thread th(&SimNodes::run, &sim);
+  getrusage(RUSAGE_THREAD, &r0);
+  for (t0 = Pixy2Collector::nowUs(); Pixy2Collector::nowUs() - t0 < ms*1000ULL; )
+    col.poll(10);
+  getrusage(RUSAGE_THREAD, &r1);
+  sim.stop = true;
+  th.join();
+  col.flush();
+
+  cpu = (r1.ru_utime.tv_sec - r0.ru_utime.tv_sec + r1.ru_stime.tv_sec - r0.ru_stime.tv_sec)*1e6 +
+    (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec) + (r1.ru_stime.tv_usec - r0.ru_stime.tv_usec);
+  for (i = 0; i < nodes; i++)
+  {
+    injected += sim.dropped[i];
+    detected += col.node(i).drops;
+    undecoded += col.node(i).undecoded;
+    close(sim.masters[i]);
+  }
+
+  snprintf(name, sizeof(name), "collector/%u%s", nodes, delta ? "/delta" : "");
+  report(name, "frames_per_s", check.frames*1000.0/ms, "fps");
+  report(name, "losses_injected", injected, "frames");
+  report(name, "drops_detected", detected, "frames");
+  report(name, "crc_errors", col.crcErrors(), "packets");
+  report(name, "late", col.late(), "frames");
+  report(name, "out_of_order", check.outOfOrder, "frames");
+  report(name, "misordered_2ms", check.misordered, "frames");
+  report(name, "capture_skew_mean", check.frames ? check.skew/check.frames : 0, "us");
+  report(name, "latency_mean", check.frames ? check.latency/check.frames : 0, "us");
+  report(name, "collector_cpu", cpu/(ms*1000.0)*100, "%");
+  report(name, "link_bytes_per_frame", sim.sent ? (double)sim.bytes/sim.sent : 0, "B");
+  report(name, "delivered", check.frames, "frames");
+  report(name, "undecoded", undecoded, "frames");
+  report(name, "undecoded_share", check.frames + undecoded ? 100.0*undecoded/(check.frames + undecoded) : 0, "%");
+}
+
+// ---------------------------------------------------------------------------------------
+// sync
+
+// Two cameras on two nodes, in virtual time (us on the host clock). Each camera frames
+// on its own crystal and each node counts on its own, skewPpm apart. A node works
+// 1-8 ms, then polls getBlocks(false) until there is a new frame, and ships it over a
+// FIFO link that adds 300 us plus exponential jitter. The host sends a sync request to
+// each node every second; nodes stamp it as it arrives and answer when their loop gets
+// round to it.
+struct SyncFrame
+{
+  int64_t idx;            // true frame number
+  double capture;         // true capture time
+};
+
+struct SyncEvent
+{
+  double at;              // arrival at the host
+  uint8_t node;
+  bool sync;              // a SYNC_RESP rather than a frame
+  SyncFrame frame;
+  uint32_t sent;          // node clock when the frame was sent
+  uint32_t est;           // Pixy2FrameClock capture estimate, node clock
+  uint32_t t[3];          // sync: t1 (host), t2 and t3 (node)
+
+  bool operator<(const SyncEvent &e) const { return at < e.at; }
+};
+
+// the host's clock, based to wrap a second into the run
+static uint32_t syncHostUs(double t) { return (uint32_t)(uint64_t)(t + 4294000000.0); }
+
+static double syncUniform(double lo, double hi) { return lo + (hi - lo)*rand()/((double)RAND_MAX + 1); }
+
+static double syncDelay(double jitterUs) { return 300 - jitterUs*log(1 - syncUniform(0, 1)); }
+
+struct SyncNode
+{
+  double period, phase;   // camera
+  double ppm, offset;     // node clock against the host's
+
+  uint32_t clock(double t) const { return (uint32_t)(int64_t)(t*(1 + ppm*1e-6) + offset); }
+
+  // A sync request is stamped as it arrives (Serial.onReceive()) and answered whenever
+  // the loop next checks.
+  void answer(double t, double jitterUs, double &req, double &reqAt, double &link, SyncEvent &ev,
+    std::vector<SyncEvent> &events)
+  {
+    if (reqAt > t)
+      return;
+    ev.sync = true;
+    ev.t[0] = syncHostUs(req);
+    ev.t[1] = clock(reqAt);
+    ev.t[2] = clock(t + 50);
+    ev.at = link = std::max(link, t + 50 + syncDelay(jitterUs));
+    events.push_back(ev);
+    req += 1000000;
+    reqAt = req + syncDelay(jitterUs);
+  }
+
+  void run(uint8_t node, double jitterUs, double us, std::vector<SyncEvent> &events)
+  {
+    Pixy2FrameClock fc;
+    SyncEvent ev;
+    double t = syncUniform(0, 10000), sent, done, link = 0;
+    double req = 500000 + node*1000, reqAt = req + syncDelay(jitterUs);
+    int64_t last = -1, idx;
+    int8_t res;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.node = node;
+    while (t < us)
+    {
+      t += syncUniform(1000, 8000);
+      for (;;)
+      {
+        answer(t, jitterUs, req, reqAt, link, ev, events);
+        sent = t;
+        done = t + syncUniform(150, 350);
+        // the camera answers a third of the way through the exchange
+        idx = (int64_t)floor((sent + (done - sent)/3 - phase)/period);
+        res = idx > last ? PIXY_RESULT_OK : PIXY_RESULT_BUSY;
+        ev.est = fc.frame(res, clock(sent), clock(done));
+        t = done;
+        if (res == PIXY_RESULT_OK)
+          break;
+        t += 300;
+      }
+      last = idx;
+      ev.sync = false;
+      ev.frame.idx = idx;
+      ev.frame.capture = phase + idx*period;
+      ev.sent = clock(t);
+      ev.at = link = std::max(link, t + syncDelay(jitterUs));
+      events.push_back(ev);
+    }
+  }
+};
+
+struct SyncMethod
+{
+  const char *name;
+  Pixy2FrameAligner<SyncFrame, 2> aligner;
+  std::vector<uint32_t> err;
+  uint32_t clear;         // sets whose right partner is 2 ms nearer than the next best
+  uint32_t correct;       // of those, sets that have it
+  double spread;          // true capture spread of the sets, summed
+  double settled;         // arrival of the last estimate more than 2 ms out
+
+  SyncMethod(const char *n) : name(n), aligner(8333), clear(0), correct(0), spread(0), settled(0) {}
+
+  void push(const SyncEvent &ev, uint32_t hostUs, SyncNode *nodes)
+  {
+    int32_t e = hostUs - syncHostUs(ev.frame.capture);
+    int64_t partner;
+    double gap;
+
+    if (e > 2000 || e < -2000)
+      settled = ev.at;
+    if (ev.at > 10000000) // steady state; settle_s covers the start
+      err.push_back(e < 0 ? -e : e);
+    aligner.push(ev.node, hostUs, ev.frame);
+    while (aligner.align())
+    {
+      // right if node 1's frame is the one nearest node 0's in true capture time; with
+      // the cameras close to half a period apart that is a coin toss, so not counted
+      partner = llround((aligner.frame(0).capture - nodes[1].phase)/nodes[1].period);
+      gap = fabs(aligner.frame(0).capture - (nodes[1].phase + partner*nodes[1].period));
+      if (gap < nodes[1].period/2 - 1000)
+      {
+        clear++;
+        if (aligner.frame(1).idx == partner)
+          correct++;
+      }
+      spread += fabs(aligner.frame(0).capture - aligner.frame(1).capture);
+    }
+  }
+
+  void report(double skewPpm, double jitterUs)
+  {
+    char section[48];
+    uint32_t sets = aligner.sets();
+
+    snprintf(section, sizeof(section), "sync/%.0fppm/%.0fms/%s", skewPpm, jitterUs/1000, name);
+    std::sort(err.begin(), err.end());
+    if (!err.empty())
+    {
+      ::report(section, "capture_err_p50", err[err.size()/2], "us");
+      ::report(section, "capture_err_p99", err[err.size()*99/100], "us");
+    }
+    ::report(section, "settle_s", settled/1e6, "s");
+    ::report(section, "pairs", sets, "sets");
+    ::report(section, "pairs_correct", clear ? correct*100.0/clear : 0, "%");
+    ::report(section, "pair_spread_mean", sets ? spread/sets : 0, "us");
+  }
+};
+
+static void benchSync(double skewPpm, double jitterUs, uint32_t ms)
+{
+  SyncNode nodes[2];
+  std::vector<SyncEvent> events;
+  SyncMethod arrival("arrival"), offset("offset"), synced("clocksync");
+  Pixy2ClockSync sync[2];
+  int32_t off[2], sample;
+  bool seen[2] = { false, false };
+  size_t i;
+  uint8_t n;
+
+  srand((getenv("PIXY_BENCH_SEED") ? atoi(getenv("PIXY_BENCH_SEED")) : 1) + (unsigned)(skewPpm*jitterUs));
+  for (n = 0; n < 2; n++)
+  {
+    nodes[n].period = 16667*(1 + syncUniform(-30, 30)*1e-6);
+    nodes[n].phase = syncUniform(0, 16667);
+    nodes[n].ppm = n ? skewPpm/2 : -skewPpm/2;
+    nodes[n].offset = syncUniform(0, 4e9);
+    nodes[n].run(n, jitterUs, ms*1000.0, events);
+  }
+  std::stable_sort(events.begin(), events.end());
+
+  for (i = 0; i < events.size(); i++)
+  {
+    const SyncEvent &ev = events[i];
+
+    n = ev.node;
+    if (ev.sync)
+    {
+      sync[n].sample(ev.t[0], ev.t[1], ev.t[2], syncHostUs(ev.at));
+      continue;
+    }
+    // the collector's mapping without sync: smallest arrival minus send time
+    sample = syncHostUs(ev.at) - ev.sent;
+    if (!seen[n] || sample < off[n])
+      off[n] = sample;
+    else
+      off[n] += (sample - off[n]) >> 10;
+    seen[n] = true;
+
+    sync[n].bound(ev.est, syncHostUs(ev.at));
+    arrival.push(ev, syncHostUs(ev.at), nodes);
+    offset.push(ev, ev.sent + off[n], nodes);
+    synced.push(ev, sync[n].valid() ? sync[n].toLocal(ev.est) : ev.est + off[n], nodes);
+  }
+  arrival.report(skewPpm, jitterUs);
+  offset.report(skewPpm, jitterUs);
+  synced.report(skewPpm, jitterUs);
+}
+
+// Two 60 fps cameras offsetUs apart, with frames pushed burst at a time as a collector
+// drains its sockets: no set may be wider than the tolerance, however the heads move.
+static void benchSyncBurst(uint32_t offsetUs, uint8_t burst, uint32_t frames)
+{
+  Pixy2FrameAligner<uint32_t, 2> small(4000), aligner(4000);
+  uint32_t i, j, t, wide = 0;
+  uint8_t s;
+  char name[32];
+
+  // the smallest case: A's second frame is nearer B's, but too far from it
+  small.push(0, 0, 0);
+  small.push(0, 16700, 1);
+  small.push(1, 8400, 0);
+  if (small.align())
+    fail("sync/burst: A %u and B %u paired, %u us apart\n", small.time(0), small.time(1), small.spreadUs());
+
+  for (i = 0; i < frames; i += burst)
+    for (s = 0; s < 2; s++)
+      for (j = i; j < i + burst && j < frames; j++)
+      {
+        t = 4294000000u + j*16667 + s*offsetUs;
+        aligner.push(s, t, j);
+        while (aligner.align())
+          if (aligner.spreadUs() > 4000)
+            wide++;
+      }
+  snprintf(name, sizeof(name), "sync/burst/%uus", offsetUs);
+  report(name, "sets", aligner.sets(), "sets");
+  report(name, "dropped", aligner.dropped(), "frames");
+  report(name, "over_tolerance", wide, "sets");
+  if (wide)
+    fail("sync/burst: %u of %u sets wider than 4000 us\n", wide, aligner.sets());
+}
+
+// ---------------------------------------------------------------------------------------
+// stereo
+
+// Two Pixy2s 100 mm apart, each toed in and tilted by about a degree, with a Pixy2-like
+// lens (60 degree field, barrel distortion) and slightly different intrinsics. Objects
+// are balls 20-60 mm across, 0.3-4 m out, from four signatures, so most frames have
+// look-alikes. Each view reports the rounded projection of every ball it sees, with up
+// to 3/4 pixel of centroid noise, missing 5% of the time, in shuffled order.
+struct StereoScene
+{
+  Pixy2StereoCalib calib;
+  Block left[PIXY2_STEREO_MAX_BLOCKS], right[PIXY2_STEREO_MAX_BLOCKS];
+  uint8_t numLeft, numRight;
+  uint8_t leftObj[PIXY2_STEREO_MAX_BLOCKS], rightObj[PIXY2_STEREO_MAX_BLOCKS];
+  float obj[PIXY2_STEREO_MAX_BLOCKS][3];
+  uint8_t both;           // balls in both views
+  uint32_t rng;
+
+  uint32_t rand() { rng = rng*1103515245 + 12345; return rng >> 16; }
+  float uniform(float lo, float hi) { return lo + (hi - lo)*(rand() & 0x7fff)/32768.0f; }
+
+  void init()
+  {
+    float yaw = 0.02f, pitch = -0.015f, roll = 0.01f, c[3] = { 100, 2, -1 };
+    float cy = cosf(yaw), sy = sinf(yaw), cp = cosf(pitch), sp = sinf(pitch), cr = cosf(roll), sr = sinf(roll);
+    float *R = calib.m_R;
+    uint8_t i;
+
+    rng = 1;
+    calib.m_left = (Pixy2StereoCamera){ 274, 273, 160, 102, -0.15f, 0.02f };
+    calib.m_right = (Pixy2StereoCamera){ 277, 276, 155, 106, -0.17f, 0.03f };
+    // R = Rz(roll)*Rx(pitch)*Ry(yaw); T = -R*c, c the right camera's centre
+    R[0] = cr*cy - sr*sp*sy; R[1] = -sr*cp; R[2] = cr*sy + sr*sp*cy;
+    R[3] = sr*cy + cr*sp*sy; R[4] = cr*cp;  R[5] = sr*sy - cr*sp*cy;
+    R[6] = -cp*sy;           R[7] = sp;     R[8] = cp*cy;
+    for (i = 0; i < 3; i++)
+      calib.m_T[i] = -(R[i*3]*c[0] + R[i*3 + 1]*c[1] + R[i*3 + 2]*c[2]);
+  }
+
+  static bool project(const Pixy2StereoCamera &cam, const float *p, float size, Block *b)
+  {
+    float x = p[0]/p[2], y = p[1]/p[2], r2 = x*x + y*y, s = 1 + cam.m_k1*r2 + cam.m_k2*r2*r2;
+    float u = cam.m_fx*x*s + cam.m_cx, v = cam.m_fy*y*s + cam.m_cy;
+
+    if (p[2] <= 0 || u < 0 || u > PIXY2_STEREO_WIDTH - 1 || v < 0 || v > PIXY2_STEREO_HEIGHT - 1)
+      return false;
+    b->m_x = (uint16_t)(u + 0.5f);
+    b->m_y = (uint16_t)(v + 0.5f);
+    b->m_width = b->m_height = (uint16_t)(cam.m_fx*size/p[2] + 1);
+    b->m_angle = 0;
+    b->m_age = 0;
+    return true;
+  }
+
+  void noise(Block *b)
+  {
+    b->m_x = (uint16_t)std::min(std::max((int)lroundf(b->m_x + uniform(-0.75f, 0.75f)), 0), PIXY2_STEREO_WIDTH - 1);
+    b->m_y = (uint16_t)std::min(std::max((int)lroundf(b->m_y + uniform(-0.75f, 0.75f)), 0), PIXY2_STEREO_HEIGHT - 1);
+  }
+
+  void step(uint8_t count)
+  {
+    float pr[3], size;
+    const float *R = calib.m_R;
+    uint8_t i, k, sig;
+    bool inL, inR;
+    Block bl, br;
+
+    numLeft = numRight = both = 0;
+    for (i = 0; i < count; i++)
+    {
+      obj[i][2] = uniform(300, 4000);
+      obj[i][0] = uniform(-0.6f, 0.65f)*obj[i][2];
+      obj[i][1] = uniform(-0.4f, 0.4f)*obj[i][2];
+      size = uniform(20, 60);
+      sig = rand() % 4 + 1;
+      for (k = 0; k < 3; k++)
+        pr[k] = R[k*3]*obj[i][0] + R[k*3 + 1]*obj[i][1] + R[k*3 + 2]*obj[i][2] + calib.m_T[k];
+      inL = project(calib.m_left, obj[i], size, &bl) && rand() % 20;
+      inR = project(calib.m_right, pr, size, &br) && rand() % 20;
+      bl.m_signature = br.m_signature = sig;
+      bl.m_index = br.m_index = i;
+      if (inL)
+      {
+        noise(&bl);
+        left[numLeft] = bl;
+        leftObj[numLeft++] = i;
+      }
+      if (inR)
+      {
+        noise(&br);
+        right[numRight] = br;
+        rightObj[numRight++] = i;
+      }
+      both += inL && inR;
+    }
+    shuffle(left, leftObj, numLeft);
+    shuffle(right, rightObj, numRight);
+  }
+
+  void shuffle(Block *b, uint8_t *o, uint8_t n)
+  {
+    uint8_t i, j;
+
+    for (i = n; i > 1; i--)
+    {
+      j = rand() % i;
+      std::swap(b[i - 1], b[j]);
+      std::swap(o[i - 1], o[j]);
+    }
+  }
+};
+
+static void benchStereo(uint8_t count, uint32_t frames)
+{
+  static StereoScene scenes[256];
+  Pixy2Stereo stereo;
+  std::vector<float> depthErr, posErr, rowErr;
+  uint32_t i, j, k, n, t0, t, points = 0, correct = 0, both = 0, checks = 0, sum = 0;
+  char name[32];
+  float dx, dy, dz;
+  int16_t u[2], v[2];
+
+  scenes[0].init();
+  t0 = micros();
+  for (i = 0; i < 100; i++)
+    stereo.begin(scenes[0].calib);
+  t = micros() - t0;
+  snprintf(name, sizeof(name), "stereo/%u", count);
+  report(name, "begin_us", t/100.0, "us");
+
+  for (i = 0; i < 256; i++)
+  {
+    scenes[i].init();
+    scenes[i].rng = i + 1;
+    scenes[i].step(count);
+  }
+
+  t0 = micros();
+  for (i = 0; i < frames; i++)
+  {
+    StereoScene &s = scenes[i & 255];
+    sum += stereo.fuse(s.left, s.numLeft, s.right, s.numRight);
+  }
+  t = micros() - t0;
+
+  for (i = 0; i < 256; i++)
+  {
+    StereoScene &s = scenes[i];
+
+    n = stereo.fuse(s.left, s.numLeft, s.right, s.numRight);
+    checks = std::max(checks, (uint32_t)stereo.checks());
+    points += n;
+    both += s.both;
+    for (j = 0; j < n; j++)
+    {
+      const Pixy2StereoPoint &p = stereo.points[j];
+      if (s.leftObj[p.m_left] != s.rightObj[p.m_right])
+        continue;
+      correct++;
+      k = s.leftObj[p.m_left];
+      dx = p.m_x - s.obj[k][0];
+      dy = p.m_y - s.obj[k][1];
+      dz = p.m_z - s.obj[k][2];
+      depthErr.push_back(fabsf(dz)*100/s.obj[k][2]);
+      posErr.push_back(sqrtf(dx*dx + dy*dy + dz*dz));
+    }
+    // epipolar row agreement of the true pairs, LUT and centroid rounding included
+    for (j = 0; j < s.numLeft; j++)
+      for (k = 0; k < s.numRight; k++)
+        if (s.leftObj[j] == s.rightObj[k])
+        {
+          stereo.rectified(0, s.left[j].m_x, s.left[j].m_y, &u[0], &v[0]);
+          stereo.rectified(1, s.right[k].m_x, s.right[k].m_y, &u[1], &v[1]);
+          rowErr.push_back(abs(v[0] - v[1])/16.0f);
+        }
+  }
+  std::sort(depthErr.begin(), depthErr.end());
+  std::sort(posErr.begin(), posErr.end());
+  std::sort(rowErr.begin(), rowErr.end());
+
+  report(name, "fuse_ns_per_frame", t*1000.0/frames, "ns");
+  report(name, "checks_max", checks, "pairs");
+  report(name, "match_precision", points ? correct*100.0/points : 0, "%");
+  report(name, "match_recall", both ? correct*100.0/both : 0, "%");
+  if (!depthErr.empty())
+  {
+    report(name, "depth_err_p50", depthErr[depthErr.size()/2], "%");
+    report(name, "depth_err_p90", depthErr[depthErr.size()*9/10], "%");
+    report(name, "pos_err_p50", posErr[posErr.size()/2], "mm");
+  }
+  if (!rowErr.empty())
+    report(name, "row_err_p99", rowErr[rowErr.size()*99/100], "px");
+  if (sum == 0xffffffff)
+    printf("\n");
+}
+
+// ---------------------------------------------------------------------------------------
+// format
+
+// Arduino's Print as the ESP32 core has it: print(number) converts into a local buffer
+// by repeated division and writes that string, write() is virtual, and HardwareSerial
+// takes the UART lock for every write. The UART here is a ring in memory.
+class FormatPrint
+{
+public:
+  virtual ~FormatPrint() { }
+  virtual size_t write(const uint8_t *buf, size_t len) = 0;
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(unsigned long n)
+  {
+    char buf[8*sizeof(long) + 1], *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+    do
+    {
+      *--str = '0' + n%10;
+      n /= 10;
+    } while (n);
+    return print(str);
+  }
+  size_t print(int n) { return n < 0 ? print("-") + print(0UL - n) : print((unsigned long)n); }
+  size_t println(int n) { return print(n) + print("\r\n"); }
+};
+
+class FormatUart : public FormatPrint
+{
+public:
+  FormatUart() : m_head(0), m_calls(0) { }
+
+  size_t write(const uint8_t *buf, size_t len) override
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    size_t i;
+
+    for (i = 0; i < len; i++)
+      m_ring[m_head++ & (sizeof(m_ring) - 1)] = buf[i];
+    m_calls++;
+    return len;
+  }
+
+  std::mutex m_lock;
+  uint8_t m_ring[4096];
+  uint32_t m_head;
+  uint32_t m_calls;
+};
+
+// The sketch's report: a line per block of the wanted signature.
+static void formatPrint(FormatUart &uart, const Block *blocks, uint8_t n)
+{
+  uint8_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    uart.print("BLUE @ (");
+    uart.print(blocks[i].m_x); uart.print(", ");
+    uart.print(blocks[i].m_y); uart.print(")  w=");
+    uart.print(blocks[i].m_width); uart.print(" h=");
+    uart.println(blocks[i].m_height);
+  }
+}
+
+static void formatSnprintf(FormatUart &uart, const Block *blocks, uint8_t n)
+{
+  char buf[1024];
+  int len = 0;
+  uint8_t i;
+
+  for (i = 0; i < n; i++)
+    len += snprintf(buf + len, sizeof(buf) - len, "BLUE @ (%u, %u)  w=%u h=%u\r\n", blocks[i].m_x, blocks[i].m_y,
+      blocks[i].m_width, blocks[i].m_height);
+  uart.write((const uint8_t *)buf, len);
+}
+
+static void formatFormat(FormatUart &uart, const Block *blocks, uint8_t n)
+{
+  Pixy2Format<1024> out;
+  uint8_t i;
+
+  for (i = 0; i < n; i++)
+    out.str("BLUE @ (").udec(blocks[i].m_x).str(", ").udec(blocks[i].m_y).str(")  w=").udec(blocks[i].m_width).
+      str(" h=").udec(blocks[i].m_height).endl();
+  out.write(uart);
+}
+
+// block() against Block::print()'s text, for a plain signature and a color code.
+static void formatBlockCheck()
+{
+  static const char *expect[] =
+  {
+    "sig: 6 x: 150 y: 99 width: 20 height: 12 index: 3 age: 255",
+    "CC block sig: 12 (10 decimal) x: 150 y: 99 width: 20 height: 12 angle: -45 index: 3 age: 255",
+  };
+  static const uint16_t sigs[] = { 6, 10 };
+  Pixy2Format<128> out;
+  Block b;
+  uint8_t i;
+
+  b.m_x = 150;
+  b.m_y = 99;
+  b.m_width = 20;
+  b.m_height = 12;
+  b.m_angle = -45;
+  b.m_index = 3;
+  b.m_age = 255;
+  for (i = 0; i < 2; i++)
+  {
+    b.m_signature = sigs[i];
+    out.clear();
+    out.block(b);
+    if (strcmp(out.c_str(), expect[i]))
+      fail("format/block: \"%s\", Block::print() has \"%s\"\n", out.c_str(), expect[i]);
+  }
+}
+
+static void benchFormat(uint8_t count, uint32_t reports)
+{
+  static const struct { const char *name; void (*fn)(FormatUart &, const Block *, uint8_t); } methods[] =
+  {
+    { "print", formatPrint },
+    { "snprintf", formatSnprintf },
+    { "format", formatFormat },
+  };
+  Block blocks[32];
+  uint8_t first[1024];
+  uint32_t i, m, t0, t, rng = 1, len = 0;
+  char name[32];
+
+  for (i = 0; i < count; i++)
+  {
+    rng = rng*1103515245 + 12345;
+    blocks[i].m_signature = 6;
+    blocks[i].m_x = (rng >> 16) % 316;
+    blocks[i].m_y = (rng >> 8) % 208;
+    blocks[i].m_width = (rng >> 4) % 316 + 1;
+    blocks[i].m_height = rng % 9 + 1;
+  }
+
+  formatBlockCheck();
+  for (m = 0; m < sizeof(methods)/sizeof(methods[0]); m++)
+  {
+    FormatUart uart;
+
+    methods[m].fn(uart, blocks, count);
+    // every method has to produce the same bytes
+    if (m == 0)
+      memcpy(first, uart.m_ring, len = uart.m_head);
+    else if (uart.m_head != len || memcmp(first, uart.m_ring, len))
+      fail("format/%s: output differs from print\n", methods[m].name);
+    uart.m_calls = 0;
+
+    t0 = micros();
+    for (i = 0; i < reports; i++)
+      methods[m].fn(uart, blocks, count);
+    t = micros() - t0;
+
+    snprintf(name, sizeof(name), "format/%u/%s", count, methods[m].name);
+    report(name, "ns_per_report", t*1000.0/reports, "ns");
+    report(name, "writes_per_report", (double)uart.m_calls/reports, "calls");
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// blackbox
+
+// CCC frames for the recorder: tracked blocks that mostly sit still or drift a pixel or
+// two, with sizes that flicker, and now and then one lost and a new one found.
+struct BoxScene
+{
+  Block blocks[PIXY2_BLACKBOX_MAX_BLOCKS];
+  uint8_t n;
+  uint8_t nextIndex;
+  uint32_t rng;
+
+  uint32_t rand() { rng = rng*1103515245 + 12345; return rng >> 16; }
+
+  void fresh(Block *b)
+  {
+    b->m_signature = rand()%7 + 1;
+    b->m_x = rand()%316;
+    b->m_y = rand()%208;
+    b->m_width = rand()%60 + 4;
+    b->m_height = rand()%40 + 4;
+    b->m_angle = 0;
+    b->m_index = nextIndex++;
+    b->m_age = 0;
+  }
+
+  void init(uint8_t count)
+  {
+    uint8_t i;
+
+    rng = 1;
+    n = count;
+    nextIndex = 0;
+    for (i = 0; i < n; i++)
+      fresh(&blocks[i]);
+  }
+
+  void step()
+  {
+    uint8_t i;
+
+    for (i = 0; i < n; i++)
+    {
+      Block &b = blocks[i];
+      if (rand()%300 == 0)
+      {
+        fresh(&b);
+        continue;
+      }
+      if (rand()%3 == 0)
+      {
+        b.m_x = std::min(std::max((int)b.m_x + (int)(rand()%5) - 2, 0), 315);
+        b.m_y = std::min(std::max((int)b.m_y + (int)(rand()%5) - 2, 0), 207);
+      }
+      if (rand()%4 == 0)
+        b.m_width += (int)(rand()%3) - 1;
+      if (rand()%4 == 0)
+        b.m_height += (int)(rand()%3) - 1;
+      if (b.m_age < 255)
+        b.m_age++;
+    }
+  }
+};
+
+static bool boxFile(char *path, Pixy2FlashFile &flash, uint32_t size)
+{
+  int fd;
+
+  strcpy(path, "/tmp/pixy_bench_boxXXXXXX");
+  if ((fd = mkstemp(path)) < 0)
+    return false;
+  close(fd);
+  return flash.open(path, size) == 0;
+}
+
+// Twenty minutes at 60 fps into 1 MB as fast as the recorder goes (pages written between
+// frames, outside the timing), then read back and checked against what went in.
+static void benchBlackBox(uint8_t count, uint32_t frames)
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBox<Pixy2FlashFile> *box = new Pixy2BlackBox<Pixy2FlashFile>(&flash);
+  Pixy2BlackBoxReader<Pixy2FlashFile> reader(&flash);
+  Pixy2BlackBoxFrame frame;
+  BoxScene scene;
+  std::vector<Block> sent, batch;
+  std::map<uint32_t, uint32_t> at;
+  uint32_t i, j, t0, t, ms, read = 0, bad = 0, first = 0, last = 0, lo = 0xffffffff, hi = 0;
+  char path[32], name[32];
+
+  if (!boxFile(path, flash, 1 << 20))
+  {
+    perror("blackbox");
+    delete box;
+    return;
+  }
+  box->begin(false);
+
+  scene.init(count);
+  sent.resize((size_t)frames*count);
+  batch.resize(64*count);
+  // 64 frames at a time fit in the queue
+  for (i = 0, t = 0; i < frames; i += 64)
+  {
+    for (j = i; j < i + 64 && j < frames; j++)
+    {
+      scene.step();
+      ms = j*50/3;
+      at[ms] = j;
+      memcpy(&sent[(size_t)j*count], scene.blocks, count*sizeof(Block));
+      memcpy(&batch[(j - i)*count], scene.blocks, count*sizeof(Block));
+    }
+    t0 = micros();
+    for (j = i; j < i + 64 && j < frames; j++)
+      box->record(&batch[(j - i)*count], count, j*50/3);
+    t += micros() - t0;
+    box->service();
+  }
+  box->flush();
+  box->service();
+
+  reader.begin();
+  while (reader.next(&frame))
+  {
+    std::map<uint32_t, uint32_t>::iterator it = at.find(frame.time);
+    if (read++ == 0)
+      first = frame.time;
+    last = frame.time;
+    if (it == at.end() || frame.numBlocks != count ||
+      memcmp(frame.blocks, &sent[(size_t)it->second*count], count*sizeof(Block)))
+      bad++;
+  }
+  for (i = 0; i < flash.sectors(); i++)
+  {
+    lo = std::min(lo, flash.erases(i));
+    hi = std::max(hi, flash.erases(i));
+  }
+
+  snprintf(name, sizeof(name), "blackbox/%u", count);
+  report(name, "record_ns_per_frame", t*1000.0/frames, "ns");
+  report(name, "bytes_per_frame", box->pagesWritten()*(double)PIXY2_BLACKBOX_PAGE/box->recorded(), "B");
+  report(name, "raw_bytes_per_frame", 4 + 1 + count*sizeof(Block), "B");
+  report(name, "dropped", box->dropped(), "frames");
+  report(name, "retained", (last - first)/1000.0, "s");
+  report(name, "read_back", read, "frames");
+  report(name, "read_mismatches", bad + reader.badPages(), "frames");
+  report(name, "sector_erases_min", lo, "");
+  report(name, "sector_erases_max", hi, "");
+  unlink(path);
+  delete box;
+}
+
+// A minute at 60 fps, the recorder started again as after a reset and half a minute more
+// with millis() from 0: the reader gives each frame its boot, in order.
+static void benchBlackBoxReboot()
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBox<Pixy2FlashFile> *box;
+  Pixy2BlackBoxReader<Pixy2FlashFile> reader(&flash);
+  Pixy2BlackBoxFrame frame;
+  BoxScene scene;
+  uint32_t boot, i, j, counts[2] = {0, 0}, wrong = 0, prev = 0;
+  char path[32];
+
+  if (!boxFile(path, flash, 1 << 20))
+  {
+    perror("blackbox");
+    return;
+  }
+  scene.init(4);
+  for (boot = 0; boot < 2; boot++)
+  {
+    box = new Pixy2BlackBox<Pixy2FlashFile>(&flash);
+    box->begin(false);
+    for (i = 0; i < 3600/(boot + 1); i += 64)
+    {
+      for (j = i; j < i + 64 && j < 3600/(boot + 1); j++)
+      {
+        scene.step();
+        box->record(scene.blocks, 4, (boot ? 0 : 600000) + j*50/3);
+      }
+      box->service();
+    }
+    box->flush();
+    box->service();
+    delete box;
+  }
+
+  reader.begin();
+  while (reader.next(&frame))
+  {
+    if (frame.boot > 1 || frame.boot < prev)
+      wrong++;
+    else
+      counts[frame.boot]++;
+    prev = frame.boot;
+  }
+  report("blackbox/reboot", "boot0_frames", counts[0], "frames");
+  report("blackbox/reboot", "boot1_frames", counts[1], "frames");
+  if (wrong || counts[0] != 3600 || counts[1] != 1800)
+    fail("blackbox/reboot: %u and %u frames in boots 0 and 1, %u out of order\n", counts[0], counts[1], wrong);
+  unlink(path);
+}
+
+// Frames for a few seconds, then none, as when the camera goes away: the loop only calls
+// flushIdle() and service(), as the writer task does on its own. The last frames must be
+// on flash PIXY2_BLACKBOX_FLUSH_MS after the page was started, without a flush().
+static void benchBlackBoxIdle()
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBox<Pixy2FlashFile> *box = new Pixy2BlackBox<Pixy2FlashFile>(&flash);
+  Pixy2BlackBoxReader<Pixy2FlashFile> reader(&flash);
+  Pixy2BlackBoxFrame frame;
+  BoxScene scene;
+  uint32_t i, ms, read = 0, last = 0, early;
+  char path[32];
+
+  if (!boxFile(path, flash, 1 << 20))
+  {
+    perror("blackbox");
+    delete box;
+    return;
+  }
+  box->begin(false);
+  scene.init(4);
+  for (i = 0; i < 200; i++)
+  {
+    scene.step();
+    box->record(scene.blocks, 4, i*50/3);
+    box->flushIdle(i*50/3);
+    box->service();
+  }
+  // no more frames; the last page was started at most FLUSH_MS ago
+  ms = 199*50/3;
+  early = box->flushIdle(ms + 1);
+  box->flushIdle(ms + PIXY2_BLACKBOX_FLUSH_MS);
+  box->service();
+
+  reader.begin();
+  while (reader.next(&frame))
+  {
+    read++;
+    last = frame.time;
+  }
+  report("blackbox/idle", "read_back", read, "frames");
+  if (read != 200 || last != 199*50/3 || early)
+    fail("blackbox/idle: %u of 200 frames on flash, the last at %u ms, %s\n", read, last,
+      early ? "queued before FLUSH_MS" : "after frames stopped");
+  unlink(path);
+  delete box;
+}
+
+// 60 fps in real time on a flash with the chip's erase and program times: how long the
+// vision loop spends in the recorder, with the writer on its own thread and with pages
+// written from the loop. With stall, the loop also waits out each erase and program as
+// it would on a classic ESP32, where they pause code running from flash.
+static void benchBlackBoxStall(bool task, bool stall, uint32_t frames)
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBox<Pixy2FlashFile> *box = new Pixy2BlackBox<Pixy2FlashFile>(&flash);
+  BoxScene scene;
+  std::vector<uint32_t> us;
+  volatile bool stop = false;
+  uint32_t i, t0, start, late = 0;
+  char path[32], name[32];
+
+  if (!boxFile(path, flash, 64*PIXY2_BLACKBOX_SECTOR))
+  {
+    perror("blackbox");
+    delete box;
+    return;
+  }
+  flash.setTiming(45000, 700);
+  box->begin(false);
+  std::thread writer([&]() { while (task && !stop) if (!box->service()) usleep(200); });
+
+  scene.init(8);
+  start = micros();
+  for (i = 0; i < frames; i++)
+  {
+    scene.step();
+    t0 = micros();
+    while (stall && flash.busy())
+      delayMicroseconds(50);
+    box->record(scene.blocks, scene.n, t0/1000);
+    if (!task)
+      box->service();
+    us.push_back(micros() - t0);
+    if (us.back() > 16667 - 2000)
+      late++;
+    // next frame
+    while ((int32_t)(micros() - (start + (i + 1)*16667)) < 0)
+      usleep(500);
+  }
+  stop = true;
+  writer.join();
+
+  snprintf(name, sizeof(name), "blackbox/%s%s", task ? "thread" : "inline", stall ? "-stall" : "");
+  report(name, "erases", box->erases(), "");
+  report(name, "erases_inline", box->erasesInline(), "");
+  report(name, "page_wait_max", box->pageWaitMaxUs(), "us");
+  report(name, "record_max", *std::max_element(us.begin(), us.end()), "us");
+  reportLatency(name, us);
+  report(name, "frames_over_budget", late, "frames");
+  unlink(path);
+  delete box;
+}
+
+// ---------------------------------------------------------------------------------------
+// codec
+
+// CCC frames one after another.
+struct CodecTrace
+{
+  std::vector<Block> blocks;
+  std::vector<uint32_t> start;   // each frame's first block, then the end
+
+  void clear()
+  {
+    blocks.clear();
+    start.assign(1, 0);
+  }
+
+  void add(const Block *b, uint8_t n)
+  {
+    blocks.insert(blocks.end(), b, b + n);
+    start.push_back(blocks.size());
+  }
+
+  uint32_t frames() const { return start.size() - 1; }
+  const Block *frame(uint32_t i) const { return blocks.data() + start[i]; }
+  uint8_t count(uint32_t i) const { return start[i + 1] - start[i]; }
+};
+
+static void codecScene(CodecTrace *trace, uint8_t count, uint32_t frames)
+{
+  BoxScene scene;
+  uint32_t i;
+
+  trace->clear();
+  scene.init(count);
+  for (i = 0; i < frames; i++)
+  {
+    scene.step();
+    trace->add(scene.blocks, scene.n);
+  }
+}
+
+// Frames as the emulated camera sends them through the link: blocks gliding on smooth
+// paths, a few pixels a frame.
+static void codecCamera(CodecTrace *trace, uint8_t count, uint32_t frames)
+{
+  Pixy2Emulated pixy;
+  uint32_t i;
+
+  trace->clear();
+  pixy.m_link.emu().setFrameRate(0);
+  pixy.m_link.emu().setBlocks(count);
+  pixy.init();
+  for (i = 0; i < frames; i++)
+    if (pixy.ccc.getBlocks() >= 0)
+      trace->add(pixy.ccc.blocks, pixy.ccc.numBlocks);
+}
+
+static bool codecDump(CodecTrace *trace, const char *path)
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBoxReader<Pixy2FlashFile> reader(&flash);
+  Pixy2BlackBoxFrame frame;
+
+  trace->clear();
+  if (flash.open(path, 0, true) < 0 || !reader.begin())
+    return false;
+  while (reader.next(&frame))
+    trace->add(frame.blocks, frame.numBlocks);
+  return trace->frames() > 0;
+}
+
+// The whole trace coded into one buffer and decoded back, ten times over for the
+// timing, then once more with a keyframe every 30 frames for the size.
+static void benchCodec(const char *name, const CodecTrace &trace)
+{
+  Pixy2FrameCodec enc, dec;
+  std::vector<uint8_t> coded;
+  std::vector<uint16_t> len(trace.frames());
+  std::vector<Block> decoded(trace.blocks.size() + 1);
+  uint32_t frames = trace.frames(), i, round, t0, tEnc = 0, tDec = 0, bad = 0;
+  uint64_t pos, bytes = 0, keyBytes = 0, anchoredBytes = 0;
+  uint8_t n;
+
+  coded.resize(frames + trace.blocks.size()*PIXY2_CODEC_MAX_BLOCK);
+  for (round = 0; round < 10; round++)
+  {
+    enc.reset();
+    dec.reset();
+    t0 = micros();
+    for (i = 0, pos = 0; i < frames; i++)
+    {
+      len[i] = enc.encode(&coded[pos], PIXY2_CODEC_MAX_FRAME, trace.frame(i), trace.count(i));
+      pos += len[i];
+    }
+    tEnc += micros() - t0;
+    bytes = pos;
+
+    t0 = micros();
+    for (i = 0, pos = 0; i < frames; i++)
+    {
+      if (dec.decode(&coded[pos], len[i], &decoded[trace.start[i]], &n) != len[i] || n != trace.count(i))
+        bad++;
+      pos += len[i];
+    }
+    tDec += micros() - t0;
+  }
+  if (memcmp(decoded.data(), trace.blocks.data(), trace.blocks.size()*sizeof(Block)))
+    bad++;
+
+  enc.reset();
+  enc.setKeyInterval(30);
+  for (i = 0; i < frames; i++)
+    keyBytes += enc.encode(&coded[0], PIXY2_CODEC_MAX_FRAME, trace.frame(i), trace.count(i));
+  // as the node protocol codes: against the keyframe, so a lost frame costs only itself
+  enc.reset();
+  enc.setAnchored(true);
+  for (i = 0; i < frames; i++)
+    anchoredBytes += enc.encode(&coded[0], PIXY2_CODEC_MAX_FRAME, trace.frame(i), trace.count(i));
+
+  report(name, "frames", frames, "");
+  report(name, "blocks_per_frame", (double)trace.blocks.size()/frames, "");
+  report(name, "block_bytes_per_frame", (double)trace.blocks.size()*sizeof(Block)/frames, "B");
+  report(name, "packed_bytes_per_frame", (double)trace.blocks.size()*PIXY2_NODE_BLOCK_SIZE/frames, "B");
+  report(name, "coded_bytes_per_frame", (double)bytes/frames, "B");
+  report(name, "coded_key30_bytes", (double)keyBytes/frames, "B");
+  report(name, "coded_key30_anchored_bytes", (double)anchoredBytes/frames, "B");
+  report(name, "ratio_to_blocks", trace.blocks.size()*sizeof(Block)/(double)bytes, "x");
+  report(name, "ratio_key30_to_blocks", trace.blocks.size()*sizeof(Block)/(double)keyBytes, "x");
+  report(name, "encode_ns_per_frame", tEnc*1000.0/(10.0*frames), "ns");
+  report(name, "decode_ns_per_frame", tDec*1000.0/(10.0*frames), "ns");
+  report(name, "mismatches", bad, "frames");
+}
+
+// ---------------------------------------------------------------------------------------
+// arena
+
+static uint64_t g_heapAllocs;
+
+// std::allocator, counting.
+template <class T> struct CountedAllocator : std::allocator<T>
+{
+  typedef T value_type;
+  CountedAllocator() { }
+  template <class U> CountedAllocator(const CountedAllocator<U> &) { }
+  T *allocate(size_t n) { g_heapAllocs++; return std::allocator<T>::allocate(n); }
+  template <class U> struct rebind { typedef CountedAllocator<U> other; };
+};
+
+// Where a frame's temporaries come from.
+template <class T> struct HeapTemp
+{
+  typedef CountedAllocator<T> type;
+  static type get(Pixy2Arena *) { return type(); }
+  static T *array(Pixy2Arena *, uint32_t n) { g_heapAllocs++; return new T[n]; }
+  static void done(T *p) { delete [] p; }
+};
+
+template <class T> struct ArenaTemp
+{
+  typedef Pixy2ArenaAllocator<T> type;
+  static type get(Pixy2Arena *arena) { return type(arena); }
+  static T *array(Pixy2Arena *arena, uint32_t n) { return arena->alloc<T>(n); }
+  static void done(T *) { }
+};
+
+// What lives across frames: a position history per track, dropped when the track goes,
+// and a log of recent events. Always on the heap.
+struct ArenaTracks
+{
+  std::map<uint8_t, std::vector<uint32_t> > history;
+  std::deque<std::string> log;
+  uint32_t frame;
+};
+
+// Feature code for one frame, the way it would be written with the STL: keep the
+// blocks that are big enough, cluster them by distance, match them to the histories.
+template <template <class> class Temp> static uint32_t arenaFrame(Pixy2Arena *arena, const Block *blocks, uint8_t n,
+  ArenaTracks *tracks)
+{
+  typedef std::vector<Block, typename Temp<Block>::type> Blocks;
+  typedef std::vector<uint8_t, typename Temp<uint8_t>::type> Members;
+  typedef std::vector<Members, typename Temp<Members>::type> Clusters;
+  typedef std::pair<const uint8_t, uint8_t> Match;
+  typedef std::map<uint8_t, uint8_t, std::less<uint8_t>, typename Temp<Match>::type> Matches;
+  Blocks kept(Temp<Block>::get(arena));
+  Clusters clusters(Temp<Members>::get(arena));
+  Matches matched(std::less<uint8_t>(), Temp<Match>::get(arena));
+  std::map<uint8_t, std::vector<uint32_t> >::iterator it;
+  uint32_t sum = 0, i, j, k;
+  int32_t *dist;
+  char text[48];
+
+  kept.reserve(n);
+  for (i = 0; i < n; i++)
+    if (blocks[i].m_width*blocks[i].m_height >= 64)
+      kept.push_back(blocks[i]);
+
+  dist = Temp<int32_t>::array(arena, kept.size()*kept.size());
+  for (i = 0; i < kept.size(); i++)
+    for (j = 0; j < kept.size(); j++)
+      dist[i*kept.size() + j] = abs((int)kept[i].m_x - kept[j].m_x) + abs((int)kept[i].m_y - kept[j].m_y);
+  for (i = 0; i < kept.size(); i++)
+  {
+    for (k = 0; k < clusters.size(); k++)
+      if (dist[i*kept.size() + clusters[k][0]] < 60)
+        break;
+    if (k == clusters.size())
+      clusters.push_back(Members(Temp<uint8_t>::get(arena)));
+    clusters[k].push_back(i);
+  }
+  for (k = 0; k < clusters.size(); k++)
+    sum += clusters[k].size()*(k + 1);
+  Temp<int32_t>::done(dist);
+
+  for (i = 0; i < kept.size(); i++)
+  {
+    matched[kept[i].m_index] = i;
+    std::vector<uint32_t> &h = tracks->history[kept[i].m_index];
+    if (h.empty())
+    {
+      snprintf(text, sizeof(text), "frame %u: track %u", tracks->frame, kept[i].m_index);
+      tracks->log.push_back(text);
+      if (tracks->log.size() > 64)
+        tracks->log.pop_front();
+    }
+    h.push_back(kept[i].m_x << 16 | kept[i].m_y);
+  }
+  for (it = tracks->history.begin(); it != tracks->history.end(); )
+  {
+    if (matched.find(it->first) == matched.end())
+      tracks->history.erase(it++);
+    else
+    {
+      // keep the last two seconds
+      if (it->second.size() > 120)
+        it->second.erase(it->second.begin(), it->second.begin() + 60);
+      sum += it->second.back();
+      ++it;
+    }
+  }
+  tracks->frame++;
+  return sum;
+}
+
+// Hours of frames through arenaFrame(), with the heap's state sampled after a warm-up
+// and at the end. A heap's free bytes that are more than its largest reusable gap are
+// what fragmentation costs.
+static void benchArena(bool arena, uint8_t count, uint32_t frames)
+{
+  Pixy2FrameArena<8192> *mem = new Pixy2FrameArena<8192>;
+  ArenaTracks tracks;
+  BoxScene scene;
+  struct mallinfo2 m0, m1;
+  uint64_t allocs = 0;
+  uint32_t i, t0, t = 0, sum = 0, low = 0xffffffff, high = 0;
+  char name[32];
+
+  tracks.frame = 0;
+  scene.init(count);
+  for (i = 0; i < frames; i++)
+  {
+    scene.step();
+    if (i == frames/10)
+    {
+      m0 = mallinfo2();
+      mem->resetStats();
+      allocs = g_heapAllocs;
+    }
+    t0 = micros();
+    mem->reset();
+    sum += arena ? arenaFrame<ArenaTemp>(mem, scene.blocks, scene.n, &tracks) :
+      arenaFrame<HeapTemp>(mem, scene.blocks, scene.n, &tracks);
+    t += micros() - t0;
+    if (i >= frames/10)
+    {
+      low = std::min(low, mem->used());
+      high = std::max(high, mem->used());
+    }
+  }
+  m1 = mallinfo2();
+  allocs = g_heapAllocs - allocs + mem->spills();
+
+  snprintf(name, sizeof(name), "arena/%s", arena ? "arena" : "heap");
+  report(name, "frames", frames, "");
+  report(name, "ns_per_frame", t*1000.0/frames, "ns");
+  report(name, "temp_heap_allocs_per_frame", (double)allocs/(frames - frames/10), "");
+  report(name, "heap_in_use_warm", m0.uordblks, "B");
+  report(name, "heap_in_use_end", m1.uordblks, "B");
+  report(name, "heap_free_warm", m0.fordblks, "B");
+  report(name, "heap_free_end", m1.fordblks, "B");
+  report(name, "heap_size_growth", (double)m1.arena - m0.arena, "B");
+  if (arena)
+  {
+    report(name, "arena_used_min", low, "B");
+    report(name, "arena_used_max", high, "B");
+    report(name, "arena_high_water", mem->highWater(), "B");
+    report(name, "arena_allocs_per_frame", (double)mem->allocs()/(frames - frames/10), "");
+    report(name, "arena_to_heap", mem->spills(), "allocs");
+  }
+  if (sum == 0xffffffff)
+    printf("\n");
+  delete mem;
+}
+
+// Mixed sizes, 16 to 400 bytes, 40 to a frame: malloc and free against the arena.
+static void benchArenaAlloc(uint32_t n)
+{
+  Pixy2FrameArena<32768> *mem = new Pixy2FrameArena<32768>;
+  std::vector<uint16_t> sizes(n);
+  void *live[40];
+  uint32_t i, j, t0, tHeap, tArena;
+
+  for (i = 0; i < n; i++)
+    sizes[i] = 16 + rand()%385;
+  t0 = micros();
+  for (i = 0; i < n; i += 40)
+  {
+    for (j = 0; j < 40; j++)
+      live[j] = malloc(sizes[i + j]);
+    for (j = 0; j < 40; j++)
+      free(live[j]);
+  }
+  tHeap = micros() - t0;
+  t0 = micros();
+  for (i = 0; i < n; i += 40)
+  {
+    mem->reset();
+    for (j = 0; j < 40; j++)
+      live[j] = mem->alloc(sizes[i + j]);
+    asm volatile("" : : "r"(live) : "memory");
+  }
+  tArena = micros() - t0;
+
+  report("arena/alloc", "malloc_free_ns", tHeap*1000.0/n, "ns");
+  report("arena/alloc", "arena_ns", tArena*1000.0/n, "ns");
+  report("arena/alloc", "arena_failures", mem->failures(), "");
+  delete mem;
+}
+
+// ---------------------------------------------------------------------------------------
+// memory
+
+// TPixy2 itself, without the link buffer addPixy() counts as heap.
+PIXY2_MEMORY_BUDGET(TPixy2<Link2Emu>, PIXY2_BUDGET_PIXY - PIXY_BUFFERSIZE);
+// The link type doesn't change these sizes: the classes hold a TPixy2 pointer.
+PIXY2_MEMORY_BUDGET(Pixy2LineTracker<Link2Emu>, PIXY2_BUDGET_LINE_TRACKER);
+PIXY2_MEMORY_BUDGET(Pixy2Scheduler<Link2Emu>, PIXY2_BUDGET_SCHEDULER);
+PIXY2_MEMORY_BUDGET(Pixy2RGBSampler<Link2Emu>, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2FastBoot<Link2Emu>, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2AutoExposure<Link2Emu>, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2PowerMode, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2Governor, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2FrameClock, PIXY2_BUDGET_SMALL);
+PIXY2_MEMORY_BUDGET(Pixy2ClockSync, PIXY2_BUDGET_CLOCK_SYNC);
+PIXY2_MEMORY_BUDGET(Pixy2Stereo, PIXY2_BUDGET_STEREO);
+PIXY2_MEMORY_BUDGET(Pixy2BlackBox<Pixy2FlashFile>, PIXY2_BUDGET_BLACKBOX);
+PIXY2_MEMORY_BUDGET(Pixy2FrameCodec, PIXY2_BUDGET_CODEC);
+PIXY2_MEMORY_BUDGET(Pixy2NodeTx, PIXY2_BUDGET_NODE_TX);
+PIXY2_MEMORY_BUDGET(Pixy2NodeParser, PIXY2_BUDGET_NODE_PARSER);
+PIXY2_MEMORY_BUDGET(Pixy2FrameService<Link2Emu>, PIXY2_BUDGET_FRAME_SERVICE);
+
+static void benchMemory()
+{
+  Pixy2Emulated pixy;
+  Pixy2MemoryReport mem;
+
+  mem.addPixy("pixy", pixy);
+  mem.addStatic("line", sizeof(Pixy2LineTracker<Link2Emu>), PIXY2_BUDGET_LINE_TRACKER);
+  mem.addStatic("scheduler", sizeof(Pixy2Scheduler<Link2Emu>), PIXY2_BUDGET_SCHEDULER);
+  mem.addStatic("rgb sampler", sizeof(Pixy2RGBSampler<Link2Emu>), PIXY2_BUDGET_SMALL);
+  mem.addStatic("fast boot", sizeof(Pixy2FastBoot<Link2Emu>), PIXY2_BUDGET_SMALL);
+  mem.addStatic("exposure", sizeof(Pixy2AutoExposure<Link2Emu>), PIXY2_BUDGET_SMALL);
+  mem.addStatic("power mode", sizeof(Pixy2PowerMode), PIXY2_BUDGET_SMALL);
+  mem.addStatic("governor", sizeof(Pixy2Governor), PIXY2_BUDGET_SMALL);
+  mem.addStatic("frame clock", sizeof(Pixy2FrameClock), PIXY2_BUDGET_SMALL);
+  mem.addStatic("clock sync", sizeof(Pixy2ClockSync), PIXY2_BUDGET_CLOCK_SYNC);
+  mem.addStatic("stereo", sizeof(Pixy2Stereo), PIXY2_BUDGET_STEREO);
+  mem.addStatic("blackbox", sizeof(Pixy2BlackBox<Pixy2FlashFile>), PIXY2_BUDGET_BLACKBOX);
+  mem.addStatic("codec", sizeof(Pixy2FrameCodec), PIXY2_BUDGET_CODEC);
+  mem.addStatic("node tx", sizeof(Pixy2NodeTx), PIXY2_BUDGET_NODE_TX);
+  mem.addStatic("node parser", sizeof(Pixy2NodeParser), PIXY2_BUDGET_NODE_PARSER);
+  mem.addStatic("frames", sizeof(Pixy2FrameService<Link2Emu>), PIXY2_BUDGET_FRAME_SERVICE);
+  mem.print();
+
+  report("memory", "static_bytes", mem.total(PIXY2_MEMORY_STATIC), "B");
+  report("memory", "heap_bytes", mem.total(PIXY2_MEMORY_HEAP), "B");
+  report("memory", "over_budget", mem.overBudget(), "");
+  if (mem.overBudget())
+    fail("memory: %u components over budget\n", mem.overBudget());
+}
+
+// ---------------------------------------------------------------------------------------
+// link, ccc, query
+
+// Best of five runs of body(0..n-1), in ns per call: the run the host disturbed least,
+// which is what a baseline can be compared with.
+template <class Body> static double bestNs(uint32_t n, Body body)
+{
+  uint32_t i, r, t0, t, best = 0xffffffff;
+
+  for (r = 0; r < 5; r++)
+  {
+    t0 = micros();
+    for (i = 0; i < n; i++)
+      body(i);
+    t = micros() - t0;
+    if (t < best)
+      best = t;
+  }
+  return best*1000.0/n;
+}
+
+// Link2Emu that keeps every byte the camera sends, to replay later without the
+// emulator's cost.
+class RecordLink : public Link2Emu
+{
+public:
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    int16_t res = Link2Emu::recv(buf, len, cs);
+
+    if (res > 0 && m_trace)
+      m_trace->insert(m_trace->end(), buf, buf + res);
+    return res;
+  }
+
+  void record(std::vector<uint8_t> *trace) { m_trace = trace; }
+
+private:
+  std::vector<uint8_t> *m_trace = NULL;
+};
+
+// Bulk link over a recording: each recv() is one copy. The recording starts over when it
+// runs out, which is always between responses.
+class ReplayLink
+{
+public:
+  int8_t open(uint32_t) { return 0; }
+  void close() { }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (m_pos == m_trace->size())
+      m_pos = 0;
+    if (m_trace->size() - m_pos < len)
+      return -1;
+    memcpy(buf, m_trace->data() + m_pos, len);
+    m_pos += len;
+    m_reads++;
+    if (cs)
+      for (*cs = 0, i = 0; i < len; i++)
+        *cs += buf[i];
+    return len;
+  }
+
+  int16_t send(uint8_t *, uint8_t len) { return len; }
+
+  void replay(const std::vector<uint8_t> *trace)
+  {
+    m_trace = trace;
+    m_pos = 0;
+  }
+
+  uint32_t reads() const { return m_reads; }
+
+private:
+  const std::vector<uint8_t> *m_trace = NULL;
+  size_t m_pos = 0;
+  uint32_t m_reads = 0;
+};
+
+// The same recording into the Serial1 stand-in, for Link2UART's per-byte reads.
+struct HalReplay
+{
+  const std::vector<uint8_t> *trace;
+  size_t pos;
+
+  static void pump(void *arg)
+  {
+    HalReplay *r = (HalReplay *)arg;
+    uint8_t discard[64];
+    size_t n;
+
+    while (Serial1.takeTx(discard, sizeof(discard)));
+    if (r->pos == r->trace->size())
+      r->pos = 0;
+    n = std::min((size_t)(HAL_SERIAL_BUFSIZE - Serial1.available()), r->trace->size() - r->pos);
+    r->pos += Serial1.putRx(r->trace->data() + r->pos, n);
+  }
+};
+
+// frames CCC responses with count blocks each, all different
+static void recordBlocks(std::vector<uint8_t> *trace, uint8_t count, uint32_t frames)
+{
+  TPixy2<RecordLink> cam;
+  uint32_t i;
+
+  trace->clear();
+  cam.m_link.emu().setFrameRate(0);
+  cam.m_link.emu().setBlocks(count);
+  cam.init();
+  cam.m_link.record(trace);
+  for (i = 0; i < frames; i++)
+    cam.ccc.getBlocks();
+}
+
+static void benchLink(uint8_t count, uint32_t frames)
+{
+  std::vector<uint8_t> trace;
+  TPixy2<ReplayLink> bulk;
+  TPixy2<Link2UART> uart;
+  HalReplay hal;
+  uint32_t reads, bytes;
+  double ns;
+  char name[32];
+
+  recordBlocks(&trace, count, 64);
+  bytes = trace.size()/64;
+  snprintf(name, sizeof(name), "link/%u", count);
+
+  bulk.m_link.replay(&trace);
+  bulk.init();
+  reads = bulk.m_link.reads();
+  ns = bestNs(frames, [&](uint32_t) { bulk.ccc.getBlocks(); });
+  report(name, "bulk_ns_per_frame", ns, "ns");
+  report(name, "bulk_ns_per_byte", ns/bytes, "ns");
+  report(name, "bulk_reads_per_frame", (double)(bulk.m_link.reads() - reads)/(5*frames), "calls");
+
+  hal.trace = &trace;
+  hal.pos = 0;
+  Serial1.setPump(HalReplay::pump, &hal);
+  uart.init();
+  reads = Serial1.reads();
+  ns = bestNs(frames, [&](uint32_t) { uart.ccc.getBlocks(); });
+  Serial1.setPump(NULL, NULL);
+  report(name, "per_byte_ns_per_frame", ns, "ns");
+  report(name, "per_byte_ns_per_byte", ns/bytes, "ns");
+  report(name, "per_byte_reads_per_frame", (double)(Serial1.reads() - reads)/(5*frames), "calls");
+}
+
+static void benchCcc(uint8_t count, uint32_t frames)
+{
+  std::vector<uint8_t> trace;
+  TPixy2<ReplayLink> pixy;
+  double ns;
+  char name[32];
+
+  recordBlocks(&trace, count, 64);
+  pixy.m_link.replay(&trace);
+  pixy.init();
+  ns = bestNs(frames, [&](uint32_t) { pixy.ccc.getBlocks(); });
+
+  snprintf(name, sizeof(name), "ccc/%u", count);
+  report(name, "ns_per_frame", ns, "ns");
+  report(name, "ns_per_block", ns/count, "ns");
+}
+
+static void benchQuery(uint32_t calls)
+{
+  static const struct
+  {
+    const char *name;
+    int8_t (*call)(TPixy2<ReplayLink> &);
+    int8_t (*record)(TPixy2<RecordLink> &);
+  } queries[] =
+  {
+    { "version", [](TPixy2<ReplayLink> &p) { return p.getVersion(); },
+      [](TPixy2<RecordLink> &c) { return c.getVersion(); } },
+    { "resolution", [](TPixy2<ReplayLink> &p) { return p.getResolution(); },
+      [](TPixy2<RecordLink> &c) { return c.getResolution(); } },
+    { "fps", [](TPixy2<ReplayLink> &p) { return p.getFPS(); },
+      [](TPixy2<RecordLink> &c) { return c.getFPS(); } },
+  };
+  std::vector<uint8_t> trace;
+  uint8_t q;
+  char name[32];
+
+  for (q = 0; q < sizeof(queries)/sizeof(queries[0]); q++)
+  {
+    TPixy2<RecordLink> cam;
+    TPixy2<ReplayLink> pixy;
+
+    trace.clear();
+    cam.init();
+    cam.m_link.record(&trace);
+    queries[q].record(cam);
+    pixy.m_link.replay(&trace);
+    snprintf(name, sizeof(name), "query/%s", queries[q].name);
+    report(name, "ns_per_call", bestNs(calls, [&](uint32_t) { queries[q].call(pixy); }), "ns");
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// checksum
+
+// As the links do it: summed into the caller's total as each byte is stored. buf may
+// alias *cs, so the total goes through memory every byte.
+static __attribute__((noinline)) void checksumInPlace(uint8_t *buf, const uint8_t *src, uint8_t len, uint16_t *cs)
+{
+  uint8_t i;
+
+  *cs = 0;
+  for (i = 0; i < len; i++)
+  {
+    buf[i] = src[i];
+    *cs += buf[i];
+  }
+}
+
+// The copy, then the sum in a local.
+static __attribute__((noinline)) void checksumLocal(uint8_t *buf, const uint8_t *src, uint8_t len, uint16_t *cs)
+{
+  uint16_t sum = 0;
+  uint8_t i;
+
+  memcpy(buf, src, len);
+  for (i = 0; i < len; i++)
+    sum += buf[i];
+  *cs = sum;
+}
+
+static void benchChecksum(uint8_t len, uint32_t rounds)
+{
+  uint8_t src[256], buf[256];
+  uint16_t cs, a = 0, b = 0;
+  uint32_t i;
+  char name[32];
+
+  for (i = 0; i < len; i++)
+    src[i] = rand();
+  snprintf(name, sizeof(name), "checksum/%u", len);
+  report(name, "in_place_ns_per_byte", bestNs(rounds, [&](uint32_t)
+    {
+      checksumInPlace(buf, src, len, &cs);
+      a += cs;
+    })/len, "ns");
+  report(name, "local_ns_per_byte", bestNs(rounds, [&](uint32_t)
+    {
+      checksumLocal(buf, src, len, &cs);
+      b += cs;
+    })/len, "ns");
+  if (a != b)
+    printf("checksum mismatch\n");
+}
+
+#ifdef PIXY2_TRACE
+// ---------------------------------------------------------------------------------------
+// trace
+
+struct TraceFile
+{
+  FILE *f;
+
+  void write(const uint8_t *buf, size_t len)
+  {
+    fwrite(buf, 1, len, f);
+  }
+};
+
+static void benchTrace(uint8_t count, uint32_t frames)
+{
+  std::vector<uint8_t> trace;
+  TPixy2<Link2UART> uart;
+  HalReplay hal;
+  TraceFile out;
+  uint32_t events = 0;
+  uint8_t core;
+  double off, on;
+  char name[32];
+
+  recordBlocks(&trace, count, 64);
+  hal.trace = &trace;
+  hal.pos = 0;
+  Serial1.setPump(HalReplay::pump, &hal);
+  uart.init();
+  Pixy2Tracer::stop();
+  off = bestNs(frames, [&](uint32_t) { uart.ccc.getBlocks(); });
+  Pixy2Tracer::start();
+  on = bestNs(frames, [&](uint32_t) { uart.ccc.getBlocks(); });
+  Pixy2Tracer::stop();
+  Serial1.setPump(NULL, NULL);
+  for (core = 0; core < PIXY2_TRACE_CORES; core++)
+    events += Pixy2Tracer::recorded(core);
+  if (getenv("PIXY_BENCH_TRACE_DUMP") && (out.f = fopen(getenv("PIXY_BENCH_TRACE_DUMP"), "wb")) != NULL)
+  {
+    Pixy2Tracer::dump(out);
+    fclose(out.f);
+  }
+
+  snprintf(name, sizeof(name), "trace/%u", count);
+  report(name, "off_ns_per_frame", off, "ns");
+  report(name, "on_ns_per_frame", on, "ns");
+  report(name, "events_per_frame", (double)events/(5*frames), "events");
+}
+
+static void benchTraceRecord(uint32_t events)
+{
+  Pixy2Tracer::start();
+  report("trace", "record_ns", bestNs(events, [](uint32_t i)
+    {
+      PIXY2_TRACE_INSTANT(PIXY2_TRACE_USER, i);
+    }), "ns");
+  Pixy2Tracer::stop();
+}
+#endif
+
+#ifdef PIXY_BENCH_BUZZER
+// ---------------------------------------------------------------------------------------
+// buzzer
+
+// Bach's fugue from the Zumo examples: octave and length changes, sharps, dotted notes.
+static const char g_fugue[] =
+  "! O5 L16 agafaea dac+adaea fa<aa<bac#a dac#adaea f"
+  "O6 dcd<b-d<ad<g d<f+d<gd<ad<b- d<dd<ed<f+d<g d<f+d<gd<ad"
+  "L8 MS <b-d<b-d MLe-<ge-<g MSc<ac<a ML d<fd<f O5 MS b-gb-g"
+  "ML >c#e>c#e MS afaf ML gc#gc# MS fdfd ML e<b-e<b-"
+  "O6 L16ragafaea dac#adaea fa<aa<bac#a dac#adaea faeadaca"
+  "<b-acadg<b-g egdgcg<b-g <ag<b-gcf<af dfcf<b-f<af"
+  "<gf<af<b-e<ge c#e<b-e<ae<ge <fe<ge<ad<fd"
+  "O5 e>ee>ef>df>d b->c#b->c#a>df>d e>ee>ef>df>d"
+  "e>d>c#>db>d>c#b >c#agaegfe f O6 dc#dfdc#<b c#4";
+
+static void benchBuzzer(uint32_t rounds)
+{
+  uint32_t notes = 0, halCalls;
+  double seqNs;
+
+  halCalls = g_halLedc.calls + g_halTimer.calls;
+  seqNs = bestNs(rounds, [&](uint32_t)
+    {
+      ZumoBuzzer::play(g_fugue);
+      notes++;
+      // each expiry ends a note; playCheck() parses and starts the next
+      while (halTimerExpire())
+        if (ZumoBuzzer::playCheck())
+          notes++;
+    });
+  halCalls = g_halLedc.calls + g_halTimer.calls - halCalls;
+
+  report("buzzer", "notes_per_sequence", (double)notes/(5*rounds), "notes");
+  report("buzzer", "sequence_ns_per_note", seqNs*5*rounds/notes, "ns");
+  report("buzzer", "hal_calls_per_note", (double)halCalls/notes, "calls");
+  report("buzzer", "play_note_ns", bestNs(rounds*100, [](uint32_t i)
+    {
+      ZumoBuzzer::playNote(NOTE_C(3) + i%48, 100, 15);
+    }), "ns");
+  ZumoBuzzer::stopPlaying();
+}
+#endif
+
+// ---------------------------------------------------------------------------------------
+// fault
+
+#define FAULT_TIMEOUT_US      2000
+
+// link time of an exchange: bytes at the baud rate, failed reads and spikes
+static double faultUs(const TLink2Fault<Link2Emu> &link)
+{
+  return (link.bytesIn() + link.bytesOut())*10*1e6/PIXY_UART_BAUDRATE +
+    (double)link.recvErrors()*FAULT_TIMEOUT_US + link.spikeUs();
+}
+
+static void benchFault(uint32_t ppm, uint32_t frames, double *cleanFps)
+{
+  TPixy2<TLink2Fault<Link2Emu> > pixy;
+  Pixy2Faults faults = { ppm, ppm/4, ppm/4, ppm, 2000, PIXY2_FAULT_BOTH };
+  uint32_t i, good = 0, failed = 0, recoveries = 0, bytes, wasted = 0;
+  double us, t = 0, failedAt = -1, recoverySum = 0, recoveryMax = 0, fps;
+  char name[32];
+
+  pixy.m_link.emu().setFrameRate(0);
+  pixy.m_link.emu().setBlocks(8);
+  pixy.init();
+  pixy.m_link.setFaults(faults, getenv("PIXY_BENCH_SEED") ? atoi(getenv("PIXY_BENCH_SEED")) : 1);
+  for (i = 0; i < frames; i++)
+  {
+    us = faultUs(pixy.m_link);
+    bytes = pixy.m_link.bytesIn() + pixy.m_link.bytesOut();
+    if (pixy.ccc.getBlocks() >= 0)
+    {
+      good++;
+      if (failedAt >= 0)
+      {
+        recoveries++;
+        recoverySum += t - failedAt;
+        recoveryMax = std::max(recoveryMax, t - failedAt);
+        failedAt = -1;
+      }
+    }
+    else
+    {
+      failed++;
+      wasted += pixy.m_link.bytesIn() + pixy.m_link.bytesOut() - bytes;
+      if (failedAt < 0)
+        failedAt = t;
+    }
+    t += faultUs(pixy.m_link) - us;
+  }
+
+  fps = good*1e6/t;
+  if (ppm == 0)
+    *cleanFps = fps;
+  snprintf(name, sizeof(name), "fault/%uppm", ppm);
+  report(name, "fps", fps, "fps");
+  report(name, "fps_kept", 100*fps/ *cleanFps, "%");
+  report(name, "failed_per_1000", 1000.0*failed/frames, "frames");
+  report(name, "recovery_mean_ms", recoveries ? recoverySum/recoveries/1000 : 0, "ms");
+  report(name, "recovery_max_ms", recoveryMax/1000, "ms");
+  report(name, "wasted_bytes_pct", 100.0*wasted/(pixy.m_link.bytesIn() + pixy.m_link.bytesOut()), "%");
+  report(name, "wasted_bytes_per_fail", failed ? (double)wasted/failed : 0, "bytes");
+}
+
+// ---------------------------------------------------------------------------------------
+// retry
+
+template <class LinkType> static void retryRun(TPixy2<LinkType> &pixy, uint32_t ppm, uint32_t calls,
+  const char *name)
+{
+  Pixy2Faults faults = { ppm, ppm/4, ppm/4, ppm, 2000, PIXY2_FAULT_BOTH };
+  uint32_t i, good = 0, failedBlocks = 0, failedVersion = 0;
+  double t0;
+
+  pixy.m_link.emu().setFrameRate(0);
+  pixy.m_link.emu().setBlocks(8);
+  pixy.init();
+  pixy.m_link.setFaults(faults, getenv("PIXY_BENCH_SEED") ? atoi(getenv("PIXY_BENCH_SEED")) : 1);
+  t0 = faultUs(pixy.m_link);
+  for (i = 0; i < calls; i++)
+  {
+    if (pixy.ccc.getBlocks() >= 0)
+      good++;
+    else
+      failedBlocks++;
+    // a query every tenth frame
+    if (i%10 == 0 && pixy.getVersion() < 0)
+      failedVersion++;
+  }
+  report(name, "blocks_failed_per_1000", 1000.0*failedBlocks/calls, "calls");
+  report(name, "version_failed_per_1000", 1000.0*failedVersion/(calls/10), "calls");
+  report(name, "fps", good*1e6/(faultUs(pixy.m_link) - t0), "fps");
+}
+
+static void benchRetry(uint32_t ppm, uint32_t calls)
+{
+  TPixy2<TLink2Fault<Link2Emu> > bare;
+  TPixy2<TLink2Retry<TLink2Fault<Link2Emu> > > retry;
+  char name[32];
+
+  snprintf(name, sizeof(name), "retry/%uppm/off", ppm);
+  retryRun(bare, ppm, calls, name);
+  snprintf(name, sizeof(name), "retry/%uppm/on", ppm);
+  retry.m_link.resetStats();
+  retryRun(retry, ppm, calls, name);
+  report(name, "retries_per_1000", 1000.0*retry.m_link.retries()/retry.m_link.exchanges(), "calls");
+  report(name, "given_up_per_1000", 1000.0*retry.m_link.givenUp()/retry.m_link.exchanges(), "calls");
+  report(name, "stale_per_1000", 1000.0*retry.m_link.stale()/retry.m_link.exchanges(), "packets");
+  report(name, "timeouts_per_1000", 1000.0*retry.m_link.failures(PIXY2_RETRY_TIMEOUT)/retry.m_link.exchanges(),
+    "calls");
+  report(name, "short_per_1000", 1000.0*retry.m_link.failures(PIXY2_RETRY_SHORT)/retry.m_link.exchanges(),
+    "calls");
+  report(name, "checksum_per_1000", 1000.0*retry.m_link.failures(PIXY2_RETRY_CHECKSUM)/retry.m_link.exchanges(),
+    "calls");
+  report(name, "bad_type_per_1000", 1000.0*retry.m_link.failures(PIXY2_RETRY_BAD_TYPE)/retry.m_link.exchanges(),
+    "calls");
+}
+
+// The emulator behind a wire that holds the answer to one request back: the request
+// times out, and the held answer comes in once the resend's answer has been read.
+class Link2Late : public Link2Emu
+{
+public:
+  Link2Late() { m_stage = 0; m_pos = 0; }
+
+  // hold back the answer to the next request
+  void holdNext() { m_stage = 1; }
+
+  int16_t send(uint8_t *buf, uint8_t len)
+  {
+    // the resend's answer is in: the held one is on the wire ahead of this one's
+    if (m_stage == 3)
+      m_stage = 4;
+    Link2Emu::send(buf, len);
+    if (m_stage == 1)
+    {
+      m_late.resize(emu().pending());
+      emu().take(m_late.data(), m_late.size());
+      m_pos = 0;
+      m_stage = 2;
+    }
+    else if (m_stage == 2)
+      m_stage = 3;
+    return len;
+  }
+
+  int16_t recv(uint8_t *buf, uint8_t len, uint16_t *cs = NULL)
+  {
+    uint8_t i;
+
+    if (m_stage == 3 && !emu().pending())
+      m_stage = 4;
+    if (m_stage != 4 || m_pos == m_late.size())
+      return Link2Emu::recv(buf, len, cs);
+    if (cs)
+      *cs = 0;
+    if (m_late.size() - m_pos < len)
+      return -1;
+    for (i = 0; i < len; i++)
+    {
+      buf[i] = m_late[m_pos++];
+      if (cs)
+        *cs += buf[i];
+    }
+    return len;
+  }
+
+private:
+  uint8_t m_stage;      // 1 hold the next answer, 2 held, 3 resent, 4 held one on the wire
+  std::vector<uint8_t> m_late;
+  size_t m_pos;
+};
+
+static void benchRetryLate()
+{
+  TPixy2<TLink2Retry<Link2Late> > pixy;
+  int8_t first, next;
+
+  pixy.m_link.emu().setFrameRate(0);
+  pixy.m_link.emu().setBlocks(4);
+  pixy.init();
+  pixy.m_link.resetStats();
+  pixy.m_link.holdNext();
+  first = pixy.ccc.getBlocks();
+  next = pixy.ccc.getBlocks();
+  report("retry/late", "recovered", pixy.m_link.recovered(), "calls");
+  report("retry/late", "drained", pixy.m_link.drained(), "bytes");
+  report("retry/late", "left_on_link", pixy.m_link.emu().pending(), "bytes");
+  // the next answer still on the link means the late one was taken for it
+  if (first < 0 || next < 0 || pixy.m_link.recovered() != 1 || pixy.m_link.emu().pending())
+    fail("retry/late: getBlocks() gave %d then %d, %u recovered, %u bytes of the next answer left\n", first,
+      next, pixy.m_link.recovered(), (unsigned)pixy.m_link.emu().pending());
+}
+
+// ---------------------------------------------------------------------------------------
+// frames
+
+struct FrameReader
+{
+  uint16_t hz;
+  uint32_t maxAgeMs;
+  uint32_t dueUs;
+};
+
+static void benchFrames(bool service, uint8_t readers, uint32_t ms)
+{
+  static const FrameReader kinds[] = { { 100, 10, 0 }, { 30, 30, 0 }, { 10, 100, 0 } };
+  TPixy2<TLink2Fault<Link2Emu> > pixy;
+  Pixy2FrameService<TLink2Fault<Link2Emu> > frames(&pixy);
+  std::vector<FrameReader> r;
+  uint32_t t0, now, calls = 0, served = 0, requests, callUs = 0, ageMs = 0;
+  uint8_t i;
+  char name[32];
+
+  for (i = 0; i < readers; i++)
+    r.push_back(kinds[i%3]);
+  pixy.m_link.emu().setFrameRate(60);
+  pixy.init();
+  pixy.m_link.resetStats();
+  requests = pixy.m_link.emu().requests();
+  for (t0 = now = micros(); now - t0 < ms*1000; now = micros())
+  {
+    for (i = 0; i < readers; i++)
+    {
+      if ((int32_t)(now - t0 - r[i].dueUs) < 0)
+        continue;
+      r[i].dueUs += 1000000/r[i].hz;
+      calls++;
+      if (service)
+      {
+        Pixy2FrameRef f = frames.getFrame(r[i].maxAgeMs);
+        if (f)
+        {
+          served++;
+          ageMs += f.age();
+        }
+      }
+      else if (pixy.ccc.getBlocks() >= 0)
+        served++;
+      callUs += micros() - now;
+      now = micros();
+    }
+    delayMicroseconds(100);
+  }
+
+  snprintf(name, sizeof(name), "frames/%u/%s", readers, service ? "service" : "direct");
+  report(name, "link_requests_per_s", (pixy.m_link.emu().requests() - requests)*1000.0/ms, "req/s");
+  report(name, "link_bytes_per_s", (pixy.m_link.bytesIn() + pixy.m_link.bytesOut())*1000.0/ms, "B/s");
+  report(name, "served_per_s", served*1000.0/ms, "fps");
+  report(name, "us_per_call", (double)callUs/calls, "us");
+  if (service)
+  {
+    report(name, "mean_age_ms", served ? (double)ageMs/served : 0, "ms");
+    report(name, "cache_hit_pct", 100.0*frames.hits()/frames.requests(), "%");
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// uart-tx
+
+struct TxDone
+{
+  uint32_t calls;
+  uint32_t doneUs;
+
+  static void done(uint32_t doneUs, void *arg)
+  {
+    TxDone *d = (TxDone *)arg;
+
+    d->calls++;
+    d->doneUs = doneUs;
+  }
+};
+
+static void benchUartTx()
+{
+  uint8_t req[PIXY_SEND_HEADER_SIZE + 2] = { PIXY_NO_CHECKSUM_SYNC & 0xff, PIXY_NO_CHECKSUM_SYNC >> 8,
+    CCC_REQUEST_BLOCKS, 2, 0xff, 0xff };
+  uint8_t req2[PIXY_SEND_HEADER_SIZE] = { PIXY_NO_CHECKSUM_SYNC & 0xff, PIXY_NO_CHECKSUM_SYNC >> 8,
+    PIXY_TYPE_REQUEST_VERSION, 0 };
+  uint8_t wire[64];
+  Link2UART link;
+  TxDone d = { 0, 0 };
+  uint32_t t0, polls = 0, wireUs = sizeof(req)*10*1000000/115200;
+  int16_t res;
+  size_t n;
+
+  link.open(115200);
+  while (Serial1.takeTx(wire, sizeof(wire)));
+
+  t0 = micros();
+  link.sendAsync(req, sizeof(req), TxDone::done, &d);
+  while (link.poll())
+    polls++;
+  report("uart-tx/async", "done_after_us", d.doneUs - t0, "us");
+  report("uart-tx/async", "model_us", wireUs, "us");
+  report("uart-tx/async", "polls", polls, "calls");
+  if (d.calls != 1 || d.doneUs != link.txDoneMicros() || (int32_t)(d.doneUs - t0) < (int32_t)wireUs)
+    fail("uart-tx/async: %u callbacks, done %u us in, txDoneMicros() %u us in\n", d.calls,
+      d.doneUs - t0, link.txDoneMicros() - t0);
+  while (Serial1.takeTx(wire, sizeof(wire)));
+
+  // send() right behind a pending sendAsync() finishes it first
+  d.calls = 0;
+  link.sendAsync(req, sizeof(req), TxDone::done, &d);
+  t0 = micros();
+  link.send(req2, sizeof(req2));
+  report("uart-tx/send-pending", "send_us", micros() - t0, "us");
+  report("uart-tx/send-pending", "callbacks", d.calls, "calls");
+  n = Serial1.takeTx(wire, sizeof(wire));
+  if (d.calls != 1 || n != sizeof(req) + sizeof(req2) || memcmp(wire, req, sizeof(req)) ||
+    memcmp(wire + sizeof(req), req2, sizeof(req2)))
+    fail("uart-tx/send-pending: %u callbacks, %u bytes on the wire\n", d.calls, (unsigned)n);
+  while (link.poll());
+
+  // a second sendAsync() is turned away until the first one's callback has fired
+  d.calls = 0;
+  link.sendAsync(req, sizeof(req), TxDone::done, &d);
+  res = link.sendAsync(req2, sizeof(req2), TxDone::done, &d);
+  report("uart-tx/async-pending", "second_result", res, "");
+  while (link.poll());
+  report("uart-tx/async-pending", "callbacks", d.calls, "calls");
+  if (res != -1 || d.calls != 1)
+    fail("uart-tx/async-pending: second sendAsync() gave %d, %u callbacks\n", res, d.calls);
+  while (Serial1.takeTx(wire, sizeof(wire)));
+}
+
+#ifdef PIXY_BENCH_ESP32
+// ---------------------------------------------------------------------------------------
+// rx-wakeup
+
+// in pixy_bench_esp32.cpp
+void rxWakeRun(bool wakeup, uint32_t baud, uint8_t count, uint32_t frames, Link2UARTRxStats *stats,
+  uint32_t *us, uint32_t *cpu);
+
+static void benchRxWakeup(bool wakeup, uint32_t baud, uint8_t count, uint32_t frames)
+{
+  Link2UARTRxStats stats;
+  uint32_t us, cpu;
+  char name[40];
+
+  rxWakeRun(wakeup, baud, count, frames, &stats, &us, &cpu);
+  snprintf(name, sizeof(name), "rx-wakeup/%u/%u/%s", baud, count, wakeup ? "wakeup" : "spin");
+  report(name, "frames_per_s", frames*1e6/us, "fps");
+  report(name, "wait_us_per_frame", (double)stats.waitUs/frames, "us");
+  report(name, "idle_pct", stats.waitUs ? 100.0*stats.blockedUs/stats.waitUs : 0, "%");
+  report(name, "wakeups_per_frame", (double)stats.wakeups/frames, "");
+  report(name, "spins_per_frame", (double)stats.spins/frames, "");
+  report(name, "exchanges_per_frame", (double)stats.exchanges/frames, "");
+  report(name, "cpu_us_per_frame", (double)cpu/frames, "us");
+}
+#endif
+
+// ---------------------------------------------------------------------------------------
+// autobaud
+
+// The emulator on the far side of Serial1 at a fixed rate, through a fault link. Bytes
+// written at any other rate are lost to framing errors, and what the camera had to say
+// is lost the same way.
+struct BaudCamera
+{
+  TLink2Fault<Link2Emu> link;
+  uint32_t baud;
+
+  static void pump(void *arg)
+  {
+    BaudCamera *cam = (BaudCamera *)arg;
+    uint8_t buf[255], c;
+    size_t n;
+
+    while ((n = Serial1.takeTx(buf, sizeof(buf))))
+      if (Serial1.baud() == cam->baud)
+        cam->link.send(buf, n);
+    while (cam->link.emu().pending() && Serial1.available() < HAL_SERIAL_BUFSIZE)
+    {
+      if (cam->link.recv(&c, 1) < 0)
+        break;
+      if (Serial1.baud() == cam->baud)
+        Serial1.putRx(&c, 1);
+    }
+  }
+};
+
+// getBlocks() until 20 in a row succeed or calls run out; returns the calls it took.
+static uint32_t autobaudRecover(TPixy2<Link2UART> &pixy, uint32_t calls)
+{
+  uint32_t i, good = 0;
+
+  for (i = 0; i < calls && good < 20; i++)
+    good = pixy.ccc.getBlocks(false) >= 0 ? good + 1 : 0;
+  if (good < 20)
+    fail("autobaud: no 20 frames in a row in %u calls\n", calls);
+  return i;
+}
+
+static void autobaudReport(const char *phase, TPixy2<Link2UART> &pixy, uint32_t expect, uint32_t calls,
+  uint32_t ms)
+{
+  char name[32];
+
+  snprintf(name, sizeof(name), "autobaud/%s", phase);
+  report(name, "rate", pixy.m_link.baud(), "baud");
+  report(name, "renegotiations", pixy.m_link.renegotiations(), "");
+  report(name, "calls_to_recover", calls, "calls");
+  report(name, "ms", ms, "ms");
+  if (pixy.m_link.baud() != expect)
+    fail("autobaud/%s: locked %u, the camera is at %u\n", phase, pixy.m_link.baud(), expect);
+}
+
+static void benchAutobaud()
+{
+  static const uint32_t rates[] = { 115200, 460800, 2000000 };
+  Pixy2Faults noise = { 0, 200000, 0, 0, 0, PIXY2_FAULT_BOTH }, none = { 0, 0, 0, 0, 0, 0 };
+  BaudCamera cam;
+  TPixy2<Link2UART> pixy;
+  uint32_t i, t0, calls;
+  char phase[32];
+
+  cam.link.emu().setFrameRate(0);
+  cam.link.emu().setRequestTimeout(1000);
+  Serial1.setPump(BaudCamera::pump, &cam);
+
+  for (i = 0; i < sizeof(rates)/sizeof(rates[0]); i++)
+  {
+    cam.baud = rates[i];
+    t0 = millis();
+    pixy.init(PIXY_UART_AUTOBAUD);
+    snprintf(phase, sizeof(phase), "open/%u", rates[i]);
+    autobaudReport(phase, pixy, rates[i], 0, millis() - t0);
+  }
+
+  // 50ms of noise on a good link: errors, but not for PIXY_UART_ERROR_MS, so it must not
+  // cost a probe
+  cam.baud = 460800;
+  pixy.init(PIXY_UART_AUTOBAUD);
+  cam.link.setFaults(noise, 1);
+  for (t0 = millis(); millis() - t0 < 50; )
+    pixy.ccc.getBlocks(false);
+  cam.link.setFaults(none, 1);
+  t0 = millis();
+  calls = autobaudRecover(pixy, 1000);
+  autobaudReport("burst", pixy, 460800, calls, millis() - t0);
+  if (pixy.m_link.renegotiations())
+    fail("autobaud/burst: %u renegotiations on a good link\n", pixy.m_link.renegotiations());
+
+  // a burst long enough to make the link probe again while it lasts: nothing answers then,
+  // so it stays at 460800, and each probe that lands there again waits longer before the next
+  pixy.init(PIXY_UART_AUTOBAUD);
+  cam.link.setFaults(noise, 1);
+  for (i = 0; i < 50; i++)
+    pixy.ccc.getBlocks(false);
+  cam.link.setFaults(none, 1);
+  t0 = millis();
+  calls = autobaudRecover(pixy, 1000);
+  autobaudReport("noise", pixy, 460800, calls, millis() - t0);
+  if (pixy.m_link.renegotiations() > 8)
+    fail("autobaud/noise: %u renegotiations for one burst\n", pixy.m_link.renegotiations());
+
+  // the camera set to 230400 in PixyMon while the link runs at 460800
+  pixy.init(PIXY_UART_AUTOBAUD);
+  cam.baud = 230400;
+  t0 = millis();
+  calls = autobaudRecover(pixy, 1000);
+  autobaudReport("slower", pixy, 230400, calls, millis() - t0);
+
+  Serial1.setPump(NULL, NULL);
+}
+
+// Reset to first frame with Link2UART and PIXY_UART_AUTOBAUD, the camera at 921600 and
+// 60 fps: a cold boot probes the rates, a warm one starts at the cached rate. Then the
+// camera is set slower while a warm boot runs: the link must still renegotiate, and the
+// next boot start at the new rate.
+static void benchBootAutobaud(uint32_t boots)
+{
+  BaudCamera cam;
+  std::vector<uint32_t> ttff[2];
+  uint32_t i, validated = 0, calls;
+  uint8_t warm;
+
+  cam.link.emu().setFrameRate(60);
+  cam.baud = 921600;
+  Serial1.setPump(BaudCamera::pump, &cam);
+  for (warm = 0; warm < 2; warm++)
+  {
+    for (i = 0; i < boots; i++)
+    {
+      TPixy2<Link2UART> pixy;
+      Pixy2FastBoot<Link2UART> boot(&pixy);
+
+      if (!warm)
+        boot.clear();
+      if (boot.begin(PIXY_UART_AUTOBAUD) < 0)
+      {
+        printf("boot: begin failed\n");
+        break;
+      }
+      while (!boot.firstFrameUs())
+        boot.frame(pixy.ccc.getBlocks());
+      ttff[warm].push_back(boot.firstFrameUs());
+      while (boot.state() == PIXY2_BOOT_WARM)
+      {
+        boot.validate();
+        boot.frame(pixy.ccc.getBlocks());
+      }
+      if (warm && boot.mismatches() == 0)
+        validated++;
+    }
+  }
+  reportLatency("boot/autobaud/cold", ttff[0]);
+  reportLatency("boot/autobaud/warm", ttff[1]);
+  report("boot/autobaud/warm", "cache_confirmed", validated, "boots");
+
+  {
+    TPixy2<Link2UART> pixy;
+    Pixy2FastBoot<Link2UART> boot(&pixy);
+
+    // a frame always ready, as autobaudRecover() counts busy answers as failures
+    cam.link.emu().setFrameRate(0);
+    boot.begin(PIXY_UART_AUTOBAUD);
+    cam.baud = 230400;
+    calls = autobaudRecover(pixy, 1000);
+    report("boot/autobaud/slower", "renegotiations", pixy.m_link.renegotiations(), "");
+    report("boot/autobaud/slower", "calls_to_recover", calls, "calls");
+    if (!boot.warm() || pixy.m_link.baud() != 230400)
+      fail("boot/autobaud/slower: %s boot at %u, the camera is at 230400\n", boot.warm() ? "warm" : "cold",
+        pixy.m_link.baud());
+    while (boot.state() == PIXY2_BOOT_WARM)
+    {
+      boot.validate();
+      boot.frame(pixy.ccc.getBlocks());
+    }
+  }
+  {
+    TPixy2<Link2UART> pixy;
+    Pixy2FastBoot<Link2UART> boot(&pixy);
+
+    boot.begin(PIXY_UART_AUTOBAUD);
+    if (!boot.warm() || pixy.m_link.baud() != 230400)
+      fail("boot/autobaud/next: %s boot at %u, the camera is at 230400\n", boot.warm() ? "warm" : "cold",
+        pixy.m_link.baud());
+  }
+  Serial1.setPump(NULL, NULL);
+}
+
+// ---------------------------------------------------------------------------------------
+// exposure
+
+// CCC frames into ae for ms; returns when the emulator's exposure first reached 0.8
+// (every block at 80% size or more), or ms if it never did.
+static uint32_t exposureRun(Pixy2AutoExposure<Link2Emu> &ae, Pixy2Emulated &pixy, uint32_t ms)
+{
+  uint32_t t0 = millis(), at = ms;
+
+  while (millis() - t0 < ms)
+  {
+    if (pixy.ccc.getBlocks(false) >= 0)
+      ae.update();
+    if (at == ms && pixy.m_link.emu().exposure() >= 0.8)
+      at = millis() - t0;
+    delayMicroseconds(2000);
+  }
+  return at;
+}
+
+static void exposureReport(const char *phase, Pixy2AutoExposure<Link2Emu> &ae, Pixy2Emulated &pixy, uint32_t ms,
+  uint32_t commands)
+{
+  char name[32];
+
+  snprintf(name, sizeof(name), "exposure/%s", phase);
+  report(name, "ms_to_converge", ms, "ms");
+  report(name, "brightness", ae.brightness(), "");
+  report(name, "lamp", ae.lamp(), "");
+  report(name, "exposure_pct", 100*pixy.m_link.emu().exposure(), "%");
+  report(name, "commands", ae.commands() - commands, "calls");
+}
+
+static void benchExposure()
+{
+  Pixy2Emulated pixy;
+  Pixy2AutoExposure<Link2Emu> ae(&pixy);
+  Pixy2Emu &emu = pixy.m_link.emu();
+  uint32_t ms, commands;
+  uint8_t brightness;
+  bool lamp;
+
+  emu.setFrameRate(60);
+  emu.setBlocks(8);
+  emu.setExposure(120, 250);
+  pixy.init();
+  ae.begin(120);
+
+  commands = ae.commands();
+  ms = exposureRun(ae, pixy, 3000);
+  exposureReport("steady", ae, pixy, ms, commands);
+  if (ae.commands() != commands)
+    fail("exposure/steady: %u commands for a scene that is already right\n", ae.commands() - commands);
+
+  // the light dims: 70 brighter is right now
+  emu.setExposure(190, 250);
+  commands = ae.commands();
+  ms = exposureRun(ae, pixy, 10000);
+  exposureReport("dim", ae, pixy, ms, commands);
+  if (emu.exposure() < 0.8)
+    fail("exposure/dim: stuck at brightness %u\n", ae.brightness());
+
+  // darker than brightness alone can make up for
+  emu.setExposure(350, 250);
+  commands = ae.commands();
+  ms = exposureRun(ae, pixy, 20000);
+  exposureReport("dark", ae, pixy, ms, commands);
+  if (!ae.lamp() || emu.exposure() < 0.8)
+    fail("exposure/dark: brightness %u, lamp %u\n", ae.brightness(), ae.lamp());
+
+  // nothing watched in view: the settle period the blocks left in may still take a
+  // step, after that nothing may change
+  emu.setBlocks(0);
+  exposureRun(ae, pixy, 2*PIXY2_AE_SETTLE_MS);
+  brightness = ae.brightness();
+  lamp = ae.lamp();
+  commands = ae.commands();
+  exposureRun(ae, pixy, 4000);
+  exposureReport("empty", ae, pixy, 0, commands);
+  if (ae.brightness() != brightness || ae.lamp() != lamp || emu.brightness() != brightness || emu.lamp() != lamp)
+    fail("exposure/empty: brightness %u -> %u, lamp %u -> %u on an empty scene\n", brightness,
+      ae.brightness(), lamp, ae.lamp());
+
+  // and back, to the same light
+  emu.setBlocks(8);
+  commands = ae.commands();
+  ms = exposureRun(ae, pixy, 3000);
+  exposureReport("back", ae, pixy, ms, commands);
+  if (ae.commands() != commands)
+    fail("exposure/back: %u commands when the blocks came back\n", ae.commands() - commands);
+
+  // the same dimming with one round trip a second: most steps wait for the budget, and
+  // a waiting step must go out as it was chosen, not flipped or with the reference decayed
+  Pixy2AutoExposure<Link2Emu> slow(&pixy, CCC_SIG_ALL, 1);
+  emu.setExposure(120, 250);
+  slow.begin(120);
+  exposureRun(slow, pixy, 1000);
+  emu.setExposure(190, 250);
+  commands = slow.commands();
+  ms = exposureRun(slow, pixy, 20000);
+  exposureReport("budget1", slow, pixy, ms, commands);
+  report("exposure/budget1", "deferred", slow.deferred(), "");
+  if (emu.exposure() < 0.8)
+    fail("exposure/budget1: stuck at brightness %u\n", slow.brightness());
+}
+
+int main(int argc, char *argv[])
+{
+  if (selected(argc, argv, "uart-pty"))
+  {
+    benchUartPty(1, 2000);
+    benchUartPty(8, 2000);
+    benchUartPty(18, 2000);
+  }
+  if (selected(argc, argv, "spidev"))
+  {
+    benchSpidev(true, 1, 5000);
+    benchSpidev(false, 1, 5000);
+    benchSpidev(true, 8, 5000);
+    benchSpidev(false, 8, 5000);
+    benchSpidev(true, 18, 5000);
+    benchSpidev(false, 18, 5000);
+  }
+  if (selected(argc, argv, "line"))
+  {
+    benchLine(4, 200000);
+    benchLine(16, 200000);
+    benchLine(32, 200000);
+  }
+  if (selected(argc, argv, "sched"))
+  {
+    benchSched(60, 20, 5, 5000);
+    benchSched(30, 10, 5, 5000);
+  }
+  if (selected(argc, argv, "rgb"))
+  {
+    benchRgb(4, 4, 500);
+    benchRgb(16, 12, 50);
+  }
+  if (selected(argc, argv, "boot"))
+  {
+    benchBoot(0, 100);
+    benchBoot(8000, 100);
+    benchBootAutobaud(20);
+  }
+  if (selected(argc, argv, "power"))
+  {
+    benchPower(3000, 3000);
+    benchPower(12000, 3000);
+  }
+  if (selected(argc, argv, "governor"))
+  {
+    benchGovernor(480000, 1200000, 5000);
+    benchGovernor(1200000, 2400000, 5000);
+  }
+  if (selected(argc, argv, "collector"))
+  {
+    benchCollector(4, 3000, false);
+    benchCollector(32, 3000, false);
+    benchCollector(128, 3000, false);
+    benchCollector(32, 3000, true);
+  }
+  if (selected(argc, argv, "sync"))
+  {
+    benchSync(50, 2000, 60000);
+    benchSync(50, 10000, 60000);
+    benchSync(200, 10000, 60000);
+    benchSyncBurst(8400, 4, 2000);
+    benchSyncBurst(2000, 4, 2000);
+  }
+  if (selected(argc, argv, "stereo"))
+  {
+    benchStereo(4, 200000);
+    benchStereo(16, 100000);
+    benchStereo(32, 50000);
+  }
+  if (selected(argc, argv, "format"))
+  {
+    benchFormat(1, 500000);
+    benchFormat(8, 100000);
+    benchFormat(18, 50000);
+  }
+  if (selected(argc, argv, "blackbox"))
+  {
+    benchBlackBox(4, 72000);
+    benchBlackBox(12, 72000);
+    benchBlackBoxStall(true, false, 300);
+    benchBlackBoxStall(false, false, 300);
+    benchBlackBoxStall(true, true, 900);
+    benchBlackBoxReboot();
+    benchBlackBoxIdle();
+  }
+  if (selected(argc, argv, "arena"))
+  {
+    benchArena(false, 12, 600000);
+    benchArena(true, 12, 600000);
+    benchArenaAlloc(2000000);
+  }
+  if (selected(argc, argv, "codec"))
+  {
+    CodecTrace trace;
+
+    codecScene(&trace, 4, 20000);
+    benchCodec("codec/scene/4", trace);
+    codecScene(&trace, 12, 20000);
+    benchCodec("codec/scene/12", trace);
+    codecCamera(&trace, 4, 20000);
+    benchCodec("codec/camera/4", trace);
+    codecCamera(&trace, 12, 20000);
+    benchCodec("codec/camera/12", trace);
+    if (getenv("PIXY_BENCH_TRACE"))
+    {
+      if (codecDump(&trace, getenv("PIXY_BENCH_TRACE")))
+        benchCodec("codec/recorded", trace);
+      else
+        fprintf(stderr, "%s: no black box frames\n", getenv("PIXY_BENCH_TRACE"));
+    }
+  }
+  if (selected(argc, argv, "memory"))
+    benchMemory();
+  if (selected(argc, argv, "link"))
+  {
+    benchLink(1, 200000);
+    benchLink(8, 100000);
+    benchLink(18, 50000);
+  }
+  if (selected(argc, argv, "checksum"))
+  {
+    benchChecksum(14, 2000000);
+    benchChecksum(252, 200000);
+  }
+  if (selected(argc, argv, "ccc"))
+  {
+    benchCcc(1, 500000);
+    benchCcc(4, 300000);
+    benchCcc(8, 200000);
+    benchCcc(18, 100000);
+  }
+  if (selected(argc, argv, "query"))
+    benchQuery(500000);
+#ifdef PIXY_BENCH_BUZZER
+  if (selected(argc, argv, "buzzer"))
+    benchBuzzer(20000);
+#endif
+  if (selected(argc, argv, "fault"))
+  {
+    static const uint32_t rates[] = { 0, 10, 100, 1000, 3000, 10000 };
+    double cleanFps = 0;
+    uint8_t r;
+
+    for (r = 0; r < sizeof(rates)/sizeof(rates[0]); r++)
+      benchFault(rates[r], 5000, &cleanFps);
+  }
+  if (selected(argc, argv, "retry"))
+  {
+    benchRetry(100, 5000);
+    benchRetry(1000, 5000);
+    benchRetry(3000, 5000);
+    benchRetryLate();
+  }
+  if (selected(argc, argv, "frames"))
+  {
+    benchFrames(false, 3, 2000);
+    benchFrames(true, 3, 2000);
+    benchFrames(false, 6, 2000);
+    benchFrames(true, 6, 2000);
+  }
+#ifdef PIXY_BENCH_ESP32
+  if (selected(argc, argv, "rx-wakeup"))
+  {
+    benchRxWakeup(false, 115200, 8, 120);
+    benchRxWakeup(true, 115200, 8, 120);
+    benchRxWakeup(false, 921600, 8, 120);
+    benchRxWakeup(true, 921600, 8, 120);
+  }
+#endif
+  if (selected(argc, argv, "uart-tx"))
+    benchUartTx();
+  if (selected(argc, argv, "autobaud"))
+    benchAutobaud();
+  if (selected(argc, argv, "exposure"))
+    benchExposure();
+#ifdef PIXY2_TRACE
+  if (selected(argc, argv, "trace"))
+  {
+    benchTrace(1, 100000);
+    benchTrace(18, 50000);
+    benchTraceRecord(1000000);
+  }
+#endif
+
+  if (getenv("PIXY_BENCH_JSON") && !writeJson(getenv("PIXY_BENCH_JSON")))
+    perror(getenv("PIXY_BENCH_JSON"));
+  if (g_failures)
+  {
+    fprintf(stderr, "%u checks failed\n", g_failures);
+    return 1;
+  }
+  if (getenv("PIXY_BENCH_BASELINE"))
+  {
+    int regressions = compareBaseline(getenv("PIXY_BENCH_BASELINE"),
+      getenv("PIXY_BENCH_THRESHOLD") ? atof(getenv("PIXY_BENCH_THRESHOLD")) : 10);
+
+    if (regressions < 0)
+      perror(getenv("PIXY_BENCH_BASELINE"));
+    if (regressions != 0)
+      return 1;
+  }
+  return 0;
+}
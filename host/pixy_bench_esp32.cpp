@@ -0,0 +1,76 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// The parts of pixy_bench that need device code built for ESP32 (Link2UART's RX wakeup),
+// against hal/'s Serial2 and FreeRTOS stand-ins. Built with -DARDUINO_ARCH_ESP32 like
+// ZumoBuzzer.cpp and linked into pixy_bench when that is built with -DPIXY_BENCH_ESP32;
+// see the top of pixy_bench.cpp.
+
+#include "Arduino.h"
+// pixy_bench.cpp has the host Link2UART; this one is another class
+#define Link2UART Link2UARTEsp32
+#include "../Pixy2UART.h"
+#undef Link2UART
+#include "Pixy2Emu.h"
+
+#include <sys/resource.h>
+
+// how long the camera takes to start answering a request
+#define RX_WAKE_GAP_US          100
+
+static void cameraPeer(const uint8_t *buf, size_t len, void *arg)
+{
+  Pixy2Emu *emu = (Pixy2Emu *)arg;
+  uint8_t out[512];
+  size_t n;
+
+  emu->feed(buf, len);
+  n = emu->take(out, sizeof(out));
+  Serial2.transmit(out, n, RX_WAKE_GAP_US);
+}
+
+static uint32_t cpuUs()
+{
+  struct rusage r;
+
+  getrusage(RUSAGE_THREAD, &r);
+  return (r.ru_utime.tv_sec + r.ru_stime.tv_sec)*1000000 + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+// frames CCC frames of count blocks at 60 fps over Serial2 at baud, waiting for bytes in
+// Link2UART's spin loop or with setRxWakeup(): its receive stats, and the time and CPU
+// time the frames took.
+void rxWakeRun(bool wakeup, uint32_t baud, uint8_t count, uint32_t frames, Link2UARTRxStats *stats,
+  uint32_t *us, uint32_t *cpu)
+{
+  TPixy2<Link2UARTEsp32> pixy;
+  Pixy2Emu emu;
+  uint32_t i, t0, c0;
+
+  emu.setFrameRate(60);
+  emu.setBlocks(count);
+  Serial2.setPeer(cameraPeer, &emu);
+  pixy.init(baud);
+  pixy.m_link.setRxWakeup(wakeup);
+  pixy.m_link.resetRxStats();
+  t0 = micros();
+  c0 = cpuUs();
+  for (i = 0; i < frames; i++)
+    pixy.ccc.getBlocks();
+  *cpu = cpuUs() - c0;
+  *us = micros() - t0;
+  *stats = pixy.m_link.rxStats();
+  pixy.m_link.close();
+  Serial2.setPeer(NULL, NULL);
+}
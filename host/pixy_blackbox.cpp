@@ -0,0 +1,139 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Black box exporter: prints the frames in a Pixy2BlackBox partition dump, oldest first.
+//
+// Get the dump from the device with
+//   parttool.py --port /dev/ttyUSB0 read_partition --partition-name blackbox --output blackbox.bin
+// Build (from this directory, with the Pixy2 Arduino library's headers on the path):
+//   g++ -O2 -std=gnu++17 -I.. -I<Pixy2 library>/src pixy_blackbox.cpp -o pixy_blackbox
+// Run:
+//   ./pixy_blackbox [-j] [-s seconds] blackbox.bin
+//
+//   -j  one JSON object per frame instead of CSV rows per block
+//   -s  only the last this many seconds before the newest frame, within its boot
+//
+// Times are ms since the boot that recorded them and start over after a reset, so each
+// row carries the boot count from the page header as well.
+
+#include "Pixy2FlashFile.h"
+#include "../Pixy2BlackBox.h"
+
+#include <getopt.h>
+
+static void printCsv(const Pixy2BlackBoxFrame &frame)
+{
+  uint8_t i;
+
+  // a frame without blocks still gets a row, so gaps show
+  if (frame.numBlocks == 0)
+    printf("%lu,%lu,,,,,,,,\n", (unsigned long)frame.boot, (unsigned long)frame.time);
+  for (i = 0; i < frame.numBlocks; i++)
+  {
+    const Block &b = frame.blocks[i];
+    printf("%lu,%lu,%u,%u,%u,%u,%u,%u,%d,%u\n", (unsigned long)frame.boot, (unsigned long)frame.time, b.m_index, b.m_signature, b.m_x, b.m_y,
+      b.m_width, b.m_height, b.m_angle, b.m_age);
+  }
+}
+
+static void printJson(const Pixy2BlackBoxFrame &frame)
+{
+  uint8_t i;
+
+  printf("{\"boot\":%lu,\"time_ms\":%lu,\"blocks\":[", (unsigned long)frame.boot, (unsigned long)frame.time);
+  for (i = 0; i < frame.numBlocks; i++)
+  {
+    const Block &b = frame.blocks[i];
+    printf("%s{\"index\":%u,\"sig\":%u,\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u,\"angle\":%d,\"age\":%u}", i ? "," : "",
+      b.m_index, b.m_signature, b.m_x, b.m_y, b.m_width, b.m_height, b.m_angle, b.m_age);
+  }
+  printf("]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  Pixy2FlashFile flash;
+  Pixy2BlackBoxReader<Pixy2FlashFile> reader(&flash);
+  Pixy2BlackBoxFrame frame;
+  uint32_t seconds = 0, newest = 0, newestBoot = 0, from = 0, frames = 0, first = 0, last = 0, boot = 0, boots = 0;
+  double span = 0;
+  bool json = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "js:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j': json = true; break;
+    case 's': seconds = strtoul(optarg, NULL, 0); break;
+    default:
+      fprintf(stderr, "usage: %s [-j] [-s seconds] dump\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr, "usage: %s [-j] [-s seconds] dump\n", argv[0]);
+    return 1;
+  }
+  if (flash.open(argv[optind], 0, true) < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (!reader.begin())
+  {
+    fprintf(stderr, "%s: no black box pages\n", argv[optind]);
+    return 1;
+  }
+
+  // the window is measured back from the newest frame, so find it first; frames from an
+  // earlier boot have times on another clock and are left out
+  if (seconds)
+  {
+    while (reader.next(&frame))
+    {
+      newest = frame.time;
+      newestBoot = frame.boot;
+    }
+    from = newest - seconds*1000;
+    reader.begin();
+  }
+  if (!json)
+    printf("boot,time_ms,index,signature,x,y,width,height,angle,age\n");
+  while (reader.next(&frame))
+  {
+    if (seconds && (frame.boot != newestBoot || (int32_t)(frame.time - from) < 0))
+      continue;
+    // the span adds up each boot's own, as times restart
+    if (frames++ == 0 || frame.boot != boot)
+    {
+      if (frames > 1)
+        span += (last - first)/1000.0;
+      boot = frame.boot;
+      boots++;
+      first = frame.time;
+    }
+    last = frame.time;
+    if (json)
+      printJson(frame);
+    else
+      printCsv(frame);
+  }
+  if (frames)
+    span += (last - first)/1000.0;
+  fprintf(stderr, "%u frames over %.1f s in %u boots from %u pages, %u bad pages\n", frames, span, boots,
+    reader.pages(), reader.badPages());
+  return 0;
+}
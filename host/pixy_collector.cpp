@@ -0,0 +1,131 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Collector daemon: merges the Pixy2NodeProtocol streams of several nodes into one
+// time-ordered feed.
+//
+// Build (from this directory, with the Pixy2 Arduino library's headers on the path):
+//   g++ -O2 -std=gnu++17 -I.. -I<Pixy2 library>/src pixy_collector.cpp -o pixy_collector
+// Run:
+//   ./pixy_collector [-b baud] [-s socket] [-H hold_ms] [-S sync_ms] [-i stats_s] [-v] device ...
+//
+//   -b  baud rate of every device (default 921600)
+//   -s  serve the merged feed on this Unix seqpacket socket, one packet per frame,
+//       timestamps on the collector's CLOCK_MONOTONIC (us, low 32 bits)
+//   -H  how long frames are held for reordering (default 20 ms)
+//   -S  send clock sync requests this often (default 1000 ms, 0 never); nodes that
+//       answer them are mapped by round trip instead of by arrival time
+//   -i  print per-node statistics to stderr this often (default 10 s, 0 never)
+//   -v  print every merged frame to stdout
+
+#include "Pixy2Collector.h"
+
+#include <signal.h>
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) { g_stop = 1; }
+
+static void printFrame(const Pixy2NodeFrame &frame, uint64_t hostUs, void *)
+{
+  uint8_t i;
+
+  printf("%llu node %u seq %u:", (unsigned long long)hostUs, frame.node, frame.seq);
+  for (i = 0; i < frame.numBlocks; i++)
+    printf(" [sig %u x %u y %u w %u h %u]", frame.blocks[i].m_signature, frame.blocks[i].m_x, frame.blocks[i].m_y,
+      frame.blocks[i].m_width, frame.blocks[i].m_height);
+  printf("\n");
+}
+
+static void printStats(Pixy2Collector &col)
+{
+  unsigned i;
+
+  fprintf(stderr, "sources %u clients %u merged %u late %u undecoded %u crc errors %u client drops %u\n",
+    col.sources(), col.clients(), col.merged(), col.late(), col.undecoded(), col.crcErrors(), col.clientDrops());
+  for (i = 0; i < PIXY2_COLLECTOR_NODES; i++)
+  {
+    const Pixy2CollectorNode &nd = col.node(i);
+    if (nd.seen || nd.frames)
+      fprintf(stderr, "  node %u: %u frames, %u dropped, %u late, %u undecoded, %u restarts, clock offset %lld us, "
+        "%u syncs (round trip %d us, %.1f ppm)\n", i, nd.frames, nd.drops, nd.late, nd.undecoded, nd.restarts,
+        (long long)nd.offset, nd.syncs, (int)nd.sync.delay(), nd.sync.ppm());
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t baud = 921600, holdMs = 20, syncMs = 1000, statsS = 10;
+  const char *sock = NULL;
+  bool verbose = false;
+  uint64_t lastStats;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:s:H:S:i:v")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b': baud = strtoul(optarg, NULL, 0); break;
+    case 's': sock = optarg; break;
+    case 'H': holdMs = strtoul(optarg, NULL, 0); break;
+    case 'S': syncMs = strtoul(optarg, NULL, 0); break;
+    case 'i': statsS = strtoul(optarg, NULL, 0); break;
+    case 'v': verbose = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-b baud] [-s socket] [-H hold_ms] [-S sync_ms] [-i stats_s] [-v] device ...\n",
+        argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc)
+  {
+    fprintf(stderr, "%s: no devices\n", argv[0]);
+    return 1;
+  }
+
+  Pixy2Collector col(holdMs*1000);
+
+  for (; optind < argc; optind++)
+    if (col.addDevice(argv[optind], baud) < 0)
+    {
+      perror(argv[optind]);
+      return 1;
+    }
+  if (sock && col.listen(sock) < 0)
+  {
+    perror(sock);
+    return 1;
+  }
+  col.syncEvery(syncMs);
+  if (verbose)
+    col.addConsumer(printFrame, NULL);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  lastStats = Pixy2Collector::nowUs();
+  while (!g_stop && col.sources())
+  {
+    col.poll(100);
+    if (statsS && Pixy2Collector::nowUs() - lastStats >= statsS*1000000ULL)
+    {
+      printStats(col);
+      lastStats = Pixy2Collector::nowUs();
+    }
+  }
+  col.flush();
+  printStats(col);
+  if (sock)
+    unlink(sock);
+  return 0;
+}
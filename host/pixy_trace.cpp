@@ -0,0 +1,187 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+// Trace exporter: turns a Pixy2Tracer dump into Chrome trace JSON, for chrome://tracing or
+// ui.perfetto.dev. Each core is a process and each task a thread in it; interrupts get
+// a thread of their own.
+//
+// Capture the dump the sketch writes with Pixy2Tracer::dump(Serial), e.g.
+//   stty -F /dev/ttyUSB0 115200 raw && cat /dev/ttyUSB0 > trace.bin
+// (anything before the dump is skipped). Build (from this directory):
+//   g++ -O2 -std=gnu++17 -I.. pixy_trace.cpp -o pixy_trace
+// Run:
+//   ./pixy_trace [-n id=name ...] trace.bin > trace.json
+//
+//   -n  name an application event id (PIXY2_TRACE_USER and up)
+
+#include "../Pixy2Host.h"
+#include "../Pixy2Trace.h"
+
+#include <getopt.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct TraceEvent
+{
+  uint32_t cycles;
+  uint32_t task;
+  uint8_t type;
+  uint8_t id;
+  uint16_t arg;
+};
+
+static bool g_first = true;
+
+// separator before each item: JSON has no trailing commas
+static const char *sep()
+{
+  if (!g_first)
+    return ",\n";
+  g_first = false;
+  return "";
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *phases[] = { "B", "E", "i" };
+  std::map<uint8_t, std::string> names;
+  std::vector<uint8_t> data;
+  std::set<std::pair<uint8_t, uint32_t> > threads;
+  const uint8_t *p, *end;
+  const char *name;
+  char other[16];
+  uint8_t cores, size, core;
+  uint32_t mhz, n, lost, i, baseUs = 0, anchorCycles = 0, lastUs = 0, skipped = 0, events = 0;
+  int64_t anchorUs = 0;
+  bool haveBase = false, anchored;
+  double ts;
+  FILE *f;
+  int opt, c;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    if (opt == 'n' && strchr(optarg, '='))
+      names[atoi(optarg)] = strchr(optarg, '=') + 1;
+    else
+    {
+      fprintf(stderr, "usage: %s [-n id=name ...] dump\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr, "usage: %s [-n id=name ...] dump\n", argv[0]);
+    return 1;
+  }
+  if ((f = fopen(argv[optind], "rb")) == NULL)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  while ((c = fgetc(f)) != EOF)
+    data.push_back(c);
+  fclose(f);
+
+  // the dump may follow other serial output
+  for (p = data.data(), end = p + data.size(); p + 12 <= end && memcmp(p, "PXTR", 4); p++);
+  if (p + 12 > end || p[4] != 1 || p[6] != sizeof(TraceEvent))
+  {
+    fprintf(stderr, "%s: no trace dump\n", argv[optind]);
+    return 1;
+  }
+  cores = p[5];
+  size = p[6];
+  mhz = get32(p + 8);
+  p += 12;
+
+  printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for (core = 0; core < cores; core++)
+  {
+    if (p + 8 > end)
+      break;
+    n = get32(p);
+    lost = get32(p + 4);
+    p += 8;
+    if (p + (size_t)n*size > end)
+    {
+      fprintf(stderr, "%s: dump cut short in core %u\n", argv[optind], core);
+      n = (end - p)/size;
+    }
+    printf("%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %u, \"args\": {\"name\": \"core %u\"}}", sep(), core,
+      core);
+    if (lost)
+      fprintf(stderr, "core %u: %u oldest events were overwritten\n", core, lost);
+
+    // Times come from the clock events: each pairs the core's cycle count with the shared
+    // microsecond clock, and they are never more than 2^30 cycles apart. Events before a
+    // ring's first clock event (when it wrapped) can't be placed.
+    anchored = false;
+    for (i = 0; i < n; i++, p += size)
+    {
+      TraceEvent e;
+
+      memcpy(&e, p, sizeof(e));
+      if (e.id == PIXY2_TRACE_CLOCK && e.type == PIXY2_TRACE_TYPE_INSTANT)
+      {
+        if (!haveBase)
+        {
+          baseUs = e.task;
+          haveBase = true;
+        }
+        anchorUs = anchored ? anchorUs + (int32_t)(e.task - lastUs) : (int32_t)(e.task - baseUs);
+        lastUs = e.task;
+        anchorCycles = e.cycles;
+        anchored = true;
+        continue;
+      }
+      if (!anchored || e.type > PIXY2_TRACE_TYPE_INSTANT)
+      {
+        skipped++;
+        continue;
+      }
+      ts = anchorUs + (int32_t)(e.cycles - anchorCycles)/(double)mhz;
+      if (names.count(e.id))
+        name = names[e.id].c_str();
+      else if ((name = pixy2TraceName(e.id)) == NULL)
+      {
+        snprintf(other, sizeof(other), "event %u", e.id);
+        name = other;
+      }
+      threads.insert(std::make_pair(core, e.task));
+      printf("%s{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": %u, \"tid\": %u, \"args\": {\"arg\": %u}%s}",
+        sep(), name, phases[e.type], ts, core, e.task, e.arg, e.type == PIXY2_TRACE_TYPE_INSTANT ? ", \"s\": \"t\"" : "");
+      events++;
+    }
+  }
+  for (std::set<std::pair<uint8_t, uint32_t> >::iterator t = threads.begin(); t != threads.end(); t++)
+  {
+    if (t->second)
+      snprintf(other, sizeof(other), "task %08x", t->second);
+    else
+      strcpy(other, "interrupts");
+    printf("%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %u, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+      sep(), t->first, t->second, other);
+  }
+  printf("\n]}\n");
+  fprintf(stderr, "%u events from %u cores at %u MHz, %u without a clock to place them\n", events, cores, mhz,
+    skipped);
+  return 0;
+}